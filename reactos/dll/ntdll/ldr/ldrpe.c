@@ -18,6 +18,33 @@
 PLDR_MANIFEST_PROBER_ROUTINE LdrpManifestProberRoutine;
 ULONG LdrpNormalSnap;
 
+/* Export directories with fewer names are binary searched without a hash */
+#define LDRP_EXPORT_HASH_MIN_NAMES 64
+
+/* Name ordinals are 16-bit, a directory claiming more names than this is corrupt */
+#define LDRP_EXPORT_HASH_MAX_NAMES 0x10000
+
+typedef struct _LDRP_EXPORT_HASH_BUCKET
+{
+    ULONG Hash;
+    ULONG NameIndex; /* Index in the name table plus one, 0 if the bucket is free */
+} LDRP_EXPORT_HASH_BUCKET, *PLDRP_EXPORT_HASH_BUCKET;
+
+typedef struct _LDRP_EXPORT_HASH
+{
+    ULONG Mask;
+    LDRP_EXPORT_HASH_BUCKET Buckets[ANYSIZE_ARRAY];
+} LDRP_EXPORT_HASH, *PLDRP_EXPORT_HASH;
+
+/* The IAT of the image whose imports are being walked, made writable on the first snap */
+typedef struct _LDRP_IAT_PROTECTION
+{
+    PVOID Iat;
+    SIZE_T Size;
+    ULONG OldProtect;
+    BOOLEAN Unprotected;
+} LDRP_IAT_PROTECTION, *PLDRP_IAT_PROTECTION;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -32,45 +59,23 @@ AVrfPageHeapDllNotification(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
     UNIMPLEMENTED;
 }
 
+static
 NTSTATUS
-NTAPI
-LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
-            IN PLDR_DATA_TABLE_ENTRY ImportLdrEntry,
-            IN PIMAGE_IMPORT_DESCRIPTOR IatEntry,
-            IN BOOLEAN EntriesValid)
+LdrpUnprotectIat(IN PLDR_DATA_TABLE_ENTRY ImportLdrEntry,
+                 OUT PLDRP_IAT_PROTECTION IatProtection)
 {
     PVOID Iat;
     NTSTATUS Status;
-    PIMAGE_THUNK_DATA OriginalThunk, FirstThunk;
     PIMAGE_NT_HEADERS NtHeader;
     PIMAGE_SECTION_HEADER SectionHeader;
-    PIMAGE_EXPORT_DIRECTORY ExportDirectory;
-    LPSTR ImportName;
-    ULONG ForwarderChain, i, Rva, OldProtect, IatSize, ExportSize;
+    ULONG i, Rva, IatSize;
     SIZE_T ImportSize;
-    DPRINT("LdrpSnapIAT(%wZ %wZ %p %u)\n", &ExportLdrEntry->BaseDllName, &ImportLdrEntry->BaseDllName, IatEntry, EntriesValid);
-
-    /* Get export directory */
-    ExportDirectory = RtlImageDirectoryEntryToData(ExportLdrEntry->DllBase,
-                                                   TRUE,
-                                                   IMAGE_DIRECTORY_ENTRY_EXPORT,
-                                                   &ExportSize);
-
-    /* Make sure it has one */
-    if (!ExportDirectory)
-    {
-        /* Fail */
-        DbgPrint("LDR: %wZ doesn't contain an EXPORT table\n",
-                 &ExportLdrEntry->BaseDllName);
-        return STATUS_INVALID_IMAGE_FORMAT;
-    }
 
     /* Get the IAT */
     Iat = RtlImageDirectoryEntryToData(ImportLdrEntry->DllBase,
                                        TRUE,
                                        IMAGE_DIRECTORY_ENTRY_IAT,
                                        &IatSize);
-    ImportSize = IatSize;
 
     /* Check if we don't have one */
     if (!Iat)
@@ -122,17 +127,15 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
                      ImportLdrEntry->DllBase);
             return STATUS_INVALID_IMAGE_FORMAT;
         }
-
-        /* Set the right size */
-        ImportSize = IatSize;
     }
 
     /* Unprotect the IAT */
+    ImportSize = IatSize;
     Status = NtProtectVirtualMemory(NtCurrentProcess(),
                                     &Iat,
                                     &ImportSize,
                                     PAGE_READWRITE,
-                                    &OldProtect);
+                                    &IatProtection->OldProtect);
     if (!NT_SUCCESS(Status))
     {
         /* Fail */
@@ -142,6 +145,80 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
         return Status;
     }
 
+    /* Remember the region for LdrpRestoreIatProtection */
+    IatProtection->Iat = Iat;
+    IatProtection->Size = ImportSize;
+    IatProtection->Unprotected = TRUE;
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+LdrpRestoreIatProtection(IN OUT PLDRP_IAT_PROTECTION IatProtection)
+{
+    ULONG OldProtect;
+
+    /* Nothing to do if no descriptor had to be snapped */
+    if (!IatProtection->Unprotected) return;
+
+    /* Protect the IAT again */
+    NtProtectVirtualMemory(NtCurrentProcess(),
+                           &IatProtection->Iat,
+                           &IatProtection->Size,
+                           IatProtection->OldProtect,
+                           &OldProtect);
+
+    /* Also flush out the cache */
+    NtFlushInstructionCache(NtCurrentProcess(), IatProtection->Iat, IatProtection->Size);
+
+    IatProtection->Unprotected = FALSE;
+}
+
+NTSTATUS
+NTAPI
+LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
+            IN PLDR_DATA_TABLE_ENTRY ImportLdrEntry,
+            IN PIMAGE_IMPORT_DESCRIPTOR IatEntry,
+            IN BOOLEAN EntriesValid,
+            IN OUT PLDRP_IAT_PROTECTION IatProtection)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PIMAGE_THUNK_DATA OriginalThunk, FirstThunk;
+    PIMAGE_NT_HEADERS NtHeader;
+    PIMAGE_EXPORT_DIRECTORY ExportDirectory;
+    LPSTR ImportName;
+    ULONG ForwarderChain, ExportSize;
+    ULONG SnapCount = 0;
+    LARGE_INTEGER StartTime = {{0}}, EndTime, Frequency = {{1}};
+    DPRINT("LdrpSnapIAT(%wZ %wZ %p %u)\n", &ExportLdrEntry->BaseDllName, &ImportLdrEntry->BaseDllName, IatEntry, EntriesValid);
+
+    /* Get export directory */
+    ExportDirectory = RtlImageDirectoryEntryToData(ExportLdrEntry->DllBase,
+                                                   TRUE,
+                                                   IMAGE_DIRECTORY_ENTRY_EXPORT,
+                                                   &ExportSize);
+
+    /* Make sure it has one */
+    if (!ExportDirectory)
+    {
+        /* Fail */
+        DbgPrint("LDR: %wZ doesn't contain an EXPORT table\n",
+                 &ExportLdrEntry->BaseDllName);
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    /* Unprotect the IAT once for all the descriptors of this image, unless
+       the entries are valid and there are no forwarders to snap either */
+    if (!IatProtection->Unprotected &&
+        (!EntriesValid || (IatEntry->ForwarderChain != (ULONG)-1)))
+    {
+        Status = LdrpUnprotectIat(ImportLdrEntry, IatProtection);
+        if (!NT_SUCCESS(Status)) return Status;
+    }
+
+    /* Time the snapping when asked to show snaps */
+    if (ShowSnaps) NtQueryPerformanceCounter(&StartTime, &Frequency);
+
     /* Check if the Thunks are already valid */
     if (EntriesValid)
     {
@@ -172,7 +249,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
             /* Snap the thunk */
             _SEH2_TRY
             {
-                Status = LdrpSnapThunk(ExportLdrEntry->DllBase,
+                Status = LdrpSnapThunk(ExportLdrEntry,
                                        ImportLdrEntry->DllBase,
                                        OriginalThunk,
                                        FirstThunk,
@@ -183,6 +260,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
 
                 /* Move to the next thunk */
                 FirstThunk++;
+                SnapCount++;
             } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
             {
                 /* Fail with the SEH error */
@@ -228,7 +306,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
             /* Snap the Thunk */
             _SEH2_TRY
             {
-                Status = LdrpSnapThunk(ExportLdrEntry->DllBase,
+                Status = LdrpSnapThunk(ExportLdrEntry,
                                        ImportLdrEntry->DllBase,
                                        OriginalThunk,
                                        FirstThunk,
@@ -240,6 +318,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
                 /* Next thunks */
                 OriginalThunk++;
                 FirstThunk++;
+                SnapCount++;
             } _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
             {
                 /* Fail with the SEH error */
@@ -251,15 +330,15 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
         }
     }
 
-    /* Protect the IAT again */
-    NtProtectVirtualMemory(NtCurrentProcess(),
-                           &Iat,
-                           &ImportSize,
-                           OldProtect,
-                           &OldProtect);
-
-    /* Also flush out the cache */
-    NtFlushInstructionCache(NtCurrentProcess(), Iat, IatSize);
+    if (ShowSnaps)
+    {
+        NtQueryPerformanceCounter(&EndTime, NULL);
+        DPRINT1("LDR: Snapped %lu imports of %wZ from %wZ in %I64u us\n",
+                SnapCount,
+                &ImportLdrEntry->BaseDllName,
+                &ExportLdrEntry->BaseDllName,
+                (EndTime.QuadPart - StartTime.QuadPart) * 1000000 / Frequency.QuadPart);
+    }
 
     /* Return to Caller */
     return Status;
@@ -270,7 +349,8 @@ NTAPI
 LdrpHandleOneNewFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                                        IN PLDR_DATA_TABLE_ENTRY LdrEntry,
                                        IN PIMAGE_BOUND_IMPORT_DESCRIPTOR *BoundEntryPtr,
-                                       IN PIMAGE_BOUND_IMPORT_DESCRIPTOR FirstEntry)
+                                       IN PIMAGE_BOUND_IMPORT_DESCRIPTOR FirstEntry,
+                                       IN OUT PLDRP_IAT_PROTECTION IatProtection)
 {
     LPSTR ImportName = NULL, BoundImportName, ForwarderName;
     NTSTATUS Status;
@@ -409,8 +489,7 @@ LdrpHandleOneNewFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                         ForwarderName);
             }
 
-            /* Remember it's valid */
-            Stale = FALSE;
+            /* A valid forwarder doesn't make a stale binding valid again */
         }
 
         /* Move to the next one */
@@ -470,7 +549,8 @@ LdrpHandleOneNewFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
         Status = LdrpSnapIAT(DllLdrEntry,
                              LdrEntry,
                              ImportEntry,
-                             FALSE);
+                             FALSE,
+                             IatProtection);
 
         /* Make sure we didn't fail */
         if (!NT_SUCCESS(Status))
@@ -502,7 +582,8 @@ NTSTATUS
 NTAPI
 LdrpHandleNewFormatImportDescriptors(IN LPWSTR DllPath OPTIONAL,
                                     IN PLDR_DATA_TABLE_ENTRY LdrEntry,
-                                    IN PIMAGE_BOUND_IMPORT_DESCRIPTOR BoundEntry)
+                                    IN PIMAGE_BOUND_IMPORT_DESCRIPTOR BoundEntry,
+                                    IN OUT PLDRP_IAT_PROTECTION IatProtection)
 {
     PIMAGE_BOUND_IMPORT_DESCRIPTOR FirstEntry = BoundEntry;
     NTSTATUS Status;
@@ -514,7 +595,8 @@ LdrpHandleNewFormatImportDescriptors(IN LPWSTR DllPath OPTIONAL,
         Status = LdrpHandleOneNewFormatImportDescriptor(DllPath,
                                                         LdrEntry,
                                                         &BoundEntry,
-                                                        FirstEntry);
+                                                        FirstEntry,
+                                                        IatProtection);
         if (!NT_SUCCESS(Status)) return Status;
     }
 
@@ -526,11 +608,12 @@ NTSTATUS
 NTAPI
 LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                                        IN PLDR_DATA_TABLE_ENTRY LdrEntry,
-                                       IN PIMAGE_IMPORT_DESCRIPTOR *ImportEntry)
+                                       IN PIMAGE_IMPORT_DESCRIPTOR *ImportEntry,
+                                       IN OUT PLDRP_IAT_PROTECTION IatProtection)
 {
     LPSTR ImportName;
     NTSTATUS Status;
-    BOOLEAN AlreadyLoaded = FALSE;
+    BOOLEAN AlreadyLoaded = FALSE, EntriesValid;
     PLDR_DATA_TABLE_ENTRY DllLdrEntry;
     PIMAGE_THUNK_DATA FirstThunk;
     PPEB Peb = NtCurrentPeb();
@@ -590,8 +673,24 @@ LdrpHandleOneOldFormatImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                        &DllLdrEntry->InInitializationOrderLinks);
     }
 
+    /*
+     * An old style binding stores the DLL's time stamp in the descriptor.
+     * If it still matches, only the forwarders in the chain need snapping.
+     * -1 means a new style binding, which we'd have handled without a bound directory.
+     */
+    EntriesValid = ((*ImportEntry)->TimeDateStamp != 0) &&
+                   ((*ImportEntry)->TimeDateStamp != (ULONG)-1) &&
+                   ((*ImportEntry)->TimeDateStamp == DllLdrEntry->TimeDateStamp) &&
+                   !(DllLdrEntry->Flags & LDRP_IMAGE_NOT_AT_BASE);
+    if (ShowSnaps && EntriesValid)
+    {
+        DPRINT1("LDR: %wZ has correct old style binding to %s\n",
+                &LdrEntry->BaseDllName,
+                ImportName);
+    }
+
     /* Now snap the IAT Entry */
-    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, FALSE);
+    Status = LdrpSnapIAT(DllLdrEntry, LdrEntry, *ImportEntry, EntriesValid, IatProtection);
     if (!NT_SUCCESS(Status))
     {
         /* Fail */
@@ -616,7 +715,8 @@ NTSTATUS
 NTAPI
 LdrpHandleOldFormatImportDescriptors(IN LPWSTR DllPath OPTIONAL,
                                      IN PLDR_DATA_TABLE_ENTRY LdrEntry,
-                                     IN PIMAGE_IMPORT_DESCRIPTOR ImportEntry)
+                                     IN PIMAGE_IMPORT_DESCRIPTOR ImportEntry,
+                                     IN OUT PLDRP_IAT_PROTECTION IatProtection)
 {
     NTSTATUS Status;
 
@@ -626,7 +726,8 @@ LdrpHandleOldFormatImportDescriptors(IN LPWSTR DllPath OPTIONAL,
         /* Parse this descriptor */
         Status = LdrpHandleOneOldFormatImportDescriptor(DllPath,
                                                         LdrEntry,
-                                                        &ImportEntry);
+                                                        &ImportEntry,
+                                                        IatProtection);
         if (!NT_SUCCESS(Status)) return Status;
     }
 
@@ -676,6 +777,115 @@ LdrpNameToOrdinal(IN LPSTR ImportName,
     return OrdinalTable[Next];
 }
 
+static
+ULONG
+LdrpHashExportName(IN LPSTR Name)
+{
+    ULONG Hash = 2166136261u;
+
+    /* FNV-1a */
+    while (*Name)
+    {
+        Hash ^= (UCHAR)*Name++;
+        Hash *= 16777619u;
+    }
+
+    return Hash;
+}
+
+static
+PLDRP_EXPORT_HASH
+LdrpBuildExportHash(IN PVOID ExportBase,
+                    IN ULONG ExportSize,
+                    IN ULONG NumberOfNames,
+                    IN PULONG NameTable)
+{
+    PLDRP_EXPORT_HASH HashTable;
+    ULONG BucketCount, Hash, i, j;
+
+    /* Each name needs at least a name pointer and an ordinal in the export directory.
+       Don't size the table from a count that can't be real, the caller searches without it. */
+    if ((NumberOfNames > LDRP_EXPORT_HASH_MAX_NAMES) ||
+        (NumberOfNames > ExportSize / (sizeof(ULONG) + sizeof(USHORT))))
+    {
+        return NULL;
+    }
+
+    /* Keep the table at most half full so probe chains stay short */
+    BucketCount = 1;
+    while (BucketCount < NumberOfNames * 2) BucketCount <<= 1;
+
+    HashTable = RtlAllocateHeap(RtlGetProcessHeap(),
+                                HEAP_ZERO_MEMORY,
+                                FIELD_OFFSET(LDRP_EXPORT_HASH, Buckets[BucketCount]));
+    if (!HashTable) return NULL;
+    HashTable->Mask = BucketCount - 1;
+
+    for (i = 0; i < NumberOfNames; i++)
+    {
+        Hash = LdrpHashExportName((LPSTR)((ULONG_PTR)ExportBase + NameTable[i]));
+
+        /* Linear probing */
+        j = Hash & HashTable->Mask;
+        while (HashTable->Buckets[j].NameIndex) j = (j + 1) & HashTable->Mask;
+
+        HashTable->Buckets[j].Hash = Hash;
+        HashTable->Buckets[j].NameIndex = i + 1;
+    }
+
+    return HashTable;
+}
+
+static
+USHORT
+LdrpHashNameToOrdinal(IN PLDR_DATA_TABLE_ENTRY LdrEntry,
+                      IN ULONG ExportSize,
+                      IN LPSTR ImportName,
+                      IN ULONG NumberOfNames,
+                      IN PULONG NameTable,
+                      IN PUSHORT OrdinalTable)
+{
+    PLDRP_EXPORT_HASH HashTable = LdrEntry->ExportHashTable;
+    PVOID ExportBase = LdrEntry->DllBase;
+    ULONG Hash, i, NameIndex;
+
+    /* Small tables are searched quickly enough as they are */
+    if (NumberOfNames < LDRP_EXPORT_HASH_MIN_NAMES)
+    {
+        return LdrpNameToOrdinal(ImportName, NumberOfNames, ExportBase, NameTable, OrdinalTable);
+    }
+
+    /* Build the hash on the first lookup and keep it with the module */
+    if (!HashTable)
+    {
+        HashTable = LdrpBuildExportHash(ExportBase, ExportSize, NumberOfNames, NameTable);
+
+        /* Not being able to cache is no reason to fail the lookup */
+        if (!HashTable)
+        {
+            return LdrpNameToOrdinal(ImportName, NumberOfNames, ExportBase, NameTable, OrdinalTable);
+        }
+
+        LdrEntry->ExportHashTable = HashTable;
+    }
+
+    Hash = LdrpHashExportName(ImportName);
+    for (i = Hash & HashTable->Mask;
+         (NameIndex = HashTable->Buckets[i].NameIndex) != 0;
+         i = (i + 1) & HashTable->Mask)
+    {
+        /* Only compare the strings when the whole hash matches */
+        if ((HashTable->Buckets[i].Hash == Hash) &&
+            !strcmp(ImportName, (PCHAR)((ULONG_PTR)ExportBase + NameTable[NameIndex - 1])))
+        {
+            return OrdinalTable[NameIndex - 1];
+        }
+    }
+
+    /* Not exported */
+    return -1;
+}
+
 NTSTATUS
 NTAPI
 LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
@@ -687,6 +897,7 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
     PIMAGE_BOUND_IMPORT_DESCRIPTOR BoundEntry = NULL;
     PIMAGE_IMPORT_DESCRIPTOR ImportEntry;
     ULONG BoundSize, IatSize;
+    LDRP_IAT_PROTECTION IatProtection;
 
     DPRINT("LdrpWalkImportDescriptor - BEGIN (%wZ %p '%S')\n", &LdrEntry->BaseDllName, LdrEntry, DllPath);
 
@@ -758,6 +969,9 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                                                IMAGE_DIRECTORY_ENTRY_IMPORT,
                                                &IatSize);
 
+    /* Nothing made writable yet. Valid bindings never need to */
+    RtlZeroMemory(&IatProtection, sizeof(IatProtection));
+
     /* Check if we got at least one */
     if ((BoundEntry) || (ImportEntry))
     {
@@ -767,16 +981,21 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
             /* Handle the descriptor */
             Status = LdrpHandleNewFormatImportDescriptors(DllPath,
                                                           LdrEntry,
-                                                          BoundEntry);
+                                                          BoundEntry,
+                                                          &IatProtection);
         }
         else
         {
             /* Handle the descriptor */
             Status = LdrpHandleOldFormatImportDescriptors(DllPath,
                                                           LdrEntry,
-                                                          ImportEntry);
+                                                          ImportEntry,
+                                                          &IatProtection);
         }
 
+        /* Protect the IAT again, if anything had to be snapped */
+        LdrpRestoreIatProtection(&IatProtection);
+
         /* Check the status of the handlers */
         if (NT_SUCCESS(Status))
         {
@@ -831,6 +1050,7 @@ LdrpLoadImportModule(IN PWSTR DllPath OPTIONAL,
     NTSTATUS Status;
     PPEB Peb = RtlGetCurrentPeb();
     PTEB Teb = NtCurrentTeb();
+    LARGE_INTEGER StartTime = {{0}}, EndTime, Frequency = {{1}};
 
     DPRINT("LdrpLoadImportModule('%S' '%s' %p %p)\n", DllPath, ImportName, DataTableEntry, Existing);
 
@@ -944,6 +1164,7 @@ done:
 #endif
 
     /* Map it */
+    if (ShowSnaps) NtQueryPerformanceCounter(&StartTime, &Frequency);
     Status = LdrpMapDll(DllPath,
                         NULL,
                         ImpDescName->Buffer,
@@ -954,6 +1175,14 @@ done:
 
     if (!NT_SUCCESS(Status)) return Status;
 
+    if (ShowSnaps)
+    {
+        NtQueryPerformanceCounter(&EndTime, NULL);
+        DPRINT1("LDR: Mapped %wZ in %I64u us\n",
+                &(*DataTableEntry)->BaseDllName,
+                (EndTime.QuadPart - StartTime.QuadPart) * 1000000 / Frequency.QuadPart);
+    }
+
     /* Walk its import descriptor table */
     Status = LdrpWalkImportDescriptor(DllPath,
                                       *DataTableEntry);
@@ -969,7 +1198,7 @@ done:
 
 NTSTATUS
 NTAPI
-LdrpSnapThunk(IN PVOID ExportBase,
+LdrpSnapThunk(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
               IN PVOID ImportBase,
               IN PIMAGE_THUNK_DATA OriginalThunk,
               IN OUT PIMAGE_THUNK_DATA Thunk,
@@ -998,6 +1227,7 @@ LdrpSnapThunk(IN PVOID ExportBase,
     PANSI_STRING ForwardName;
     PVOID ForwarderHandle;
     ULONG ForwardOrdinal;
+    PVOID ExportBase = ExportLdrEntry->DllBase;
 
     /* Check if the snap is by ordinal */
     if ((IsOrdinal = IMAGE_SNAP_BY_ORDINAL(OriginalThunk->u1.Ordinal)))
@@ -1034,12 +1264,13 @@ LdrpSnapThunk(IN PVOID ExportBase,
         }
         else
         {
-            /* Well bummer, hint didn't work, do it the long way */
-            Ordinal = LdrpNameToOrdinal(ImportName,
-                                        ExportEntry->NumberOfNames,
-                                        ExportBase,
-                                        NameTable,
-                                        OrdinalTable);
+            /* Well bummer, hint didn't work, look the name up */
+            Ordinal = LdrpHashNameToOrdinal(ExportLdrEntry,
+                                            ExportSize,
+                                            ImportName,
+                                            ExportEntry->NumberOfNames,
+                                            NameTable,
+                                            OrdinalTable);
         }
     }
 
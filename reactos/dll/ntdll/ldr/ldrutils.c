@@ -1583,6 +1583,9 @@ LdrpFinalizeAndDeallocateDataTableEntry(IN PLDR_DATA_TABLE_ENTRY Entry)
     /* Release the full dll name string */
     if (Entry->FullDllName.Buffer) LdrpFreeUnicodeString(&Entry->FullDllName);
 
+    /* Release the export name lookup cache */
+    if (Entry->ExportHashTable) RtlFreeHeap(RtlGetProcessHeap(), 0, Entry->ExportHashTable);
+
     /* Finally free the entry's memory */
     RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
 }
@@ -2330,7 +2333,7 @@ LdrpGetProcedureAddress(IN PVOID BaseAddress,
         }
 
         /* Now get the thunk */
-        Status = LdrpSnapThunk(LdrEntry->DllBase,
+        Status = LdrpSnapThunk(LdrEntry,
                                ImageBase,
                                &Thunk,
                                &Thunk,
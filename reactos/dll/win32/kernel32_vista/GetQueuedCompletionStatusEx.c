@@ -0,0 +1,64 @@
+
+#include "k32_vista.h"
+
+#include <ndk/rtlfuncs.h>
+#include <ndk/iofuncs.h>
+
+/* An entry is a FILE_IO_COMPLETION_INFORMATION seen through the Win32 names */
+C_ASSERT(sizeof(OVERLAPPED_ENTRY) == sizeof(FILE_IO_COMPLETION_INFORMATION));
+C_ASSERT(FIELD_OFFSET(OVERLAPPED_ENTRY, lpOverlapped) == FIELD_OFFSET(FILE_IO_COMPLETION_INFORMATION, ApcContext));
+C_ASSERT(FIELD_OFFSET(OVERLAPPED_ENTRY, Internal) == FIELD_OFFSET(FILE_IO_COMPLETION_INFORMATION, IoStatusBlock.Status));
+C_ASSERT(FIELD_OFFSET(OVERLAPPED_ENTRY, dwNumberOfBytesTransferred) == FIELD_OFFSET(FILE_IO_COMPLETION_INFORMATION, IoStatusBlock.Information));
+
+/*
+ * @implemented
+ */
+BOOL
+WINAPI
+GetQueuedCompletionStatusEx(IN HANDLE CompletionPort,
+                            OUT LPOVERLAPPED_ENTRY lpCompletionPortEntries,
+                            IN ULONG ulCount,
+                            OUT PULONG ulNumEntriesRemoved,
+                            IN DWORD dwMilliseconds,
+                            IN BOOL fAlertable)
+{
+    NTSTATUS Status;
+    LARGE_INTEGER Time;
+    PLARGE_INTEGER TimePtr;
+
+    /* Convert the timeout */
+    TimePtr = NULL;
+    if (dwMilliseconds != INFINITE)
+    {
+        Time.QuadPart = (ULONGLONG)dwMilliseconds * -10000;
+        TimePtr = &Time;
+    }
+
+    /* Dequeue as many packets as we can in a single call */
+    Status = NtRemoveIoCompletionEx(CompletionPort,
+                                    (PFILE_IO_COMPLETION_INFORMATION)lpCompletionPortEntries,
+                                    ulCount,
+                                    ulNumEntriesRemoved,
+                                    TimePtr,
+                                    (BOOLEAN)(fAlertable != FALSE));
+    if (Status != STATUS_SUCCESS)
+    {
+        /* Timeouts and APCs are success codes, turn them into the wait errors */
+        if (Status == STATUS_TIMEOUT)
+        {
+            SetLastError(WAIT_TIMEOUT);
+        }
+        else if (Status == STATUS_USER_APC)
+        {
+            SetLastError(WAIT_IO_COMPLETION);
+        }
+        else
+        {
+            SetLastError(RtlNtStatusToDosError(Status));
+        }
+        return FALSE;
+    }
+
+    /* Unlike GetQueuedCompletionStatus, failed packets are returned as entries */
+    return TRUE;
+}
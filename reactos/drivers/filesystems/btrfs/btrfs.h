@@ -53,6 +53,7 @@ static const UINT64 superblock_addrs[] = { 0x10000, 0x4000000, 0x4000000000, 0x4
 #define BTRFS_COMPRESSION_NONE  0
 #define BTRFS_COMPRESSION_ZLIB  1
 #define BTRFS_COMPRESSION_LZO   2
+#define BTRFS_COMPRESSION_ZSTD  3
 
 #define BTRFS_ENCRYPTION_NONE   0
 
@@ -97,7 +98,7 @@ static const UINT64 superblock_addrs[] = { 0x10000, 0x4000000, 0x4000000000, 0x4
 #define BTRFS_INCOMPAT_FLAGS_DEFAULT_SUBVOL     0x0002
 #define BTRFS_INCOMPAT_FLAGS_MIXED_GROUPS       0x0004
 #define BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO       0x0008
-#define BTRFS_INCOMPAT_FLAGS_COMPRESS_LZOV2     0x0010
+#define BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD      0x0010
 #define BTRFS_INCOMPAT_FLAGS_BIG_METADATA       0x0020
 #define BTRFS_INCOMPAT_FLAGS_EXTENDED_IREF      0x0040
 #define BTRFS_INCOMPAT_FLAGS_RAID56             0x0080
@@ -61,6 +61,7 @@
 
 #define ALLOC_TAG 0x7442484D //'MHBt'
 #define ALLOC_TAG_ZLIB 0x7A42484D //'MHBz'
+#define ALLOC_TAG_ZSTD 0x5A42484D //'MHBZ'
 
 #define STDCALL __stdcall
 
@@ -490,10 +491,21 @@ typedef struct {
     LIST_ENTRY list_entry;
 } sys_chunk;
 
+typedef enum {
+    calc_thread_crc32c,
+    calc_thread_compress
+} calc_thread_type;
+
 typedef struct {
+    calc_thread_type type;
     UINT8* data;
     UINT32* csum;
     UINT32 sectors;
+    UINT8 compression;
+    UINT32 inlen;
+    UINT8* out;
+    UINT32 outlen;
+    NTSTATUS Status;
     LONG pos, done;
     KEVENT event;
     LONG refcount;
@@ -522,6 +534,7 @@ typedef struct {
     UINT8 compress_type;
     BOOL readonly;
     UINT32 zlib_level;
+    UINT32 zstd_level;
     UINT32 flush_interval;
     UINT32 max_inline;
     UINT64 subvol_id;
@@ -797,6 +810,7 @@ extern UINT32 mount_compress;
 extern UINT32 mount_compress_force;
 extern UINT32 mount_compress_type;
 extern UINT32 mount_zlib_level;
+extern UINT32 mount_zstd_level;
 extern UINT32 mount_flush_interval;
 extern UINT32 mount_max_inline;
 extern UINT32 mount_raid5_recalculation;
@@ -1068,7 +1082,8 @@ NTSTATUS registry_load_volume_options(device_extension* Vcb);
 
 // in compress.c
 NTSTATUS decompress(UINT8 type, UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT64 outlen);
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback);
+UINT32 compression_buffer_size(UINT8 type, UINT32 inlen);
+NTSTATUS compress_extent(UINT8 type, unsigned int level, UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, UINT32* comp_length);
 
 // in galois.c
 void galois_double(UINT8* data, UINT32 len);
@@ -1087,6 +1102,7 @@ void NTAPI calc_thread(void* context);
 void calc_thread(void* context);
 #endif
 NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj);
+NTSTATUS add_calc_job_comp(device_extension* Vcb, UINT8 compression, UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, calc_job** pcj);
 void free_calc_job(calc_job* cj);
 
 // in balance.c
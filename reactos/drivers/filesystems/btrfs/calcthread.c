@@ -19,6 +19,20 @@
 
 #define SECTOR_BLOCK 16
 
+static void queue_calc_job(device_extension* Vcb, calc_job* cj) {
+    cj->pos = 0;
+    cj->done = 0;
+    cj->refcount = 1;
+    KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
+
+    ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
+    InsertTailList(&Vcb->calcthreads.job_list, &cj->list_entry);
+    ExReleaseResourceLite(&Vcb->calcthreads.lock);
+    
+    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
+    KeClearEvent(&Vcb->calcthreads.event);
+}
+
 NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32* csum, calc_job** pcj) {
     calc_job* cj;
     
@@ -28,20 +42,38 @@ NTSTATUS add_calc_job(device_extension* Vcb, UINT8* data, UINT32 sectors, UINT32
         return STATUS_INSUFFICIENT_RESOURCES;
     }
     
+    cj->type = calc_thread_crc32c;
     cj->data = data;
     cj->sectors = sectors;
     cj->csum = csum;
-    cj->pos = 0;
-    cj->done = 0;
-    cj->refcount = 1;
-    KeInitializeEvent(&cj->event, NotificationEvent, FALSE);
+    
+    queue_calc_job(Vcb, cj);
+    
+    *pcj = cj;
+    
+    return STATUS_SUCCESS;
+}
 
-    ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
-    InsertTailList(&Vcb->calcthreads.job_list, &cj->list_entry);
-    ExReleaseResourceLite(&Vcb->calcthreads.lock);
+// Compresses inlen bytes of inbuf into outbuf. Once the event is signalled,
+// Status tells whether it worked and outlen is the compressed length.
+NTSTATUS add_calc_job_comp(device_extension* Vcb, UINT8 compression, UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, calc_job** pcj) {
+    calc_job* cj;
     
-    KeSetEvent(&Vcb->calcthreads.event, 0, FALSE);
-    KeClearEvent(&Vcb->calcthreads.event);
+    cj = ExAllocatePoolWithTag(NonPagedPool, sizeof(calc_job), ALLOC_TAG);
+    if (!cj) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    cj->type = calc_thread_compress;
+    cj->compression = compression;
+    cj->data = inbuf;
+    cj->inlen = inlen;
+    cj->out = outbuf;
+    cj->outlen = outlen;
+    cj->Status = STATUS_PENDING;
+    
+    queue_calc_job(Vcb, cj);
     
     *pcj = cj;
     
@@ -89,6 +121,18 @@ static BOOL do_calc(device_extension* Vcb, calc_job* cj) {
     return TRUE;
 }
 
+static void do_compress(device_extension* Vcb, calc_job* cj) {
+    UINT32 comp_length, level;
+    
+    level = cj->compression == BTRFS_COMPRESSION_ZSTD ? Vcb->options.zstd_level : Vcb->options.zlib_level;
+    
+    cj->Status = compress_extent(cj->compression, level, cj->data, cj->inlen, cj->out, cj->outlen, &comp_length);
+    if (NT_SUCCESS(cj->Status))
+        cj->outlen = comp_length;
+    
+    KeSetEvent(&cj->event, 0, FALSE);
+}
+
 #ifdef __REACTOS__
 void NTAPI calc_thread(void* context) {
 #else
@@ -105,27 +149,45 @@ void calc_thread(void* context) {
         FsRtlEnterFileSystem();
         
         while (TRUE) {
-            calc_job* cj;
-            BOOL b;
+            calc_job* cj = NULL;
+            LIST_ENTRY* le;
             
             ExAcquireResourceExclusiveLite(&Vcb->calcthreads.lock, TRUE);
             
-            if (IsListEmpty(&Vcb->calcthreads.job_list)) {
+            // Checksum jobs stay on the list until their last block is done, so skip
+            // any whose blocks have all been handed out to other threads already.
+            le = Vcb->calcthreads.job_list.Flink;
+            while (le != &Vcb->calcthreads.job_list) {
+                calc_job* cj2 = CONTAINING_RECORD(le, calc_job, list_entry);
+                
+                if (cj2->type == calc_thread_compress || cj2->pos * SECTOR_BLOCK < (LONG)cj2->sectors) {
+                    cj = cj2;
+                    break;
+                }
+                
+                le = le->Flink;
+            }
+            
+            if (!cj) {
                 ExReleaseResourceLite(&Vcb->calcthreads.lock);
                 break;
             }
             
-            cj = CONTAINING_RECORD(Vcb->calcthreads.job_list.Flink, calc_job, list_entry);
             cj->refcount++;
             
+            // A compression job isn't split between threads, so the next thread can start on the next one
+            if (cj->type == calc_thread_compress)
+                RemoveEntryList(&cj->list_entry);
+            
             ExReleaseResourceLite(&Vcb->calcthreads.lock);
             
-            b = do_calc(Vcb, cj);
+            // If another thread took the last block first, do_calc does nothing and we look again
+            if (cj->type == calc_thread_compress)
+                do_compress(Vcb, cj);
+            else
+                do_calc(Vcb, cj);
             
             free_calc_job(cj);
-            
-            if (!b)
-                break;
         }
         
         FsRtlExitFileSystem();
@@ -39,8 +39,19 @@
 #include <zlib.h>
 #endif
 
+#define ZSTD_STATIC_LINKING_ONLY
+
+#ifndef __REACTOS__
+#include "zstd/zstd.h"
+#else
+#include <zstd.h>
+#endif
+
 #define LINUX_PAGE_SIZE 4096
 
+// Linux won't read zstd frames with a bigger window than this (ZSTD_BTRFS_MAX_WINDOWLOG)
+#define ZSTD_BTRFS_MAX_WINDOWLOG 17
+
 typedef struct {
     UINT8* in;
     UINT32 inlen;
@@ -346,149 +357,124 @@ static NTSTATUS zlib_decompress(UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT6
     return STATUS_SUCCESS;
 }
 
+static void* zstd_alloc(void* opaque, size_t size) {
+    return ExAllocatePoolWithTag(PagedPool, size, ALLOC_TAG_ZSTD);
+}
+
+static void zstd_free(void* opaque, void* ptr) {
+    ExFreePool(ptr);
+}
+
+static const ZSTD_customMem zstd_mem = { zstd_alloc, zstd_free, NULL };
+
+static NTSTATUS zstd_decompress(UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT64 outlen) {
+    NTSTATUS Status;
+    ZSTD_DCtx* dctx;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t ret;
+    
+    dctx = ZSTD_createDCtx_advanced(zstd_mem);
+    if (!dctx) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    
+    input.src = inbuf;
+    input.size = (size_t)inlen;
+    input.pos = 0;
+    
+    output.dst = outbuf;
+    output.size = (size_t)outlen;
+    output.pos = 0;
+    
+    // The extent holds a single frame, padded with zeroes to the end of the sector,
+    // so stop at the end of the frame rather than asking for the whole buffer to be used.
+    do {
+        ret = ZSTD_decompressStream(dctx, &output, &input);
+        
+        if (ZSTD_isError(ret)) {
+            ERR("ZSTD_decompressStream returned %s\n", ZSTD_getErrorName(ret));
+            Status = STATUS_INTERNAL_ERROR;
+            goto end;
+        }
+        
+        if (output.pos == output.size)
+            break;
+        
+        if (ret != 0 && input.pos == input.size) {
+            ERR("zstd frame truncated\n");
+            Status = STATUS_INTERNAL_ERROR;
+            goto end;
+        }
+    } while (ret != 0);
+    
+    if (output.pos < output.size)
+        RtlZeroMemory(outbuf + output.pos, output.size - output.pos);
+    
+    Status = STATUS_SUCCESS;
+    
+end:
+    ZSTD_freeDCtx(dctx);
+    
+    return Status;
+}
+
 NTSTATUS decompress(UINT8 type, UINT8* inbuf, UINT64 inlen, UINT8* outbuf, UINT64 outlen) {
     if (type == BTRFS_COMPRESSION_ZLIB)
         return zlib_decompress(inbuf, inlen, outbuf, outlen);
     else if (type == BTRFS_COMPRESSION_LZO)
         return lzo_decompress(inbuf, inlen, outbuf, outlen);
+    else if (type == BTRFS_COMPRESSION_ZSTD)
+        return zstd_decompress(inbuf, inlen, outbuf, outlen);
     else {
         ERR("unsupported compression type %x\n", type);
         return STATUS_NOT_SUPPORTED;
     }
 }
 
-static NTSTATUS zlib_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
-    NTSTATUS Status;
-    UINT8 compression;
-    UINT64 comp_length;
-    UINT8* comp_data;
-    UINT32 out_left;
-    LIST_ENTRY* le;
-    chunk* c;
+static NTSTATUS zlib_compress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, unsigned int level, UINT32* comp_length) {
     z_stream c_stream;
     int ret;
     
-    comp_data = ExAllocatePoolWithTag(PagedPool, end_data - start_data, ALLOC_TAG);
-    if (!comp_data) {
-        ERR("out of memory\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-    
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        return Status;
-    }
-    
     c_stream.zalloc = zlib_alloc;
     c_stream.zfree = zlib_free;
     c_stream.opaque = (voidpf)0;
 
-    ret = deflateInit(&c_stream, fcb->Vcb->options.zlib_level);
+    ret = deflateInit(&c_stream, level);
     
     if (ret != Z_OK) {
         ERR("deflateInit returned %08x\n", ret);
-        ExFreePool(comp_data);
         return STATUS_INTERNAL_ERROR;
     }
     
-    c_stream.avail_in = end_data - start_data;
-    c_stream.next_in = data;
-    c_stream.avail_out = end_data - start_data;
-    c_stream.next_out = comp_data;
+    c_stream.avail_in = inlen;
+    c_stream.next_in = inbuf;
+    c_stream.avail_out = outlen;
+    c_stream.next_out = outbuf;
     
     do {
         ret = deflate(&c_stream, Z_FINISH);
         
         if (ret == Z_STREAM_ERROR) {
             ERR("deflate returned %x\n", ret);
-            ExFreePool(comp_data);
+            deflateEnd(&c_stream);
             return STATUS_INTERNAL_ERROR;
         }
     } while (c_stream.avail_in > 0 && c_stream.avail_out > 0);
     
-    out_left = c_stream.avail_out;
+    // if we ran out of space, the whole buffer counts as used
+    *comp_length = outlen - c_stream.avail_out;
     
     ret = deflateEnd(&c_stream);
     
-    if (ret != Z_OK) {
+    // Z_DATA_ERROR only means that the stream was cut short, because we ran out of space
+    if (ret != Z_OK && (ret != Z_DATA_ERROR || c_stream.avail_out != 0)) {
         ERR("deflateEnd returned %08x\n", ret);
-        ExFreePool(comp_data);
         return STATUS_INTERNAL_ERROR;
     }
     
-    if (out_left < fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
-        ExFreePool(comp_data);
-        
-        comp_length = end_data - start_data;
-        comp_data = data;
-        compression = BTRFS_COMPRESSION_NONE;
-        
-        *compressed = FALSE;
-    } else {
-        UINT32 cl;
-        
-        compression = BTRFS_COMPRESSION_ZLIB;
-        cl = end_data - start_data - out_left;
-        comp_length = sector_align(cl, fcb->Vcb->superblock.sector_size);
-        
-        RtlZeroMemory(comp_data + cl, comp_length - cl);
-        
-        *compressed = TRUE;
-    }
-    
-    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
-    
-    le = fcb->Vcb->chunks.Flink;
-    while (le != &fcb->Vcb->chunks) {
-        c = CONTAINING_RECORD(le, chunk, list_entry);
-        
-        if (!c->readonly && !c->reloc) {
-            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-            
-            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data)) {
-                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-                    
-                    if (compression != BTRFS_COMPRESSION_NONE)
-                        ExFreePool(comp_data);
-                    
-                    return STATUS_SUCCESS;
-                }
-            }
-            
-            ExReleaseResourceLite(&c->lock);
-        }
-
-        le = le->Flink;
-    }
-    
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-    
-    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
-    
-    if ((c = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags))) {
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-        
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-        
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data)) {
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
-                return STATUS_SUCCESS;
-            }
-        }
-        
-        ExReleaseResourceLite(&c->lock);
-    } else
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-    
-    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
-
-    return STATUS_DISK_FULL;
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS lzo_do_compress(const UINT8* in, UINT32 in_len, UINT8* out, UINT32* out_len, void* wrkmem) {
@@ -732,63 +718,43 @@ static __inline UINT32 lzo_max_outlen(UINT32 inlen) {
     return inlen + (inlen / 16) + 64 + 3; // formula comes from LZO.FAQ
 }
 
-static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
+static NTSTATUS lzo_compress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, UINT32* comp_length) {
     NTSTATUS Status;
-    UINT8 compression;
-    UINT64 comp_length;
-    ULONG comp_data_len, num_pages, i;
-    UINT8* comp_data;
-    BOOL skip_compression = FALSE;
+    ULONG num_pages, i;
     lzo_stream stream;
     UINT32* out_size;
-    LIST_ENTRY* le;
-    chunk* c;
     
-    num_pages = (sector_align(end_data - start_data, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE;
+    num_pages = (sector_align(inlen, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE;
     
     // Four-byte overall header
     // Another four-byte header page
     // Each page has a maximum size of lzo_max_outlen(LINUX_PAGE_SIZE)
     // Plus another four bytes for possible padding
-    comp_data_len = sizeof(UINT32) + ((lzo_max_outlen(LINUX_PAGE_SIZE) + (2 * sizeof(UINT32))) * num_pages);
-    
-    comp_data = ExAllocatePoolWithTag(PagedPool, comp_data_len, ALLOC_TAG);
-    if (!comp_data) {
-        ERR("out of memory\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    if (outlen < sizeof(UINT32) + ((lzo_max_outlen(LINUX_PAGE_SIZE) + (2 * sizeof(UINT32))) * num_pages))
+        return STATUS_BUFFER_TOO_SMALL;
     
     stream.wrkmem = ExAllocatePoolWithTag(PagedPool, LZO1X_MEM_COMPRESS, ALLOC_TAG);
     if (!stream.wrkmem) {
         ERR("out of memory\n");
-        ExFreePool(comp_data);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
     
-    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
-    if (!NT_SUCCESS(Status)) {
-        ERR("excise_extents returned %08x\n", Status);
-        ExFreePool(comp_data);
-        ExFreePool(stream.wrkmem);
-        return Status;
-    }
-    
-    out_size = (UINT32*)comp_data;
+    out_size = (UINT32*)outbuf;
     *out_size = sizeof(UINT32);
     
-    stream.in = data;
-    stream.out = comp_data + (2 * sizeof(UINT32));
+    stream.in = inbuf;
+    stream.out = outbuf + (2 * sizeof(UINT32));
     
     for (i = 0; i < num_pages; i++) {
         UINT32* pagelen = (UINT32*)(stream.out - sizeof(UINT32));
         
-        stream.inlen = min(LINUX_PAGE_SIZE, end_data - start_data - (i * LINUX_PAGE_SIZE));
+        stream.inlen = min(LINUX_PAGE_SIZE, inlen - (i * LINUX_PAGE_SIZE));
         
         Status = lzo1x_1_compress(&stream);
         if (!NT_SUCCESS(Status)) {
             ERR("lzo1x_1_compress returned %08x\n", Status);
-            skip_compression = TRUE;
-            break;
+            ExFreePool(stream.wrkmem);
+            return Status;
         }
         
         *pagelen = stream.outlen;
@@ -806,91 +772,74 @@ static NTSTATUS lzo_write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end
     
     ExFreePool(stream.wrkmem);
     
-    if (skip_compression || *out_size >= end_data - start_data - fcb->Vcb->superblock.sector_size) { // compressed extent would be larger than or same size as uncompressed extent
-        ExFreePool(comp_data);
-        
-        comp_length = end_data - start_data;
-        comp_data = data;
-        compression = BTRFS_COMPRESSION_NONE;
-        
-        *compressed = FALSE;
-    } else {
-        compression = BTRFS_COMPRESSION_LZO;
-        comp_length = sector_align(*out_size, fcb->Vcb->superblock.sector_size);
-        
-        RtlZeroMemory(comp_data + *out_size, comp_length - *out_size);
-        
-        *compressed = TRUE;
+    *comp_length = *out_size;
+    
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS zstd_compress(UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, unsigned int level, UINT32* comp_length) {
+    NTSTATUS Status;
+    ZSTD_CCtx* cctx;
+    ZSTD_compressionParameters params;
+    size_t ret;
+    
+    cctx = ZSTD_createCCtx_advanced(zstd_mem);
+    if (!cctx) {
+        ERR("out of memory\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
     }
     
-    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
+    params = ZSTD_getCParams(level, inlen, 0);
     
-    le = fcb->Vcb->chunks.Flink;
-    while (le != &fcb->Vcb->chunks) {
-        c = CONTAINING_RECORD(le, chunk, list_entry);
-        
-        if (!c->readonly && !c->reloc) {
-            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-            
-            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data)) {
-                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-                    
-                    if (compression != BTRFS_COMPRESSION_NONE)
-                        ExFreePool(comp_data);
-                    
-                    return STATUS_SUCCESS;
-                }
-            }
-            
-            ExReleaseResourceLite(&c->lock);
-        }
-
-        le = le->Flink;
+    ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    if (!ZSTD_isError(ret))
+        ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, min(params.windowLog, ZSTD_BTRFS_MAX_WINDOWLOG));
+    
+    if (ZSTD_isError(ret)) {
+        ERR("ZSTD_CCtx_setParameter returned %s\n", ZSTD_getErrorName(ret));
+        Status = STATUS_INTERNAL_ERROR;
+        goto end;
     }
     
-    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-
-    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
+    ret = ZSTD_compress2(cctx, outbuf, outlen, inbuf, inlen);
     
-    if ((c = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags))) {
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
-        
-        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
-        
-        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
-            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data)) {
-                if (compression != BTRFS_COMPRESSION_NONE)
-                    ExFreePool(comp_data);
-                
-                return STATUS_SUCCESS;
-            }
-        }
-        
-        ExReleaseResourceLite(&c->lock);
-    } else
-        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+    if (!ZSTD_isError(ret))
+        *comp_length = (UINT32)ret;
+    else if (ZSTD_getErrorCode(ret) == ZSTD_error_dstSize_tooSmall) // same as zlib: the whole buffer counts as used
+        *comp_length = outlen;
+    else {
+        ERR("ZSTD_compress2 returned %s\n", ZSTD_getErrorName(ret));
+        Status = STATUS_INTERNAL_ERROR;
+        goto end;
+    }
     
-    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
-
-    return STATUS_DISK_FULL;
+    Status = STATUS_SUCCESS;
+    
+end:
+    ZSTD_freeCCtx(cctx);
+    
+    return Status;
 }
 
-NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
-    UINT8 type;
+UINT32 compression_buffer_size(UINT8 type, UINT32 inlen) {
+    if (type == BTRFS_COMPRESSION_LZO) {
+        ULONG num_pages = (sector_align(inlen, LINUX_PAGE_SIZE)) / LINUX_PAGE_SIZE;
+        
+        return sizeof(UINT32) + ((lzo_max_outlen(LINUX_PAGE_SIZE) + (2 * sizeof(UINT32))) * num_pages);
+    } else // zlib and zstd give up once it would take more space than the input
+        return inlen;
+}
 
-    if (fcb->Vcb->options.compress_type != 0)
-        type = fcb->Vcb->options.compress_type;
+// Called from the calc threads, so this mustn't touch the filesystem. The level is ignored for LZO.
+NTSTATUS compress_extent(UINT8 type, unsigned int level, UINT8* inbuf, UINT32 inlen, UINT8* outbuf, UINT32 outlen, UINT32* comp_length) {
+    if (type == BTRFS_COMPRESSION_ZLIB)
+        return zlib_compress(inbuf, inlen, outbuf, outlen, level, comp_length);
+    else if (type == BTRFS_COMPRESSION_LZO)
+        return lzo_compress(inbuf, inlen, outbuf, outlen, comp_length);
+    else if (type == BTRFS_COMPRESSION_ZSTD)
+        return zstd_compress(inbuf, inlen, outbuf, outlen, level, comp_length);
     else {
-        if (fcb->Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO)
-            type = BTRFS_COMPRESSION_LZO;
-        else
-            type = BTRFS_COMPRESSION_ZLIB;
+        ERR("unsupported compression type %x\n", type);
+        return STATUS_NOT_SUPPORTED;
     }
-    
-    if (type == BTRFS_COMPRESSION_LZO) {
-        fcb->Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
-        return lzo_write_compressed_bit(fcb, start_data, end_data, data, compressed, Irp, rollback);
-    } else
-        return zlib_write_compressed_bit(fcb, start_data, end_data, data, compressed, Irp, rollback);
 }
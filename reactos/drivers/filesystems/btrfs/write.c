@@ -40,6 +40,16 @@ typedef struct {
     read_stripe_master* master;
 } read_stripe;
 
+#define COMPRESSION_BATCH 16 // extents handed to the calc threads at once by write_compressed
+
+typedef struct {
+    UINT64 start;
+    UINT64 end;
+    UINT8* data;
+    UINT8* comp_data;
+    calc_job* cj;
+} comp_part;
+
 // static BOOL extent_item_is_shared(EXTENT_ITEM* ei, ULONG len);
 static NTSTATUS STDCALL write_data_completion(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID conptr);
 static void remove_fcb_extent(fcb* fcb, extent* ext, LIST_ENTRY* rollback);
@@ -3840,34 +3850,175 @@ nextitem:
     return STATUS_SUCCESS;
 }
 
-NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback) {
+static UINT8 get_compression_type(device_extension* Vcb) {
+    UINT8 type;
+
+    if (Vcb->options.compress_type != 0)
+        type = Vcb->options.compress_type;
+    else {
+        if (Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD)
+            type = BTRFS_COMPRESSION_ZSTD;
+        else if (Vcb->superblock.incompat_flags & BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO)
+            type = BTRFS_COMPRESSION_LZO;
+        else
+            type = BTRFS_COMPRESSION_ZLIB;
+    }
+    
+    if (type == BTRFS_COMPRESSION_LZO)
+        Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_LZO;
+    else if (type == BTRFS_COMPRESSION_ZSTD)
+        Vcb->superblock.incompat_flags |= BTRFS_INCOMPAT_FLAGS_COMPRESS_ZSTD;
+    
+    return type;
+}
+
+static NTSTATUS write_compressed_bit(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, UINT8 type, UINT8* comp_data, UINT32 comp_data_len, BOOL* compressed, PIRP Irp, LIST_ENTRY* rollback) {
     NTSTATUS Status;
-    UINT64 i;
+    UINT8 compression;
+    UINT64 comp_length;
+    LIST_ENTRY* le;
+    chunk* c;
+    
+    Status = excise_extents(fcb->Vcb, fcb, start_data, end_data, Irp, rollback);
+    if (!NT_SUCCESS(Status)) {
+        ERR("excise_extents returned %08x\n", Status);
+        return Status;
+    }
     
-    for (i = 0; i < sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE; i++) {
-        UINT64 s2, e2;
-        BOOL compressed;
+    if (!comp_data || comp_data_len + fcb->Vcb->superblock.sector_size > end_data - start_data) { // compressed extent would be larger than or same size as uncompressed extent
+        comp_length = end_data - start_data;
+        comp_data = data;
+        compression = BTRFS_COMPRESSION_NONE;
         
-        s2 = start_data + (i * COMPRESSED_EXTENT_SIZE);
-        e2 = min(s2 + COMPRESSED_EXTENT_SIZE, end_data);
+        *compressed = FALSE;
+    } else {
+        compression = type;
+        comp_length = sector_align(comp_data_len, fcb->Vcb->superblock.sector_size);
         
-        Status = write_compressed_bit(fcb, s2, e2, (UINT8*)data + (i * COMPRESSED_EXTENT_SIZE), &compressed, Irp, rollback);
+        RtlZeroMemory(comp_data + comp_data_len, comp_length - comp_data_len);
         
-        if (!NT_SUCCESS(Status)) {
-            ERR("write_compressed_bit returned %08x\n", Status);
-            return Status;
+        *compressed = TRUE;
+    }
+    
+    ExAcquireResourceSharedLite(&fcb->Vcb->chunk_lock, TRUE);
+    
+    le = fcb->Vcb->chunks.Flink;
+    while (le != &fcb->Vcb->chunks) {
+        c = CONTAINING_RECORD(le, chunk, list_entry);
+        
+        if (!c->readonly && !c->reloc) {
+            ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+            
+            if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
+                if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data)) {
+                    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+                    
+                    return STATUS_SUCCESS;
+                }
+            }
+            
+            ExReleaseResourceLite(&c->lock);
         }
+
+        le = le->Flink;
+    }
+    
+    ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+
+    ExAcquireResourceExclusiveLite(&fcb->Vcb->chunk_lock, TRUE);
+    
+    if ((c = alloc_chunk(fcb->Vcb, fcb->Vcb->data_flags))) {
+        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
         
-        // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
-        // bother with the rest of it.
-        if (s2 == 0 && e2 == COMPRESSED_EXTENT_SIZE && !compressed && !fcb->Vcb->options.compress_force) {
-            fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
-            fcb->inode_item_changed = TRUE;
-            mark_fcb_dirty(fcb);
+        ExAcquireResourceExclusiveLite(&c->lock, TRUE);
+        
+        if (c->chunk_item->type == fcb->Vcb->data_flags && (c->chunk_item->size - c->used) >= comp_length) {
+            if (insert_extent_chunk(fcb->Vcb, fcb, c, start_data, comp_length, FALSE, comp_data, Irp, rollback, compression, end_data - start_data))
+                return STATUS_SUCCESS;
+        }
+        
+        ExReleaseResourceLite(&c->lock);
+    } else
+        ExReleaseResourceLite(&fcb->Vcb->chunk_lock);
+    
+    WARN("couldn't find any data chunks with %llx bytes free\n", comp_length);
+
+    return STATUS_DISK_FULL;
+}
+
+NTSTATUS write_compressed(fcb* fcb, UINT64 start_data, UINT64 end_data, void* data, PIRP Irp, LIST_ENTRY* rollback) {
+    NTSTATUS Status = STATUS_SUCCESS;
+    UINT64 i, num_parts;
+    ULONG j, batch, queued;
+    UINT8 type;
+    UINT32 comp_buf_len;
+    comp_part parts[COMPRESSION_BATCH];
+    BOOL nocompress = FALSE;
+    
+    type = get_compression_type(fcb->Vcb);
+    comp_buf_len = compression_buffer_size(type, COMPRESSED_EXTENT_SIZE);
+    num_parts = sector_align(end_data - start_data, COMPRESSED_EXTENT_SIZE) / COMPRESSED_EXTENT_SIZE;
+    
+    for (i = 0; i < num_parts; i += batch) {
+        batch = (ULONG)min(num_parts - i, COMPRESSION_BATCH);
+        
+        // Let the calc threads compress a batch of extents at once, then write them out in order
+        for (queued = 0; queued < batch; queued++) {
+            parts[queued].start = start_data + ((i + queued) * COMPRESSED_EXTENT_SIZE);
+            parts[queued].end = min(parts[queued].start + COMPRESSED_EXTENT_SIZE, end_data);
+            parts[queued].data = (UINT8*)data + ((i + queued) * COMPRESSED_EXTENT_SIZE);
             
+            parts[queued].comp_data = ExAllocatePoolWithTag(PagedPool, comp_buf_len, ALLOC_TAG);
+            if (!parts[queued].comp_data) {
+                ERR("out of memory\n");
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+            
+            Status = add_calc_job_comp(fcb->Vcb, type, parts[queued].data, (UINT32)(parts[queued].end - parts[queued].start),
+                                       parts[queued].comp_data, comp_buf_len, &parts[queued].cj);
+            if (!NT_SUCCESS(Status)) {
+                ERR("add_calc_job_comp returned %08x\n", Status);
+                ExFreePool(parts[queued].comp_data);
+                break;
+            }
+        }
+        
+        for (j = 0; j < queued; j++) {
+            KeWaitForSingleObject(&parts[j].cj->event, Executive, KernelMode, FALSE, NULL);
+            
+            if (NT_SUCCESS(Status) && !nocompress) {
+                BOOL compressed;
+                
+                // If compression failed, the extent gets written uncompressed
+                Status = write_compressed_bit(fcb, parts[j].start, parts[j].end, parts[j].data, type,
+                                              NT_SUCCESS(parts[j].cj->Status) ? parts[j].comp_data : NULL,
+                                              parts[j].cj->outlen, &compressed, Irp, rollback);
+                
+                if (!NT_SUCCESS(Status))
+                    ERR("write_compressed_bit returned %08x\n", Status);
+                else if (parts[j].start == 0 && parts[j].end == COMPRESSED_EXTENT_SIZE && !compressed && !fcb->Vcb->options.compress_force) {
+                    // If the first 128 KB of a file is incompressible, we set the nocompress flag so we don't
+                    // bother with the rest of it.
+                    fcb->inode_item.flags |= BTRFS_INODE_NOCOMPRESS;
+                    fcb->inode_item_changed = TRUE;
+                    mark_fcb_dirty(fcb);
+                    
+                    nocompress = TRUE;
+                }
+            }
+            
+            free_calc_job(parts[j].cj);
+            ExFreePool(parts[j].comp_data);
+        }
+        
+        if (!NT_SUCCESS(Status))
+            return Status;
+        
+        if (nocompress) {
             // write subsequent data non-compressed
-            if (e2 < end_data) {
-                Status = do_write_file(fcb, e2, end_data, (UINT8*)data + e2, Irp, rollback);
+            if (COMPRESSED_EXTENT_SIZE < end_data) {
+                Status = do_write_file(fcb, COMPRESSED_EXTENT_SIZE, end_data, (UINT8*)data + COMPRESSED_EXTENT_SIZE, Irp, rollback);
                 
                 if (!NT_SUCCESS(Status)) {
                     ERR("do_write_file returned %08x\n", Status);
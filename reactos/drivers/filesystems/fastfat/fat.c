@@ -371,12 +371,14 @@ FAT32FindAndMarkAvailableCluster(
 }
 
 /*
- * FUNCTION: Counts free cluster in a FAT12 table
+ * FUNCTION: Counts free cluster in a FAT12 table, and marks the used ones
+ *           in Bitmap if given
  */
 static
 NTSTATUS
 FAT12CountAvailableClusters(
-    PDEVICE_EXTENSION DeviceExt)
+    PDEVICE_EXTENSION DeviceExt,
+    PRTL_BITMAP Bitmap)
 {
     ULONG Entry;
     PVOID BaseAddress;
@@ -414,6 +416,8 @@ FAT12CountAvailableClusters(
 
         if (Entry == 0)
             ulCount++;
+        else if (Bitmap)
+            RtlSetBit(Bitmap, i);
     }
 
     CcUnpinData(Context);
@@ -425,12 +429,14 @@ FAT12CountAvailableClusters(
 
 
 /*
- * FUNCTION: Counts free clusters in a FAT16 table
+ * FUNCTION: Counts free clusters in a FAT16 table, and marks the used ones
+ *           in Bitmap if given
  */
 static
 NTSTATUS
 FAT16CountAvailableClusters(
-    PDEVICE_EXTENSION DeviceExt)
+    PDEVICE_EXTENSION DeviceExt,
+    PRTL_BITMAP Bitmap)
 {
     PUSHORT Block;
     PUSHORT BlockEnd;
@@ -465,6 +471,8 @@ FAT16CountAvailableClusters(
         {
             if (*Block == 0)
                 ulCount++;
+            else if (Bitmap)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -480,12 +488,14 @@ FAT16CountAvailableClusters(
 
 
 /*
- * FUNCTION: Counts free clusters in a FAT32 table
+ * FUNCTION: Counts free clusters in a FAT32 table, and marks the used ones
+ *           in Bitmap if given
  */
 static
 NTSTATUS
 FAT32CountAvailableClusters(
-    PDEVICE_EXTENSION DeviceExt)
+    PDEVICE_EXTENSION DeviceExt,
+    PRTL_BITMAP Bitmap)
 {
     PULONG Block;
     PULONG BlockEnd;
@@ -521,6 +531,8 @@ FAT32CountAvailableClusters(
         {
             if ((*Block & 0x0fffffff) == 0)
                 ulCount++;
+            else if (Bitmap)
+                RtlSetBit(Bitmap, i);
             Block++;
             i++;
         }
@@ -544,11 +556,11 @@ CountAvailableClusters(
     if (!DeviceExt->AvailableClustersValid)
     {
         if (DeviceExt->FatInfo.FatType == FAT12)
-            Status = FAT12CountAvailableClusters(DeviceExt);
+            Status = FAT12CountAvailableClusters(DeviceExt, NULL);
         else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
-            Status = FAT16CountAvailableClusters(DeviceExt);
+            Status = FAT16CountAvailableClusters(DeviceExt, NULL);
         else
-            Status = FAT32CountAvailableClusters(DeviceExt);
+            Status = FAT32CountAvailableClusters(DeviceExt, NULL);
     }
     Clusters->QuadPart = DeviceExt->AvailableClusters;
     ExReleaseResourceLite (&DeviceExt->FatResource);
@@ -556,6 +568,148 @@ CountAvailableClusters(
     return Status;
 }
 
+/*
+ * FUNCTION: Builds the in-memory map of used clusters, counting the free
+ *           ones on the way. Without it, allocations scan the FAT.
+ */
+NTSTATUS
+InitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    NTSTATUS Status;
+    RTL_BITMAP Bitmap;
+    PULONG Buffer;
+    ULONG SizeOfBitmap;
+
+    /* Non paged, as the paging file may live on the volume */
+    SizeOfBitmap = DeviceExt->FatInfo.NumberOfClusters + 2;
+    Buffer = ExAllocatePoolWithTag(NonPagedPool, ROUND_UP(SizeOfBitmap, 32) / 8, TAG_VFAT);
+    if (Buffer == NULL)
+    {
+        DPRINT1("No memory for the map of %u clusters\n", SizeOfBitmap);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlInitializeBitMap(&Bitmap, Buffer, SizeOfBitmap);
+    RtlClearAllBits(&Bitmap);
+
+    /* The two first entries don't describe clusters */
+    RtlSetBits(&Bitmap, 0, 2);
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+    if (DeviceExt->FatInfo.FatType == FAT12)
+        Status = FAT12CountAvailableClusters(DeviceExt, &Bitmap);
+    else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
+        Status = FAT16CountAvailableClusters(DeviceExt, &Bitmap);
+    else
+        Status = FAT32CountAvailableClusters(DeviceExt, &Bitmap);
+
+    if (NT_SUCCESS(Status))
+    {
+        DeviceExt->FreeClusterBitmap = Bitmap;
+    }
+    else
+    {
+        ExFreePoolWithTag(Buffer, TAG_VFAT);
+    }
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+
+    return Status;
+}
+
+/*
+ * FUNCTION: Finds a free cluster for a chain ending with PreviousCluster
+ *           (0 for a new chain) which is about to grow by ClusterCount
+ *           clusters, and marks it as the end of the chain
+ */
+static
+NTSTATUS
+AllocateCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG PreviousCluster,
+    ULONG ClusterCount,
+    PULONG Cluster)
+{
+    PRTL_BITMAP Bitmap = &DeviceExt->FreeClusterBitmap;
+    ULONG Index, OldValue;
+    ULONG RunIndex, RunLength;
+    ULONG BestIndex, BestLength;
+    NTSTATUS Status;
+
+    /* Without the map, take the next free cluster in the FAT */
+    if (Bitmap->Buffer == NULL)
+    {
+        return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+    }
+
+    for (;;)
+    {
+        if (PreviousCluster != 0 && PreviousCluster + 1 < Bitmap->SizeOfBitMap &&
+            !RtlTestBit(Bitmap, PreviousCluster + 1))
+        {
+            /* Keep the chain contiguous */
+            Index = PreviousCluster + 1;
+        }
+        else if (ClusterCount > 1)
+        {
+            /* Start an extent in the smallest free run which holds it,
+             * or in the largest one if none is big enough */
+            BestIndex = BestLength = 0;
+            for (RunLength = RtlFindNextForwardRunClear(Bitmap, 2, &RunIndex);
+                 RunLength != 0;
+                 RunLength = RtlFindNextForwardRunClear(Bitmap, RunIndex + RunLength, &RunIndex))
+            {
+                if ((BestLength < ClusterCount && RunLength > BestLength) ||
+                    (RunLength >= ClusterCount && RunLength < BestLength))
+                {
+                    BestIndex = RunIndex;
+                    BestLength = RunLength;
+                    if (BestLength == ClusterCount)
+                        break;
+                }
+            }
+
+            if (BestLength == 0)
+            {
+                return STATUS_DISK_FULL;
+            }
+            Index = BestIndex;
+        }
+        else
+        {
+            /* Nothing is known about the chain, go on after the last allocation */
+            Index = RtlFindClearBits(Bitmap, 1, DeviceExt->LastAvailableCluster);
+            if (Index == 0xffffffff)
+            {
+                return STATUS_DISK_FULL;
+            }
+        }
+
+        Status = DeviceExt->WriteCluster(DeviceExt, Index, 0xffffffff, &OldValue);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+        RtlSetBit(Bitmap, Index);
+
+        if (OldValue == 0)
+        {
+            break;
+        }
+
+        /* The map was wrong about this one, put it back and look again */
+        DPRINT1("Cluster 0x%x is in use (0x%x)\n", Index, OldValue);
+        DeviceExt->WriteCluster(DeviceExt, Index, OldValue, &OldValue);
+    }
+
+    DPRINT("Allocated cluster 0x%x\n", Index);
+    DeviceExt->LastAvailableCluster = *Cluster = Index;
+    if (DeviceExt->AvailableClustersValid)
+        InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+
+    return STATUS_SUCCESS;
+}
+
 
 /*
  * FUNCTION: Writes a cluster to the FAT12 physical and in-memory tables
@@ -706,6 +860,14 @@ WriteCluster(
 
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     Status = DeviceExt->WriteCluster(DeviceExt, ClusterToWrite, NewValue, &OldValue);
+    if (NT_SUCCESS(Status) && DeviceExt->FreeClusterBitmap.Buffer != NULL &&
+        ClusterToWrite < DeviceExt->FreeClusterBitmap.SizeOfBitMap)
+    {
+        if (NewValue == 0)
+            RtlClearBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+        else
+            RtlSetBit(&DeviceExt->FreeClusterBitmap, ClusterToWrite);
+    }
     if (DeviceExt->AvailableClustersValid)
     {
         if (OldValue && NewValue == 0)
@@ -761,12 +923,15 @@ GetNextCluster(
 }
 
 /*
- * FUNCTION: Retrieve the next cluster depending on the FAT type
+ * FUNCTION: Retrieve the next cluster depending on the FAT type, allocating
+ *           it if the chain ends. ClusterCount tells how many clusters the
+ *           chain is about to grow by, so that they can be kept together.
  */
 NTSTATUS
 GetNextClusterExtend(
     PDEVICE_EXTENSION DeviceExt,
     ULONG CurrentCluster,
+    ULONG ClusterCount,
     PULONG NextCluster)
 {
     ULONG NewCluster;
@@ -782,7 +947,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = AllocateCluster(DeviceExt, 0, ClusterCount, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -801,7 +966,7 @@ GetNextClusterExtend(
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
            mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = AllocateCluster(DeviceExt, CurrentCluster, ClusterCount, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
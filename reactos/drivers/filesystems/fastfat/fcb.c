@@ -147,6 +147,8 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
     ExInitializeFastMutex(&rcFCB->LastMutex);
+    /* Non paged, as the paging file may live on the volume */
+    FsRtlInitializeLargeMcb(&rcFCB->Mcb, NonPagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -265,6 +267,7 @@ vfatDestroyFCB(
     PVFATFCB pFCB)
 {
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->Mcb);
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
@@ -1248,10 +1248,13 @@ VfatSetAllocationSizeInformation(
         if (FirstCluster == 0)
         {
             Fcb->LastCluster = Fcb->LastOffset = 0;
-            Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
+            FsRtlTruncateLargeMcb(&Fcb->Mcb, 0);
+            /* Ask for room for the whole allocation at once */
+            Status = GetNextClusterExtend(DeviceExt, 0, ROUND_UP(NewSize, ClusterSize) / ClusterSize,
+                                          &FirstCluster);
             if (!NT_SUCCESS(Status))
             {
-                DPRINT1("NextCluster failed. Status = %x\n", Status);
+                DPRINT1("GetNextClusterExtend failed. Status = %x\n", Status);
                 return Status;
             }
 
@@ -1334,6 +1337,7 @@ VfatSetAllocationSizeInformation(
             if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
             {
                 /* disk is full */
+                FsRtlTruncateLargeMcb(&Fcb->Mcb, Fcb->RFCB.AllocationSize.u.LowPart / ClusterSize);
                 NCluster = Cluster;
                 Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
                 WriteCluster(DeviceExt, Cluster, 0xffffffff);
@@ -1363,6 +1367,8 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         /* FIXME: Use the cached cluster/offset better way. */
         Fcb->LastCluster = Fcb->LastOffset = 0;
+        /* Only the clusters which stay allocated remain mapped */
+        FsRtlTruncateLargeMcb(&Fcb->Mcb, ROUND_UP(NewSize, ClusterSize) / ClusterSize);
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
@@ -760,6 +760,9 @@ VfatMount(
 
     VolumeFcb->Flags |= VCB_IS_DIRTY;
 
+    /* Map the free space once, allocations then won't have to scan the FAT */
+    InitializeFreeClusterBitmap(DeviceExt);
+
     FsRtlNotifyVolumeEvent(DeviceExt->FATFileObject, FSRTL_VOLUME_MOUNT);
     FsRtlNotifyInitializeSync(&DeviceExt->NotifySync);
     InitializeListHead(&DeviceExt->NotifyList);
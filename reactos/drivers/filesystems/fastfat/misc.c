@@ -439,6 +439,12 @@ VfatCheckForDismount(
     {
         PVPB DelVpb;
 
+        if (DeviceExt->FreeClusterBitmap.Buffer != NULL)
+        {
+            ExFreePoolWithTag(DeviceExt->FreeClusterBitmap.Buffer, TAG_VFAT);
+            DeviceExt->FreeClusterBitmap.Buffer = NULL;
+        }
+
         /* If we have a local VPB, we'll have to delete it
          * but we won't dismount us - something went bad before
          */
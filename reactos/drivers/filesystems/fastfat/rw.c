@@ -15,10 +15,10 @@
 #include <debug.h>
 
 /*
- * Uncomment to enable strict verification of cluster/offset pair
- * caching. If this option is enabled you lose all the benefits of
- * the caching and the read/write operations will actually be
- * slower. It's meant only for debugging!!!
+ * Uncomment to enable strict verification of the cluster runs
+ * found in the FCB extent map. If this option is enabled you lose
+ * all the benefits of the caching and the read/write operations
+ * will actually be slower. It's meant only for debugging!!!
  * - Filip Navara, 26/07/2004
  */
 /* #define DEBUG_VERIFY_OFFSET_CACHING */
@@ -44,7 +44,7 @@ NextCluster(
     else
     {
         if (Extend)
-            return GetNextClusterExtend(DeviceExt, (*CurrentCluster), CurrentCluster);
+            return GetNextClusterExtend(DeviceExt, (*CurrentCluster), 1, CurrentCluster);
         else
             return GetNextCluster(DeviceExt, (*CurrentCluster), CurrentCluster);
     }
@@ -86,7 +86,9 @@ OffsetToCluster(
         {
             for (i = 0; i < FileOffset / DeviceExt->FatInfo.BytesPerCluster; i++)
             {
-                Status = GetNextClusterExtend (DeviceExt, CurrentCluster, &CurrentCluster);
+                Status = GetNextClusterExtend (DeviceExt, CurrentCluster,
+                                               FileOffset / DeviceExt->FatInfo.BytesPerCluster - i,
+                                               &CurrentCluster);
                 if (!NT_SUCCESS(Status))
                     return Status;
             }
@@ -106,6 +108,99 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Map a file offset to the disk cluster holding it and count how many of
+ * the following clusters, up to MaxClusters, are contiguous on disk. Runs
+ * are remembered in the FCB extent map, so each part of the chain is only
+ * walked once. Cluster is 0xffffffff if the chain ends before the offset.
+ */
+static
+NTSTATUS
+OffsetToClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    ULONG MaxClusters,
+    PULONG Cluster,
+    PULONG ClusterCount)
+{
+    LONGLONG Vbn, Lbn, RunLength;
+    LONGLONG LastVbn, LastLbn;
+    LONGLONG RunVbn;
+    ULONG RunCluster, RunCount;
+    ULONG CurrentCluster;
+    NTSTATUS Status;
+
+    ASSERT(FirstCluster > 1);
+    ASSERT(MaxClusters > 0);
+
+    Vbn = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    /* A mapped run is final unless it's the last one and might go on */
+    if (FsRtlLookupLargeMcbEntry(&Fcb->Mcb, Vbn, &Lbn, &RunLength, NULL, NULL, NULL) && Lbn != -1)
+    {
+        if (RunLength >= MaxClusters ||
+            !FsRtlLookupLastLargeMcbEntry(&Fcb->Mcb, &LastVbn, &LastLbn) ||
+            LastVbn >= Vbn + RunLength)
+        {
+            *Cluster = (ULONG)Lbn;
+            *ClusterCount = (ULONG)min(RunLength, MaxClusters);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    /* Resume the chain walk where the map ends */
+    if (FsRtlLookupLastLargeMcbEntry(&Fcb->Mcb, &LastVbn, &LastLbn))
+    {
+        RunVbn = LastVbn + 1;
+        Status = GetNextCluster(DeviceExt, (ULONG)LastLbn, &CurrentCluster);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+    }
+    else
+    {
+        RunVbn = 0;
+        CurrentCluster = FirstCluster;
+    }
+
+    /* Record the runs found up to the end of the wanted range */
+    while (CurrentCluster != 0xffffffff && RunVbn < Vbn + MaxClusters)
+    {
+        RunCluster = CurrentCluster;
+        RunCount = 0;
+        do
+        {
+            RunCount++;
+            Status = GetNextCluster(DeviceExt, CurrentCluster, &CurrentCluster);
+            if (!NT_SUCCESS(Status))
+            {
+                return Status;
+            }
+        }
+        while (CurrentCluster == RunCluster + RunCount && RunVbn + RunCount < Vbn + MaxClusters);
+
+        if (!FsRtlAddLargeMcbEntry(&Fcb->Mcb, RunVbn, RunCluster, RunCount))
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RunVbn += RunCount;
+    }
+
+    if (!FsRtlLookupLargeMcbEntry(&Fcb->Mcb, Vbn, &Lbn, &RunLength, NULL, NULL, NULL) || Lbn == -1)
+    {
+        *Cluster = 0xffffffff;
+        *ClusterCount = 0;
+        return STATUS_SUCCESS;
+    }
+
+    *Cluster = (ULONG)Lbn;
+    *ClusterCount = (ULONG)min(RunLength, MaxClusters);
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -117,20 +212,16 @@ VfatReadFileData(
     LARGE_INTEGER ReadOffset,
     PULONG LengthRead)
 {
-    ULONG CurrentCluster;
     ULONG FirstCluster;
     ULONG StartCluster;
     ULONG ClusterCount;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
     NTSTATUS Status;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -187,8 +278,7 @@ VfatReadFileData(
     }
 
     /* Find the first cluster */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -208,18 +298,19 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
+    KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
+    IrpContext->RefCount = 1;
 
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
+    while (Length > 0)
     {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+        /* Get the run of contiguous clusters the read starts in */
+        ClusterCount = (ReadOffset.u.LowPart % BytesPerCluster + Length - 1) / BytesPerCluster + 1;
+        Status = OffsetToClusterRun(DeviceExt, Fcb, FirstCluster, ReadOffset.u.LowPart,
+                                    ClusterCount, &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
+        {
+            break;
+        }
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
         /* DEBUG VERIFICATION */
         {
@@ -227,63 +318,15 @@ VfatReadFileData(
             OffsetToCluster(DeviceExt, FirstCluster,
                             ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
                             &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
+            if (CorrectCluster != StartCluster)
                 KeBugCheck(FAT_FILE_SYSTEM);
         }
 #endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
-    IrpContext->RefCount = 1;
-
-    while (Length > 0 && CurrentCluster != 0xffffffff)
-    {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
 
-        do
-        {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
-        }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               ReadOffset.u.LowPart % BytesPerCluster;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - ReadOffset.u.LowPart % BytesPerCluster);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         ExAcquireFastMutex(&Fcb->LastMutex);
         Fcb->LastCluster = StartCluster + (ClusterCount - 1);
@@ -332,18 +375,14 @@ VfatWriteFileData(
     PVFATFCB Fcb;
     ULONG Count;
     ULONG FirstCluster;
-    ULONG CurrentCluster;
     ULONG BytesDone;
     ULONG StartCluster;
     ULONG ClusterCount;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -408,8 +447,7 @@ VfatWriteFileData(
     /*
      * Find the first cluster
      */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -421,20 +459,19 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
+    IrpContext->RefCount = 1;
+    BufferOffset = 0;
 
-    /*
-     * Find the cluster to start the write from
-     */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
+    while (Length > 0)
     {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+        /* Get the run of contiguous clusters the write starts in */
+        ClusterCount = (WriteOffset.u.LowPart % BytesPerCluster + Length - 1) / BytesPerCluster + 1;
+        Status = OffsetToClusterRun(DeviceExt, Fcb, FirstCluster, WriteOffset.u.LowPart,
+                                    ClusterCount, &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
+        {
+            break;
+        }
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
         /* DEBUG VERIFICATION */
         {
@@ -442,63 +479,15 @@ VfatWriteFileData(
             OffsetToCluster(DeviceExt, FirstCluster,
                             ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
                             &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
+            if (CorrectCluster != StartCluster)
                 KeBugCheck(FAT_FILE_SYSTEM);
         }
 #endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
 
-    IrpContext->RefCount = 1;
-    BufferOffset = 0;
-
-    while (Length > 0 && CurrentCluster != 0xffffffff)
-    {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
-        {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
-        }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               WriteOffset.u.LowPart % BytesPerCluster;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - WriteOffset.u.LowPart % BytesPerCluster);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         ExAcquireFastMutex(&Fcb->LastMutex);
         Fcb->LastCluster = StartCluster + (ClusterCount - 1);
@@ -306,6 +306,7 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    RTL_BITMAP FreeClusterBitmap;    /* A set bit for each used cluster */
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
 
@@ -484,6 +485,14 @@ typedef struct _VFATFCB
     FAST_MUTEX LastMutex;
     ULONG LastCluster;
     ULONG LastOffset;
+
+    /*
+     * Extent map of the cluster chain: file cluster index to disk cluster,
+     * in contiguous runs. It always describes a prefix of the chain, is
+     * filled as the chain gets walked and is cut back when the allocation
+     * changes.
+     */
+    LARGE_MCB Mcb;
 } VFATFCB, *PVFATFCB;
 
 #define CCB_DELETE_ON_CLOSE     0x0001
@@ -835,6 +844,7 @@ NTSTATUS
 GetNextClusterExtend(
     PDEVICE_EXTENSION DeviceExt,
     ULONG CurrentCluster,
+    ULONG ClusterCount,
     PULONG NextCluster);
 
 NTSTATUS
@@ -842,6 +852,10 @@ CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
     PLARGE_INTEGER Clusters);
 
+NTSTATUS
+InitializeFreeClusterBitmap(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 WriteCluster(
     PDEVICE_EXTENSION DeviceExt,
@@ -79,6 +79,48 @@ DecodeRun(PUCHAR DataRun,
     return DataRun;
 }
 
+/*
+ * Decodes a whole run list into DataRunsMCB, so that reads can look up
+ * their clusters instead of decoding the run list again. Sparse runs
+ * are left out of the MCB, pNextVBN receives the first VCN past the list.
+ */
+BOOLEAN
+ConvertDataRunsToLargeMCB(PUCHAR DataRun,
+                          PLARGE_MCB DataRunsMCB,
+                          PULONGLONG pNextVBN)
+{
+    LONGLONG DataRunOffset;
+    ULONGLONG DataRunLength;
+    LONGLONG DataRunStartLCN;
+    ULONGLONG LastLCN = 0;
+
+    while (*DataRun != 0)
+    {
+        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+
+        if (DataRunOffset != -1)
+        {
+            /* Normal data run. */
+            DataRunStartLCN = LastLCN + DataRunOffset;
+            LastLCN = DataRunStartLCN;
+
+            if (DataRunLength != 0 &&
+                !FsRtlAddLargeMcbEntry(DataRunsMCB,
+                                       *pNextVBN,
+                                       DataRunStartLCN,
+                                       DataRunLength))
+            {
+                DPRINT1("Failed to add run at VCN %I64u to the MCB\n", *pNextVBN);
+                return FALSE;
+            }
+        }
+
+        *pNextVBN += DataRunLength;
+    }
+
+    return TRUE;
+}
+
 BOOLEAN
 FindRun(PNTFS_ATTR_RECORD NresAttr,
         ULONGLONG vcn,
@@ -119,6 +161,11 @@ InternalReadNonResidentAttributes(PFIND_ATTR_CONTXT Context)
     }
 
     ListContext = PrepareAttributeContext(Attribute);
+    if (ListContext == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     ListSize = AttributeDataLength(&ListContext->Record);
     if (ListSize > 0xFFFFFFFF)
     {
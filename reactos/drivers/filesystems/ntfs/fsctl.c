@@ -447,6 +447,8 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     Vcb->Identifier.Type = NTFS_TYPE_VCB;
     Vcb->Identifier.Size = sizeof(NTFS_TYPE_VCB);
 
+    NtfsInitializeMftCache(Vcb);
+
     Status = NtfsGetVolumeData(DeviceToMount,
                                Vcb);
     if (!NT_SUCCESS(Status))
@@ -544,6 +546,9 @@ ByeBye:
         if (Vcb && Vcb->StreamFileObject)
             ObDereferenceObject(Vcb->StreamFileObject);
 
+        if (Vcb)
+            NtfsPurgeMftCache(Vcb);
+
         if (Fcb)
             NtfsDestroyFCB(Fcb);
 
@@ -875,6 +880,8 @@ LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
     }
     else
     {
+        /* Whoever held the lock may have written to the MFT */
+        NtfsPurgeMftCache(DeviceExt);
         DeviceExt->Flags &= ~VCB_VOLUME_LOCKED;
     }
 
@@ -43,29 +43,46 @@ PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord)
     Context = ExAllocatePoolWithTag(NonPagedPool,
                                     FIELD_OFFSET(NTFS_ATTR_CONTEXT, Record) + AttrRecord->Length,
                                     TAG_NTFS);
+    if (Context == NULL)
+    {
+        DPRINT1("Failed to allocate the attribute context\n");
+        return NULL;
+    }
+
     RtlCopyMemory(&Context->Record, AttrRecord, AttrRecord->Length);
     if (AttrRecord->IsNonResident)
     {
-        LONGLONG DataRunOffset;
-        ULONGLONG DataRunLength;
+        /* Decode the run list once for all the reads through this context */
+        _SEH2_TRY
+        {
+            FsRtlInitializeLargeMcb(&Context->DataRunsMCB, NonPagedPool);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            DPRINT1("FsRtlInitializeLargeMcb() raised 0x%08lx\n", _SEH2_GetExceptionCode());
+            ExFreePoolWithTag(Context, TAG_NTFS);
+            _SEH2_YIELD(return NULL);
+        }
+        _SEH2_END;
 
-        Context->CacheRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
-        Context->CacheRunOffset = 0;
-        Context->CacheRun = DecodeRun(Context->CacheRun, &DataRunOffset, &DataRunLength);
-        Context->CacheRunLength = DataRunLength;
-        if (DataRunOffset != -1)
+        /* Our FsRtl doesn't raise, it leaves the MCB without its mutex instead */
+        if (Context->DataRunsMCB.GuardedMutex == NULL)
         {
-            /* Normal run. */
-            Context->CacheRunStartLCN =
-            Context->CacheRunLastLCN = DataRunOffset;
+            DPRINT1("Failed to initialize the MCB\n");
+            ExFreePoolWithTag(Context, TAG_NTFS);
+            return NULL;
         }
-        else
+
+        Context->DataRunsEndVCN = Context->Record.NonResident.LowestVCN;
+        if (!ConvertDataRunsToLargeMCB((PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset,
+                                       &Context->DataRunsMCB,
+                                       &Context->DataRunsEndVCN))
         {
-            /* Sparse run. */
-            Context->CacheRunStartLCN = -1;
-            Context->CacheRunLastLCN = 0;
+            DPRINT1("Failed to map the run list\n");
+            FsRtlUninitializeLargeMcb(&Context->DataRunsMCB);
+            ExFreePoolWithTag(Context, TAG_NTFS);
+            return NULL;
         }
-        Context->CacheRunCurrentOffset = 0;
     }
 
     return Context;
@@ -75,6 +92,11 @@ PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord)
 VOID
 ReleaseAttributeContext(PNTFS_ATTR_CONTEXT Context)
 {
+    if (Context->Record.IsNonResident)
+    {
+        FsRtlUninitializeLargeMcb(&Context->DataRunsMCB);
+    }
+
     ExFreePoolWithTag(Context, TAG_NTFS);
 }
 
@@ -122,7 +144,7 @@ FindAttribute(PDEVICE_EXTENSION Vcb,
                 DPRINT("Found context\n");
                 *AttrCtx = PrepareAttributeContext(Attribute);
                 FindCloseAttribute(&Context);
-                return STATUS_SUCCESS;
+                return (*AttrCtx != NULL) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
             }
         }
 
@@ -161,12 +183,10 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
               PCHAR Buffer,
               ULONG Length)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
+    ULONGLONG Vcn;
+    LONGLONG Lcn;
+    LONGLONG RunLength;
+    ULONG RunOffset;
     ULONG ReadLength;
     ULONG AlreadyRead;
     NTSTATUS Status;
@@ -185,152 +205,102 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
      * Non-resident attribute
      */
 
-    /*
-     * I. Find the corresponding start data run.
-     */
-
     AlreadyRead = 0;
-
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
+    while (Length > 0)
     {
-        DataRun = Context->CacheRun;
-        LastLCN = Context->CacheRunLastLCN;
-        DataRunStartLCN = Context->CacheRunStartLCN;
-        DataRunLength = Context->CacheRunLength;
-        CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else
-    {
-        LastLCN = 0;
-        DataRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
-        CurrentOffset = 0;
+        /* Find the run holding this offset in the decoded run list */
+        Vcn = Offset / Vcb->NtfsInfo.BytesPerCluster;
+        if (Vcn < Context->Record.NonResident.LowestVCN || Vcn >= Context->DataRunsEndVCN)
+        {
+            break;
+        }
 
-        while (1)
+        if (!FsRtlLookupLargeMcbEntry(&Context->DataRunsMCB, Vcn, &Lcn, &RunLength, NULL, NULL, NULL))
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
+            /* Sparse data run at the end of the list. */
+            Lcn = -1;
+            RunLength = Context->DataRunsEndVCN - Vcn;
+        }
 
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
+        RunOffset = (ULONG)(Offset - Vcn * Vcb->NtfsInfo.BytesPerCluster);
+        ReadLength = (ULONG)min(RunLength * Vcb->NtfsInfo.BytesPerCluster - RunOffset, Length);
+        if (Lcn == -1)
+        {
+            /* Sparse data run. */
+            RtlZeroMemory(Buffer, ReadLength);
+        }
+        else
+        {
+            Status = NtfsReadDisk(Vcb->StorageDevice,
+                                  Lcn * Vcb->NtfsInfo.BytesPerCluster + RunOffset,
+                                  ReadLength,
+                                  Vcb->NtfsInfo.BytesPerSector,
+                                  (PVOID)Buffer,
+                                  FALSE);
+            if (!NT_SUCCESS(Status))
             {
                 break;
             }
-
-            if (*DataRun == 0)
-            {
-                return AlreadyRead;
-            }
-
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
         }
-    }
 
-    /*
-     * II. Go through the run list and read the data
-     */
-
-    ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
-    if (DataRunStartLCN == -1)
-    {
-        RtlZeroMemory(Buffer, ReadLength);
-        Status = STATUS_SUCCESS;
-    }
-    else
-    {
-        Status = NtfsReadDisk(Vcb->StorageDevice,
-                              DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset,
-                              ReadLength,
-                              Vcb->NtfsInfo.BytesPerSector,
-                              (PVOID)Buffer,
-                              FALSE);
-    }
-    if (NT_SUCCESS(Status))
-    {
+        Offset += ReadLength;
         Length -= ReadLength;
         Buffer += ReadLength;
         AlreadyRead += ReadLength;
+    }
 
-        if (ReadLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
-        {
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != (ULONGLONG)-1)
-            {
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-                DataRunStartLCN = -1;
-        }
+    return AlreadyRead;
+}
 
-        while (Length > 0)
-        {
-            ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
-            if (DataRunStartLCN == -1)
-                RtlZeroMemory(Buffer, ReadLength);
-            else
-            {
-                Status = NtfsReadDisk(Vcb->StorageDevice,
-                                      DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                      ReadLength,
-                                      Vcb->NtfsInfo.BytesPerSector,
-                                      (PVOID)Buffer,
-                                      FALSE);
-                if (!NT_SUCCESS(Status))
-                    break;
-            }
 
-            Length -= ReadLength;
-            Buffer += ReadLength;
-            AlreadyRead += ReadLength;
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb)
+{
+    ExInitializeFastMutex(&Vcb->MftCacheLock);
+    InitializeListHead(&Vcb->MftCacheListHead);
+    Vcb->MftCacheCount = 0;
+}
 
-            /* We finished this request, but there still data in this data run. */
-            if (Length == 0 && ReadLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
-                break;
 
-            /*
-             * Go to next run in the list.
-             */
+VOID
+NtfsPurgeMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PLIST_ENTRY Entry;
+
+    ExAcquireFastMutex(&Vcb->MftCacheLock);
+    while (!IsListEmpty(&Vcb->MftCacheListHead))
+    {
+        Entry = RemoveHeadList(&Vcb->MftCacheListHead);
+        ExFreePoolWithTag(CONTAINING_RECORD(Entry, NTFS_MFT_CACHE_ENTRY, MftCacheListEntry), TAG_NTFS);
+    }
+    Vcb->MftCacheCount = 0;
+    ExReleaseFastMutex(&Vcb->MftCacheLock);
+}
 
-            if (*DataRun == 0)
-                break;
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-        } /* while */
 
-    } /* if Disk */
+static
+PNTFS_MFT_CACHE_ENTRY
+LookupMftCache(PDEVICE_EXTENSION Vcb,
+               ULONGLONG MFTIndex)
+{
+    PLIST_ENTRY Entry;
+    PNTFS_MFT_CACHE_ENTRY CacheEntry;
 
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + AlreadyRead;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
+    for (Entry = Vcb->MftCacheListHead.Flink;
+         Entry != &Vcb->MftCacheListHead;
+         Entry = Entry->Flink)
+    {
+        CacheEntry = CONTAINING_RECORD(Entry, NTFS_MFT_CACHE_ENTRY, MftCacheListEntry);
+        if (CacheEntry->MFTIndex == MFTIndex)
+        {
+            /* Move it to the front, the list tail is the next victim */
+            RemoveEntryList(Entry);
+            InsertHeadList(&Vcb->MftCacheListHead, Entry);
+            return CacheEntry;
+        }
+    }
 
-    return AlreadyRead;
+    return NULL;
 }
 
 
@@ -340,9 +310,21 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                PFILE_RECORD_HEADER file)
 {
     ULONGLONG BytesRead;
+    PNTFS_MFT_CACHE_ENTRY CacheEntry;
+    NTSTATUS Status;
 
     DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
 
+    ExAcquireFastMutex(&Vcb->MftCacheLock);
+    CacheEntry = LookupMftCache(Vcb, index);
+    if (CacheEntry != NULL)
+    {
+        RtlCopyMemory(file, &CacheEntry->Record, Vcb->NtfsInfo.BytesPerFileRecord);
+        ExReleaseFastMutex(&Vcb->MftCacheLock);
+        return STATUS_SUCCESS;
+    }
+    ExReleaseFastMutex(&Vcb->MftCacheLock);
+
     BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
     if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
     {
@@ -351,7 +333,43 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
     }
 
     /* Apply update sequence array fixups. */
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    /* Keep the fixed up record, reusing the least recently used one when full */
+    ExAcquireFastMutex(&Vcb->MftCacheLock);
+    if (LookupMftCache(Vcb, index) == NULL)
+    {
+        if (Vcb->MftCacheCount >= NTFS_MFT_CACHE_SIZE)
+        {
+            CacheEntry = CONTAINING_RECORD(RemoveTailList(&Vcb->MftCacheListHead),
+                                           NTFS_MFT_CACHE_ENTRY,
+                                           MftCacheListEntry);
+        }
+        else
+        {
+            CacheEntry = ExAllocatePoolWithTag(NonPagedPool,
+                                               FIELD_OFFSET(NTFS_MFT_CACHE_ENTRY, Record) + Vcb->NtfsInfo.BytesPerFileRecord,
+                                               TAG_NTFS);
+            if (CacheEntry != NULL)
+            {
+                Vcb->MftCacheCount++;
+            }
+        }
+
+        if (CacheEntry != NULL)
+        {
+            CacheEntry->MFTIndex = index;
+            RtlCopyMemory(&CacheEntry->Record, file, Vcb->NtfsInfo.BytesPerFileRecord);
+            InsertHeadList(&Vcb->MftCacheListHead, &CacheEntry->MftCacheListEntry);
+        }
+    }
+    ExReleaseFastMutex(&Vcb->MftCacheLock);
+
+    return STATUS_SUCCESS;
 }
 
 
@@ -469,6 +487,134 @@ DumpIndexEntry(PINDEX_ENTRY_ATTRIBUTE IndexEntry)
 }
 #endif
 
+/*
+ * Index entries are sorted by their upcased names, in every node of the
+ * B+tree, so an exact lookup only reads the index blocks on the path down
+ * to the name. STATUS_MORE_PROCESSING_REQUIRED tells the caller to scan
+ * the entries instead, when our collation could differ from the volume one.
+ */
+static
+NTSTATUS
+LookupIndexEntry(PDEVICE_EXTENSION Vcb,
+                 PFILE_RECORD_HEADER MftRecord,
+                 ULONG IndexBlockSize,
+                 PINDEX_ENTRY_ATTRIBUTE FirstEntry,
+                 PINDEX_ENTRY_ATTRIBUTE LastEntry,
+                 PUNICODE_STRING FileName,
+                 ULONGLONG *OutMFTIndex)
+{
+    NTSTATUS Status;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    PNTFS_ATTR_CONTEXT IndexAllocationCtx = NULL;
+    PINDEX_BUFFER IndexBuffer = NULL;
+    UNICODE_STRING EntryName;
+    ULONGLONG SubNodeVCN;
+    ULONG BytesPerIndexVCN;
+    ULONG Depth;
+    LONG Comparison;
+    ULONG i;
+
+    /* Upcasing beyond ASCII depends on the $UpCase table of the volume */
+    for (i = 0; i < FileName->Length / sizeof(WCHAR); i++)
+    {
+        if (FileName->Buffer[i] > 0x7F)
+        {
+            return STATUS_MORE_PROCESSING_REQUIRED;
+        }
+    }
+
+    /* Index blocks smaller than a cluster are addressed in 512 bytes units */
+    BytesPerIndexVCN = (IndexBlockSize >= Vcb->NtfsInfo.BytesPerCluster) ? Vcb->NtfsInfo.BytesPerCluster : 512;
+
+    Status = STATUS_MORE_PROCESSING_REQUIRED;
+    for (Depth = 0; Depth < 32; Depth++)
+    {
+        /* Stop at the first entry which doesn't sort before the name */
+        IndexEntry = FirstEntry;
+        while (IndexEntry < LastEntry &&
+               !(IndexEntry->Flags & NTFS_INDEX_ENTRY_END))
+        {
+            EntryName.Buffer = IndexEntry->FileName.Name;
+            EntryName.Length =
+            EntryName.MaximumLength = IndexEntry->FileName.NameLength * sizeof(WCHAR);
+            Comparison = RtlCompareUnicodeString(FileName, &EntryName, TRUE);
+            if (Comparison == 0)
+            {
+                /* Names equal but for the case, or system files, are left to the scan */
+                if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) > 0x10 &&
+                    IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
+                    CompareFileName(FileName, IndexEntry, FALSE))
+                {
+                    *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+                    Status = STATUS_SUCCESS;
+                }
+                goto Done;
+            }
+            else if (Comparison < 0)
+            {
+                break;
+            }
+
+            ASSERT(IndexEntry->Length >= sizeof(INDEX_ENTRY_ATTRIBUTE));
+            IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+        }
+
+        /* The name would be in the subnode before this entry, if there's one */
+        if (IndexEntry >= LastEntry ||
+            !(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            goto Done;
+        }
+
+        SubNodeVCN = *(PULONGLONG)((PCHAR)IndexEntry + IndexEntry->Length - sizeof(ULONGLONG));
+
+        /* The root entries stay valid for the scan, read the blocks aside */
+        if (IndexAllocationCtx == NULL)
+        {
+            Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationCtx);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT("Corrupted filesystem!\n");
+                return Status;
+            }
+
+            IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+            if (IndexBuffer == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Done;
+            }
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+        }
+
+        if (ReadAttribute(Vcb, IndexAllocationCtx, SubNodeVCN * BytesPerIndexVCN, (PCHAR)IndexBuffer, IndexBlockSize) != IndexBlockSize ||
+            !NT_SUCCESS(FixupUpdateSequenceArray(Vcb, &IndexBuffer->Ntfs)))
+        {
+            goto Done;
+        }
+
+        ASSERT(IndexBuffer->Ntfs.Type == NRH_INDX_TYPE);
+        ASSERT(IndexBuffer->Header.AllocatedSize + FIELD_OFFSET(INDEX_BUFFER, Header) == IndexBlockSize);
+        FirstEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset);
+        LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries);
+        ASSERT(LastEntry <= (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)IndexBuffer + IndexBlockSize));
+    }
+
+Done:
+    if (IndexBuffer != NULL)
+    {
+        ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+    }
+
+    if (IndexAllocationCtx != NULL)
+    {
+        ReleaseAttributeContext(IndexAllocationCtx);
+    }
+
+    return Status;
+}
+
 NTSTATUS
 BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
                    PFILE_RECORD_HEADER MftRecord,
@@ -491,6 +637,16 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
 
     DPRINT("BrowseIndexEntries(%p, %p, %p, %u, %p, %p, %wZ, %u, %u, %u, %p)\n", Vcb, MftRecord, IndexRecord, IndexBlockSize, FirstEntry, LastEntry, FileName, *StartEntry, *CurrentEntry, DirSearch, OutMFTIndex);
 
+    /* Looking up an exact name doesn't need all the index blocks */
+    if (!DirSearch && IndexRecord != NULL)
+    {
+        Status = LookupIndexEntry(Vcb, MftRecord, IndexBlockSize, FirstEntry, LastEntry, FileName, OutMFTIndex);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED)
+        {
+            return Status;
+        }
+    }
+
     IndexEntry = FirstEntry;
     while (IndexEntry < LastEntry &&
            !(IndexEntry->Flags & NTFS_INDEX_ENTRY_END))
@@ -611,7 +767,7 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
     IndexRoot = (PINDEX_ROOT_ATTRIBUTE)IndexRecord;
     IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.FirstEntryOffset);
     /* Index root is always resident. */
-    IndexEntryEnd = (PINDEX_ENTRY_ATTRIBUTE)(IndexRecord + IndexRoot->Header.TotalSizeOfEntries);
+    IndexEntryEnd = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)&IndexRoot->Header + IndexRoot->Header.TotalSizeOfEntries);
     ReleaseAttributeContext(IndexRootCtx);
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
@@ -119,10 +119,17 @@ typedef struct
     ULONG Flags;
     ULONG OpenHandleCount;
 
+    /* Fixed up MFT records, most recently used first */
+    FAST_MUTEX MftCacheLock;
+    LIST_ENTRY MftCacheListHead;
+    ULONG MftCacheCount;
+
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION, NTFS_VCB, *PNTFS_VCB;
 
 #define VCB_VOLUME_LOCKED       0x0001
 
+#define NTFS_MFT_CACHE_SIZE     64
+
 typedef struct
 {
     NTFSIDENTIFIER Identifier;
@@ -427,15 +434,18 @@ typedef struct
 
 typedef struct _NTFS_ATTR_CONTEXT
 {
-    PUCHAR            CacheRun;
-    ULONGLONG            CacheRunOffset;
-    LONGLONG            CacheRunStartLCN;
-    ULONGLONG            CacheRunLength;
-    LONGLONG            CacheRunLastLCN;
-    ULONGLONG            CacheRunCurrentOffset;
+    LARGE_MCB           DataRunsMCB;    /* VCN to LCN, in clusters */
+    ULONGLONG           DataRunsEndVCN; /* Sparse runs at the end aren't in the MCB */
     NTFS_ATTR_RECORD    Record;
 } NTFS_ATTR_CONTEXT, *PNTFS_ATTR_CONTEXT;
 
+typedef struct _NTFS_MFT_CACHE_ENTRY
+{
+    LIST_ENTRY          MftCacheListEntry;
+    ULONGLONG           MFTIndex;
+    FILE_RECORD_HEADER  Record;
+} NTFS_MFT_CACHE_ENTRY, *PNTFS_MFT_CACHE_ENTRY;
+
 #define FCB_CACHE_INITIALIZED   0x0001
 #define FCB_IS_VOLUME_STREAM    0x0002
 #define FCB_IS_VOLUME           0x0004
@@ -509,6 +519,11 @@ DecodeRun(PUCHAR DataRun,
           LONGLONG *DataRunOffset,
           ULONGLONG *DataRunLength);
 
+BOOLEAN
+ConvertDataRunsToLargeMCB(PUCHAR DataRun,
+                          PLARGE_MCB DataRunsMCB,
+                          PULONGLONG pNextVBN);
+
 VOID
 NtfsDumpFileAttributes(PDEVICE_EXTENSION Vcb,
                        PFILE_RECORD_HEADER FileRecord);
@@ -752,6 +767,12 @@ ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsPurgeMftCache(PDEVICE_EXTENSION Vcb);
+
 NTSTATUS
 FindAttribute(PDEVICE_EXTENSION Vcb,
               PFILE_RECORD_HEADER MftRecord,
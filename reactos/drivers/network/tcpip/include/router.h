@@ -9,6 +9,14 @@
 
 #include <neighbor.h>
 
+/* Node of the longest-prefix-match trie over the FIB */
+typedef struct _FIB_NODE {
+    struct _FIB_NODE *Parent;     /* Parent node, NULL for the root */
+    struct _FIB_NODE *Child[2];   /* Subtrees for the next bit being 0 or 1 */
+    IP_ADDRESS Prefix;            /* Prefix, with the bits past PrefixLength cleared */
+    UINT PrefixLength;            /* Number of significant bits in Prefix */
+    LIST_ENTRY Routes;            /* FIB entries for exactly this prefix */
+} FIB_NODE, *PFIB_NODE;
 
 /* Forward Information Base Entry */
 typedef struct _FIB_ENTRY {
@@ -18,6 +26,8 @@ typedef struct _FIB_ENTRY {
     IP_ADDRESS Netmask;           /* Netmask of network */
     PNEIGHBOR_CACHE_ENTRY Router; /* Pointer to NCE of router to use */
     UINT Metric;                  /* Cost of this route */
+    LIST_ENTRY NodeEntry;         /* Entry on the trie node's route list */
+    PFIB_NODE Node;               /* Trie node holding this route */
 } FIB_ENTRY, *PFIB_ENTRY;
 
 PFIB_ENTRY RouterAddRoute(
@@ -432,30 +432,38 @@ AhciCommandCompletionDpcRoutine (
 
     AhciDebugPrint("AhciCommandCompletionDpcRoutine()\n");
 
-    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
-    Srb = RemoveQueue(&PortExtension->CompletionQueue);
-    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+    // Several commands can complete before the DPC gets to run,
+    // but it is queued only once, so drain the whole queue
+    for (;;)
+    {
+        StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+        Srb = RemoveQueue(&PortExtension->CompletionQueue);
+        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
 
-    NT_ASSERT(Srb != NULL);
+        if (Srb == NULL)
+        {
+            break;
+        }
 
-    if (Srb->SrbStatus == SRB_STATUS_PENDING)
-    {
-        Srb->SrbStatus = SRB_STATUS_SUCCESS;
-    }
-    else
-    {
-        return;
-    }
+        if (Srb->SrbStatus == SRB_STATUS_PENDING)
+        {
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        }
+        else
+        {
+            continue;
+        }
 
-    SrbExtension = GetSrbExtension(Srb);
+        SrbExtension = GetSrbExtension(Srb);
 
-    CompletionRoutine = SrbExtension->CompletionRoutine;
-    NT_ASSERT(CompletionRoutine != NULL);
+        CompletionRoutine = SrbExtension->CompletionRoutine;
+        NT_ASSERT(CompletionRoutine != NULL);
 
-    // now it's completion routine responsibility to set SrbStatus
-    CompletionRoutine(PortExtension, Srb);
+        // now it's completion routine responsibility to set SrbStatus
+        CompletionRoutine(PortExtension, Srb);
 
-    StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        StorPortNotification(RequestComplete, AdapterExtension, Srb);
+    }
 
     return;
 }// -- AhciCommandCompletionDpcRoutine();
@@ -494,6 +502,75 @@ AhciHwPassiveInitialize (
     return TRUE;
 }// -- AhciHwPassiveInitialize();
 
+/**
+ * @name AhciGetMessageCount
+ * @implemented
+ *
+ * Reads the number of MSI messages the system enabled for the HBA from its PCI MSI capability.
+ *
+ * @param AdapterExtension
+ *
+ * @return
+ * return the number of granted messages, 1 if MSI is not enabled
+ */
+ULONG
+AhciGetMessageCount (
+    __in PAHCI_ADAPTER_EXTENSION AdapterExtension
+    )
+{
+    ULONG pci_cfg_len, visited;
+    UCHAR offset;
+    USHORT messageControl;
+    UCHAR pci_cfg_buf[sizeof(PCI_COMMON_CONFIG)];
+    PPCI_COMMON_CONFIG pciConfigData;
+    PPCI_CAPABILITIES_HEADER capability;
+
+    pci_cfg_len = StorPortGetBusData(AdapterExtension,
+                                     PCIConfiguration,
+                                     AdapterExtension->SystemIoBusNumber,
+                                     AdapterExtension->SlotNumber,
+                                     pci_cfg_buf,
+                                     sizeof(PCI_COMMON_CONFIG));
+
+    if (pci_cfg_len != sizeof(PCI_COMMON_CONFIG))
+    {
+        return 1;
+    }
+
+    pciConfigData = (PPCI_COMMON_CONFIG)pci_cfg_buf;
+    if ((pciConfigData->Status & PCI_STATUS_CAPABILITIES_LIST) == 0)
+    {
+        return 1;
+    }
+
+    // walk the capability list, bounded in case it loops
+    offset = pciConfigData->u.type0.CapabilitiesPtr & ~0x3;
+    for (visited = 0; (offset != 0) && (visited < 48); visited++)
+    {
+        if (offset < PCI_COMMON_HDR_LENGTH || offset > sizeof(PCI_COMMON_CONFIG) - 4)
+        {
+            break;
+        }
+
+        capability = (PPCI_CAPABILITIES_HEADER)&pci_cfg_buf[offset];
+        if (capability->CapabilityID == PCI_CAPABILITY_ID_MSI)
+        {
+            // Message Control: MSI Enable is bit 0, Multiple Message Enable is bits 6:4
+            messageControl = *(PUSHORT)&pci_cfg_buf[offset + 2];
+            if ((messageControl & 0x1) == 0)
+            {
+                return 1;
+            }
+
+            return 1 << ((messageControl >> 4) & 0x7);
+        }
+
+        offset = capability->Next & ~0x3;
+    }
+
+    return 1;
+}// -- AhciGetMessageCount();
+
 /**
  * @name AhciHwInitialize
  * @implemented
@@ -515,6 +592,7 @@ AhciHwInitialize (
     AhciDebugPrint("AhciHwInitialize()\n");
 
     AdapterExtension->StateFlags.MessagePerPort = FALSE;
+    AdapterExtension->MessageCount = AhciGetMessageCount(AdapterExtension);
 
     // First check what type of interrupt/synchronization device is using
     ghc.Status = StorPortReadRegisterUlong(AdapterExtension, &AdapterExtension->ABAR_Address->GHC);
@@ -523,10 +601,10 @@ AhciHwInitialize (
     // but has reverted to using the first vector only.  When this bit is cleared to ‘0’,
     // the HBA has not reverted to single MSI mode (i.e. hardware is already in single MSI mode,
     // software has allocated the number of messages requested
-    if (ghc.MRSM == 0)
+    if ((ghc.MRSM == 0) && (AdapterExtension->MessageCount > 1))
     {
         AdapterExtension->StateFlags.MessagePerPort = TRUE;
-        AhciDebugPrint("\tMultiple MSI based message not supported\n");
+        AhciDebugPrint("\tMSI message per port, %d messages\n", AdapterExtension->MessageCount);
     }
 
     StorPortEnablePassiveInitialization(AdapterExtension, AhciHwPassiveInitialize);
@@ -565,7 +643,7 @@ AhciCompleteIssuedSrb (
 
     for (i = 0; i < NCS; i++)
     {
-        if (((1 << i) & CommandsToComplete) != 0)
+        if (((1UL << i) & CommandsToComplete) != 0)
         {
             Srb = PortExtension->Slot[i];
 
@@ -574,6 +652,9 @@ AhciCompleteIssuedSrb (
                 continue;
             }
 
+            // slot (and NCQ tag) can be reused right away
+            PortExtension->Slot[i] = NULL;
+
             SrbExtension = GetSrbExtension(Srb);
             NT_ASSERT(SrbExtension != NULL);
 
@@ -683,6 +764,11 @@ AhciInterruptHandler (
     {
         AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
         PortExtension->CommandIssuedSlots &= outstanding;
+        PortExtension->QueuedSlots &= outstanding;
+
+        // refill the freed slots with pending Srbs, we already hold the interrupt lock here
+        AhciFillCommandSlots(PortExtension);
+        AhciActivatePort(PortExtension);
     }
 
     return;
@@ -705,6 +791,7 @@ AhciHwInterrupt (
     __in PAHCI_ADAPTER_EXTENSION AdapterExtension
     )
 {
+    BOOLEAN handled;
     ULONG portPending, nextPort, i, portCount;
 
     if (AdapterExtension->StateFlags.Removed)
@@ -723,6 +810,9 @@ AhciHwInterrupt (
         return FALSE;
     }
 
+    // A message signaled interrupt is not raised again for ports
+    // which are still pending, so handle all of them at once
+    handled = FALSE;
     for (i = 1; i <= portCount; i++)
     {
         nextPort = (AdapterExtension->LastInterruptPort + i) % portCount;
@@ -737,20 +827,79 @@ AhciHwInterrupt (
         }
 
         // we can assign this interrupt to this port
-        AdapterExtension->LastInterruptPort = nextPort;
         AhciInterruptHandler(&AdapterExtension->PortExtension[nextPort]);
+        handled = TRUE;
+    }
 
-        portPending &= ~(1 << nextPort);
-
-        // interrupt belongs to this device
-        // should always return TRUE
-        return TRUE;
+    if (handled == FALSE)
+    {
+        AhciDebugPrint("\tSomething went wrong");
+        return FALSE;
     }
 
-    AhciDebugPrint("\tSomething went wrong");
-    return FALSE;
+    // start with the next port the next time, so no port is favored
+    AdapterExtension->LastInterruptPort = (AdapterExtension->LastInterruptPort + 1) % portCount;
+
+    // interrupt belongs to this device
+    return TRUE;
 }// -- AhciHwInterrupt();
 
+#if (NTDDI_VERSION >= NTDDI_VISTA)
+/**
+ * @name AhciHwMSInterrupt
+ * @implemented
+ *
+ * The Storport driver calls the HwMSInterruptRoutine routine for message signaled interrupts.
+ *
+ * @param AdapterExtension
+ * @param MessageId
+ *
+ * @return
+ * return TRUE Indicates that an interrupt was pending on adapter.
+ * return FALSE Indicates the interrupt was not ours.
+ */
+BOOLEAN
+AhciHwMSInterrupt (
+    __in PVOID AdapterExtension,
+    __in ULONG MessageId
+    )
+{
+    ULONG portPending;
+    PAHCI_ADAPTER_EXTENSION adapterExtension;
+    PAHCI_PORT_EXTENSION portExtension;
+
+    adapterExtension = AdapterExtension;
+
+    if (adapterExtension->StateFlags.Removed)
+    {
+        return FALSE;
+    }
+
+    // 10.6.2.3
+    // Message N belongs to port N only while there are enough messages for every port.
+    // With fewer messages than ports the last granted one is shared by the remaining
+    // ports, so that message (and any message in that case) needs the full IS scan
+    if ((adapterExtension->StateFlags.MessagePerPort) &&
+        (adapterExtension->MessageCount >= adapterExtension->PortCount) &&
+        (MessageId + 1 < adapterExtension->MessageCount) &&
+        (MessageId < adapterExtension->PortCount) &&
+        (IsPortValid(adapterExtension, MessageId)))
+    {
+        portExtension = &adapterExtension->PortExtension[MessageId];
+        portPending = StorPortReadRegisterUlong(adapterExtension, adapterExtension->IS);
+        if (((portPending & (1UL << MessageId)) != 0) &&
+            (portExtension->DeviceParams.IsActive != FALSE))
+        {
+            AhciInterruptHandler(portExtension);
+            return TRUE;
+        }
+    }
+
+    // single message or a message shared by the remaining ports
+    return AhciHwInterrupt(adapterExtension);
+}// -- AhciHwMSInterrupt();
+#endif
+
 /**
  * @name AhciHwStartIo
  * @not_implemented
@@ -1099,6 +1248,12 @@ AhciHwFindAdapter (
     ConfigInfo->MaximumTransferLength = MAXIMUM_TRANSFER_LENGTH;
     ConfigInfo->SynchronizationModel = StorSynchronizeFullDuplex;
 
+#if (NTDDI_VERSION >= NTDDI_VISTA)
+    // all messages share the interrupt lock, AhciProcessIO relies on it
+    ConfigInfo->HwMSInterruptRoutine = AhciHwMSInterrupt;
+    ConfigInfo->InterruptSynchronizationMode = InterruptSynchronizeAll;
+#endif
+
     // Turn IE -- Interrupt Enabled
     ghc.Status = StorPortReadRegisterUlong(adapterExtension, &abar->GHC);
     ghc.IE = 1;
@@ -1220,6 +1375,13 @@ AhciATA_CFIS (
     cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountLow] = SrbExtension->SectorCountLow;
     cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountHigh] = SrbExtension->SectorCountHigh;
 
+    if (IsQueuedCommand(SrbExtension))
+    {
+        // FPDMA QUEUED: the sector count is in the features registers
+        // and the tag, which is our command slot, goes in SectorCount[7:3]
+        cmdTable->CFIS[AHCI_ATA_CFIS_SectorCountLow] = (UCHAR)(SrbExtension->SlotIndex << 3);
+    }
+
     return 5;
 }// -- AhciATA_CFIS();
 
@@ -1440,7 +1602,13 @@ AhciProcessSrb (
 
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
-    PortExtension->QueueSlots |= 1 << SlotIndex;
+    PortExtension->QueueSlots |= 1UL << SlotIndex;
+
+    if (IsQueuedCommand(SrbExtension))
+    {
+        PortExtension->QueuedSlots |= 1UL << SlotIndex;
+    }
+
     return;
 }// -- AhciProcessSrb();
 
@@ -1459,7 +1627,7 @@ AhciActivatePort (
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    ULONG QueueSlots, ncqSlots;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1481,27 +1649,97 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
-
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
-    else
-        slotToActivate = (QueueSlots & (~tmp));
-
-    // mark that bit off in QueueSlots
+    // issue every prepared slot at once, the HBA runs non-queued commands
+    // one after another and lets the device reorder native queued ones
+    // mark them off in QueueSlots
     // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    PortExtension->QueueSlots = 0;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= QueueSlots;
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    // section 3.3.13
+    // software shall write PxSACT for a native queued command before writing PxCI
+    ncqSlots = QueueSlots & PortExtension->QueuedSlots;
+    if (ncqSlots != 0)
+    {
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, ncqSlots);
+    }
+
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, QueueSlots);
 
     return;
 }// -- AhciActivatePort();
 
+/**
+ * @name AhciFillCommandSlots
+ * @implemented
+ *
+ * Move pending Srbs from the port queue to free command slots.
+ * Caller must hold the interrupt lock.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK tmpSrb;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
+
+    AhciDebugPrint("AhciFillCommandSlots()\n");
+
+    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
+    NCS = AHCI_Global_Port_CAP_NCS(PortExtension->AdapterExtension->CAP);
+    commandSlotMask = AHCI_SLOT_MASK(NCS); // available slots mask
+
+    commandSlotMask = (commandSlotMask & ~occupiedSlots);
+
+    // iterate over HBA port slots
+    for (slotIndex = 0; (slotIndex < NCS) && (commandSlotMask != 0); slotIndex++)
+    {
+        // find next free slot
+        if ((commandSlotMask & (1UL << slotIndex)) == 0)
+        {
+            continue;
+        }
+
+        tmpSrb = PeekQueue(&PortExtension->SrbQueue);
+        if (tmpSrb == NULL)
+        {
+            break;
+        }
+
+        // Native queued and non-queued commands can't be outstanding together,
+        // the Srb has to wait until the other kind is done
+        SrbExtension = GetSrbExtension(tmpSrb);
+        if (IsQueuedCommand(SrbExtension))
+        {
+            if ((occupiedSlots & ~PortExtension->QueuedSlots) != 0)
+            {
+                break;
+            }
+        }
+        else if (PortExtension->QueuedSlots != 0)
+        {
+            break;
+        }
+
+        RemoveQueue(&PortExtension->SrbQueue);
+        NT_ASSERT(tmpSrb->PathId == PortExtension->PortNumber);
+        AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
+
+        occupiedSlots |= (1UL << slotIndex);
+        commandSlotMask &= ~(1UL << slotIndex);
+    }
+
+    return;
+}// -- AhciFillCommandSlots();
+
 /**
  * @name AhciProcessIO
  * @implemented
@@ -1521,10 +1759,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1546,36 +1782,7 @@ AhciProcessIO (
         return; // we should wait for device to get active
     }
 
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
+    AhciFillCommandSlots(PortExtension);
 
     // program HBA port
     AhciActivatePort(PortExtension);
@@ -1718,6 +1925,20 @@ InquiryCompletion (
 
         PortExtension->DeviceParams.BytesPerPhysicalSector = DEVICE_ATA_BLOCK_SIZE;
 
+        /* Native Command Queuing, needs both HBA and device support */
+        PortExtension->DeviceParams.NcqEnabled = 0;
+        PortExtension->DeviceParams.QueueDepth = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
+        if (IsAdapterCAPSNCQ(AdapterExtension->CAP) &&
+            PortExtension->DeviceParams.Lba48BitMode &&
+            ((((PUSHORT)IdentifyDeviceData)[IDENTIFY_SATA_CAPABILITIES_WORD] & IDENTIFY_SATA_CAPABILITIES_NCQ) != 0))
+        {
+            PortExtension->DeviceParams.NcqEnabled = 1;
+            // QueueDepth is 0's based
+            PortExtension->DeviceParams.QueueDepth = min(PortExtension->DeviceParams.QueueDepth,
+                                                         (ULONG)IdentifyDeviceData->QueueDepth + 1);
+            AhciDebugPrint("\tNCQ, QueueDepth: %d\n", PortExtension->DeviceParams.QueueDepth);
+        }
+
         // last byte should be NULL
         StorPortCopyMemory(PortExtension->DeviceParams.VendorId, IdentifyDeviceData->ModelNumber, sizeof(PortExtension->DeviceParams.VendorId) - 1);
         StorPortCopyMemory(PortExtension->DeviceParams.RevisionID, IdentifyDeviceData->FirmwareRevision, sizeof(PortExtension->DeviceParams.RevisionID) - 1);
@@ -1750,7 +1971,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqEnabled;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1772,7 +1993,7 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->DeviceParams.QueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -2026,7 +2247,21 @@ DeviceRequestReadWrite (
     SrbExtension->SectorCountLow = (SectorCount >> 0) & 0xFF;
     SrbExtension->SectorCountHigh = (SectorCount >> 8) & 0xFF;
 
-    NT_ASSERT(SectorCount < 0x100);
+    if (PortExtension->DeviceParams.NcqEnabled)
+    {
+        // READ/WRITE FPDMA QUEUED
+        // sector count goes in the features registers, the tag is filled in AhciATA_CFIS
+        SrbExtension->Flags |= ATA_FLAGS_QUEUED;
+        SrbExtension->CommandReg = IsReading ? IDE_COMMAND_READ_FPDMA_QUEUED : IDE_COMMAND_WRITE_FPDMA_QUEUED;
+        SrbExtension->Device = IDE_LBA_MODE;
+
+        SrbExtension->FeaturesLow = SrbExtension->SectorCountLow;
+        SrbExtension->FeaturesHigh = SrbExtension->SectorCountHigh;
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+    }
+
+    NT_ASSERT(SectorCount <= 0xFFFF);
 
     SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
 
@@ -2499,6 +2734,33 @@ RemoveQueue (
     return Srb;
 }// -- RemoveQueue();
 
+/**
+ * @name PeekQueue
+ * @implemented
+ *
+ * Return the next Srb without removing it from Queue
+ *
+ * @param Queue
+ *
+ * @return
+ * return Srb
+ *
+ */
+__inline
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    )
+{
+    NT_ASSERT(Queue->Head < MAXIMUM_QUEUE_BUFFER_SIZE);
+    NT_ASSERT(Queue->Tail < MAXIMUM_QUEUE_BUFFER_SIZE);
+
+    if (Queue->Head == Queue->Tail)
+        return NULL;
+
+    return Queue->Buffer[Queue->Tail];
+}// -- PeekQueue();
+
 /**
  * @name GetSrbExtension
  * @implemented
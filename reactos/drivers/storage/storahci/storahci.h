@@ -15,7 +15,7 @@
 
 #define MAXIMUM_AHCI_PORT_COUNT             32
 #define MAXIMUM_AHCI_PRDT_ENTRIES           32
-#define MAXIMUM_AHCI_PORT_NCS               30
+#define MAXIMUM_AHCI_PORT_NCS               32
 #define MAXIMUM_QUEUE_BUFFER_SIZE           255
 #define MAXIMUM_TRANSFER_LENGTH             (128*1024) // 128 KB
 
@@ -28,6 +28,19 @@
 
 // section 3.1.2
 #define AHCI_Global_HBA_CAP_S64A            (1 << 31)
+#define AHCI_Global_HBA_CAP_SNCQ            (1 << 30)
+
+// Serial ATA Native Command Queuing, not in older ata.h
+#ifndef IDE_COMMAND_READ_FPDMA_QUEUED
+#define IDE_COMMAND_READ_FPDMA_QUEUED       0x60
+#endif
+#ifndef IDE_COMMAND_WRITE_FPDMA_QUEUED
+#define IDE_COMMAND_WRITE_FPDMA_QUEUED      0x61
+#endif
+
+// IDENTIFY DEVICE word 76 -- Serial ATA Capabilities
+#define IDENTIFY_SATA_CAPABILITIES_WORD     76
+#define IDENTIFY_SATA_CAPABILITIES_NCQ      (1 << 8)
 
 // FIS Types : http://wiki.osdev.org/AHCI
 #define FIS_TYPE_REG_H2D        0x27 // Register FIS - host to device
@@ -66,14 +79,19 @@
 #define ATA_FLAGS_DATA_OUT                  (1 << 2)
 #define ATA_FLAGS_48BIT_COMMAND             (1 << 3)
 #define ATA_FLAGS_USE_DMA                   (1 << 4)
+#define ATA_FLAGS_QUEUED                    (1 << 5) // FPDMA QUEUED command, tagged with its slot
 
 #define IsAtaCommand(AtaFunction)           (AtaFunction & ATA_FUNCTION_ATA_COMMAND)
 #define IsAtapiCommand(AtaFunction)         (AtaFunction & ATA_FUNCTION_ATAPI_COMMAND)
 #define IsDataTransferNeeded(SrbExtension)  (SrbExtension->Flags & (ATA_FLAGS_DATA_IN | ATA_FLAGS_DATA_OUT))
 #define IsAdapterCAPS64(CAP)                (CAP & AHCI_Global_HBA_CAP_S64A)
+#define IsAdapterCAPSNCQ(CAP)               (CAP & AHCI_Global_HBA_CAP_SNCQ)
+#define IsQueuedCommand(SrbExtension)       (SrbExtension->Flags & ATA_FLAGS_QUEUED)
 
 // 3.1.1 NCS = CAP[12:08] -> Align
-#define AHCI_Global_Port_CAP_NCS(x)         (((x) & 0xF00) >> 8)
+// 0's based value, so this gives the number of command slots (1 ~ 32)
+#define AHCI_Global_Port_CAP_NCS(x)         ((((x) & 0x1F00) >> 8) + 1)
+#define AHCI_SLOT_MASK(NCS)                 (((NCS) >= 32) ? (ULONG)~0 : ((1UL << (NCS)) - 1))
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 #define AhciDebugPrint(format, ...) StorPortDebugPrint(0, format, __VA_ARGS__)
@@ -458,6 +476,7 @@ typedef struct _AHCI_PORT_EXTENSION
     ULONG PortNumber;
     ULONG QueueSlots;                                   // slots which we have already assigned task (Slot)
     ULONG CommandIssuedSlots;                           // slots which has been programmed
+    ULONG QueuedSlots;                                  // slots holding FPDMA QUEUED commands (PxSACT)
     ULONG MaxPortQueueDepth;
 
     struct
@@ -467,6 +486,8 @@ typedef struct _AHCI_PORT_EXTENSION
         UCHAR AccessType;
         UCHAR DeviceType;
         UCHAR IsActive;
+        UCHAR NcqEnabled;
+        ULONG QueueDepth;
         LARGE_INTEGER MaxLba;
         ULONG BytesPerLogicalSector;
         ULONG BytesPerPhysicalSector;
@@ -507,6 +528,7 @@ typedef struct _AHCI_ADAPTER_EXTENSION
     ULONG   CAP2;
     ULONG   LastInterruptPort;
     ULONG   CurrentCommandSlot;
+    ULONG   MessageCount;// MSI messages granted to the HBA
 
     PVOID NonCachedExtension; // holds virtual address to noncached buffer allocated for Port Extension
 
@@ -570,11 +592,26 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     );
 
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
+VOID
+AhciActivatePort (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
 BOOLEAN
 AhciAdapterReset (
     __in PAHCI_ADAPTER_EXTENSION AdapterExtension
     );
 
+ULONG
+AhciGetMessageCount (
+    __in PAHCI_ADAPTER_EXTENSION AdapterExtension
+    );
+
 __inline
 VOID
 AhciZeroMemory (
@@ -639,6 +676,12 @@ RemoveQueue (
     __inout PAHCI_QUEUE Queue
     );
 
+__inline
+PVOID
+PeekQueue (
+    __in PAHCI_QUEUE Queue
+    );
+
 __inline
 PAHCI_SRB_EXTENSION
 GetSrbExtension(
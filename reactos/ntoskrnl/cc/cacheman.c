@@ -42,9 +42,101 @@ INIT_FUNCTION
 CcInitializeCacheManager(VOID)
 {
     CcInitView();
+
+    /* Throttle writers once an eighth of the memory is dirty in the cache */
+    CcDirtyPageThreshold = max(MmNumberOfPhysicalPages / 8,
+                               CC_MAX_CLUSTER_VIEWS * (VACB_MAPPING_GRANULARITY / PAGE_SIZE));
+    InitializeListHead(&CcDeferredWrites);
+    KeInitializeSpinLock(&CcDeferredWriteSpinLock);
+
     return TRUE;
 }
 
+static
+VOID
+CcReadAheadCluster (
+    IN PROS_SHARED_CACHE_MAP SharedCacheMap,
+    IN PROS_VACB *Vacbs,
+    IN ULONG Count)
+{
+    NTSTATUS Status;
+    ULONG i;
+
+    if (Count == 0)
+    {
+        return;
+    }
+
+    Status = CcReadVacbCluster(Vacbs, Count);
+    for (i = 0; i < Count; i++)
+    {
+        CcRosReleaseVacb(SharedCacheMap, Vacbs[i], NT_SUCCESS(Status), FALSE, FALSE);
+    }
+}
+
+static
+VOID
+NTAPI
+CcPerformReadAhead (
+    IN PVOID Context)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap = Context;
+    PROS_VACB Vacbs[CC_MAX_CLUSTER_VIEWS];
+    PROS_VACB Vacb;
+    LONGLONG Offset, End;
+    PVOID BaseAddress;
+    BOOLEAN Valid;
+    ULONG Count;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    Offset = SharedCacheMap->ReadAheadOffset;
+    End = Offset + SharedCacheMap->ReadAheadLength;
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    DPRINT("CcPerformReadAhead(SharedCacheMap 0x%p, %I64x - %I64x)\n",
+           SharedCacheMap, Offset, End);
+
+    /* Gather runs of views which aren't cached yet and read each run at once */
+    Count = 0;
+    for (; Offset < End; Offset += VACB_MAPPING_GRANULARITY)
+    {
+        Status = CcRosRequestVacb(SharedCacheMap,
+                                  Offset,
+                                  &BaseAddress,
+                                  &Valid,
+                                  &Vacb);
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        if (Valid)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+            CcReadAheadCluster(SharedCacheMap, Vacbs, Count);
+            Count = 0;
+            continue;
+        }
+
+        Vacbs[Count++] = Vacb;
+        if (Count == CC_MAX_CLUSTER_VIEWS)
+        {
+            CcReadAheadCluster(SharedCacheMap, Vacbs, Count);
+            Count = 0;
+        }
+    }
+    CcReadAheadCluster(SharedCacheMap, Vacbs, Count);
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    SharedCacheMap->ReadAheadActive = FALSE;
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    /* Drop the reference taken by CcScheduleReadAhead */
+    CcRosDereferenceCache(SharedCacheMap->FileObject);
+}
+
 /*
  * @unimplemented
  */
@@ -78,7 +170,7 @@ CcRemapBcb (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -88,11 +180,77 @@ CcScheduleReadAhead (
 	IN	ULONG			Length
 	)
 {
-	UNIMPLEMENTED;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    LONGLONG ReadEnd, Start, End;
+    ULONG Granularity, ReadAheadLength;
+    BOOLEAN Sequential;
+    KIRQL OldIrql;
+
+    CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
+        FileObject, FileOffset->QuadPart, Length);
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap == NULL || SharedCacheMap->DisableReadAhead || Length == 0)
+    {
+        return;
+    }
+
+    ReadEnd = FileOffset->QuadPart + Length;
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+
+    /* A read is sequential if it starts in the granule where the previous one ended */
+    Granularity = SharedCacheMap->ReadAheadGranularity;
+    Sequential = BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) ||
+                 (FileOffset->QuadPart >= ROUND_DOWN(SharedCacheMap->LastReadEnd, Granularity) &&
+                  ROUND_DOWN(FileOffset->QuadPart, Granularity) <= SharedCacheMap->LastReadEnd);
+    SharedCacheMap->LastReadEnd = ReadEnd;
+
+    if (!Sequential)
+    {
+        SharedCacheMap->ReadAheadEnd = 0;
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+        return;
+    }
+
+    /* Only one read ahead at a time, the next read will catch up */
+    if (SharedCacheMap->ReadAheadActive)
+    {
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+        return;
+    }
+
+    /* Stay twice the reader's request size ahead, in whole views */
+    ReadAheadLength = max(2 * ROUND_UP(Length, Granularity), VACB_MAPPING_GRANULARITY);
+    ReadAheadLength = min(ReadAheadLength, CC_MAX_CLUSTER_VIEWS * VACB_MAPPING_GRANULARITY);
+
+    Start = max(ROUND_UP(ReadEnd, VACB_MAPPING_GRANULARITY), SharedCacheMap->ReadAheadEnd);
+    End = min(ROUND_UP(ReadEnd + ReadAheadLength, VACB_MAPPING_GRANULARITY),
+              ROUND_UP(SharedCacheMap->FileSize.QuadPart, VACB_MAPPING_GRANULARITY));
+    if (Start >= End)
+    {
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+        return;
+    }
+
+    SharedCacheMap->ReadAheadOffset = Start;
+    SharedCacheMap->ReadAheadLength = (ULONG)(End - Start);
+    SharedCacheMap->ReadAheadEnd = End;
+    SharedCacheMap->ReadAheadActive = TRUE;
+
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    /* Keep the cache map alive until the worker is done */
+    CcRosReferenceCache(FileObject);
+
+    ExInitializeWorkItem(&SharedCacheMap->ReadAheadWorkItem,
+                         CcPerformReadAhead,
+                         SharedCacheMap);
+    ExQueueWorkItem(&SharedCacheMap->ReadAheadWorkItem, DelayedWorkQueue);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -102,10 +260,19 @@ CcSetAdditionalCacheAttributes (
 	IN	BOOLEAN		DisableWriteBehind
 	)
 {
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    KIRQL OldIrql;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p DisableReadAhead=%d DisableWriteBehind=%d\n",
         FileObject, DisableReadAhead, DisableWriteBehind);
 
-	UNIMPLEMENTED;
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    ASSERT(SharedCacheMap);
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    SharedCacheMap->DisableReadAhead = DisableReadAhead;
+    SharedCacheMap->DisableWriteBehind = DisableWriteBehind;
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
 }
 
 /*
@@ -149,7 +316,7 @@ CcSetDirtyPageThreshold (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -158,8 +325,16 @@ CcSetReadAheadGranularity (
 	IN	ULONG		Granularity
 	)
 {
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p Granularity=%lu\n",
         FileObject, Granularity);
 
-	UNIMPLEMENTED;
+    /* Must be a power of two, at least a page */
+    ASSERT(Granularity >= PAGE_SIZE && (Granularity & (Granularity - 1)) == 0);
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    ASSERT(SharedCacheMap);
+
+    SharedCacheMap->ReadAheadGranularity = Granularity;
 }
@@ -34,6 +34,13 @@ ULONG CcFastReadWait;
 ULONG CcFastReadNoWait;
 ULONG CcFastReadResourceMiss;
 
+extern KEVENT MpwThreadEvent;
+extern ULONG DirtyPageCount;
+
+LIST_ENTRY CcDeferredWrites;
+KSPIN_LOCK CcDeferredWriteSpinLock;
+ULONG CcDirtyPageThreshold;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -167,6 +174,170 @@ CcWriteVirtualAddress (
     return STATUS_SUCCESS;
 }
 
+static
+PMDL
+CcBuildVacbClusterMdl (
+    PROS_VACB *Vacbs,
+    ULONG Count,
+    PULONG Size)
+{
+    LONGLONG Length;
+    ULONG i, Pages;
+    PPFN_NUMBER PageArray;
+    PMDL Mdl;
+
+    Length = Vacbs[0]->SharedCacheMap->SectionSize.QuadPart - Vacbs[0]->FileOffset.QuadPart;
+    if (Length > Count * VACB_MAPPING_GRANULARITY)
+    {
+        Length = Count * VACB_MAPPING_GRANULARITY;
+    }
+    *Size = (ULONG)Length;
+
+    Pages = BYTES_TO_PAGES(*Size);
+    Mdl = IoAllocateMdl(Vacbs[0]->BaseAddress, Pages * PAGE_SIZE, FALSE, FALSE, NULL);
+    if (!Mdl)
+    {
+        return NULL;
+    }
+
+    /* The views aren't virtually contiguous, so describe their pages one by one */
+    PageArray = MmGetMdlPfnArray(Mdl);
+    for (i = 0; i < Pages; i++)
+    {
+        PageArray[i] = MmGetPfnForProcess(NULL,
+                                          (PVOID)((ULONG_PTR)Vacbs[i / (VACB_MAPPING_GRANULARITY / PAGE_SIZE)]->BaseAddress +
+                                                  ((i % (VACB_MAPPING_GRANULARITY / PAGE_SIZE)) << PAGE_SHIFT)));
+    }
+    Mdl->MdlFlags |= (MDL_PAGES_LOCKED | MDL_IO_PAGE_READ);
+
+    return Mdl;
+}
+
+static
+VOID
+CcFreeVacbClusterMdl (
+    PMDL Mdl)
+{
+    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+    {
+        MmUnmapLockedPages(Mdl->MappedSystemVa, Mdl);
+    }
+    IoFreeMdl(Mdl);
+}
+
+/*
+ * Reads Count file contiguous VACBs with a single paging I/O.
+ * All the VACBs must be locked by the caller.
+ */
+NTSTATUS
+NTAPI
+CcReadVacbCluster (
+    PROS_VACB *Vacbs,
+    ULONG Count)
+{
+    ULONG Size, Tail;
+    PMDL Mdl;
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatus;
+    KEVENT Event;
+
+    ASSERT(Count != 0 && Count <= CC_MAX_CLUSTER_VIEWS);
+
+    if (Count == 1)
+    {
+        return CcReadVirtualAddress(Vacbs[0]);
+    }
+
+    Mdl = CcBuildVacbClusterMdl(Vacbs, Count, &Size);
+    if (!Mdl)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    Status = IoPageRead(Vacbs[0]->SharedCacheMap->FileObject, Mdl, &Vacbs[0]->FileOffset, &Event, &IoStatus);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = IoStatus.Status;
+    }
+
+    CcFreeVacbClusterMdl(Mdl);
+
+    if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE))
+    {
+        DPRINT1("IoPageRead failed, Status %x\n", Status);
+        return Status;
+    }
+
+    /* Only the last view can extend beyond the section */
+    Tail = Size - (Count - 1) * VACB_MAPPING_GRANULARITY;
+    if (Tail < VACB_MAPPING_GRANULARITY)
+    {
+        RtlZeroMemory((char*)Vacbs[Count - 1]->BaseAddress + Tail,
+                      VACB_MAPPING_GRANULARITY - Tail);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Writes Count file contiguous VACBs with a single paging I/O.
+ * All the VACBs must be locked by the caller.
+ */
+NTSTATUS
+NTAPI
+CcWriteVacbCluster (
+    PROS_VACB *Vacbs,
+    ULONG Count)
+{
+    ULONG Size, i;
+    PMDL Mdl;
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatus;
+    KEVENT Event;
+
+    ASSERT(Count != 0 && Count <= CC_MAX_CLUSTER_VIEWS);
+
+    if (Count == 1)
+    {
+        return CcWriteVirtualAddress(Vacbs[0]);
+    }
+
+    Mdl = CcBuildVacbClusterMdl(Vacbs, Count, &Size);
+    if (!Mdl)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        Vacbs[i]->Dirty = FALSE;
+    }
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    Status = IoSynchronousPageWrite(Vacbs[0]->SharedCacheMap->FileObject, Mdl, &Vacbs[0]->FileOffset, &Event, &IoStatus);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = IoStatus.Status;
+    }
+
+    CcFreeVacbClusterMdl(Mdl);
+
+    if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE))
+    {
+        DPRINT1("IoPageWrite failed, Status %x\n", Status);
+        for (i = 0; i < Count; i++)
+        {
+            Vacbs[i]->Dirty = TRUE;
+        }
+        return Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 ReadWriteOrZero(
     _Inout_ PVOID BaseAddress,
@@ -332,8 +503,89 @@ CcCopyData (
     return TRUE;
 }
 
+static
+BOOLEAN
+CcIsWriteThrottled (
+    IN ULONG BytesToWrite)
+{
+    ULONG Pages;
+
+    /* Don't charge more than a view, or large writes would never get through */
+    Pages = BYTES_TO_PAGES(min(BytesToWrite, VACB_MAPPING_GRANULARITY));
+
+    return (DirtyPageCount + Pages > CcDirtyPageThreshold);
+}
+
+static
+VOID
+CcQueueDeferredWrite (
+    IN PDEFERRED_WRITE DeferredWrite,
+    IN BOOLEAN Retrying)
+{
+    KIRQL OldIrql;
+
+    KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+    /* Writes that already waited once keep their place in the queue */
+    if (Retrying)
+    {
+        InsertHeadList(&CcDeferredWrites, &DeferredWrite->DeferredWriteLinks);
+    }
+    else
+    {
+        InsertTailList(&CcDeferredWrites, &DeferredWrite->DeferredWriteLinks);
+    }
+    KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+    /* Wake up the lazy writer so that it makes some room */
+    KeSetEvent(&MpwThreadEvent, IO_NO_INCREMENT, FALSE);
+}
+
+VOID
+NTAPI
+CcPostDeferredWrites (
+    IN BOOLEAN Force)
+{
+    PDEFERRED_WRITE DeferredWrite;
+    KIRQL OldIrql;
+
+    for (;;)
+    {
+        KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+        if (IsListEmpty(&CcDeferredWrites))
+        {
+            KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+            break;
+        }
+
+        /* Post in order, and stop at the first write which still doesn't fit */
+        DeferredWrite = CONTAINING_RECORD(CcDeferredWrites.Flink,
+                                          DEFERRED_WRITE,
+                                          DeferredWriteLinks);
+        if (!Force && CcIsWriteThrottled(DeferredWrite->BytesToWrite))
+        {
+            KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+            /* Have the lazy writer go for another pass */
+            KeSetEvent(&MpwThreadEvent, IO_NO_INCREMENT, FALSE);
+            break;
+        }
+        RemoveEntryList(&DeferredWrite->DeferredWriteLinks);
+        KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+        if (DeferredWrite->Event != NULL)
+        {
+            KeSetEvent(DeferredWrite->Event, IO_NO_INCREMENT, FALSE);
+        }
+        else
+        {
+            DeferredWrite->PostRoutine(DeferredWrite->Context1,
+                                       DeferredWrite->Context2);
+            ExFreePoolWithTag(DeferredWrite, TAG_CC);
+        }
+    }
+}
+
 /*
- * @unimplemented
+ * @implemented
  */
 BOOLEAN
 NTAPI
@@ -343,9 +595,37 @@ CcCanIWrite (
     IN BOOLEAN Wait,
     IN BOOLEAN Retrying)
 {
+    DEFERRED_WRITE DeferredWrite;
+    KEVENT WaitEvent;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p BytesToWrite=%lu Wait=%d Retrying=%d\n",
         FileObject, BytesToWrite, Wait, Retrying);
 
+    /* Don't jump ahead of writes which are already waiting */
+    if (!CcIsWriteThrottled(BytesToWrite) &&
+        (Retrying || IsListEmpty(&CcDeferredWrites)))
+    {
+        return TRUE;
+    }
+
+    if (!Wait)
+    {
+        KeSetEvent(&MpwThreadEvent, IO_NO_INCREMENT, FALSE);
+        return FALSE;
+    }
+
+    /* Queue ourselves and let the lazy writer release us once it made room */
+    KeInitializeEvent(&WaitEvent, NotificationEvent, FALSE);
+    DeferredWrite.FileObject = FileObject;
+    DeferredWrite.BytesToWrite = BytesToWrite;
+    DeferredWrite.Event = &WaitEvent;
+    DeferredWrite.PostRoutine = NULL;
+    DeferredWrite.Context1 = NULL;
+    DeferredWrite.Context2 = NULL;
+    CcQueueDeferredWrite(&DeferredWrite, Retrying);
+
+    KeWaitForSingleObject(&WaitEvent, Executive, KernelMode, FALSE, NULL);
+
     return TRUE;
 }
 
@@ -370,13 +650,21 @@ CcCopyRead (
            FileObject, FileOffset->QuadPart, Length, Wait,
            Buffer, IoStatus);
 
-    return CcCopyData(FileObject,
-                      FileOffset->QuadPart,
-                      Buffer,
-                      Length,
-                      CcOperationRead,
-                      Wait,
-                      IoStatus);
+    if (!CcCopyData(FileObject,
+                    FileOffset->QuadPart,
+                    Buffer,
+                    Length,
+                    CcOperationRead,
+                    Wait,
+                    IoStatus))
+    {
+        return FALSE;
+    }
+
+    /* Start reading what comes next if the file is read sequentially */
+    CcScheduleReadAhead(FileObject, FileOffset, Length);
+
+    return TRUE;
 }
 
 /*
@@ -410,7 +698,7 @@ CcCopyWrite (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -422,10 +710,32 @@ CcDeferWrite (
     IN ULONG BytesToWrite,
     IN BOOLEAN Retrying)
 {
+    PDEFERRED_WRITE DeferredWrite;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p PostRoutine=%p Context1=%p Context2=%p BytesToWrite=%lu Retrying=%d\n",
         FileObject, PostRoutine, Context1, Context2, BytesToWrite, Retrying);
 
-    PostRoutine(Context1, Context2);
+    /* If there's room already, or we can't queue, post immediately */
+    if (!CcIsWriteThrottled(BytesToWrite) && IsListEmpty(&CcDeferredWrites))
+    {
+        PostRoutine(Context1, Context2);
+        return;
+    }
+
+    DeferredWrite = ExAllocatePoolWithTag(NonPagedPool, sizeof(DEFERRED_WRITE), TAG_CC);
+    if (DeferredWrite == NULL)
+    {
+        PostRoutine(Context1, Context2);
+        return;
+    }
+
+    DeferredWrite->FileObject = FileObject;
+    DeferredWrite->BytesToWrite = BytesToWrite;
+    DeferredWrite->Event = NULL;
+    DeferredWrite->PostRoutine = PostRoutine;
+    DeferredWrite->Context1 = Context1;
+    DeferredWrite->Context2 = Context2;
+    CcQueueDeferredWrite(DeferredWrite, Retrying);
 }
 
 /*
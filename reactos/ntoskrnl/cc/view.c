@@ -129,41 +129,132 @@ CcRosTraceCacheMap (
 #endif
 }
 
+/*
+ * Writes Count file contiguous VACBs of the same shared cache map.
+ * All the VACBs must be locked by the caller.
+ */
+static
 NTSTATUS
-NTAPI
-CcRosFlushVacb (
-    PROS_VACB Vacb)
+CcRosFlushVacbCluster (
+    PROS_VACB *Vacbs,
+    ULONG Count)
 {
+    PROS_SHARED_CACHE_MAP SharedCacheMap = Vacbs[0]->SharedCacheMap;
     NTSTATUS Status;
     KIRQL oldIrql;
+    ULONG i;
 
-    Status = CcWriteVirtualAddress(Vacb);
+    Status = CcWriteVacbCluster(Vacbs, Count);
     if (NT_SUCCESS(Status))
     {
         KeAcquireGuardedMutex(&ViewLock);
-        KeAcquireSpinLock(&Vacb->SharedCacheMap->CacheMapLock, &oldIrql);
+        KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
-        Vacb->Dirty = FALSE;
-        RemoveEntryList(&Vacb->DirtyVacbListEntry);
-        DirtyPageCount -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
-        CcRosVacbDecRefCount(Vacb);
+        for (i = 0; i < Count; i++)
+        {
+            Vacbs[i]->Dirty = FALSE;
+            RemoveEntryList(&Vacbs[i]->DirtyVacbListEntry);
+            DirtyPageCount -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            CcRosVacbDecRefCount(Vacbs[i]);
+        }
 
-        KeReleaseSpinLock(&Vacb->SharedCacheMap->CacheMapLock, oldIrql);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
         KeReleaseGuardedMutex(&ViewLock);
     }
 
     return Status;
 }
 
+NTSTATUS
+NTAPI
+CcRosFlushVacb (
+    PROS_VACB Vacb)
+{
+    return CcRosFlushVacbCluster(&Vacb, 1);
+}
+
+/*
+ * Looks for the dirty VACBs directly following Vacb in its file, so that
+ * they get written with a single I/O. Must be called with ViewLock held.
+ * The VACBs returned are referenced and locked.
+ */
+static
+ULONG
+CcRosGatherDirtyVacbs (
+    PROS_VACB Vacb,
+    PROS_VACB *Cluster,
+    ULONG MaxCount)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap = Vacb->SharedCacheMap;
+    PLIST_ENTRY current_entry;
+    PROS_VACB current;
+    LONGLONG NextOffset;
+    LARGE_INTEGER ZeroTimeout;
+    ULONG Count, Locked;
+    KIRQL oldIrql;
+
+    Count = 0;
+    NextOffset = Vacb->FileOffset.QuadPart + VACB_MAPPING_GRANULARITY;
+
+    /* The VACBs of a shared cache map are sorted by offset */
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+    current_entry = Vacb->CacheMapVacbListEntry.Flink;
+    while ((current_entry != &SharedCacheMap->CacheMapVacbListHead) && (Count < MaxCount))
+    {
+        current = CONTAINING_RECORD(current_entry,
+                                    ROS_VACB,
+                                    CacheMapVacbListEntry);
+
+        /* Stop at the first hole, clean view or view in use */
+        if ((current->FileOffset.QuadPart != NextOffset) ||
+            !current->Dirty || (current->ReferenceCount > 1))
+        {
+            break;
+        }
+
+        CcRosVacbIncRefCount(current);
+        Cluster[Count++] = current;
+        NextOffset += VACB_MAPPING_GRANULARITY;
+        current_entry = current_entry->Flink;
+    }
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+
+    /* Don't wait for views someone else is busy with, just write a shorter run */
+    ZeroTimeout.QuadPart = 0;
+    for (Locked = 0; Locked < Count; Locked++)
+    {
+        if (CcRosAcquireVacbLock(Cluster[Locked], &ZeroTimeout) != STATUS_SUCCESS)
+        {
+            break;
+        }
+
+        if (!Cluster[Locked]->Dirty || (Cluster[Locked]->ReferenceCount > 2))
+        {
+            CcRosReleaseVacbLock(Cluster[Locked]);
+            break;
+        }
+    }
+
+    while (Count > Locked)
+    {
+        CcRosVacbDecRefCount(Cluster[--Count]);
+    }
+
+    return Locked;
+}
+
 NTSTATUS
 NTAPI
 CcRosFlushDirtyPages (
     ULONG Target,
     PULONG Count,
-    BOOLEAN Wait)
+    BOOLEAN Wait,
+    BOOLEAN CalledFromLazy)
 {
     PLIST_ENTRY current_entry;
     PROS_VACB current;
+    PROS_VACB Cluster[CC_MAX_CLUSTER_VIEWS];
+    ULONG ClusterCount, i;
     BOOLEAN Locked;
     NTSTATUS Status;
     LARGE_INTEGER ZeroTimeout;
@@ -176,6 +267,17 @@ CcRosFlushDirtyPages (
     KeEnterCriticalRegion();
     KeAcquireGuardedMutex(&ViewLock);
 
+    /* The lazy writer ages an eighth of the dirty pages per pass, and
+     * always brings them back under the throttle threshold */
+    if (CalledFromLazy)
+    {
+        Target = max(Target, DirtyPageCount / 8);
+        if (DirtyPageCount > CcDirtyPageThreshold)
+        {
+            Target = max(Target, DirtyPageCount - CcDirtyPageThreshold);
+        }
+    }
+
     current_entry = DirtyVacbListHead.Flink;
     if (current_entry == &DirtyVacbListHead)
     {
@@ -189,6 +291,12 @@ CcRosFlushDirtyPages (
                                     DirtyVacbListEntry);
         current_entry = current_entry->Flink;
 
+        /* Leave these to explicit flushes */
+        if (CalledFromLazy && current->SharedCacheMap->DisableWriteBehind)
+        {
+            continue;
+        }
+
         CcRosVacbIncRefCount(current);
 
         Locked = current->SharedCacheMap->Callbacks->AcquireForLazyWrite(
@@ -221,16 +329,28 @@ CcRosFlushDirtyPages (
             continue;
         }
 
+        /* Write the dirty views following this one along with it */
+        Cluster[0] = current;
+        ClusterCount = 1 + CcRosGatherDirtyVacbs(current,
+                                                 &Cluster[1],
+                                                 CC_MAX_CLUSTER_VIEWS - 1);
+
         KeReleaseGuardedMutex(&ViewLock);
 
-        Status = CcRosFlushVacb(current);
+        Status = CcRosFlushVacbCluster(Cluster, ClusterCount);
 
-        CcRosReleaseVacbLock(current);
+        for (i = 0; i < ClusterCount; i++)
+        {
+            CcRosReleaseVacbLock(Cluster[i]);
+        }
         current->SharedCacheMap->Callbacks->ReleaseFromLazyWrite(
             current->SharedCacheMap->LazyWriteContext);
 
         KeAcquireGuardedMutex(&ViewLock);
-        CcRosVacbDecRefCount(current);
+        for (i = 0; i < ClusterCount; i++)
+        {
+            CcRosVacbDecRefCount(Cluster[i]);
+        }
 
         if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE) &&
             (Status != STATUS_MEDIA_WRITE_PROTECTED))
@@ -239,8 +359,8 @@ CcRosFlushDirtyPages (
         }
         else
         {
-            (*Count) += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
-            Target -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            (*Count) += ClusterCount * (VACB_MAPPING_GRANULARITY / PAGE_SIZE);
+            Target -= min(Target, ClusterCount * (VACB_MAPPING_GRANULARITY / PAGE_SIZE));
         }
 
         current_entry = DirtyVacbListHead.Flink;
@@ -249,6 +369,13 @@ CcRosFlushDirtyPages (
     KeReleaseGuardedMutex(&ViewLock);
     KeLeaveCriticalRegion();
 
+    /* Let throttled writers go. If nothing could be written, release them
+     * anyway rather than have them wait for good */
+    if (CalledFromLazy)
+    {
+        CcPostDeferredWrites(*Count == 0);
+    }
+
     DPRINT("CcRosFlushDirtyPages() finished\n");
     return STATUS_SUCCESS;
 }
@@ -346,7 +473,7 @@ retry:
     if ((Target > 0) && !FlushedPages)
     {
         /* Flush dirty pages to disk */
-        CcRosFlushDirtyPages(Target, &PagesFreed, FALSE);
+        CcRosFlushDirtyPages(Target, &PagesFreed, FALSE, FALSE);
         FlushedPages = TRUE;
 
         /* We can only swap as many pages as we flushed */
@@ -1194,6 +1321,7 @@ CcRosInitializeFileCache (
         SharedCacheMap->SectionSize = FileSizes->AllocationSize;
         SharedCacheMap->FileSize = FileSizes->FileSize;
         SharedCacheMap->PinAccess = PinAccess;
+        SharedCacheMap->ReadAheadGranularity = PAGE_SIZE;
         KeInitializeSpinLock(&SharedCacheMap->CacheMapLock);
         InitializeListHead(&SharedCacheMap->CacheMapVacbListHead);
         FileObject->SectionObjectPointer->SharedCacheMap = SharedCacheMap;
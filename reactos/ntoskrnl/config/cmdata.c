@@ -37,6 +37,7 @@ ULONG CmpConfigurationAreaSize = PAGE_SIZE * 4;
 PCM_FULL_RESOURCE_DESCRIPTOR CmpConfigurationData;
 
 EX_PUSH_LOCK CmpHiveListHeadLock, CmpLoadHiveLock;
+EX_PUSH_LOCK CmpSubKeyIndexLock;
 
 HIVE_LIST_ENTRY CmpMachineHiveList[] =
 {
@@ -402,6 +403,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management",
+        L"PageFaultClusterSize",
+        &MmPageFaultClusterSize,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Memory Management",
         L"PoolTagSmallTableSize",
@@ -323,7 +323,7 @@ CmpDelayDerefKeyControlBlock(IN PCM_KEY_CONTROL_BLOCK Kcb)
         /* Yes, we have no work item, setup the interval */
         CmpDelayDerefKCBWorkItemActive = TRUE;
         Timeout.QuadPart = CmpDelayDerefKCBIntervalInSeconds * -10000000;
-        KeSetTimer(&CmpDelayDerefKCBTimer, Timeout, &CmpDelayDerefKCBDpc);
+        KeSetCoalescableTimer(&CmpDelayDerefKCBTimer, Timeout, 0, 1000, &CmpDelayDerefKCBDpc);
     }
 
     /* Release the table lock */
@@ -342,7 +342,7 @@ CmpArmDelayedCloseTimer(VOID)
 
     /* Setup the interval */
     Timeout.QuadPart = CmpDelayCloseIntervalInSeconds * -10000000;
-    KeSetTimer(&CmpDelayCloseTimer, Timeout, &CmpDelayCloseDpc);
+    KeSetCoalescableTimer(&CmpDelayCloseTimer, Timeout, 0, 1000, &CmpDelayCloseDpc);
 }
 
 VOID
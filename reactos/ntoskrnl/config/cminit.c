@@ -14,6 +14,33 @@
 
 /* FUNCTIONS *****************************************************************/
 
+static
+VOID
+NTAPI
+CmpLockSubKeyIndex(IN PHHIVE Hive,
+                   IN BOOLEAN Exclusive)
+{
+    /* Lookups only hold the registry lock shared, so serialize the indexes */
+    KeEnterCriticalRegion();
+    if (Exclusive)
+    {
+        ExAcquirePushLockExclusive(&CmpSubKeyIndexLock);
+    }
+    else
+    {
+        ExAcquirePushLockShared(&CmpSubKeyIndexLock);
+    }
+}
+
+static
+VOID
+NTAPI
+CmpUnlockSubKeyIndex(IN PHHIVE Hive)
+{
+    ExReleasePushLock(&CmpSubKeyIndexLock);
+    KeLeaveCriticalRegion();
+}
+
 NTSTATUS
 NTAPI
 CmpInitializeHive(OUT PCMHIVE *CmHive,
@@ -211,6 +238,14 @@ CmpInitializeHive(OUT PCMHIVE *CmHive,
         }
     }
 
+    /* Index the subkeys of large keys, this is only an optimization */
+    if (!CmpInitializeSubKeyIndexCache(&Hive->Hive,
+                                       CmpLockSubKeyIndex,
+                                       CmpUnlockSubKeyIndex))
+    {
+        DPRINT1("Failed to allocate the subkey index cache\n");
+    }
+
     /* Lock the hive list */
     ExAcquirePushLockExclusive(&CmpHiveListHeadLock);
 
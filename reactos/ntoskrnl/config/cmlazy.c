@@ -166,7 +166,7 @@ CmpLazyFlush(VOID)
         /* Do it */
         DueTime.QuadPart = Int32x32To64(CmpLazyFlushIntervalInSeconds,
                                         -10 * 1000 * 1000);
-        KeSetTimer(&CmpLazyFlushTimer, DueTime, &CmpLazyFlushDpc);
+        KeSetCoalescableTimer(&CmpLazyFlushTimer, DueTime, 0, 1000, &CmpLazyFlushDpc);
     }
 }
 
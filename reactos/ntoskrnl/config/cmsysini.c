@@ -1583,6 +1583,7 @@ CmInitSystem1(VOID)
     InitializeListHead(&CmpHiveListHead);
     ExInitializePushLock(&CmpHiveListHeadLock);
     ExInitializePushLock(&CmpLoadHiveLock);
+    ExInitializePushLock(&CmpSubKeyIndexLock);
 
     /* Initialize registry lock */
     ExInitializeResourceLite(&CmpRegistryLock);
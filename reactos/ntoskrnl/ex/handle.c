@@ -19,6 +19,23 @@ LIST_ENTRY HandleTableListHead;
 EX_PUSH_LOCK HandleTableListLock;
 #define SizeOfHandle(x) (sizeof(HANDLE) * (x))
 
+/*
+ * Per-processor caches of recently freed handles. A processor caches handles
+ * for one table at a time, so that a process opening and closing handles in
+ * a tight loop recycles them without touching the shared free list.
+ */
+#define EXP_HANDLE_CACHE_DEPTH 16
+
+typedef struct DECLSPEC_CACHEALIGN _EXP_HANDLE_CACHE
+{
+    KSPIN_LOCK Lock;
+    PHANDLE_TABLE HandleTable;
+    ULONG Count;
+    ULONG Handles[EXP_HANDLE_CACHE_DEPTH];
+} EXP_HANDLE_CACHE, *PEXP_HANDLE_CACHE;
+
+EXP_HANDLE_CACHE ExpHandleCache[MAXIMUM_PROCESSORS];
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -26,9 +43,96 @@ NTAPI
 INIT_FUNCTION
 ExpInitializeHandleTables(VOID)
 {
+    ULONG i;
+
     /* Initialize the list of handle tables and the lock */
     InitializeListHead(&HandleTableListHead);
     ExInitializePushLock(&HandleTableListLock);
+
+    /* Initialize the per-processor free handle caches */
+    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    {
+        KeInitializeSpinLock(&ExpHandleCache[i].Lock);
+    }
+}
+
+static
+BOOLEAN
+ExpPushCachedHandle(IN PHANDLE_TABLE HandleTable,
+                    IN ULONG Handle)
+{
+    PEXP_HANDLE_CACHE Cache;
+    BOOLEAN Cached = FALSE;
+    KIRQL OldIrql;
+
+    /* Stay on this processor while we use its cache */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Cache = &ExpHandleCache[KeGetCurrentProcessorNumber()];
+    KeAcquireSpinLockAtDpcLevel(&Cache->Lock);
+
+    /* Take over the cache if it's empty, otherwise it must be ours */
+    if (!Cache->Count) Cache->HandleTable = HandleTable;
+    if ((Cache->HandleTable == HandleTable) &&
+        (Cache->Count < EXP_HANDLE_CACHE_DEPTH))
+    {
+        Cache->Handles[Cache->Count++] = Handle;
+        Cached = TRUE;
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&Cache->Lock);
+    KeLowerIrql(OldIrql);
+    return Cached;
+}
+
+static
+BOOLEAN
+ExpPopCachedHandle(IN PHANDLE_TABLE HandleTable,
+                   OUT PEXHANDLE Handle)
+{
+    PEXP_HANDLE_CACHE Cache;
+    BOOLEAN Found = FALSE;
+    KIRQL OldIrql;
+
+    /* Stay on this processor while we use its cache */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Cache = &ExpHandleCache[KeGetCurrentProcessorNumber()];
+
+    /* Do a lockless check first, most caches are empty or belong elsewhere */
+    if ((Cache->HandleTable == HandleTable) && (Cache->Count))
+    {
+        KeAcquireSpinLockAtDpcLevel(&Cache->Lock);
+        if ((Cache->HandleTable == HandleTable) && (Cache->Count))
+        {
+            Handle->Value = Cache->Handles[--Cache->Count];
+            Found = TRUE;
+        }
+        KeReleaseSpinLockFromDpcLevel(&Cache->Lock);
+    }
+
+    KeLowerIrql(OldIrql);
+    return Found;
+}
+
+static
+VOID
+ExpFlushCachedHandles(IN PHANDLE_TABLE HandleTable)
+{
+    PEXP_HANDLE_CACHE Cache;
+    KIRQL OldIrql;
+    ULONG i;
+
+    /* Make sure no processor keeps handles from this table */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Cache = &ExpHandleCache[i];
+        KeAcquireSpinLock(&Cache->Lock, &OldIrql);
+        if (Cache->HandleTable == HandleTable)
+        {
+            Cache->HandleTable = NULL;
+            Cache->Count = 0;
+        }
+        KeReleaseSpinLock(&Cache->Lock, OldIrql);
+    }
 }
 
 PHANDLE_TABLE_ENTRY
@@ -44,14 +148,19 @@ ExpLookupHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     /* Clear the tag bits */
     Handle.TagBits = 0;
 
-    /* Check if the handle is in the allocated range */
-    if (Handle.Value >= HandleTable->NextHandleNeedingPool)
+    /*
+     * This runs without any lock. The table is only ever grown, and the slow
+     * allocation path publishes the new TableCode before it raises
+     * NextHandleNeedingPool, so read them in the opposite order.
+     */
+    if (Handle.Value >= *(volatile ULONG *)&HandleTable->NextHandleNeedingPool)
     {
         return NULL;
     }
 
     /* Get the table code */
-    TableBase = HandleTable->TableCode;
+    _ReadWriteBarrier();
+    TableBase = *(volatile ULONG_PTR *)&HandleTable->TableCode;
 
     /* Extract the table level and actual table base */
     TableLevel = (ULONG)(TableBase & 3);
@@ -185,6 +294,9 @@ ExpFreeHandleTable(IN PHANDLE_TABLE HandleTable)
     PHANDLE_TABLE_ENTRY Level1, *Level2, **Level3;
     PAGED_CODE();
 
+    /* Drop any cached free handles, the table is going away */
+    ExpFlushCachedHandles(HandleTable);
+
     /* Check which level we're at */
     if (TableLevel == 0)
     {
@@ -269,6 +381,12 @@ ExpFreeHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     /* Mark the handle as free */
     NewValue = (ULONG)Handle.Value & ~(SizeOfHandle(1) - 1);
 
+    /* Keep it on this processor if we can, strict FIFO tables can't */
+    if (!(HandleTable->StrictFIFO) && ExpPushCachedHandle(HandleTable, NewValue))
+    {
+        return;
+    }
+
     /* Check if we're FIFO */
     if (!HandleTable->StrictFIFO)
     {
@@ -650,6 +768,19 @@ ExpAllocateHandleTableEntry(IN PHANDLE_TABLE HandleTable,
     BOOLEAN Result;
     ULONG i;
 
+    /* Reuse a handle this processor freed recently, if we have one */
+    if (!(HandleTable->StrictFIFO) && ExpPopCachedHandle(HandleTable, &Handle))
+    {
+        /* Look it up and count it */
+        Entry = ExpLookupHandleTableEntry(HandleTable, Handle);
+        ASSERT(Entry->Object == NULL);
+        InterlockedIncrement(&HandleTable->HandleCount);
+
+        /* Return the handle and the entry */
+        *NewHandle = Handle;
+        return Entry;
+    }
+
     /* Start allocation loop */
     for (;;)
     {
@@ -866,6 +997,9 @@ ExpLockHandleTableEntry(IN PHANDLE_TABLE HandleTable,
                 /* We locked it, get out */
                 return TRUE;
             }
+
+            /* Somebody raced us, the entry may well be free again so retry */
+            continue;
         }
         else
         {
@@ -895,8 +1029,14 @@ ExUnlockHandleTableEntry(IN PHANDLE_TABLE HandleTable,
                              EXHANDLE_TABLE_ENTRY_LOCK_BIT);
     ASSERT((OldValue & EXHANDLE_TABLE_ENTRY_LOCK_BIT) == 0);
 
-    /* Unblock any waiters */
-    ExfUnblockPushLock(&HandleTable->HandleContentionEvent, NULL);
+    /*
+     * Unblock any waiters. Don't touch the shared contention lock when there
+     * are none, waiters recheck the entry after queueing themselves.
+     */
+    if (HandleTable->HandleContentionEvent.Ptr)
+    {
+        ExfUnblockPushLock(&HandleTable->HandleContentionEvent, NULL);
+    }
 }
 
 VOID
@@ -990,8 +1130,11 @@ ExDestroyHandle(IN PHANDLE_TABLE HandleTable,
     ASSERT(Object != NULL);
     ASSERT((((ULONG_PTR)Object) & EXHANDLE_TABLE_ENTRY_LOCK_BIT) == 0);
 
-    /* Unblock the pushlock */
-    ExfUnblockPushLock(&HandleTable->HandleContentionEvent, NULL);
+    /* Unblock the pushlock if anybody is waiting */
+    if (HandleTable->HandleContentionEvent.Ptr)
+    {
+        ExfUnblockPushLock(&HandleTable->HandleContentionEvent, NULL);
+    }
 
     /* Free the actual entry */
     ExpFreeHandleTableEntry(HandleTable, ExHandle, HandleTableEntry);
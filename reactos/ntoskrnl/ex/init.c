@@ -657,6 +657,9 @@ NTAPI
 INIT_FUNCTION
 ExpInitSystemPhase1(VOID)
 {
+    /* Pool is up, give each processor its own pool lookaside lists */
+    ExpInitPerProcessorPoolLookasides();
+
     /* Initialize worker threads */
     ExpInitializeWorkerThreads();
 
@@ -14,6 +14,7 @@
 
 #if defined (ALLOC_PRAGMA)
 #pragma alloc_text(INIT, ExpInitLookasideLists)
+#pragma alloc_text(INIT, ExpInitPerProcessorPoolLookasides)
 #endif
 
 /* GLOBALS *******************************************************************/
@@ -24,8 +25,23 @@ LIST_ENTRY ExpPagedLookasideListHead;
 KSPIN_LOCK ExpPagedLookasideListLock;
 LIST_ENTRY ExSystemLookasideListHead;
 LIST_ENTRY ExPoolLookasideListHead;
-GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
-GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
+KSPIN_LOCK ExpPoolLookasideListLock;
+GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+PGENERAL_LOOKASIDE ExpProcessorPoolLookasides[MAXIMUM_PROCESSORS];
+BOOLEAN ExpPerProcessorPoolLookasides;
+
+/* Processors that may get started, each gets its pool lookasides up front */
+#ifdef CONFIG_SMP
+#define EXP_POOL_LOOKASIDE_PROCESSORS   MAXIMUM_PROCESSORS
+#else
+#define EXP_POOL_LOOKASIDE_PROCESSORS   1
+#endif
+
+/* Depth tuning parameters used by the balance set manager */
+#define EXP_LOOKASIDE_MINIMUM_DEPTH     4
+#define EXP_LOOKASIDE_IDLE_ALLOCATES    75
+#define EXP_LOOKASIDE_IDLE_SHRINK       10
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
@@ -57,6 +73,51 @@ ExInitializeSystemLookasideList(IN PGENERAL_LOOKASIDE List,
     List->LastAllocateHits = 0;
 }
 
+static
+VOID
+NTAPI
+INIT_FUNCTION
+ExpInitializePoolLookasides(IN PGENERAL_LOOKASIDE Lists)
+{
+    ULONG i;
+    PGENERAL_LOOKASIDE Entry;
+
+    /* Loop for all pool lists, non-paged and paged ones alternate */
+    for (Entry = Lists, i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
+    {
+        ExInitializeSystemLookasideList(Entry++,
+                                        NonPagedPool,
+                                        (i + 1) * 8,
+                                        'looP',
+                                        256,
+                                        &ExPoolLookasideListHead);
+        ExInitializeSystemLookasideList(Entry++,
+                                        PagedPool,
+                                        (i + 1) * 8,
+                                        'looP',
+                                        256,
+                                        &ExPoolLookasideListHead);
+    }
+}
+
+static
+VOID
+ExpBindPoolLookasides(IN PKPRCB Prcb)
+{
+    ULONG i;
+    PGENERAL_LOOKASIDE Entry;
+
+    /* Use the lists set aside for this processor, if there are any */
+    Entry = ExpProcessorPoolLookasides[Prcb->Number];
+    if (!Entry) return;
+
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
+    {
+        Prcb->PPNPagedLookasideList[i].P = Entry++;
+        Prcb->PPPagedLookasideList[i].P = Entry++;
+    }
+}
+
 VOID
 NTAPI
 INIT_FUNCTION
@@ -67,24 +128,174 @@ ExInitPoolLookasidePointers(VOID)
     PGENERAL_LOOKASIDE Entry;
 
     /* Loop for all pool lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
-        /* Initialize the non-paged list */
+        /* Initialize the non-paged list, unless another CPU already did */
         Entry = &ExpSmallNPagedPoolLookasideLists[i];
-        InitializeSListHead(&Entry->ListHead);
+        if (!Prcb->Number) InitializeSListHead(&Entry->ListHead);
 
         /* Bind to PRCB */
         Prcb->PPNPagedLookasideList[i].P = Entry;
         Prcb->PPNPagedLookasideList[i].L = Entry;
 
-        /* Initialize the paged list */
+        /* Initialize the paged list, unless another CPU already did */
         Entry = &ExpSmallPagedPoolLookasideLists[i];
-        InitializeSListHead(&Entry->ListHead);
+        if (!Prcb->Number) InitializeSListHead(&Entry->ListHead);
 
         /* Bind to PRCB */
         Prcb->PPPagedLookasideList[i].P = Entry;
         Prcb->PPPagedLookasideList[i].L = Entry;
     }
+
+    /* Processors started once pool is up use the lists set aside for them.
+       This runs at HIGH_LEVEL on application processors, so nothing may be
+       allocated here */
+    if (ExpPerProcessorPoolLookasides) ExpBindPoolLookasides(Prcb);
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+ExpInitPerProcessorPoolLookasides(VOID)
+{
+    ULONG i;
+    KIRQL OldIrql;
+    PGENERAL_LOOKASIDE Lists[EXP_POOL_LOOKASIDE_PROCESSORS];
+
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    /* Allocate the P lists of every processor that may ever run, while we
+       still can. Both kinds come in one block, which is too big to come from
+       a pool lookaside list itself. The global lists become the L lists */
+    for (i = 0; i < EXP_POOL_LOOKASIDE_PROCESSORS; i++)
+    {
+        Lists[i] = ExAllocatePoolWithTag(NonPagedPool,
+                                         2 * NUMBER_POOL_LOOKASIDE_LISTS *
+                                         sizeof(GENERAL_LOOKASIDE),
+                                         'looP');
+        if (!Lists[i])
+        {
+            /* This processor keeps using the shared lists */
+            DPRINT1("No per-processor pool lookasides for CPU %lu\n", i);
+        }
+    }
+
+    /* The balance set manager may already be scanning the pool lists */
+    KeAcquireSpinLock(&ExpPoolLookasideListLock, &OldIrql);
+    for (i = 0; i < EXP_POOL_LOOKASIDE_PROCESSORS; i++)
+    {
+        if (Lists[i]) ExpInitializePoolLookasides(Lists[i]);
+        ExpProcessorPoolLookasides[i] = Lists[i];
+    }
+    KeReleaseSpinLock(&ExpPoolLookasideListLock, OldIrql);
+
+    /* Bind the processors already running */
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        ExpBindPoolLookasides(KiProcessorBlock[i]);
+    }
+
+    /* Processors started from now on bind themselves */
+    ExpPerProcessorPoolLookasides = TRUE;
+}
+
+static
+VOID
+ExpComputeLookasideDepth(IN PGENERAL_LOOKASIDE Lookaside,
+                         IN ULONG Allocates,
+                         IN ULONG Misses)
+{
+    ULONG Depth, MaximumDepth, MissRatio;
+
+    Depth = Lookaside->Depth;
+    MaximumDepth = Lookaside->MaximumDepth;
+
+    if (Allocates < EXP_LOOKASIDE_IDLE_ALLOCATES)
+    {
+        /* The list is barely used, let it shrink quickly */
+        if (Depth > EXP_LOOKASIDE_MINIMUM_DEPTH + EXP_LOOKASIDE_IDLE_SHRINK)
+            Depth -= EXP_LOOKASIDE_IDLE_SHRINK;
+        else
+            Depth = EXP_LOOKASIDE_MINIMUM_DEPTH;
+    }
+    else
+    {
+        /* Get the miss ratio, in tenth of percent */
+        if (Misses > Allocates) Misses = Allocates;
+        MissRatio = (Misses * 1000) / Allocates;
+
+        if (MissRatio < 5)
+        {
+            /* Almost everything hits, give back one entry */
+            if (Depth > EXP_LOOKASIDE_MINIMUM_DEPTH) Depth--;
+        }
+        else
+        {
+            /* Grow proportionally to the misses and the room left */
+            Depth += ((MissRatio * (MaximumDepth - Depth)) / 2000) + 5;
+            if (Depth > MaximumDepth) Depth = MaximumDepth;
+        }
+    }
+
+    Lookaside->Depth = (USHORT)Depth;
+}
+
+static
+VOID
+ExpScanGeneralLookasideList(IN PLIST_ENTRY ListHead,
+                            IN PKSPIN_LOCK Lock OPTIONAL,
+                            IN BOOLEAN ListUsesMisses)
+{
+    PGENERAL_LOOKASIDE Lookaside;
+    PLIST_ENTRY ListEntry;
+    ULONG Allocates, Misses;
+    KIRQL OldIrql = PASSIVE_LEVEL;
+
+    if (Lock) KeAcquireSpinLock(Lock, &OldIrql);
+
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Lookaside = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+
+        /* Get the activity since the last scan */
+        Allocates = Lookaside->TotalAllocates - Lookaside->LastTotalAllocates;
+        Lookaside->LastTotalAllocates = Lookaside->TotalAllocates;
+
+        /* Check how the list tracks misses/hits */
+        if (ListUsesMisses)
+        {
+            Misses = Lookaside->AllocateMisses - Lookaside->LastAllocateMisses;
+            Lookaside->LastAllocateMisses = Lookaside->AllocateMisses;
+        }
+        else
+        {
+            Misses = Allocates - (Lookaside->AllocateHits - Lookaside->LastAllocateHits);
+            Lookaside->LastAllocateHits = Lookaside->AllocateHits;
+        }
+
+        ExpComputeLookasideDepth(Lookaside, Allocates, Misses);
+    }
+
+    if (Lock) KeReleaseSpinLock(Lock, OldIrql);
+}
+
+VOID
+NTAPI
+ExAdjustLookasideDepth(VOID)
+{
+    /* Pool lookaside lists count hits, the others count misses */
+    ExpScanGeneralLookasideList(&ExPoolLookasideListHead,
+                                &ExpPoolLookasideListLock,
+                                FALSE);
+    ExpScanGeneralLookasideList(&ExSystemLookasideListHead, NULL, TRUE);
+    ExpScanGeneralLookasideList(&ExpNonPagedLookasideListHead,
+                                &ExpNonPagedLookasideListLock,
+                                TRUE);
+    ExpScanGeneralLookasideList(&ExpPagedLookasideListHead,
+                                &ExpPagedLookasideListLock,
+                                TRUE);
 }
 
 VOID
@@ -101,9 +312,10 @@ ExpInitLookasideLists(VOID)
     InitializeListHead(&ExPoolLookasideListHead);
     KeInitializeSpinLock(&ExpNonPagedLookasideListLock);
     KeInitializeSpinLock(&ExpPagedLookasideListLock);
+    KeInitializeSpinLock(&ExpPoolLookasideListLock);
 
     /* Initialize the system lookaside lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
         /* Initialize the non-paged list */
         ExInitializeSystemLookasideList(&ExpSmallNPagedPoolLookasideLists[i],
@@ -16,6 +16,11 @@
 
 ULONG ExPushLockSpinCount = 0;
 
+/* Adaptive spin budget and statistics */
+ULONG ExpPushLockSpinLimit;
+ULONG ExpPushLockSpinAcquires;
+ULONG ExpPushLockSpinFailures;
+
 #undef EX_PUSH_LOCK
 #undef PEX_PUSH_LOCK
 
@@ -49,7 +54,55 @@ ExpInitializePushLocks(VOID)
     if (KeNumberProcessors > 1)
         ExPushLockSpinCount = 1024;
 #endif
+
+    /* Start the adaptive budget at the maximum */
+    ExpPushLockSpinLimit = ExPushLockSpinCount;
+}
+
+#ifdef CONFIG_SMP
+/*++
+ * @name ExpSpinOnPushLock
+ *
+ *     The ExpSpinOnPushLock routine spins on a queued wait block for a while
+ *     before its owner goes into a real wait.
+ *
+ * @param WaitBlock
+ *        Pointer to the wait block that was queued on the pushlock.
+ *
+ * @return TRUE if the wait block was woken while spinning.
+ *
+ * @remarks The spin budget adapts to recent history: it doubles each time
+ *          spinning avoided a wait, and halves each time it didn't, between
+ *          a small floor and ExPushLockSpinCount.
+ *
+ *--*/
+BOOLEAN
+FASTCALL
+ExpSpinOnPushLock(IN PEX_PUSH_LOCK_WAIT_BLOCK WaitBlock)
+{
+    ULONG i, Limit;
+
+    /* Spin for the current budget */
+    Limit = ExpPushLockSpinLimit;
+    for (i = Limit; i; i--)
+    {
+        if (!(*(volatile LONG *)&WaitBlock->Flags & EX_PUSH_LOCK_WAITING))
+        {
+            /* It worked, allow longer spins */
+            ExpPushLockSpinAcquires++;
+            ExpPushLockSpinLimit = min(Limit * 2, ExPushLockSpinCount);
+            return TRUE;
+        }
+
+        YieldProcessor();
+    }
+
+    /* It didn't, spin less next time */
+    ExpPushLockSpinFailures++;
+    ExpPushLockSpinLimit = max(Limit / 2, 32);
+    return FALSE;
 }
+#endif
 
 /*++
  * @name ExfWakePushLock
@@ -328,20 +381,9 @@ ExTimedWaitForUnblockPushLock(IN PEX_PUSH_LOCK PushLock,
                       FALSE);
 
 #ifdef CONFIG_SMP
-    /* Spin on the push lock if necessary */
-    if (ExPushLockSpinCount)
-    {
-        ULONG i = ExPushLockSpinCount;
-
-        do
-        {
-            /* Check if we got lucky and can leave early */
-            if (!(*(volatile LONG *)&((PEX_PUSH_LOCK_WAIT_BLOCK)WaitBlock)->Flags & EX_PUSH_LOCK_WAITING))
-                return STATUS_SUCCESS;
-
-            YieldProcessor();
-        } while (--i);
-    }
+    /* Spin on the push lock if necessary, we can leave early if we get lucky */
+    if ((ExPushLockSpinCount) && (ExpSpinOnPushLock(WaitBlock)))
+        return STATUS_SUCCESS;
 #endif
 
     /* Now try to remove the wait bit */
@@ -594,18 +636,7 @@ ExfAcquirePushLockExclusive(PEX_PUSH_LOCK PushLock)
 
 #ifdef CONFIG_SMP
             /* Now spin on the push lock if necessary */
-            if (ExPushLockSpinCount)
-            {
-                ULONG i = ExPushLockSpinCount;
-
-                do
-                {
-                    if (!(*(volatile LONG *)&WaitBlock->Flags & EX_PUSH_LOCK_WAITING))
-                        break;
-
-                    YieldProcessor();
-                } while (--i);
-            }
+            if (ExPushLockSpinCount) ExpSpinOnPushLock(WaitBlock);
 #endif
 
             /* Now try to remove the wait bit */
@@ -761,18 +792,7 @@ ExfAcquirePushLockShared(PEX_PUSH_LOCK PushLock)
 
 #ifdef CONFIG_SMP
             /* Now spin on the push lock if necessary */
-            if (ExPushLockSpinCount)
-            {
-                ULONG i = ExPushLockSpinCount;
-
-                do
-                {
-                    if (!(*(volatile LONG *)&WaitBlock->Flags & EX_PUSH_LOCK_WAITING))
-                        break;
-
-                    YieldProcessor();
-                } while (--i);
-            }
+            if (ExPushLockSpinCount) ExpSpinOnPushLock(WaitBlock);
 #endif
 
             /* Now try to remove the wait bit */
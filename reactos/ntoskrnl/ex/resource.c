@@ -76,6 +76,12 @@ KSPIN_LOCK ExpResourceSpinLock;
 LIST_ENTRY ExpSystemResourcesList;
 BOOLEAN ExResourceStrict = TRUE;
 
+/* Adaptive spinning and its statistics */
+#define EXP_RESOURCE_OWNER_CHECK_SPINS 64
+ULONG ExpResourceSpinCount = 0;
+ULONG ExpResourceSpinAcquires;
+ULONG ExpResourceSpinFailures;
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 #if DBG
@@ -172,8 +178,78 @@ ExpResourceInitialization(VOID)
     ExpTimeout.QuadPart = Int32x32To64(4, -10000000);
     InitializeListHead(&ExpSystemResourcesList);
     KeInitializeSpinLock(&ExpResourceSpinLock);
+
+#ifdef CONFIG_SMP
+    /* Spinning only makes sense when the owner can run at the same time */
+    if (KeNumberProcessors > 1) ExpResourceSpinCount = 4096;
+#endif
 }
 
+#ifdef CONFIG_SMP
+/*++
+ * @name ExpSpinOnResource
+ *
+ *     The ExpSpinOnResource routine spins for a short while before a wait,
+ *     hoping that the resource gets handed to the caller in the meantime.
+ *
+ * @param Resource
+ *        Pointer to the resource being waited on.
+ *
+ * @param Object
+ *        Pointer to the exclusive event or shared semaphore of the resource.
+ *
+ * @return TRUE if the wait object got signaled while spinning.
+ *
+ * @remarks Spinning stops as soon as the owner is not running on a processor
+ *          anymore, since it can't release the resource then. The owner is
+ *          looked at under the resource lock: it can't release the resource
+ *          while the lock is held, and a thread can't exit while it owns a
+ *          resource, so the thread object stays valid meanwhile.
+ *
+ *--*/
+BOOLEAN
+FASTCALL
+ExpSpinOnResource(IN PERESOURCE Resource,
+                  IN PVOID Object)
+{
+    PDISPATCHER_HEADER Header = Object;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    ERESOURCE_THREAD OwnerThread;
+    BOOLEAN OwnerRunning;
+    ULONG i;
+
+    for (i = 0; i < ExpResourceSpinCount; i++)
+    {
+        /* Check if the release already handed the resource to us */
+        if (*(volatile LONG *)&Header->SignalState > 0)
+        {
+            InterlockedIncrement((PLONG)&ExpResourceSpinAcquires);
+            return TRUE;
+        }
+
+        /* Every few spins, check that the owner is still running */
+        if (!(i % EXP_RESOURCE_OWNER_CHECK_SPINS))
+        {
+            ExAcquireResourceLock(Resource, &LockHandle);
+            OwnerThread = Resource->OwnerEntry.OwnerThread;
+            OwnerRunning = (OwnerThread) &&
+                           !(OwnerThread & 3) &&
+                           (((PKTHREAD)OwnerThread)->State == Running);
+            ExReleaseResourceLock(Resource, &LockHandle);
+
+            /* Stop if there's no owner thread, only a pointer, or it's not running */
+            if (!OwnerRunning) break;
+        }
+
+        YieldProcessor();
+    }
+
+    /* We'll have to wait */
+    InterlockedIncrement((PLONG)&ExpResourceSpinFailures);
+    return FALSE;
+}
+#endif
+
 /*++
  * @name ExpAllocateExclusiveWaiterEvent
  *
@@ -632,6 +708,16 @@ ExpWaitForResource(IN PERESOURCE Resource,
     /* Increase contention count and use a 5 second timeout */
     Resource->ContentionCount++;
     Timeout.QuadPart = 500 * -10000;
+
+#ifdef CONFIG_SMP
+    /*
+     * Most resources are held for a short time, so spin a bit first. If the
+     * owner releases to us meanwhile, the wait below is satisfied without a
+     * context switch.
+     */
+    if (ExpResourceSpinCount) ExpSpinOnResource(Resource, Object);
+#endif
+
     for (;;)
     {
         /* Wait for ownership */
@@ -729,6 +815,103 @@ ExpWaitForResource(IN PERESOURCE Resource,
     }
 }
 
+/*++
+ * @name ExQuerySystemLockInformation
+ *
+ *     The ExQuerySystemLockInformation routine returns contention data for
+ *     every resource in the system resource list.
+ *
+ * @param LockInformation
+ *        Pointer to a nonpaged buffer that receives the lock information.
+ *
+ * @param LockInformationLength
+ *        Size of the buffer, in bytes.
+ *
+ * @param ReturnLength
+ *        Receives the size needed for the complete list.
+ *
+ * @return STATUS_SUCCESS, or STATUS_INFO_LENGTH_MISMATCH if the buffer is
+ *         too small.
+ *
+ * @remarks The list is walked at DISPATCH_LEVEL, so the buffer must not be
+ *          pageable.
+ *
+ *--*/
+NTSTATUS
+NTAPI
+ExQuerySystemLockInformation(OUT PRTL_PROCESS_LOCKS LockInformation,
+                             IN ULONG LockInformationLength,
+                             OUT PULONG ReturnLength)
+{
+    KLOCK_QUEUE_HANDLE LockHandle, ResourceLockHandle;
+    PLIST_ENTRY ListEntry;
+    PERESOURCE Resource;
+    PRTL_PROCESS_LOCK_INFORMATION LockInfo;
+    ERESOURCE_THREAD OwnerThread;
+    ULONG RequiredLength, NumberOfLocks = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    /* Start with the header */
+    RequiredLength = FIELD_OFFSET(RTL_PROCESS_LOCKS, Locks);
+    if (LockInformationLength < RequiredLength) Status = STATUS_INFO_LENGTH_MISMATCH;
+    LockInfo = LockInformation ? LockInformation->Locks : NULL;
+
+    /* Lock the resource list and loop it */
+    KeAcquireInStackQueuedSpinLock(&ExpResourceSpinLock, &LockHandle);
+    for (ListEntry = ExpSystemResourcesList.Flink;
+         ListEntry != &ExpSystemResourcesList;
+         ListEntry = ListEntry->Flink)
+    {
+        /* Check if this one still fits */
+        RequiredLength += sizeof(RTL_PROCESS_LOCK_INFORMATION);
+        if (RequiredLength > LockInformationLength)
+        {
+            /* It doesn't, keep counting to return the needed size */
+            Status = STATUS_INFO_LENGTH_MISMATCH;
+            continue;
+        }
+
+        /* Get the resource and fill out its data */
+        Resource = CONTAINING_RECORD(ListEntry, ERESOURCE, SystemResourcesList);
+        LockInfo->Address = Resource;
+        LockInfo->Type = RTL_RESOURCE_TYPE;
+        LockInfo->CreatorBackTraceIndex = (USHORT)Resource->CreatorBackTraceIndex;
+        LockInfo->OwnerThreadId = 0;
+        LockInfo->RecursionCount = 0;
+
+        /*
+         * Report the exclusive owner, unless it's an owner pointer. The owner
+         * can't release the resource, and so can't exit, while we hold the
+         * resource lock.
+         */
+        ExAcquireResourceLock(Resource, &ResourceLockHandle);
+        OwnerThread = Resource->OwnerEntry.OwnerThread;
+        if ((IsOwnedExclusive(Resource)) && (OwnerThread) && !(OwnerThread & 3))
+        {
+            LockInfo->OwnerThreadId =
+                HandleToUlong(((PETHREAD)OwnerThread)->Cid.UniqueThread);
+            LockInfo->RecursionCount = Resource->OwnerEntry.OwnerCount;
+        }
+        ExReleaseResourceLock(Resource, &ResourceLockHandle);
+
+        LockInfo->ActiveCount = Resource->ActiveCount;
+        LockInfo->ContentionCount = Resource->ContentionCount;
+        LockInfo->EntryCount = Resource->ActiveEntries;
+        LockInfo->NumberOfSharedWaiters = Resource->NumberOfSharedWaiters;
+        LockInfo->NumberOfExclusiveWaiters = Resource->NumberOfExclusiveWaiters;
+
+        /* Move to the next one */
+        LockInfo++;
+        NumberOfLocks++;
+    }
+    KeReleaseInStackQueuedSpinLock(&LockHandle);
+
+    /* Write the count and the needed size */
+    if (NT_SUCCESS(Status)) LockInformation->NumberOfLocks = NumberOfLocks;
+    *ReturnLength = RequiredLength;
+    return Status;
+}
+
 /* FUNCTIONS *****************************************************************/
 
 /*++
@@ -641,8 +641,8 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->TransitionCount = 0; /* FIXME */
     Spi->CacheTransitionCount = 0; /* FIXME */
     Spi->DemandZeroCount = 0; /* FIXME */
-    Spi->PageReadCount = 0; /* FIXME */
-    Spi->PageReadIoCount = 0; /* FIXME */
+    Spi->PageReadCount = MmPageReadCount;
+    Spi->PageReadIoCount = MmPageReadIoCount;
     Spi->CacheReadCount = 0; /* FIXME */
     Spi->CacheIoCount = 0; /* FIXME */
     Spi->DirtyPagesWriteCount = 0; /* FIXME */
@@ -1149,9 +1149,39 @@ QSI_DEF(SystemModuleInformation)
 /* Class 12 - Locks Information */
 QSI_DEF(SystemLocksInformation)
 {
-    /* FIXME */
-    DPRINT1("NtQuerySystemInformation - SystemLocksInformation not implemented\n");
-    return STATUS_NOT_IMPLEMENTED;
+    _SEH2_VOLATILE PRTL_PROCESS_LOCKS LockInformation;
+    ULONG BufferSize;
+    NTSTATUS Status;
+
+    /* Get the size the current resources need, and fail if the caller can't hold it */
+    ExQuerySystemLockInformation(NULL, 0, ReqSize);
+    if (Size < *ReqSize) return STATUS_INFO_LENGTH_MISMATCH;
+
+    /*
+     * The resource list is walked at DISPATCH_LEVEL, use a nonpaged buffer.
+     * Its size comes from the resource count and not from the caller, with
+     * some room for the resources created in the meantime.
+     */
+    BufferSize = min(Size, *ReqSize + 16 * sizeof(RTL_PROCESS_LOCK_INFORMATION));
+    LockInformation = ExAllocatePoolWithTag(NonPagedPool, BufferSize, 'kLxE');
+    if (!LockInformation) return STATUS_INSUFFICIENT_RESOURCES;
+
+    _SEH2_TRY
+    {
+        /*
+         * Query the resources and copy them to the caller. If more were created
+         * than we left room for, the caller retries with the returned size.
+         */
+        Status = ExQuerySystemLockInformation(LockInformation, BufferSize, ReqSize);
+        if (NT_SUCCESS(Status)) RtlCopyMemory(Buffer, LockInformation, *ReqSize);
+    }
+    _SEH2_FINALLY
+    {
+        ExFreePoolWithTag(LockInformation, 'kLxE');
+    }
+    _SEH2_END;
+
+    return Status;
 }
 
 /* Class 13 - Stack Trace Information */
@@ -2055,10 +2085,12 @@ QSI_DEF(SystemLookasideInformation)
     }
 
     /* Copy info from pool lookaside lists */
+    KeAcquireSpinLock(&ExpPoolLookasideListLock, &OldIrql);
     ExpCopyLookasideInformation(&Info,
                                 &Remaining,
                                 &ExPoolLookasideListHead,
                                 FALSE);
+    KeReleaseSpinLock(&ExpPoolLookasideListLock, OldIrql);
     if (Remaining == 0)
     {
         goto Leave;
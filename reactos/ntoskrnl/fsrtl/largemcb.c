@@ -510,44 +510,92 @@ FsRtlLookupBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
     OUT PULONG Index OPTIONAL)
 {
     BOOLEAN Result = FALSE;
-    ULONG i;
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    PLARGE_MCB_MAPPING_ENTRY Run;
+    LARGE_MCB_MAPPING_ENTRY NeedleRun;
+    ULONG i = 0;
     LONGLONG LastVbn = 0, LastLbn = 0, Count = 0;   // the last values we've found during traversal
 
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p)\n", OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index);
 
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &LastVbn, &LastLbn, &Count); i++)
+    // a mapped run can be found in the tree directly, only its index needs a traversal
+    if (Index == NULL)
     {
-        // have we reached the target mapping?
-        if (Vbn < LastVbn + Count)
+        NeedleRun.RunStartVbn.QuadPart = Vbn;
+        NeedleRun.RunEndVbn.QuadPart = Vbn + 1;
+        NeedleRun.StartingLbn.QuadPart = ~0ULL;
+        Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
+        Run = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun);
+        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
+
+        if (Run)
         {
-            if (Lbn)
+            LastVbn = Run->RunStartVbn.QuadPart;
+            LastLbn = Run->StartingLbn.QuadPart;
+            Count = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+            Result = TRUE;
+        }
+    }
+
+    // otherwise walk the runs and the holes between them, once and in order
+    for (Run = (Result ? NULL : (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE));
+         Run;
+         Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
+    {
+        // is there a hole before this run?
+        if (Run->RunStartVbn.QuadPart > LastVbn + Count)
+        {
+            LastVbn = LastVbn + Count;
+            LastLbn = -1;
+            Count = Run->RunStartVbn.QuadPart - LastVbn;
+            if (Vbn < LastVbn + Count)
             {
-                if (LastLbn == -1)
-                    *Lbn = -1;
-                else
-                    *Lbn = LastLbn + (Vbn - LastVbn);
+                Result = TRUE;
+                break;
             }
+            i++;
+        }
 
-            if (SectorCountFromLbn)
-                *SectorCountFromLbn = LastVbn + Count - Vbn;
-            if (StartingLbn)
-                *StartingLbn = LastLbn;
-            if (SectorCountFromStartingLbn)
-                *SectorCountFromStartingLbn = LastVbn + Count - LastVbn;
-            if (Index)
-                *Index = i;
+        LastVbn = Run->RunStartVbn.QuadPart;
+        LastLbn = Run->StartingLbn.QuadPart;
+        Count = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
 
+        // have we reached the target mapping?
+        if (Vbn < LastVbn + Count)
+        {
             Result = TRUE;
-            goto quit;
+            break;
         }
+        i++;
     }
 
-    if (Lbn)
-        *Lbn = -1;
-    if (StartingLbn)
-        *StartingLbn = -1;
+    if (Result)
+    {
+        if (Lbn)
+        {
+            if (LastLbn == -1)
+                *Lbn = -1;
+            else
+                *Lbn = LastLbn + (Vbn - LastVbn);
+        }
+
+        if (SectorCountFromLbn)
+            *SectorCountFromLbn = LastVbn + Count - Vbn;
+        if (StartingLbn)
+            *StartingLbn = LastLbn;
+        if (SectorCountFromStartingLbn)
+            *SectorCountFromStartingLbn = LastVbn + Count - LastVbn;
+        if (Index)
+            *Index = i;
+    }
+    else
+    {
+        if (Lbn)
+            *Lbn = -1;
+        if (StartingLbn)
+            *StartingLbn = -1;
+    }
 
-quit:
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p) = %d (%I64d, %I64d, %I64d, %I64d, %d)\n",
            OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index, Result,
            (Lbn ? *Lbn : (ULONGLONG)-1), (SectorCountFromLbn ? *SectorCountFromLbn : (ULONGLONG)-1), (StartingLbn ? *StartingLbn : (ULONGLONG)-1),
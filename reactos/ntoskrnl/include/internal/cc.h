@@ -154,6 +154,16 @@ typedef struct _ROS_SHARED_CACHE_MAP
     PVOID LazyWriteContext;
     KSPIN_LOCK CacheMapLock;
     ULONG OpenCount;
+    /* Read ahead state, protected by CacheMapLock */
+    LONGLONG LastReadEnd;
+    LONGLONG ReadAheadEnd;
+    LONGLONG ReadAheadOffset;
+    ULONG ReadAheadLength;
+    ULONG ReadAheadGranularity;
+    BOOLEAN ReadAheadActive;
+    BOOLEAN DisableReadAhead;
+    BOOLEAN DisableWriteBehind;
+    WORK_QUEUE_ITEM ReadAheadWorkItem;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
@@ -192,6 +202,28 @@ typedef struct _ROS_VACB
     /* Pointer to the next VACB in a chain. */
 } ROS_VACB, *PROS_VACB;
 
+typedef struct _DEFERRED_WRITE
+{
+    /* Entry in CcDeferredWrites */
+    LIST_ENTRY DeferredWriteLinks;
+    PFILE_OBJECT FileObject;
+    ULONG BytesToWrite;
+    /* Set for a waiting CcCanIWrite caller, otherwise the post routine is called */
+    PKEVENT Event;
+    PCC_POST_DEFERRED_WRITE PostRoutine;
+    PVOID Context1;
+    PVOID Context2;
+} DEFERRED_WRITE, *PDEFERRED_WRITE;
+
+//
+// Maximum number of views read or written with a single paging I/O
+//
+#define CC_MAX_CLUSTER_VIEWS                            4
+
+extern LIST_ENTRY CcDeferredWrites;
+extern KSPIN_LOCK CcDeferredWriteSpinLock;
+extern ULONG CcDirtyPageThreshold;
+
 typedef struct _INTERNAL_BCB
 {
     /* Lock */
@@ -251,6 +283,26 @@ NTSTATUS
 NTAPI
 CcWriteVirtualAddress(PROS_VACB Vacb);
 
+NTSTATUS
+NTAPI
+CcReadVacbCluster(
+    PROS_VACB *Vacbs,
+    ULONG Count
+);
+
+NTSTATUS
+NTAPI
+CcWriteVacbCluster(
+    PROS_VACB *Vacbs,
+    ULONG Count
+);
+
+VOID
+NTAPI
+CcPostDeferredWrites(
+    BOOLEAN Force
+);
+
 BOOLEAN
 NTAPI
 CcInitializeCacheManager(VOID);
@@ -286,7 +338,8 @@ NTAPI
 CcRosFlushDirtyPages(
     ULONG Target,
     PULONG Count,
-    BOOLEAN Wait
+    BOOLEAN Wait,
+    BOOLEAN CalledFromLazy
 );
 
 VOID
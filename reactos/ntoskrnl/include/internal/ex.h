@@ -28,6 +28,7 @@ extern LIST_ENTRY ExpNonPagedLookasideListHead;
 extern LIST_ENTRY ExpPagedLookasideListHead;
 extern KSPIN_LOCK ExpNonPagedLookasideListLock;
 extern KSPIN_LOCK ExpPagedLookasideListLock;
+extern KSPIN_LOCK ExpPoolLookasideListLock;
 
 /*
  * NT/Cm Version Info variables
@@ -253,10 +254,26 @@ VOID
 NTAPI
 ExpResourceInitialization(VOID);
 
+NTSTATUS
+NTAPI
+ExQuerySystemLockInformation(
+    OUT PRTL_PROCESS_LOCKS LockInformation,
+    IN ULONG LockInformationLength,
+    OUT PULONG ReturnLength
+);
+
 VOID
 NTAPI
 ExInitPoolLookasidePointers(VOID);
 
+VOID
+NTAPI
+ExpInitPerProcessorPoolLookasides(VOID);
+
+VOID
+NTAPI
+ExAdjustLookasideDepth(VOID);
+
 /* Callback Functions ********************************************************/
 
 VOID
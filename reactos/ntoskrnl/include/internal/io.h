@@ -92,6 +92,18 @@
 #define IOP_USE_TOP_LEVEL_DEVICE_HINT       0x01
 #define IOP_CREATE_FILE_OBJECT_EXTENSION    0x02
 
+//
+// Max completion packets NtRemoveIoCompletionEx takes from the queue at once
+//
+#define IOP_MAX_COMPLETION_BATCH            16
+
+//
+// Windows 2003 SP2 information class, our headers only know it from Vista on
+//
+#if (NTDDI_VERSION < NTDDI_VISTA)
+#define FileIoCompletionNotificationInformation ((FILE_INFORMATION_CLASS)41)
+#endif
+
 
 typedef struct _FILE_OBJECT_EXTENSION
 {
@@ -1263,6 +1275,16 @@ IoSetIoCompletion(
     IN BOOLEAN Quota 
 );
 
+NTSTATUS
+NTAPI
+IopSetCompletionNotificationModes(
+    IN HANDLE FileHandle,
+    OUT PIO_STATUS_BLOCK IoStatusBlock,
+    IN PVOID FileInformation,
+    IN ULONG Length,
+    IN KPROCESSOR_MODE PreviousMode
+);
+
 //
 // Ramdisk Routines
 //
@@ -55,6 +55,7 @@ typedef struct _KI_SAMPLE_MAP
 } KI_SAMPLE_MAP, *PKI_SAMPLE_MAP;
 
 #define MAX_TIMER_DPCS                      16
+#define KI_TIMER_COALESCING_WINDOWS         4
 
 typedef struct _DPC_QUEUE_ENTRY
 {
@@ -71,6 +72,16 @@ typedef struct _KNMI_HANDLER_CALLBACK
     PVOID Handle;
 } KNMI_HANDLER_CALLBACK, *PKNMI_HANDLER_CALLBACK;
 
+typedef struct _KI_SCHEDULER_COUNTERS
+{
+    ULONG IdleDispatches;
+    ULONG RemoteDispatches;
+    ULONG Migrations;
+    ULONG IdleSchedules;
+    ULONG ThreadsStolen;
+    ULONG StealFailures;
+} KI_SCHEDULER_COUNTERS, *PKI_SCHEDULER_COUNTERS;
+
 typedef PCHAR
 (NTAPI *PKE_BUGCHECK_UNICODE_TO_ANSI)(
     IN PUNICODE_STRING Unicode,
@@ -117,6 +128,7 @@ extern LIST_ENTRY KeBugcheckCallbackListHead, KeBugcheckReasonCallbackListHead;
 extern KSPIN_LOCK BugCheckCallbackLock;
 extern KDPC KiTimerExpireDpc;
 extern KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+extern const ULONG KiTimerCoalescingWindows[KI_TIMER_COALESCING_WINDOWS];
 extern FAST_MUTEX KiGenericCallDpcMutex;
 extern LIST_ENTRY KiProfileListHead, KiProfileSourceListHead;
 extern KSPIN_LOCK KiProfileLock;
@@ -127,6 +139,7 @@ extern KEVENT KiSwapEvent;
 extern PKPRCB KiProcessorBlock[];
 extern ULONG KiMask32Array[MAXIMUM_PRIORITY];
 extern ULONG_PTR KiIdleSummary;
+extern KI_SCHEDULER_COUNTERS KiSchedulerCounters[MAXIMUM_PROCESSORS];
 extern PVOID KeUserApcDispatcher;
 extern PVOID KeUserCallbackDispatcher;
 extern PVOID KeUserExceptionDispatcher;
@@ -286,6 +299,18 @@ KiInsertTreeTimer(
     IN LARGE_INTEGER Interval
 );
 
+#if (NTDDI_VERSION < NTDDI_WIN7)
+BOOLEAN
+NTAPI
+KeSetCoalescableTimer(
+    IN OUT PKTIMER Timer,
+    IN LARGE_INTEGER DueTime,
+    IN ULONG Period,
+    IN ULONG TolerableDelay,
+    IN PKDPC Dpc OPTIONAL
+);
+#endif
+
 VOID
 FASTCALL
 KiCompleteTimer(
@@ -705,6 +730,17 @@ VOID
 FASTCALL
 KiActivateWaiterQueue(IN PKQUEUE Queue);
 
+ULONG
+NTAPI
+KeRemoveQueueEx(
+    IN PKQUEUE Queue,
+    IN KPROCESSOR_MODE WaitMode,
+    IN BOOLEAN Alertable,
+    IN PLARGE_INTEGER Timeout OPTIONAL,
+    OUT PLIST_ENTRY *EntryArray,
+    IN ULONG Count
+);
+
 ULONG
 NTAPI
 KeQueryRuntimeProcess(IN PKPROCESS Process,
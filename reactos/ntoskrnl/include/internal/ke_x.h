@@ -875,6 +875,23 @@ KiComputeTimerTableIndex(IN ULONGLONG DueTime)
     return (DueTime / KeMaximumIncrement) & (TIMER_TABLE_SIZE - 1);
 }
 
+//
+// Rounds the due time of a coalescable timer up to the end of its coalescing
+// window, so that all timers sharing the window land in the same timer table
+// entry and are expired together by a single clock DPC pass.
+//
+FORCEINLINE
+ULONGLONG
+KiCoalesceDueTime(IN ULONGLONG DueTime,
+                  IN ULONG Window)
+{
+    ULONGLONG Granularity;
+
+    ASSERT(Window < KI_TIMER_COALESCING_WINDOWS);
+    Granularity = (ULONGLONG)KiTimerCoalescingWindows[Window] * 10000;
+    return ((DueTime + Granularity - 1) / Granularity) * Granularity;
+}
+
 //
 // Called from KiCompleteTimer, KiInsertTreeTimer, KeSetSystemTime
 // to remove timer entries
@@ -978,6 +995,14 @@ KiComputeDueTime(IN PKTIMER Timer,
     /* Recalculate due time */
     Timer->DueTime.QuadPart = InterruptTime.QuadPart - DueTime.QuadPart;
 
+    /* Batch coalescable timers with their neighbours */
+    if (Timer->Header.Coalescable)
+    {
+        Timer->DueTime.QuadPart =
+            KiCoalesceDueTime(Timer->DueTime.QuadPart,
+                              Timer->Header.EncodedTolerableDelay);
+    }
+
     /* Get the handle */
     *Hand = KiComputeTimerTableIndex(Timer->DueTime.QuadPart);
     Timer->Header.Hand = (UCHAR)*Hand;
@@ -1231,7 +1256,7 @@ KxSetTimerForThreadWait(IN PKTIMER Timer,
     }                                                                       \
                                                                             \
     /* Set wait settings */                                                 \
-    Thread->Alertable = FALSE;                                              \
+    Thread->Alertable = Alertable;                                          \
     Thread->WaitMode = WaitMode;                                            \
     Thread->WaitReason = WrQueue;                                           \
                                                                             \
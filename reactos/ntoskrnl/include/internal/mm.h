@@ -40,11 +40,20 @@ extern SIZE_T MmtotalCommitLimitMaximum;
 extern PVOID MiDebugMapping; // internal
 extern PMMPTE MmDebugPte; // internal
 
+extern ULONG MmPageFaultClusterSize;
+extern ULONG MmPageReadCount;
+extern ULONG MmPageReadIoCount;
+
 struct _KTRAP_FRAME;
 struct _EPROCESS;
 struct _MM_RMAP_ENTRY;
 typedef ULONG_PTR SWAPENTRY;
 
+//
+// Maximum number of pages brought in by a single page fault
+//
+#define MI_MAXIMUM_FAULT_CLUSTER    16
+
 //
 // MmDbgCopyMemory Flags
 //
@@ -641,6 +650,14 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset);
 
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
 /* process.c ****************************************************************/
 
 NTSTATUS
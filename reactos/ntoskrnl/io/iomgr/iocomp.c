@@ -95,6 +95,132 @@ IopFreeMiniPacket(PIOP_MINI_COMPLETION_PACKET Packet)
     InterlockedPushEntrySList(&List->L.ListHead, (PSLIST_ENTRY)Packet);
 }
 
+/*
+ * Returns the data of a packet removed from the queue, and frees the packet
+ */
+static
+VOID
+IopRetrieveCompletionPacket(IN PLIST_ENTRY ListEntry,
+                            OUT PFILE_IO_COMPLETION_INFORMATION Information)
+{
+    PIOP_MINI_COMPLETION_PACKET Packet;
+    PIRP Irp;
+
+    /* Get the Packet Data */
+    Packet = CONTAINING_RECORD(ListEntry,
+                               IOP_MINI_COMPLETION_PACKET,
+                               ListEntry);
+
+    /* Check if this is piggybacked on an IRP */
+    if (Packet->PacketType == IopCompletionPacketIrp)
+    {
+        /* Get the IRP */
+        Irp = CONTAINING_RECORD(ListEntry,
+                                IRP,
+                                Tail.Overlay.ListEntry);
+
+        /* Save values */
+        Information->KeyContext = Irp->Tail.CompletionKey;
+        Information->ApcContext = Irp->Overlay.AsynchronousParameters.UserApcContext;
+        Information->IoStatusBlock = Irp->IoStatus;
+
+        /* Free the IRP */
+        IoFreeIrp(Irp);
+    }
+    else
+    {
+        /* Save values */
+        Information->KeyContext = Packet->KeyContext;
+        Information->ApcContext = Packet->ApcContext;
+        Information->IoStatusBlock.Status = Packet->IoStatus;
+        Information->IoStatusBlock.Information = Packet->IoStatusInformation;
+
+        /* Free the packet */
+        IopFreeMiniPacket(Packet);
+    }
+}
+
+NTSTATUS
+NTAPI
+IopSetCompletionNotificationModes(IN HANDLE FileHandle,
+                                  OUT PIO_STATUS_BLOCK IoStatusBlock,
+                                  IN PVOID FileInformation,
+                                  IN ULONG Length,
+                                  IN KPROCESSOR_MODE PreviousMode)
+{
+    PFILE_OBJECT FileObject;
+    ULONG Flags;
+    NTSTATUS Status;
+    PAGED_CODE();
+
+    /* Validate the length */
+    if (Length < sizeof(FILE_IO_COMPLETION_NOTIFICATION_INFORMATION))
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    /* Enter SEH for probing and capturing the flags */
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode)
+        {
+            ProbeForWriteIoStatusBlock(IoStatusBlock);
+            ProbeForRead(FileInformation, Length, sizeof(ULONG));
+        }
+
+        Flags = ((PFILE_IO_COMPLETION_NOTIFICATION_INFORMATION)FileInformation)->Flags;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Return the exception code */
+        _SEH2_YIELD(return _SEH2_GetExceptionCode());
+    }
+    _SEH2_END;
+
+    /* Check for unknown flags */
+    if (Flags & ~(FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+                  FILE_SKIP_SET_EVENT_ON_HANDLE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Reference the Handle */
+    Status = ObReferenceObjectByHandle(FileHandle,
+                                       0,
+                                       IoFileObjectType,
+                                       PreviousMode,
+                                       (PVOID*)&FileObject,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* The modes can only be turned on, never back off */
+    if (Flags & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)
+    {
+        InterlockedOr((PLONG)&FileObject->Flags, FO_SKIP_COMPLETION_PORT);
+    }
+    if (Flags & FILE_SKIP_SET_EVENT_ON_HANDLE)
+    {
+        InterlockedOr((PLONG)&FileObject->Flags, FO_SKIP_SET_EVENT);
+    }
+    ObDereferenceObject(FileObject);
+
+    /* Protect write in SEH */
+    _SEH2_TRY
+    {
+        /* Fill out the I/O Status Block */
+        IoStatusBlock->Information = 0;
+        IoStatusBlock->Status = STATUS_SUCCESS;
+    }
+    _SEH2_EXCEPT(ExSystemExceptionFilter())
+    {
+        /* Get the exception code */
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
 VOID
 NTAPI
 IopDeleteIoCompletion(PVOID ObjectBody)
@@ -449,13 +575,10 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
 {
     LARGE_INTEGER SafeTimeout;
     PKQUEUE Queue;
-    PIOP_MINI_COMPLETION_PACKET Packet;
     PLIST_ENTRY ListEntry;
     KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
     NTSTATUS Status;
-    PIRP Irp;
-    PVOID Apc, Key;
-    IO_STATUS_BLOCK IoStatus;
+    FILE_IO_COMPLETION_INFORMATION Information;
     PAGED_CODE();
 
     /* Check if the call was from user mode */
@@ -506,46 +629,16 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
         }
         else
         {
-            /* Get the Packet Data */
-            Packet = CONTAINING_RECORD(ListEntry,
-                                       IOP_MINI_COMPLETION_PACKET,
-                                       ListEntry);
-
-            /* Check if this is piggybacked on an IRP */
-            if (Packet->PacketType == IopCompletionPacketIrp)
-            {
-                /* Get the IRP */
-                Irp = CONTAINING_RECORD(ListEntry,
-                                        IRP,
-                                        Tail.Overlay.ListEntry);
-
-                /* Save values */
-                Key = Irp->Tail.CompletionKey;
-                Apc = Irp->Overlay.AsynchronousParameters.UserApcContext;
-                IoStatus = Irp->IoStatus;
-
-                /* Free the IRP */
-                IoFreeIrp(Irp);
-            }
-            else
-            {
-                /* Save values */
-                Key = Packet->KeyContext;
-                Apc = Packet->ApcContext;
-                IoStatus.Status = Packet->IoStatus;
-                IoStatus.Information = Packet->IoStatusInformation;
-
-                /* Free the packet */
-                IopFreeMiniPacket(Packet);
-            }
+            /* Get the values and free the packet */
+            IopRetrieveCompletionPacket(ListEntry, &Information);
 
             /* Enter SEH to write back the values */
             _SEH2_TRY
             {
                 /* Write the values to caller */
-                *ApcContext = Apc;
-                *KeyContext = Key;
-                *IoStatusBlock = IoStatus;
+                *ApcContext = Information.ApcContext;
+                *KeyContext = Information.KeyContext;
+                *IoStatusBlock = Information.IoStatusBlock;
             }
             _SEH2_EXCEPT(ExSystemExceptionFilter())
             {
@@ -563,6 +656,129 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
     return Status;
 }
 
+NTSTATUS
+NTAPI
+NtRemoveIoCompletionEx(IN HANDLE IoCompletionHandle,
+                       OUT PFILE_IO_COMPLETION_INFORMATION IoCompletionInformation,
+                       IN ULONG Count,
+                       OUT PULONG NumEntriesRemoved,
+                       IN PLARGE_INTEGER Timeout OPTIONAL,
+                       IN BOOLEAN Alertable)
+{
+    LARGE_INTEGER SafeTimeout;
+    PKQUEUE Queue;
+    PLIST_ENTRY EntryArray[IOP_MAX_COMPLETION_BATCH];
+    FILE_IO_COMPLETION_INFORMATION Information[IOP_MAX_COMPLETION_BATCH];
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    NTSTATUS Status;
+    ULONG Removed, Total = 0, i;
+    PAGED_CODE();
+
+    /* Validate the count */
+    if ((Count == 0) ||
+        (Count > MAXULONG / sizeof(FILE_IO_COMPLETION_INFORMATION)))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Check if the call was from user mode */
+    if (PreviousMode != KernelMode)
+    {
+        /* Protect probes in SEH */
+        _SEH2_TRY
+        {
+            /* Probe the output array and count */
+            ProbeForWrite(IoCompletionInformation,
+                          Count * sizeof(FILE_IO_COMPLETION_INFORMATION),
+                          sizeof(PVOID));
+            ProbeForWriteUlong(NumEntriesRemoved);
+            if (Timeout)
+            {
+                /* Probe and capture the timeout */
+                SafeTimeout = ProbeForReadLargeInteger(Timeout);
+                Timeout = &SafeTimeout;
+            }
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* Return the exception code */
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* Open the Object */
+    Status = ObReferenceObjectByHandle(IoCompletionHandle,
+                                       IO_COMPLETION_MODIFY_STATE,
+                                       IoCompletionType,
+                                       PreviousMode,
+                                       (PVOID*)&Queue,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Take the packets in batches, only the first one waits */
+    do
+    {
+        Removed = KeRemoveQueueEx(Queue,
+                                  PreviousMode,
+                                  Alertable,
+                                  Timeout,
+                                  EntryArray,
+                                  min(Count - Total, IOP_MAX_COMPLETION_BATCH));
+        if (Removed == 0)
+        {
+            /* Timeout, user APC or alert. Only report it if we got nothing */
+            if (Total == 0) Status = (NTSTATUS)(ULONG_PTR)EntryArray[0];
+            break;
+        }
+
+        /* Get the values and free the packets */
+        for (i = 0; i < Removed; i++)
+        {
+            IopRetrieveCompletionPacket(EntryArray[i], &Information[i]);
+        }
+
+        /* Enter SEH to write back the values */
+        _SEH2_TRY
+        {
+            RtlCopyMemory(&IoCompletionInformation[Total],
+                          Information,
+                          Removed * sizeof(FILE_IO_COMPLETION_INFORMATION));
+        }
+        _SEH2_EXCEPT(ExSystemExceptionFilter())
+        {
+            /* Get the exception code */
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        Total += Removed;
+        if (!NT_SUCCESS(Status)) break;
+
+        /* Whatever is left must already be there */
+        SafeTimeout.QuadPart = 0;
+        Timeout = &SafeTimeout;
+    } while ((Removed == IOP_MAX_COMPLETION_BATCH) && (Total < Count));
+
+    /* Dereference the Object */
+    ObDereferenceObject(Queue);
+
+    /* Enter SEH to write back the count */
+    _SEH2_TRY
+    {
+        *NumEntriesRemoved = Total;
+    }
+    _SEH2_EXCEPT(ExSystemExceptionFilter())
+    {
+        /* Get the exception code */
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    /* Return status */
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 NtSetIoCompletion(IN HANDLE IoCompletionPortHandle,
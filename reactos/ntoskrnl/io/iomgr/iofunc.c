@@ -434,8 +434,10 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
                     IopUnlockFileObject(FileObject);
                 }
 
-                /* Set completion if required */
-                if (CompletionInfo.Port != NULL && UserApcContext != NULL)
+                /* Set completion if required, fast I/O is a synchronous success */
+                if (CompletionInfo.Port != NULL && UserApcContext != NULL &&
+                    !((FileObject->Flags & FO_SKIP_COMPLETION_PORT) &&
+                      NT_SUCCESS(KernelIosb.Status)))
                 {
                     if (!NT_SUCCESS(IoSetIoCompletion(CompletionInfo.Port,
                                                       CompletionInfo.Key,
@@ -1716,8 +1718,10 @@ NtLockFile(IN HANDLE FileHandle,
                 ObDereferenceObject(Event);
             }
 
-            /* Set completion if required */
-            if (FileObject->CompletionContext != NULL && ApcContext != NULL)
+            /* Set completion if required, fast I/O is a synchronous success */
+            if (FileObject->CompletionContext != NULL && ApcContext != NULL &&
+                !((FileObject->Flags & FO_SKIP_COMPLETION_PORT) &&
+                  NT_SUCCESS(KernelIosb.Status)))
             {
                 if (!NT_SUCCESS(IoSetIoCompletion(FileObject->CompletionContext->Port,
                                                   FileObject->CompletionContext->Key,
@@ -2840,6 +2844,16 @@ NtSetInformationFile(IN HANDLE FileHandle,
     PAGED_CODE();
     IOTRACE(IO_API_DEBUG, "FileHandle: %p\n", FileHandle);
 
+    /* The completion modes are kept in the file object, the driver isn't involved */
+    if (FileInformationClass == FileIoCompletionNotificationInformation)
+    {
+        return IopSetCompletionNotificationModes(FileHandle,
+                                                 IoStatusBlock,
+                                                 FileInformation,
+                                                 Length,
+                                                 PreviousMode);
+    }
+
     /* Check if we're called from user mode */
     if (PreviousMode != KernelMode)
     {
@@ -62,6 +62,44 @@ KiActivateWaiterQueue(IN PKQUEUE Queue)
     }
 }
 
+/*
+ * Moves up to Count queued entries to the array, without waiting.
+ * Must be called with the dispatcher lock held.
+ */
+static
+ULONG
+KiRemoveQueueEntries(IN PKQUEUE Queue,
+                     OUT PLIST_ENTRY *EntryArray,
+                     IN ULONG Count)
+{
+    PLIST_ENTRY QueueEntry;
+    ULONG Removed = 0;
+
+    while ((Removed < Count) && !IsListEmpty(&Queue->EntryListHead))
+    {
+        /* Check if the entry is valid. If not, bugcheck */
+        QueueEntry = Queue->EntryListHead.Flink;
+        if (!(QueueEntry->Flink) || !(QueueEntry->Blink))
+        {
+            /* Invalid item */
+            KeBugCheckEx(INVALID_WORK_QUEUE_ITEM,
+                         (ULONG_PTR)QueueEntry,
+                         (ULONG_PTR)Queue,
+                         (ULONG_PTR)NULL,
+                         (ULONG_PTR)((PWORK_QUEUE_ITEM)QueueEntry)->
+                                     WorkerRoutine);
+        }
+
+        /* Remove the Entry and decrease the number of entries */
+        RemoveEntryList(QueueEntry);
+        QueueEntry->Flink = NULL;
+        Queue->Header.SignalState--;
+        EntryArray[Removed++] = QueueEntry;
+    }
+
+    return Removed;
+}
+
 /*
  * Returns the previous number of entries in the queue
  */
@@ -231,16 +269,25 @@ KeReadStateQueue(IN PKQUEUE Queue)
 }
 
 /*
- * @implemented
+ * Removes up to Count entries from the queue, waiting for the first one only.
+ * Returns the number of entries removed. If the wait ended without an entry,
+ * zero is returned and the first element of the array holds the wait status,
+ * just like what KeRemoveQueue returns.
  */
-PLIST_ENTRY
+ULONG
 NTAPI
-KeRemoveQueue(IN PKQUEUE Queue,
-              IN KPROCESSOR_MODE WaitMode,
-              IN PLARGE_INTEGER Timeout OPTIONAL)
+KeRemoveQueueEx(IN PKQUEUE Queue,
+                IN KPROCESSOR_MODE WaitMode,
+                IN BOOLEAN Alertable,
+                IN PLARGE_INTEGER Timeout OPTIONAL,
+                OUT PLIST_ENTRY *EntryArray,
+                IN ULONG Count)
 {
     PLIST_ENTRY QueueEntry;
     LONG_PTR Status;
+    NTSTATUS WaitStatus;
+    ULONG Removed = 0;
+    KIRQL OldIrql;
     PKTHREAD Thread = KeGetCurrentThread();
     PKQUEUE PreviousQueue;
     PKWAIT_BLOCK WaitBlock = &Thread->WaitBlock[0];
@@ -252,6 +299,7 @@ KeRemoveQueue(IN PKQUEUE Queue,
     ULONG Hand = 0;
     ASSERT_QUEUE(Queue);
     ASSERT_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
+    ASSERT(Count != 0);
 
     /* Check if the Lock is already held */
     if (Thread->WaitNext)
@@ -306,29 +354,11 @@ KeRemoveQueue(IN PKQUEUE Queue,
         if ((Queue->CurrentCount < Queue->MaximumCount) &&
             (QueueEntry != &Queue->EntryListHead))
         {
-            /* Decrease the number of entries */
-            Queue->Header.SignalState--;
-
             /* Increase numbef of running threads */
             Queue->CurrentCount++;
 
-            /* Check if the entry is valid. If not, bugcheck */
-            if (!(QueueEntry->Flink) || !(QueueEntry->Blink))
-            {
-                /* Invalid item */
-                KeBugCheckEx(INVALID_WORK_QUEUE_ITEM,
-                             (ULONG_PTR)QueueEntry,
-                             (ULONG_PTR)Queue,
-                             (ULONG_PTR)NULL,
-                             (ULONG_PTR)((PWORK_QUEUE_ITEM)QueueEntry)->
-                                         WorkerRoutine);
-            }
-
-            /* Remove the Entry */
-            RemoveEntryList(QueueEntry);
-            QueueEntry->Flink = NULL;
-
-            /* Nothing to wait on */
+            /* Take the entries, nothing to wait on */
+            Removed = KiRemoveQueueEntries(Queue, EntryArray, Count);
             break;
         }
         else
@@ -344,12 +374,12 @@ KeRemoveQueue(IN PKQUEUE Queue,
             }
             else
             {
-                /* Fail if there's a User APC Pending */
-                if ((WaitMode != KernelMode) &&
-                    (Thread->ApcState.UserApcPending))
+                /* Fail if there's a User APC Pending or we were alerted */
+                WaitStatus = KiCheckAlertability(Thread, Alertable, WaitMode);
+                if (WaitStatus != STATUS_WAIT_0)
                 {
                     /* Return the status and increase the pending threads */
-                    QueueEntry = (PLIST_ENTRY)STATUS_USER_APC;
+                    EntryArray[0] = (PLIST_ENTRY)(LONG_PTR)WaitStatus;
                     Queue->CurrentCount++;
                     break;
                 }
@@ -362,7 +392,7 @@ KeRemoveQueue(IN PKQUEUE Queue,
                     if ((ULONG64)InterruptTime.QuadPart >= Timer->DueTime.QuadPart)
                     {
                         /* It did, so we don't need to wait */
-                        QueueEntry = (PLIST_ENTRY)STATUS_TIMEOUT;
+                        EntryArray[0] = (PLIST_ENTRY)STATUS_TIMEOUT;
                         Queue->CurrentCount++;
                         break;
                     }
@@ -404,7 +434,29 @@ KeRemoveQueue(IN PKQUEUE Queue,
                 Thread->WaitReason = 0;
 
                 /* Check if we were executing an APC */
-                if (Status != STATUS_KERNEL_APC) return (PLIST_ENTRY)Status;
+                if (Status != STATUS_KERNEL_APC)
+                {
+                    /* We got either an entry or the wait status */
+                    EntryArray[0] = (PLIST_ENTRY)Status;
+                    if ((Status == STATUS_TIMEOUT) ||
+                        (Status == STATUS_USER_APC) ||
+                        (Status == STATUS_ALERTED))
+                    {
+                        return 0;
+                    }
+
+                    /* Also take the entries which were queued meanwhile */
+                    Removed = 1;
+                    if (Count > 1)
+                    {
+                        OldIrql = KiAcquireDispatcherLock();
+                        Removed += KiRemoveQueueEntries(Queue,
+                                                        EntryArray + 1,
+                                                        Count - 1);
+                        KiReleaseDispatcherLock(OldIrql);
+                    }
+                    return Removed;
+                }
 
                 /* Check if we had a timeout */
                 if (Timeout)
@@ -427,6 +479,22 @@ KeRemoveQueue(IN PKQUEUE Queue,
     /* Unlock Database and return */
     KiReleaseDispatcherLockFromDpcLevel();
     KiExitDispatcher(Thread->WaitIrql);
+    return Removed;
+}
+
+/*
+ * @implemented
+ */
+PLIST_ENTRY
+NTAPI
+KeRemoveQueue(IN PKQUEUE Queue,
+              IN KPROCESSOR_MODE WaitMode,
+              IN PLARGE_INTEGER Timeout OPTIONAL)
+{
+    PLIST_ENTRY QueueEntry;
+
+    /* Remove a single entry, which is the wait status if there was none */
+    KeRemoveQueueEx(Queue, WaitMode, FALSE, Timeout, &QueueEntry, 1);
     return QueueEntry;
 }
 
@@ -15,9 +15,13 @@
 #ifdef _WIN64
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr64((PLONG64)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, ~(SetMember));
 #else
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr((PLONG)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, ~(SetMember));
 #endif
 
 /* GLOBALS *******************************************************************/
@@ -25,15 +29,198 @@
 ULONG_PTR KiIdleSummary;
 ULONG_PTR KiIdleSMTSummary;
 
+/* Scheduler trace counters, each slot is only written by its own processor */
+KI_SCHEDULER_COUNTERS KiSchedulerCounters[MAXIMUM_PROCESSORS];
+
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+static
+ULONG
+KiSelectReadyProcessor(IN PKTHREAD Thread)
+{
+    KAFFINITY Affinity, IdleSet;
+
+    /* Only consider the processors this thread is allowed to run on */
+    Affinity = Thread->Affinity & KeActiveProcessors;
+    ASSERT(Affinity != 0);
+
+    /* Check if any of them is idle */
+    IdleSet = KiIdleSummary & Affinity;
+    if (IdleSet)
+    {
+        /* Prefer the ideal processor, then the last one the thread ran on */
+        if (IdleSet & AFFINITY_MASK(Thread->IdealProcessor))
+            return Thread->IdealProcessor;
+        if (IdleSet & AFFINITY_MASK(Thread->NextProcessor))
+            return Thread->NextProcessor;
+
+        /* Otherwise take the first idle one */
+        return RtlFindLeastSignificantBit((ULONGLONG)IdleSet);
+    }
+
+    /* Nobody is idle, keep the thread where its cache footprint is */
+    if (Affinity & AFFINITY_MASK(Thread->NextProcessor))
+        return Thread->NextProcessor;
+    if (Affinity & AFFINITY_MASK(Thread->IdealProcessor))
+        return Thread->IdealProcessor;
+
+    return RtlFindLeastSignificantBit((ULONGLONG)Affinity);
+}
+
+static
+PKTHREAD
+KiStealReadyThread(IN PKPRCB SourcePrcb,
+                   IN PKPRCB Prcb)
+{
+    ULONG Summary;
+    ULONG Priority;
+    PLIST_ENTRY ListHead, ListEntry;
+    PKTHREAD Thread, Candidate, Fallback;
+
+    /* Walk the source ready queues from the highest priority down */
+    Candidate = Fallback = NULL;
+    Summary = SourcePrcb->ReadySummary;
+    while (Summary)
+    {
+        BitScanReverse(&Priority, Summary);
+        Summary ^= PRIORITY_MASK(Priority);
+
+        ListHead = &SourcePrcb->DispatcherReadyListHead[Priority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            ASSERT(Thread->State == Ready);
+            ASSERT(Thread->NextProcessor == SourcePrcb->Number);
+
+            /* Skip threads that can't run here */
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+
+            /* A thread that wants to run here is the best choice */
+            if (Thread->IdealProcessor == Prcb->Number)
+            {
+                Candidate = Thread;
+                break;
+            }
+
+            /* Leave threads on their ideal processor if we can */
+            if (Thread->IdealProcessor != SourcePrcb->Number)
+            {
+                if (!Candidate) Candidate = Thread;
+            }
+            else if (!Fallback)
+            {
+                Fallback = Thread;
+            }
+        }
+
+        /* Never take a lower priority thread than one we found */
+        if (!Candidate) Candidate = Fallback;
+        if (Candidate) break;
+    }
+
+    /* Check if we found anything */
+    if (!Candidate) return NULL;
+
+    /* Remove it from the source queue */
+    if (RemoveEntryList(&Candidate->WaitListEntry))
+    {
+        /* The list is empty now, reset the ready summary */
+        SourcePrcb->ReadySummary ^= PRIORITY_MASK(Candidate->Priority);
+    }
+
+    return Candidate;
+}
+#endif
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKPRCB SourcePrcb, TargetPrcb;
+    PKTHREAD Thread = NULL;
+    ULONG Summary, BestSummary = 0;
+    ULONG i;
+    PKI_SCHEDULER_COUNTERS Counters = &KiSchedulerCounters[Prcb->Number];
+
+    /* This is only called by the idle thread of this processor */
+    ASSERT(Prcb == KeGetCurrentPrcb());
+    Counters->IdleSchedules++;
+
+    /*
+     * Find the sibling with the most urgent backlog. A higher ready summary
+     * means higher priority threads are waiting, and for equal top priority,
+     * more populated queues. This is a lockless peek, we recheck under lock.
+     */
+    SourcePrcb = NULL;
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        TargetPrcb = KiProcessorBlock[i];
+        if (!(TargetPrcb) || (TargetPrcb == Prcb)) continue;
+
+        Summary = TargetPrcb->ReadySummary;
+        if (Summary > BestSummary)
+        {
+            BestSummary = Summary;
+            SourcePrcb = TargetPrcb;
+        }
+    }
+
+    /* Nothing to steal, stay in idle schedule mode and try again later */
+    if (!SourcePrcb) return NULL;
+
+    /* Lock both PRCBs, always in processor order to avoid deadlocks */
+    if (Prcb->Number < SourcePrcb->Number)
+    {
+        KiAcquirePrcbLock(Prcb);
+        KiAcquirePrcbLock(SourcePrcb);
+    }
+    else
+    {
+        KiAcquirePrcbLock(SourcePrcb);
+        KiAcquirePrcbLock(Prcb);
+    }
+
+    /* Somebody may have given us a thread while we were looking */
+    if (Prcb->NextThread)
+    {
+        Prcb->IdleSchedule = FALSE;
+    }
+    else
+    {
+        Thread = KiStealReadyThread(SourcePrcb, Prcb);
+        if (Thread)
+        {
+            /* Move it here and make it our next thread */
+            Thread->NextProcessor = Prcb->Number;
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+
+            /* We are not idle anymore */
+            InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
+            Prcb->IdleSchedule = FALSE;
+            Counters->ThreadsStolen++;
+            Counters->Migrations++;
+        }
+        else
+        {
+            /* Everything there is bound to other processors */
+            Counters->StealFailures++;
+        }
+    }
+
+    /* Release the locks */
+    KiReleasePrcbLock(SourcePrcb);
+    KiReleasePrcbLock(Prcb);
+    return Thread;
+#else
+    /* Nobody to steal from */
+    Prcb->IdleSchedule = FALSE;
     return NULL;
+#endif
 }
 
 VOID
@@ -83,6 +270,7 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     ULONG Processor = 0;
     KPRIORITY OldPriority;
     PKTHREAD NextThread;
+    PKI_SCHEDULER_COUNTERS Counters;
 
     /* Sanity checks */
     ASSERT(Thread->State == DeferredReady);
@@ -228,21 +416,35 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
-    /* Queue the thread on CPU 0 and get the PRCB and lock it */
-    Thread->NextProcessor = 0;
-    Prcb = KiProcessorBlock[0];
+    /* Pick a processor for the thread, get its PRCB and lock it */
+    Counters = &KiSchedulerCounters[KeGetCurrentProcessorNumber()];
+#ifdef CONFIG_SMP
+    Processor = KiSelectReadyProcessor(Thread);
+    if (Processor != Thread->NextProcessor) Counters->Migrations++;
+#endif
+    Thread->NextProcessor = (UCHAR)Processor;
+    Prcb = KiProcessorBlock[Processor];
     KiAcquirePrcbLock(Prcb);
 
-    /* Check if we have an idle summary */
-    if (KiIdleSummary)
+    /* Check if the processor is still idle */
+    if ((KiIdleSummary & Prcb->SetMember) && !(Prcb->NextThread))
     {
-        /* Clear it and set this thread as the next one */
-        KiIdleSummary = 0;
+        /* Clear its idle bit and set this thread as the next one */
+        InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
+        Prcb->IdleSchedule = FALSE;
         Thread->State = Standby;
         Prcb->NextThread = Thread;
+        Counters->IdleDispatches++;
 
-        /* Unlock the PRCB and return */
+        /* Unlock the PRCB */
         KiReleasePrcbLock(Prcb);
+
+        /* Wake it up if it's another CPU */
+        if (KeGetCurrentProcessorNumber() != Processor)
+        {
+            Counters->RemoteDispatches++;
+            KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+        }
         return;
     }
 
@@ -294,6 +496,7 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
             if (KeGetCurrentProcessorNumber() != Thread->NextProcessor)
             {
                 /* We are, send an IPI */
+                Counters->RemoteDispatches++;
                 KiIpiSend(AFFINITY_MASK(Thread->NextProcessor), IPI_DPC);
             }
             return;
@@ -336,12 +539,9 @@ KiSelectNextThread(IN PKPRCB Prcb)
         /* Didn't find any, get the current idle thread */
         Thread = Prcb->IdleThread;
 
-        /* Enable idle scheduling */
+        /* Enable idle scheduling, the idle loop will look for work to steal */
         InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
         Prcb->IdleSchedule = TRUE;
-
-        /* FIXME: SMT support */
-        ASSERTMSG("SMP: Not yet implemented\n", FALSE);
     }
 
     /* Sanity checks and return the thread */
@@ -385,8 +585,9 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         }
         else
         {
-            /* Set the idle summary */
+            /* Set the idle summary and enable idle scheduling */
             InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+            Prcb->IdleSchedule = TRUE;
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -816,3 +1017,67 @@ NtYieldExecution(VOID)
     KeLowerIrql(OldIrql);
     return Status;
 }
+
+#if DBG && defined(KDBG)
+
+BOOLEAN
+KiKdbgExtSched(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    PKPRCB Prcb;
+    PKI_SCHEDULER_COUNTERS Counters;
+    PLIST_ENTRY ListHead, ListEntry;
+    ULONG i, Priority, Length;
+
+    if (Argc > 1)
+    {
+        if (_stricmp(Argv[1], "reset"))
+        {
+            KdbpPrint("Invalid parameter: %s\n", Argv[1]);
+            return TRUE;
+        }
+
+        /* Start a new measurement interval */
+        RtlZeroMemory(KiSchedulerCounters, sizeof(KiSchedulerCounters));
+        return TRUE;
+    }
+
+    KdbpPrint("Idle summary: %p\n", (PVOID)KiIdleSummary);
+    KdbpPrint("CPU  Ready  Summary   IdleDisp  Remote    Migrate   IdleSch   Stolen    Failed\n");
+
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        Prcb = KiProcessorBlock[i];
+        if (!Prcb) continue;
+
+        /* Count the threads on the ready queues, we own the machine here */
+        Length = 0;
+        for (Priority = 0; Priority < MAXIMUM_PRIORITY; Priority++)
+        {
+            ListHead = &Prcb->DispatcherReadyListHead[Priority];
+            for (ListEntry = ListHead->Flink;
+                 ListEntry != ListHead;
+                 ListEntry = ListEntry->Flink)
+            {
+                Length++;
+            }
+        }
+
+        Counters = &KiSchedulerCounters[i];
+        KdbpPrint("%3lu  %5lu  %08lx  %8lu  %8lu  %8lu  %8lu  %8lu  %8lu\n",
+                  i,
+                  Length,
+                  Prcb->ReadySummary,
+                  Counters->IdleDispatches,
+                  Counters->RemoteDispatches,
+                  Counters->Migrations,
+                  Counters->IdleSchedules,
+                  Counters->ThreadsStolen,
+                  Counters->StealFailures);
+    }
+
+    return TRUE;
+}
+
+#endif // DBG && KDBG
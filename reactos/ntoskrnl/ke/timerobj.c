@@ -19,6 +19,12 @@ LARGE_INTEGER KiTimeIncrementReciprocal;
 UCHAR KiTimeIncrementShiftCount;
 BOOLEAN KiEnableTimerWatchdog = FALSE;
 
+/* Coalescing windows for KeSetCoalescableTimer, in milliseconds */
+const ULONG KiTimerCoalescingWindows[KI_TIMER_COALESCING_WINDOWS] =
+{
+    50, 100, 250, 1000
+};
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 BOOLEAN
@@ -196,6 +202,75 @@ KiCompleteTimer(IN PKTIMER Timer,
     if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
 }
 
+static
+BOOLEAN
+FASTCALL
+KiSetTimerEx(IN OUT PKTIMER Timer,
+             IN LARGE_INTEGER DueTime,
+             IN LONG Period,
+             IN ULONG TolerableDelay,
+             IN PKDPC Dpc OPTIONAL)
+{
+    KIRQL OldIrql;
+    BOOLEAN Inserted;
+    ULONG Hand = 0;
+    LONG Window;
+    BOOLEAN RequestInterrupt = FALSE;
+
+    /* Find the widest coalescing window that fits in the tolerable delay */
+    for (Window = KI_TIMER_COALESCING_WINDOWS - 1; Window >= 0; Window--)
+    {
+        if (KiTimerCoalescingWindows[Window] <= TolerableDelay) break;
+    }
+
+    /* Lock the Database and Raise IRQL */
+    OldIrql = KiAcquireDispatcherLock();
+
+    /* Check if it's inserted, and remove it if it is */
+    Inserted = Timer->Header.Inserted;
+    if (Inserted) KxRemoveTreeTimer(Timer);
+
+    /* Set Default Timer Data */
+    Timer->Dpc = Dpc;
+    Timer->Period = Period;
+
+    /* Remember the coalescing window, periodic timers keep it when re-armed */
+    if (Window >= 0)
+    {
+        Timer->Header.Coalescable = TRUE;
+        Timer->Header.EncodedTolerableDelay = (UCHAR)Window;
+    }
+    else
+    {
+        Timer->Header.Coalescable = FALSE;
+        Timer->Header.EncodedTolerableDelay = 0;
+    }
+
+    if (!KiComputeDueTime(Timer, DueTime, &Hand))
+    {
+        /* Signal the timer */
+        RequestInterrupt = KiSignalTimer(Timer);
+        
+        /* Release the dispatcher lock */
+        KiReleaseDispatcherLockFromDpcLevel();
+        
+        /* Check if we need to do an interrupt */
+        if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);        
+    }
+    else
+    {
+        /* Insert the timer */
+        Timer->Header.SignalState = FALSE;
+        KxInsertTimer(Timer, Hand);        
+    }
+    
+    /* Exit the dispatcher */
+    KiExitDispatcher(OldIrql);
+
+    /* Return old state */
+    return Inserted;
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -296,47 +371,32 @@ KeSetTimerEx(IN OUT PKTIMER Timer,
              IN LONG Period,
              IN PKDPC Dpc OPTIONAL)
 {
-    KIRQL OldIrql;
-    BOOLEAN Inserted;
-    ULONG Hand = 0;
-    BOOLEAN RequestInterrupt = FALSE;
     ASSERT_TIMER(Timer);
     ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
     DPRINT("KeSetTimerEx(): Timer %p, DueTime %I64d, Period %d, Dpc %p\n",
            Timer, DueTime.QuadPart, Period, Dpc);
 
-    /* Lock the Database and Raise IRQL */
-    OldIrql = KiAcquireDispatcherLock();
-
-    /* Check if it's inserted, and remove it if it is */
-    Inserted = Timer->Header.Inserted;
-    if (Inserted) KxRemoveTreeTimer(Timer);
+    /* Set the timer without any tolerable delay */
+    return KiSetTimerEx(Timer, DueTime, Period, 0, Dpc);
+}
 
-    /* Set Default Timer Data */
-    Timer->Dpc = Dpc;
-    Timer->Period = Period;
-    if (!KiComputeDueTime(Timer, DueTime, &Hand))
-    {
-        /* Signal the timer */
-        RequestInterrupt = KiSignalTimer(Timer);
-        
-        /* Release the dispatcher lock */
-        KiReleaseDispatcherLockFromDpcLevel();
-        
-        /* Check if we need to do an interrupt */
-        if (RequestInterrupt) HalRequestSoftwareInterrupt(DISPATCH_LEVEL);        
-    }
-    else
-    {
-        /* Insert the timer */
-        Timer->Header.SignalState = FALSE;
-        KxInsertTimer(Timer, Hand);        
-    }
-    
-    /* Exit the dispatcher */
-    KiExitDispatcher(OldIrql);
+/*
+ * @implemented
+ */
+BOOLEAN
+NTAPI
+KeSetCoalescableTimer(IN OUT PKTIMER Timer,
+                      IN LARGE_INTEGER DueTime,
+                      IN ULONG Period,
+                      IN ULONG TolerableDelay,
+                      IN PKDPC Dpc OPTIONAL)
+{
+    ASSERT_TIMER(Timer);
+    ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+    ASSERT(Period <= MAXLONG);
+    DPRINT("KeSetCoalescableTimer(): Timer %p, DueTime %I64d, Period %lu, Delay %lu, Dpc %p\n",
+           Timer, DueTime.QuadPart, Period, TolerableDelay, Dpc);
 
-    /* Return old state */
-    return Inserted;
+    /* Let the timer expire anywhere in its tolerable delay window */
+    return KiSetTimerEx(Timer, DueTime, (LONG)Period, TolerableDelay, Dpc);
 }
-
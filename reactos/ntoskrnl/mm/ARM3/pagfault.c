@@ -18,6 +18,12 @@
 /* GLOBALS ********************************************************************/
 
 #define HYDRA_PROCESS (PEPROCESS)1
+
+/* How many pages a hard fault may bring in, and how many it did so far */
+ULONG MmPageFaultClusterSize = 8;
+ULONG MmPageReadCount;
+ULONG MmPageReadIoCount;
+
 #if MI_TRACE_PFNS
 BOOLEAN UserPdeFault = FALSE;
 #endif
@@ -667,6 +673,7 @@ MiResolveDemandZeroFault(IN PVOID Address,
             /* We'll need a free page and zero it manually */
             PageFrameNumber = MiRemoveAnyPage(Color);
             NeedZero = TRUE;
+            MmZeroPageInlineFallbacks++;
         }
     }
     else
@@ -879,13 +886,15 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
                        _Inout_ KIRQL *OldIrql)
 {
     ULONG Color;
-    PFN_NUMBER Page;
+    PFN_NUMBER Pages[MI_MAXIMUM_FAULT_CLUSTER];
     NTSTATUS Status;
     MMPTE TempPte = *PointerPte;
     PMMPFN Pfn1;
+    PMMPTE ClusterPte;
+    ULONG ClusterSize, MaxClusterSize, i;
+    ULONG Protection;
     ULONG PageFileIndex = TempPte.u.Soft.PageFileLow;
     ULONG_PTR PageFileOffset = TempPte.u.Soft.PageFileHigh;
-    ULONG Protection = TempPte.u.Soft.Protection;
 
     /* Things we don't support yet */
     ASSERT(CurrentProcess > HYDRA_PROCESS);
@@ -899,56 +908,94 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     ASSERT(TempPte.u.Soft.PageFileHigh != 0);
     ASSERT(TempPte.u.Soft.PageFileHigh != MI_PTE_LOOKUP_NEEDED);
 
-    /* Get any page, it will be overwritten */
-    Color = MI_GET_NEXT_PROCESS_COLOR(CurrentProcess);
-    Page = MiRemoveAnyPage(Color);
+    /*
+     * Pages paged out together usually sit next to each other in the paging
+     * file, so bring in the following PTEs of this page table which point to
+     * the next paging file pages along with the faulting one.
+     */
+    MaxClusterSize = max(min(MmPageFaultClusterSize, MI_MAXIMUM_FAULT_CLUSTER), 1);
+    ClusterPte = PointerPte + 1;
+    for (ClusterSize = 1; ClusterSize < MaxClusterSize; ClusterSize++, ClusterPte++)
+    {
+        /* Stay in the same page table, and don't eat the last free pages */
+        if ((((ULONG_PTR)ClusterPte & (PAGE_SIZE - 1)) == 0) ||
+            (MmAvailablePages < MmMinimumFreePages + ClusterSize))
+        {
+            break;
+        }
 
-    /* Initialize this PFN */
-    MiInitializePfn(Page, PointerPte, StoreInstruction);
+        TempPte = *ClusterPte;
+        if ((TempPte.u.Hard.Valid == 1) ||
+            (TempPte.u.Soft.Prototype == 1) ||
+            (TempPte.u.Soft.Transition == 1) ||
+            (TempPte.u.Soft.PageFileLow != PageFileIndex) ||
+            (TempPte.u.Soft.PageFileHigh != PageFileOffset + ClusterSize) ||
+            (TempPte.u.Soft.PageFileHigh == MI_PTE_LOOKUP_NEEDED))
+        {
+            break;
+        }
+    }
+
+    for (i = 0; i < ClusterSize; i++)
+    {
+        Protection = PointerPte[i].u.Soft.Protection;
 
-    /* Sets the PFN as being in IO operation */
-    Pfn1 = MI_PFN_ELEMENT(Page);
-    ASSERT(Pfn1->u1.Event == NULL);
-    ASSERT(Pfn1->u3.e1.ReadInProgress == 0);
-    ASSERT(Pfn1->u3.e1.WriteInProgress == 0);
-    Pfn1->u3.e1.ReadInProgress = 1;
+        /* Get any page, it will be overwritten */
+        Color = MI_GET_NEXT_PROCESS_COLOR(CurrentProcess);
+        Pages[i] = MiRemoveAnyPage(Color);
 
-    /* We must write the PTE now as the PFN lock will be released while performing the IO operation */
-    MI_MAKE_TRANSITION_PTE(&TempPte, Page, Protection);
+        /* Initialize this PFN. Only the faulting page may be written to */
+        MiInitializePfn(Pages[i], &PointerPte[i], (i == 0) ? StoreInstruction : FALSE);
 
-    MI_WRITE_INVALID_PTE(PointerPte, TempPte);
+        /* Sets the PFN as being in IO operation */
+        Pfn1 = MI_PFN_ELEMENT(Pages[i]);
+        ASSERT(Pfn1->u1.Event == NULL);
+        ASSERT(Pfn1->u3.e1.ReadInProgress == 0);
+        ASSERT(Pfn1->u3.e1.WriteInProgress == 0);
+        Pfn1->u3.e1.ReadInProgress = 1;
+
+        /* We must write the PTE now as the PFN lock will be released while performing the IO operation */
+        MI_MAKE_TRANSITION_PTE(&TempPte, Pages[i], Protection);
+
+        MI_WRITE_INVALID_PTE(&PointerPte[i], TempPte);
+    }
 
     /* Release the PFN lock while we proceed */
     KeReleaseQueuedSpinLock(LockQueuePfnLock, *OldIrql);
 
     /* Do the paging IO */
-    Status = MiReadPageFile(Page, PageFileIndex, PageFileOffset);
+    Status = MiReadPageFileCluster(Pages, ClusterSize, PageFileIndex, PageFileOffset);
 
     /* Lock the PFN database again */
     *OldIrql = KeAcquireQueuedSpinLock(LockQueuePfnLock);
 
-    /* Nobody should have changed that while we were not looking */
-    ASSERT(Pfn1->u3.e1.ReadInProgress == 1);
-    ASSERT(Pfn1->u3.e1.WriteInProgress == 0);
-
-    if (!NT_SUCCESS(Status))
+    for (i = 0; i < ClusterSize; i++)
     {
-        /* Malheur! */
-        ASSERT(FALSE);
-        Pfn1->u4.InPageError = 1;
-        Pfn1->u1.ReadStatus = Status;
-    }
+        Pfn1 = MI_PFN_ELEMENT(Pages[i]);
 
-    /* And the PTE can finally be valid */
-    MI_MAKE_HARDWARE_PTE(&TempPte, PointerPte, Protection, Page);
-    MI_WRITE_VALID_PTE(PointerPte, TempPte);
+        /* Nobody should have changed that while we were not looking */
+        ASSERT(Pfn1->u3.e1.ReadInProgress == 1);
+        ASSERT(Pfn1->u3.e1.WriteInProgress == 0);
 
-    Pfn1->u3.e1.ReadInProgress = 0;
-    /* Did someone start to wait on us while we proceeded ? */
-    if (Pfn1->u1.Event)
-    {
-        /* Tell them we're done */
-        KeSetEvent(Pfn1->u1.Event, IO_NO_INCREMENT, FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            /* Malheur! */
+            ASSERT(FALSE);
+            Pfn1->u4.InPageError = 1;
+            Pfn1->u1.ReadStatus = Status;
+        }
+
+        /* And the PTE can finally be valid */
+        MI_MAKE_HARDWARE_PTE(&TempPte, &PointerPte[i], Pfn1->OriginalPte.u.Soft.Protection, Pages[i]);
+        MI_WRITE_VALID_PTE(&PointerPte[i], TempPte);
+
+        Pfn1->u3.e1.ReadInProgress = 0;
+        /* Did someone start to wait on us while we proceeded ? */
+        if (Pfn1->u1.Event)
+        {
+            /* Tell them we're done */
+            KeSetEvent(Pfn1->u1.Event, IO_NO_INCREMENT, FALSE);
+        }
     }
 
     return Status;
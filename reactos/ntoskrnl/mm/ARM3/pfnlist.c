@@ -551,6 +551,7 @@ MiRemoveZeroPage(IN ULONG Color)
             /* This means there's no zero pages, we have to look for free ones */
             ASSERT(MmZeroedPageListHead.Total == 0);
             Zero = TRUE;
+            MmZeroPageInlineFallbacks++;
 
             /* Check the colored free list */
             PageIndex = MmFreePagesByColor[FreePageList][Color].Flink;
@@ -617,9 +617,14 @@ MiAllocatePoolPages(IN POOL_TYPE PoolType,
         }
 
         //
-        // Update the pool hint if the request was just one page
+        // Update the pool hint if the request was just one page, or if it was
+        // carved from the hint itself, so the next search starts past it
+        // instead of rescanning the allocated front of the bitmap
         //
-        if (SizeInPages == 1) MmPagedPoolInfo.PagedPoolHint = i + 1;
+        if ((SizeInPages == 1) || (i == MmPagedPoolInfo.PagedPoolHint))
+        {
+            MmPagedPoolInfo.PagedPoolHint = i + SizeInPages;
+        }
 
         //
         // Update the end bitmap so we know the bounds of this allocation when
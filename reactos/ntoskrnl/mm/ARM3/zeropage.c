@@ -20,6 +20,13 @@
 BOOLEAN MmZeroingPageThreadActive;
 KEVENT MmZeroingPageEvent;
 
+/* Statistics */
+ULONG MmZeroPageThreadPages;
+ULONG MmZeroPageInlineFallbacks;
+
+/* Pages taken off the free list per PFN lock hold, all mapped at once */
+#define MI_ZERO_PAGE_BATCH (MI_ZERO_PTES - 1)
+
 /* PRIVATE FUNCTIONS **********************************************************/
 
 VOID
@@ -42,7 +49,9 @@ MmZeroPageThread(VOID)
     KIRQL OldIrql;
     PVOID ZeroAddress;
     PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
+    PFN_NUMBER PageList[MI_ZERO_PAGE_BATCH];
+    ULONG Count, i;
+    PMMPFN Pfn1, FirstPfn;
 
     /* Get the discardable sections to free them */
     MiFindInitializationCode(&StartAddress, &EndAddress);
@@ -79,34 +88,46 @@ MmZeroPageThread(VOID)
                 break;
             }
 
-            PageIndex = MmFreePageListHead.Flink;
-            ASSERT(PageIndex != LIST_HEAD);
-            Pfn1 = MiGetPfnEntry(PageIndex);
-            MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
-            MI_SET_PROCESS2("Kernel 0 Loop");
-            FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
-
-            /* The first global free page should also be the first on its own list */
-            if (FreePage != PageIndex)
+            /* Grab a batch of free pages, chained for MiMapPagesInZeroSpace */
+            FirstPfn = (PMMPFN)LIST_HEAD;
+            for (Count = 0; (Count < MI_ZERO_PAGE_BATCH) && (MmFreePageListHead.Total); Count++)
             {
-                KeBugCheckEx(PFN_LIST_CORRUPT,
-                             0x8F,
-                             FreePage,
-                             PageIndex,
-                             0);
+                PageIndex = MmFreePageListHead.Flink;
+                ASSERT(PageIndex != LIST_HEAD);
+                Pfn1 = MiGetPfnEntry(PageIndex);
+                MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
+                MI_SET_PROCESS2("Kernel 0 Loop");
+                FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+
+                /* The first global free page should also be the first on its own list */
+                if (FreePage != PageIndex)
+                {
+                    KeBugCheckEx(PFN_LIST_CORRUPT,
+                                 0x8F,
+                                 FreePage,
+                                 PageIndex,
+                                 0);
+                }
+
+                Pfn1->u1.Flink = (PFN_NUMBER)FirstPfn;
+                FirstPfn = Pfn1;
+                PageList[Count] = PageIndex;
             }
-
-            Pfn1->u1.Flink = LIST_HEAD;
             KeReleaseQueuedSpinLock(LockQueuePfnLock, OldIrql);
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
+            /* Map them next to each other and wipe them in one go */
+            ZeroAddress = MiMapPagesInZeroSpace(FirstPfn, Count);
             ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+            KeZeroPages(ZeroAddress, Count * PAGE_SIZE);
+            MiUnmapPagesInZeroSpace(ZeroAddress, Count);
 
             OldIrql = KeAcquireQueuedSpinLock(LockQueuePfnLock);
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+            for (i = 0; i < Count; i++)
+            {
+                MiInsertPageInList(&MmZeroedPageListHead, PageList[i]);
+            }
+            MmZeroPageThreadPages += Count;
         }
     }
 }
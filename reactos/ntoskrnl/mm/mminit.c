@@ -202,7 +202,7 @@ MmMpwThreadMain(PVOID Parameter)
 
         // XXX arty -- we flush when evicting pages or destorying cache
         // sections.
-        CcRosFlushDirtyPages(128, &PagesWritten, FALSE);
+        CcRosFlushDirtyPages(128, &PagesWritten, FALSE, TRUE);
 #endif
     }
 }
@@ -289,16 +289,34 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
 {
-    LARGE_INTEGER file_offset;
+    return MiReadPageFileCluster(&Page, 1, PageFileIndex, PageFileOffset);
+}
+
+/*
+ * Reads PageCount consecutive pages of a paging file. Pages that are
+ * contiguous on the disk too are read with a single paging I/O.
+ */
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    LARGE_INTEGER file_offset, next_offset;
     IO_STATUS_BLOCK Iosb;
-    NTSTATUS Status;
+    NTSTATUS Status = STATUS_SUCCESS;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
+    UCHAR MdlBase[sizeof(MDL) + MI_MAXIMUM_FAULT_CLUSTER * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
     PPAGINGFILE PagingFile;
+    ULONG RunStart, RunLength;
 
     DPRINT("MiReadSwapFile\n");
 
+    ASSERT(PageCount != 0 && PageCount <= MI_MAXIMUM_FAULT_CLUSTER);
+
     if (PageFileOffset == 0)
     {
         KeBugCheck(MEMORY_MANAGEMENT);
@@ -315,27 +333,45 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+    for (RunStart = 0; RunStart < PageCount; RunStart += RunLength)
+    {
+        file_offset.QuadPart = (PageFileOffset + RunStart) * PAGE_SIZE;
+        file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
 
-    file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
-    file_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, file_offset);
+        /* Extend the run as long as the paging file is contiguous on the disk */
+        for (RunLength = 1; RunStart + RunLength < PageCount; RunLength++)
+        {
+            next_offset.QuadPart = (PageFileOffset + RunStart + RunLength) * PAGE_SIZE;
+            next_offset = MmGetOffsetPageFile(PagingFile->RetrievalPointers, next_offset);
+            if (next_offset.QuadPart != file_offset.QuadPart + RunLength * PAGE_SIZE)
+                break;
+        }
 
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoPageRead(PagingFile->FileObject,
-                        Mdl,
-                        &file_offset,
-                        &Event,
-                        &Iosb);
-    if (Status == STATUS_PENDING)
-    {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
-    }
-    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
-    {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        MmInitializeMdl(Mdl, NULL, RunLength * PAGE_SIZE);
+        MmBuildMdlFromPages(Mdl, &Pages[RunStart]);
+        Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+        KeInitializeEvent(&Event, NotificationEvent, FALSE);
+        Status = IoPageRead(PagingFile->FileObject,
+                            Mdl,
+                            &file_offset,
+                            &Event,
+                            &Iosb);
+        if (Status == STATUS_PENDING)
+        {
+            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+            Status = Iosb.Status;
+        }
+        if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+        {
+            MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        }
+
+        InterlockedIncrement((PLONG)&MmPageReadIoCount);
+        InterlockedExchangeAdd((PLONG)&MmPageReadCount, RunLength);
+
+        if (!NT_SUCCESS(Status))
+            break;
     }
     return(Status);
 }
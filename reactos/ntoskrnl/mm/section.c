@@ -1277,6 +1277,126 @@ MiReadPage(PMEMORY_AREA MemoryArea,
 }
 #endif
 
+/*
+ * Picks the pages following a section page fault which can be read in
+ * along with it: not loaded yet, in the same region of the view, within
+ * the initialized part of the segment and backed by the same cache view.
+ * They are marked as being paged in, like the faulting page. Called with
+ * both the address space and the segment locked.
+ */
+static
+ULONG
+MiGatherSectionFaultCluster(PEPROCESS Process,
+                            PMEMORY_AREA MemoryArea,
+                            PMM_REGION Region,
+                            PVOID PAddress,
+                            PLARGE_INTEGER Offset)
+{
+    PMM_SECTION_SEGMENT Segment = MemoryArea->Data.SectionData.Segment;
+    LARGE_INTEGER ClusterOffset;
+    LONGLONG SegmentEnd, FileOffset, VacbEnd;
+    PVOID ClusterAddress;
+    ULONG Count, MaxCount;
+
+    MaxCount = min(MmPageFaultClusterSize, MI_MAXIMUM_FAULT_CLUSTER);
+
+    SegmentEnd = Segment->Length.QuadPart;
+    if (MemoryArea->Data.SectionData.Section->AllocationAttributes & SEC_IMAGE)
+    {
+        /* The rest is zero filled, not read */
+        SegmentEnd = min(SegmentEnd, (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart));
+    }
+
+    FileOffset = Offset->QuadPart + Segment->Image.FileOffset;
+    VacbEnd = ROUND_DOWN(FileOffset, VACB_MAPPING_GRANULARITY) + VACB_MAPPING_GRANULARITY;
+
+    for (Count = 1; Count < MaxCount; Count++)
+    {
+        ClusterAddress = (PVOID)((ULONG_PTR)PAddress + Count * PAGE_SIZE);
+        ClusterOffset.QuadPart = Offset->QuadPart + Count * PAGE_SIZE;
+
+        if (((ULONG_PTR)ClusterAddress >= MA_GetEndingAddress(MemoryArea)) ||
+            (ClusterOffset.QuadPart >= SegmentEnd) ||
+            (FileOffset + (Count + 1) * PAGE_SIZE > VacbEnd))
+        {
+            break;
+        }
+
+        if (MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
+                         &MemoryArea->Data.SectionData.RegionListHead,
+                         ClusterAddress, NULL) != Region)
+        {
+            break;
+        }
+
+        if ((MmGetPageEntrySectionSegment(Segment, &ClusterOffset) != 0) ||
+            MmIsPagePresent(Process, ClusterAddress) ||
+            MmIsPageSwapEntry(Process, ClusterAddress) ||
+            MmIsDisabledPage(Process, ClusterAddress))
+        {
+            break;
+        }
+
+        /* Tell everyone else we are serving this page too */
+        MmSetPageEntrySectionSegment(Segment, &ClusterOffset, MAKE_SWAP_SSE(MM_WAIT_ENTRY));
+        MmCreatePageFileMapping(Process, ClusterAddress, MM_WAIT_ENTRY);
+    }
+
+    /* The faulting page is not part of what we return */
+    return Count - 1;
+}
+
+/*
+ * Maps the pages gathered by MiGatherSectionFaultCluster once they were read,
+ * or gives back the ones which couldn't be. Called with both the address
+ * space and the segment locked.
+ */
+static
+VOID
+MiMapSectionFaultCluster(PEPROCESS Process,
+                         PMM_SECTION_SEGMENT Segment,
+                         PVOID PAddress,
+                         PLARGE_INTEGER Offset,
+                         ULONG Attributes,
+                         PPFN_NUMBER Pages,
+                         ULONG Count,
+                         ULONG ReadCount)
+{
+    LARGE_INTEGER ClusterOffset;
+    PVOID ClusterAddress;
+    SWAPENTRY FakeSwapEntry;
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        ClusterAddress = (PVOID)((ULONG_PTR)PAddress + (i + 1) * PAGE_SIZE);
+        ClusterOffset.QuadPart = Offset->QuadPart + (i + 1) * PAGE_SIZE;
+
+        MmDeletePageFileMapping(Process, ClusterAddress, &FakeSwapEntry);
+
+        if (i >= ReadCount)
+        {
+            MmSetPageEntrySectionSegment(Segment, &ClusterOffset, 0);
+            continue;
+        }
+
+        Status = MmCreateVirtualMapping(Process,
+                                        ClusterAddress,
+                                        Attributes,
+                                        &Pages[i],
+                                        1);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Unable to create virtual mapping\n");
+            KeBugCheck(MEMORY_MANAGEMENT);
+        }
+        MmInsertRmap(Pages[i], Process, ClusterAddress);
+
+        MmSetPageEntrySectionSegment(Segment, &ClusterOffset, MAKE_SSE(Pages[i] << PAGE_SHIFT, 1));
+    }
+}
+
 NTSTATUS
 NTAPI
 MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
@@ -1497,23 +1617,33 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     if (Entry == 0)
     {
         SWAPENTRY FakeSwapEntry;
+        BOOLEAN ReadFromFile;
+        PFN_NUMBER ClusterPages[MI_MAXIMUM_FAULT_CLUSTER - 1];
+        ULONG ClusterCount = 0, ClusterRead = 0;
+        LARGE_INTEGER ClusterOffset;
 
         /*
          * If the entry is zero (and it can't change because we have
          * locked the segment) then we need to load the page.
          */
+        ReadFromFile = !((Segment->Flags & MM_PAGEFILE_SEGMENT) ||
+                         ((Offset.QuadPart >= (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart) &&
+                           (Section->AllocationAttributes & SEC_IMAGE))));
 
         /*
-         * Release all our locks and read in the page from disk
+         * Release all our locks and read in the page from disk, along with
+         * the following pages which come from the same cache view
          */
         MmSetPageEntrySectionSegment(Segment, &Offset, MAKE_SWAP_SSE(MM_WAIT_ENTRY));
+        if (ReadFromFile)
+        {
+            ClusterCount = MiGatherSectionFaultCluster(Process, MemoryArea, Region, PAddress, &Offset);
+        }
         MmUnlockSectionSegment(Segment);
         MmCreatePageFileMapping(Process, PAddress, MM_WAIT_ENTRY);
         MmUnlockAddressSpace(AddressSpace);
 
-        if ((Segment->Flags & MM_PAGEFILE_SEGMENT) ||
-                ((Offset.QuadPart >= (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart) &&
-                  (Section->AllocationAttributes & SEC_IMAGE))))
+        if (!ReadFromFile)
         {
             MI_SET_USAGE(MI_USAGE_SECTION);
             if (Process) MI_SET_PROCESS2(Process->ImageFileName);
@@ -1532,6 +1662,19 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             {
                 DPRINT1("MiReadPage failed (Status %x)\n", Status);
             }
+            else
+            {
+                /* Those are in the cache view we just read, so this is cheap */
+                for (ClusterRead = 0; ClusterRead < ClusterCount; ClusterRead++)
+                {
+                    ClusterOffset.QuadPart = Offset.QuadPart + (ClusterRead + 1) * PAGE_SIZE;
+                    if (!NT_SUCCESS(MiReadPage(MemoryArea, ClusterOffset.QuadPart, &ClusterPages[ClusterRead])))
+                        break;
+                }
+
+                InterlockedIncrement((PLONG)&MmPageReadIoCount);
+                InterlockedExchangeAdd((PLONG)&MmPageReadCount, 1 + ClusterRead);
+            }
         }
         if (!NT_SUCCESS(Status))
         {
@@ -1542,6 +1685,14 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
              * Cleanup and release locks
              */
             MmLockAddressSpace(AddressSpace);
+            if (ClusterCount != 0)
+            {
+                /* At least give back the pages we reserved along */
+                MmLockSectionSegment(Segment);
+                MiMapSectionFaultCluster(Process, Segment, PAddress, &Offset, Attributes,
+                                         ClusterPages, ClusterCount, 0);
+                MmUnlockSectionSegment(Segment);
+            }
             MiSetPageEvent(Process, Address);
             DPRINT("Address 0x%p\n", Address);
             return(Status);
@@ -1570,6 +1721,12 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         /* Set this section offset has being backed by our new page. */
         Entry = MAKE_SSE(Page << PAGE_SHIFT, 1);
         MmSetPageEntrySectionSegment(Segment, &Offset, Entry);
+
+        if (ClusterCount != 0)
+        {
+            MiMapSectionFaultCluster(Process, Segment, PAddress, &Offset, Attributes,
+                                     ClusterPages, ClusterCount, ClusterRead);
+        }
         MmUnlockSectionSegment(Segment);
 
         MiSetPageEvent(Process, Address);
@@ -16,9 +16,146 @@ typedef struct _DECLSPEC_INTRIN_TYPE _CRT_ALIGN(16) __m128d
     double m128d_f64[2];
 } __m128d;
 
+#if defined(_MSC_VER)
+typedef union _DECLSPEC_INTRIN_TYPE _CRT_ALIGN(16) __m128i
+{
+    __int8 m128i_i8[16];
+    __int16 m128i_i16[8];
+    __int32 m128i_i32[4];
+    __int64 m128i_i64[2];
+    unsigned __int8 m128i_u8[16];
+    unsigned __int16 m128i_u16[8];
+    unsigned __int32 m128i_u32[4];
+    unsigned __int64 m128i_u64[2];
+} __m128i;
+#else
+typedef long long __m128i __attribute__((__vector_size__(16), __may_alias__));
+typedef long long __m128i_u __attribute__((__vector_size__(16), __may_alias__, __aligned__(1)));
+typedef int __v4si __attribute__((__vector_size__(16)));
+typedef short __v8hi __attribute__((__vector_size__(16)));
+typedef char __v16qi __attribute__((__vector_size__(16)));
+#endif
+
 extern __m128d _mm_load_sd(double const*);
 
 extern int _mm_cvtsd_si32(__m128d);
 
+#ifdef _MSC_VER
+extern __m128i _mm_setzero_si128(void);
+extern __m128i _mm_set1_epi32(int i);
+extern __m128i _mm_set1_epi16(short w);
+extern __m128i _mm_loadu_si128(__m128i const *p);
+extern void _mm_storeu_si128(__m128i *p, __m128i b);
+extern void _mm_store_si128(__m128i *p, __m128i b);
+extern __m128i _mm_and_si128(__m128i a, __m128i b);
+extern __m128i _mm_or_si128(__m128i a, __m128i b);
+extern __m128i _mm_xor_si128(__m128i a, __m128i b);
+extern __m128i _mm_add_epi16(__m128i a, __m128i b);
+extern __m128i _mm_sub_epi16(__m128i a, __m128i b);
+extern __m128i _mm_mullo_epi16(__m128i a, __m128i b);
+extern __m128i _mm_srli_epi16(__m128i a, int count);
+extern __m128i _mm_unpacklo_epi8(__m128i a, __m128i b);
+extern __m128i _mm_unpackhi_epi8(__m128i a, __m128i b);
+extern __m128i _mm_packus_epi16(__m128i a, __m128i b);
+extern __m128i _mm_shufflelo_epi16(__m128i a, int imm);
+extern __m128i _mm_shufflehi_epi16(__m128i a, int imm);
+#pragma intrinsic(_mm_setzero_si128, _mm_set1_epi32, _mm_set1_epi16)
+#pragma intrinsic(_mm_loadu_si128, _mm_storeu_si128, _mm_store_si128)
+#pragma intrinsic(_mm_and_si128, _mm_or_si128, _mm_xor_si128)
+#pragma intrinsic(_mm_add_epi16, _mm_sub_epi16, _mm_mullo_epi16, _mm_srli_epi16)
+#pragma intrinsic(_mm_unpacklo_epi8, _mm_unpackhi_epi8, _mm_packus_epi16)
+#pragma intrinsic(_mm_shufflelo_epi16, _mm_shufflehi_epi16)
+#elif defined(__SSE2__)
+/*
+ * Like in xmmintrin.h, the __builtin_ia32_* functions are only
+ * available with the -msse2 compiler switch, which is the default on amd64
+ */
+__INTRIN_INLINE __m128i _mm_setzero_si128(void)
+{
+    return (__m128i){ 0, 0 };
+}
+
+__INTRIN_INLINE __m128i _mm_set1_epi32(int i)
+{
+    return (__m128i)(__v4si){ i, i, i, i };
+}
+
+__INTRIN_INLINE __m128i _mm_set1_epi16(short w)
+{
+    return (__m128i)(__v8hi){ w, w, w, w, w, w, w, w };
+}
+
+__INTRIN_INLINE __m128i _mm_loadu_si128(__m128i const *p)
+{
+    return *(__m128i_u const *)p;
+}
+
+__INTRIN_INLINE void _mm_storeu_si128(__m128i *p, __m128i b)
+{
+    *(__m128i_u *)p = b;
+}
+
+__INTRIN_INLINE void _mm_store_si128(__m128i *p, __m128i b)
+{
+    *p = b;
+}
+
+__INTRIN_INLINE __m128i _mm_and_si128(__m128i a, __m128i b)
+{
+    return a & b;
+}
+
+__INTRIN_INLINE __m128i _mm_or_si128(__m128i a, __m128i b)
+{
+    return a | b;
+}
+
+__INTRIN_INLINE __m128i _mm_xor_si128(__m128i a, __m128i b)
+{
+    return a ^ b;
+}
+
+__INTRIN_INLINE __m128i _mm_add_epi16(__m128i a, __m128i b)
+{
+    return (__m128i)((__v8hi)a + (__v8hi)b);
+}
+
+__INTRIN_INLINE __m128i _mm_sub_epi16(__m128i a, __m128i b)
+{
+    return (__m128i)((__v8hi)a - (__v8hi)b);
+}
+
+__INTRIN_INLINE __m128i _mm_mullo_epi16(__m128i a, __m128i b)
+{
+    return (__m128i)((__v8hi)a * (__v8hi)b);
+}
+
+__INTRIN_INLINE __m128i _mm_srli_epi16(__m128i a, int count)
+{
+    return (__m128i)__builtin_ia32_psrlwi128((__v8hi)a, count);
+}
+
+__INTRIN_INLINE __m128i _mm_unpacklo_epi8(__m128i a, __m128i b)
+{
+    return (__m128i)__builtin_ia32_punpcklbw128((__v16qi)a, (__v16qi)b);
+}
+
+__INTRIN_INLINE __m128i _mm_unpackhi_epi8(__m128i a, __m128i b)
+{
+    return (__m128i)__builtin_ia32_punpckhbw128((__v16qi)a, (__v16qi)b);
+}
+
+__INTRIN_INLINE __m128i _mm_packus_epi16(__m128i a, __m128i b)
+{
+    return (__m128i)__builtin_ia32_packuswb128((__v8hi)a, (__v8hi)b);
+}
+
+/* The shuffle control must be a constant */
+#define _mm_shufflelo_epi16(a, imm) \
+    ((__m128i)__builtin_ia32_pshuflw((__v8hi)(__m128i)(a), (int)(imm)))
+#define _mm_shufflehi_epi16(a, imm) \
+    ((__m128i)__builtin_ia32_pshufhw((__v8hi)(__m128i)(a), (int)(imm)))
+#endif
+
 
 #endif /* _INCLUDED_EMM */
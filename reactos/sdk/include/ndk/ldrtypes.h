@@ -160,6 +160,7 @@ typedef struct _LDR_DATA_TABLE_ENTRY
     };
     PACTIVATION_CONTEXT EntryPointActivationContext;
     PVOID PatchInformation;
+    PVOID ExportHashTable; // ReactOS: ntdll's export name lookup cache
 } LDR_DATA_TABLE_ENTRY, *PLDR_DATA_TABLE_ENTRY;
 
 //
@@ -689,6 +689,9 @@ CmpFindSubKeyByName(IN PHHIVE Hive,
     HCELL_INDEX SubKey, CellToRelease;
     ULONG Found;
 
+    /* Large parents are looked up through their name index, if any */
+    if (CmpFindSubKeyInIndexCache(Hive, Parent, SearchName, &SubKey)) return SubKey;
+
     /* Loop each storage type */
     for (i = 0; i < Hive->StorageTypeCount; i++)
     {
@@ -1681,6 +1684,9 @@ CmpAddSubKey(IN PHHIVE Hive,
         KeyNode->SubKeyLists[Type] = LeafCell;
     }
 
+    /* Keep the parent's name index in sync */
+    CmpAddToSubKeyIndexCache(Hive, KeyNode, &Name, Child);
+
     /* If the name was compressed, free our copy */
     if (IsCompressed) Hive->Free(Name.Buffer, 0);
 
@@ -1697,7 +1703,7 @@ CmpRemoveSubKey(IN PHHIVE Hive,
                 IN HCELL_INDEX ParentKey,
                 IN HCELL_INDEX TargetKey)
 {
-    PCM_KEY_NODE Node;
+    PCM_KEY_NODE Node, TargetNode;
     UNICODE_STRING SearchName;
     BOOLEAN IsCompressed;
     WCHAR Buffer[50];
@@ -1711,6 +1717,7 @@ CmpRemoveSubKey(IN PHHIVE Hive,
     /* Get the target key node */
     Node = (PCM_KEY_NODE)HvGetCell(Hive, TargetKey);
     if (!Node) return FALSE;
+    TargetNode = Node;
 
     /* Make sure it's dirty, then release it */
     ASSERT(HvIsCellDirty(Hive, TargetKey));
@@ -1809,6 +1816,9 @@ CmpRemoveSubKey(IN PHHIVE Hive,
     if (LeafIndex & INVALID_INDEX) goto Exit;
     ASSERT(ChildCell != HCELL_NIL);
 
+    /* Forget the child in the name indexes */
+    CmpRemoveFromSubKeyIndexCache(Hive, Node, TargetKey, TargetNode);
+
     /* Decrement key counts and check if this was the last leaf entry */
     Node->SubKeyCounts[Storage]--;
     if (!(--Leaf->Count))
@@ -359,6 +359,50 @@ CmpIsKeyValueBig(IN PHHIVE Hive,
     return FALSE;
 }
 
+//
+// Subkey Name Index Cache
+//
+// Parents with at least CM_SUBKEY_INDEX_THRESHOLD subkeys get an in-memory
+// hash table of their children's names, built the first time they are
+// searched and kept up to date by CmpAddSubKey and CmpRemoveSubKey.
+//
+#define CM_SUBKEY_INDEX_THRESHOLD       64
+#define CM_SUBKEY_INDEX_BUCKETS         64
+
+typedef VOID
+(CMAPI *PCM_SUBKEY_INDEX_LOCK_ROUTINE)(
+    IN PHHIVE Hive,
+    IN BOOLEAN Exclusive
+);
+
+typedef VOID
+(CMAPI *PCM_SUBKEY_INDEX_UNLOCK_ROUTINE)(
+    IN PHHIVE Hive
+);
+
+typedef struct _CM_SUBKEY_INDEX_ENTRY
+{
+    ULONG HashKey;
+    HCELL_INDEX Cell;
+} CM_SUBKEY_INDEX_ENTRY, *PCM_SUBKEY_INDEX_ENTRY;
+
+typedef struct _CM_SUBKEY_INDEX
+{
+    struct _CM_SUBKEY_INDEX *Next;
+    PCM_KEY_NODE Parent;
+    ULONG Count;
+    ULONG Used;
+    ULONG Size;
+    CM_SUBKEY_INDEX_ENTRY Entries[ANYSIZE_ARRAY];
+} CM_SUBKEY_INDEX, *PCM_SUBKEY_INDEX;
+
+typedef struct _CM_SUBKEY_INDEX_CACHE
+{
+    PCM_SUBKEY_INDEX_LOCK_ROUTINE Lock;
+    PCM_SUBKEY_INDEX_UNLOCK_ROUTINE Unlock;
+    PCM_SUBKEY_INDEX Buckets[CM_SUBKEY_INDEX_BUCKETS];
+} CM_SUBKEY_INDEX_CACHE, *PCM_SUBKEY_INDEX_CACHE;
+
 /*
  * Public Hive functions.
  */
@@ -514,6 +558,14 @@ CmpFindSubKeyByNumber(
     IN ULONG Number
 );
 
+LONG
+NTAPI
+CmpDoCompareKeyName(
+    IN PHHIVE Hive,
+    IN PCUNICODE_STRING SearchName,
+    IN HCELL_INDEX Cell
+);
+
 ULONG
 NTAPI
 CmpComputeHashKey(
@@ -546,6 +598,50 @@ CmpMarkIndexDirty(
     HCELL_INDEX TargetKey
 );
 
+//
+// Subkey Name Index Cache Routines
+//
+BOOLEAN
+NTAPI
+CmpInitializeSubKeyIndexCache(
+    IN PHHIVE Hive,
+    IN PCM_SUBKEY_INDEX_LOCK_ROUTINE Lock OPTIONAL,
+    IN PCM_SUBKEY_INDEX_UNLOCK_ROUTINE Unlock OPTIONAL
+);
+
+VOID
+NTAPI
+CmpFreeSubKeyIndexCache(
+    IN PHHIVE Hive
+);
+
+BOOLEAN
+NTAPI
+CmpFindSubKeyInIndexCache(
+    IN PHHIVE Hive,
+    IN PCM_KEY_NODE Parent,
+    IN PCUNICODE_STRING SearchName,
+    OUT PHCELL_INDEX SubKey
+);
+
+VOID
+NTAPI
+CmpAddToSubKeyIndexCache(
+    IN PHHIVE Hive,
+    IN PCM_KEY_NODE Parent,
+    IN PCUNICODE_STRING Name,
+    IN HCELL_INDEX Child
+);
+
+VOID
+NTAPI
+CmpRemoveFromSubKeyIndexCache(
+    IN PHHIVE Hive,
+    IN PCM_KEY_NODE Parent,
+    IN HCELL_INDEX Child,
+    IN PCM_KEY_NODE ChildNode
+);
+
 
 //
 // Name Functions
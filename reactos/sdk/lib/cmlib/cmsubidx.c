@@ -0,0 +1,574 @@
+/*
+ * PROJECT:         ReactOS Registry Library
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            lib/cmlib/cmsubidx.c
+ * PURPOSE:         Configuration Manager - Subkey Name Index Cache
+ */
+
+/* INCLUDES ******************************************************************/
+
+#include "cmlib.h"
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+/*
+ * Each index is an open-addressed table of (name hash, cell) pairs using
+ * linear probing. Removed entries leave a tombstone behind so that probe
+ * chains stay intact; they are dropped when the table is rehashed.
+ */
+#define CM_SUBKEY_INDEX_MIN_SIZE    128
+#define CM_SUBKEY_INDEX_FREE        HCELL_NIL
+#define CM_SUBKEY_INDEX_DELETED     ((HCELL_INDEX)-2)
+
+#define CmpSubKeyIndexAllocationSize(Size)  \
+    (FIELD_OFFSET(CM_SUBKEY_INDEX, Entries) + (Size) * sizeof(CM_SUBKEY_INDEX_ENTRY))
+
+/* FUNCTIONS *****************************************************************/
+
+static
+VOID
+CmpLockSubKeyIndexCache(IN PHHIVE Hive,
+                        IN BOOLEAN Exclusive)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+
+    /* Hosts without concurrent users don't need a lock */
+    if (Cache->Lock) Cache->Lock(Hive, Exclusive);
+}
+
+static
+VOID
+CmpUnlockSubKeyIndexCache(IN PHHIVE Hive)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+
+    if (Cache->Unlock) Cache->Unlock(Hive);
+}
+
+static
+ULONG
+CmpHashSubKeyIndexParent(IN PCM_KEY_NODE Parent)
+{
+    ULONG_PTR Value = (ULONG_PTR)Parent;
+
+    /* Key nodes are at least 8-byte aligned, fold the upper bits in too */
+    Value = (Value >> 3) ^ (Value >> 12);
+    return (ULONG)Value & (CM_SUBKEY_INDEX_BUCKETS - 1);
+}
+
+static
+ULONG
+CmpComputeKeyNodeHash(IN PCM_KEY_NODE Node)
+{
+    PUCHAR CompressedName;
+    ULONG Hash = 0, Value, i, Length;
+
+    /* This must produce the same value as CmpComputeHashKey on the name */
+    if (Node->Flags & KEY_COMP_NAME)
+    {
+        CompressedName = (PUCHAR)Node->Name;
+        Length = Node->NameLength;
+    }
+    else
+    {
+        CompressedName = NULL;
+        Length = Node->NameLength / sizeof(WCHAR);
+    }
+
+    for (i = 0; i < Length; i++)
+    {
+        Value = CompressedName ? CompressedName[i] : Node->Name[i];
+        if ((Value >= L'a') && (Value < L'z'))
+        {
+            Value = Value - L'a' + L'A';
+        }
+        else if (Value >= L'z')
+        {
+            Value = RtlUpcaseUnicodeChar((WCHAR)Value);
+        }
+
+        Hash *= 37;
+        Hash += Value;
+    }
+
+    return Hash;
+}
+
+static
+PCM_SUBKEY_INDEX*
+CmpFindSubKeyIndexLink(IN PCM_SUBKEY_INDEX_CACHE Cache,
+                       IN PCM_KEY_NODE Parent)
+{
+    PCM_SUBKEY_INDEX *Link;
+
+    /* Return the link pointing to the parent's index, or to the list end */
+    Link = &Cache->Buckets[CmpHashSubKeyIndexParent(Parent)];
+    while ((*Link) && ((*Link)->Parent != Parent))
+    {
+        Link = &(*Link)->Next;
+    }
+
+    return Link;
+}
+
+static
+VOID
+CmpFreeSubKeyIndex(IN PHHIVE Hive,
+                   IN PCM_SUBKEY_INDEX Index)
+{
+    Hive->Free(Index, CmpSubKeyIndexAllocationSize(Index->Size));
+}
+
+static
+PCM_SUBKEY_INDEX
+CmpAllocateSubKeyIndex(IN PHHIVE Hive,
+                       IN PCM_KEY_NODE Parent,
+                       IN ULONG Count)
+{
+    PCM_SUBKEY_INDEX Index;
+    ULONG Size, i;
+
+    /* Keep the table at most half full so that probe chains stay short */
+    Size = CM_SUBKEY_INDEX_MIN_SIZE;
+    while (Size < 2 * Count)
+    {
+        /* Don't overflow on absurd counts from a corrupted hive */
+        if (Size >= 0x10000000) return NULL;
+        Size *= 2;
+    }
+
+    Index = Hive->Allocate(CmpSubKeyIndexAllocationSize(Size), TRUE, TAG_CM);
+    if (!Index) return NULL;
+
+    Index->Next = NULL;
+    Index->Parent = Parent;
+    Index->Count = 0;
+    Index->Used = 0;
+    Index->Size = Size;
+    for (i = 0; i < Size; i++)
+    {
+        Index->Entries[i].HashKey = 0;
+        Index->Entries[i].Cell = CM_SUBKEY_INDEX_FREE;
+    }
+
+    return Index;
+}
+
+static
+VOID
+CmpInsertSubKeyIndexEntry(IN PCM_SUBKEY_INDEX Index,
+                          IN ULONG HashKey,
+                          IN HCELL_INDEX Cell)
+{
+    ULONG Mask = Index->Size - 1;
+    ULONG i = HashKey & Mask;
+
+    /* Callers guarantee there's at least one free slot */
+    ASSERT(Index->Used < Index->Size);
+    while ((Index->Entries[i].Cell != CM_SUBKEY_INDEX_FREE) &&
+           (Index->Entries[i].Cell != CM_SUBKEY_INDEX_DELETED))
+    {
+        i = (i + 1) & Mask;
+    }
+
+    /* Reusing a tombstone doesn't make the table any fuller */
+    if (Index->Entries[i].Cell == CM_SUBKEY_INDEX_FREE) Index->Used++;
+    Index->Entries[i].HashKey = HashKey;
+    Index->Entries[i].Cell = Cell;
+    Index->Count++;
+}
+
+static
+HCELL_INDEX
+CmpLookupSubKeyIndex(IN PHHIVE Hive,
+                     IN PCM_SUBKEY_INDEX Index,
+                     IN ULONG HashKey,
+                     IN PCUNICODE_STRING SearchName)
+{
+    PCM_SUBKEY_INDEX_ENTRY Entry;
+    ULONG Mask = Index->Size - 1;
+    ULONG i = HashKey & Mask;
+
+    for (;;)
+    {
+        Entry = &Index->Entries[i];
+
+        /* A free slot ends the probe chain */
+        if (Entry->Cell == CM_SUBKEY_INDEX_FREE) return HCELL_NIL;
+
+        /* Compare the hash first, then the full name */
+        if ((Entry->Cell != CM_SUBKEY_INDEX_DELETED) &&
+            (Entry->HashKey == HashKey) &&
+            !(CmpDoCompareKeyName(Hive, SearchName, Entry->Cell)))
+        {
+            return Entry->Cell;
+        }
+
+        i = (i + 1) & Mask;
+    }
+}
+
+static
+PCM_SUBKEY_INDEX
+CmpGrowSubKeyIndex(IN PHHIVE Hive,
+                   IN PCM_SUBKEY_INDEX Index)
+{
+    PCM_SUBKEY_INDEX NewIndex;
+    ULONG i;
+
+    /* Rehash the live entries, which also gets rid of the tombstones */
+    NewIndex = CmpAllocateSubKeyIndex(Hive, Index->Parent, Index->Count + 1);
+    if (!NewIndex) return NULL;
+
+    NewIndex->Next = Index->Next;
+    for (i = 0; i < Index->Size; i++)
+    {
+        if ((Index->Entries[i].Cell != CM_SUBKEY_INDEX_FREE) &&
+            (Index->Entries[i].Cell != CM_SUBKEY_INDEX_DELETED))
+        {
+            CmpInsertSubKeyIndexEntry(NewIndex,
+                                      Index->Entries[i].HashKey,
+                                      Index->Entries[i].Cell);
+        }
+    }
+
+    CmpFreeSubKeyIndex(Hive, Index);
+    return NewIndex;
+}
+
+static
+BOOLEAN
+CmpAddLeafToSubKeyIndex(IN PHHIVE Hive,
+                        IN PCM_SUBKEY_INDEX Index,
+                        IN HCELL_INDEX LeafCell,
+                        IN ULONG Total)
+{
+    PCM_KEY_INDEX Leaf;
+    PCM_KEY_FAST_INDEX FastLeaf;
+    PCM_KEY_NODE Node;
+    HCELL_INDEX Cell;
+    ULONG HashKey, i;
+    BOOLEAN Result = FALSE;
+
+    Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
+    if (!Leaf) return FALSE;
+
+    /* Don't let a corrupted leaf overrun the table */
+    if (Leaf->Count > Total - Index->Count) goto Exit;
+
+    FastLeaf = (PCM_KEY_FAST_INDEX)Leaf;
+    for (i = 0; i < Leaf->Count; i++)
+    {
+        if (Leaf->Signature == CM_KEY_HASH_LEAF)
+        {
+            /* Hash leaves already store the very hash we use */
+            CmpInsertSubKeyIndexEntry(Index,
+                                      FastLeaf->List[i].HashKey,
+                                      FastLeaf->List[i].Cell);
+            continue;
+        }
+
+        if (Leaf->Signature == CM_KEY_FAST_LEAF)
+        {
+            Cell = FastLeaf->List[i].Cell;
+        }
+        else if (Leaf->Signature == CM_KEY_INDEX_LEAF)
+        {
+            Cell = Leaf->List[i];
+        }
+        else
+        {
+            goto Exit;
+        }
+
+        /* Otherwise hash the name from the key node itself */
+        Node = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
+        if (!Node) goto Exit;
+        HashKey = CmpComputeKeyNodeHash(Node);
+        HvReleaseCell(Hive, Cell);
+
+        CmpInsertSubKeyIndexEntry(Index, HashKey, Cell);
+    }
+
+    Result = TRUE;
+
+Exit:
+    HvReleaseCell(Hive, LeafCell);
+    return Result;
+}
+
+static
+PCM_SUBKEY_INDEX
+CmpBuildSubKeyIndex(IN PHHIVE Hive,
+                    IN PCM_KEY_NODE Parent,
+                    IN ULONG Total)
+{
+    PCM_SUBKEY_INDEX Index;
+    PCM_KEY_INDEX Root;
+    HCELL_INDEX ListCell;
+    ULONG i, j;
+    BOOLEAN Result = TRUE;
+
+    Index = CmpAllocateSubKeyIndex(Hive, Parent, Total);
+    if (!Index) return NULL;
+
+    /* Walk the leaves of every storage type, looking through index roots */
+    for (i = 0; (i < Hive->StorageTypeCount) && (Result); i++)
+    {
+        if (!Parent->SubKeyCounts[i]) continue;
+
+        ListCell = Parent->SubKeyLists[i];
+        Root = (PCM_KEY_INDEX)HvGetCell(Hive, ListCell);
+        if (!Root)
+        {
+            Result = FALSE;
+            break;
+        }
+
+        if (Root->Signature == CM_KEY_INDEX_ROOT)
+        {
+            for (j = 0; (j < Root->Count) && (Result); j++)
+            {
+                Result = CmpAddLeafToSubKeyIndex(Hive, Index, Root->List[j], Total);
+            }
+        }
+        else
+        {
+            Result = CmpAddLeafToSubKeyIndex(Hive, Index, ListCell, Total);
+        }
+
+        HvReleaseCell(Hive, ListCell);
+    }
+
+    /* The index is only trustworthy if it saw every subkey */
+    if (!(Result) || (Index->Count != Total))
+    {
+        DPRINT1("Failed to index the subkeys of %p (%lu of %lu)\n",
+                Parent, Index->Count, Total);
+        CmpFreeSubKeyIndex(Hive, Index);
+        return NULL;
+    }
+
+    return Index;
+}
+
+BOOLEAN
+NTAPI
+CmpInitializeSubKeyIndexCache(IN PHHIVE Hive,
+                              IN PCM_SUBKEY_INDEX_LOCK_ROUTINE Lock OPTIONAL,
+                              IN PCM_SUBKEY_INDEX_UNLOCK_ROUTINE Unlock OPTIONAL)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache;
+    ULONG i;
+
+    ASSERT(Hive->SubKeyIndexCache == NULL);
+
+    Cache = Hive->Allocate(sizeof(CM_SUBKEY_INDEX_CACHE), TRUE, TAG_CM);
+    if (!Cache) return FALSE;
+
+    Cache->Lock = Lock;
+    Cache->Unlock = Unlock;
+    for (i = 0; i < CM_SUBKEY_INDEX_BUCKETS; i++)
+    {
+        Cache->Buckets[i] = NULL;
+    }
+
+    Hive->SubKeyIndexCache = Cache;
+    return TRUE;
+}
+
+VOID
+NTAPI
+CmpFreeSubKeyIndexCache(IN PHHIVE Hive)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+    PCM_SUBKEY_INDEX Index;
+    ULONG i;
+
+    if (!Cache) return;
+
+    for (i = 0; i < CM_SUBKEY_INDEX_BUCKETS; i++)
+    {
+        while (Cache->Buckets[i])
+        {
+            Index = Cache->Buckets[i];
+            Cache->Buckets[i] = Index->Next;
+            CmpFreeSubKeyIndex(Hive, Index);
+        }
+    }
+
+    Hive->SubKeyIndexCache = NULL;
+    Hive->Free(Cache, sizeof(CM_SUBKEY_INDEX_CACHE));
+}
+
+BOOLEAN
+NTAPI
+CmpFindSubKeyInIndexCache(IN PHHIVE Hive,
+                          IN PCM_KEY_NODE Parent,
+                          IN PCUNICODE_STRING SearchName,
+                          OUT PHCELL_INDEX SubKey)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+    PCM_SUBKEY_INDEX *Link;
+    PCM_SUBKEY_INDEX Index;
+    ULONG HashKey, Total = 0, i;
+    BOOLEAN Found = FALSE;
+
+    /* Small parents are searched in the hive directly */
+    if (!Cache) return FALSE;
+    for (i = 0; i < Hive->StorageTypeCount; i++)
+    {
+        Total += Parent->SubKeyCounts[i];
+    }
+    if (Total < CM_SUBKEY_INDEX_THRESHOLD) return FALSE;
+
+    HashKey = CmpComputeHashKey(0, SearchName, FALSE);
+
+    /* Try an existing index first */
+    CmpLockSubKeyIndexCache(Hive, FALSE);
+    Index = *CmpFindSubKeyIndexLink(Cache, Parent);
+    if ((Index) && (Index->Count == Total))
+    {
+        *SubKey = CmpLookupSubKeyIndex(Hive, Index, HashKey, SearchName);
+        CmpUnlockSubKeyIndexCache(Hive);
+        return TRUE;
+    }
+    CmpUnlockSubKeyIndexCache(Hive);
+
+    /* Build the index, someone may have beaten us to it in the meantime */
+    CmpLockSubKeyIndexCache(Hive, TRUE);
+    Link = CmpFindSubKeyIndexLink(Cache, Parent);
+    Index = *Link;
+    if ((Index) && (Index->Count != Total))
+    {
+        /* The subkeys changed behind our back, start over */
+        *Link = Index->Next;
+        CmpFreeSubKeyIndex(Hive, Index);
+        Index = NULL;
+    }
+
+    if (!Index)
+    {
+        Index = CmpBuildSubKeyIndex(Hive, Parent, Total);
+        if (Index)
+        {
+            Index->Next = *Link;
+            *Link = Index;
+        }
+    }
+
+    if (Index)
+    {
+        *SubKey = CmpLookupSubKeyIndex(Hive, Index, HashKey, SearchName);
+        Found = TRUE;
+    }
+    CmpUnlockSubKeyIndexCache(Hive);
+
+    return Found;
+}
+
+VOID
+NTAPI
+CmpAddToSubKeyIndexCache(IN PHHIVE Hive,
+                         IN PCM_KEY_NODE Parent,
+                         IN PCUNICODE_STRING Name,
+                         IN HCELL_INDEX Child)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+    PCM_SUBKEY_INDEX *Link;
+    PCM_SUBKEY_INDEX Index;
+
+    if (!Cache) return;
+
+    CmpLockSubKeyIndexCache(Hive, TRUE);
+
+    Link = CmpFindSubKeyIndexLink(Cache, Parent);
+    Index = *Link;
+    if (Index)
+    {
+        /* Rehash into a bigger table once it gets three quarters full */
+        if ((Index->Used + 1) * 4 > Index->Size * 3)
+        {
+            Index = CmpGrowSubKeyIndex(Hive, Index);
+            if (!Index)
+            {
+                /* Drop it, it will be rebuilt on the next lookup */
+                Index = *Link;
+                *Link = Index->Next;
+                CmpFreeSubKeyIndex(Hive, Index);
+                Index = NULL;
+            }
+            else
+            {
+                *Link = Index;
+            }
+        }
+
+        if (Index)
+        {
+            CmpInsertSubKeyIndexEntry(Index,
+                                      CmpComputeHashKey(0, Name, FALSE),
+                                      Child);
+        }
+    }
+
+    CmpUnlockSubKeyIndexCache(Hive);
+}
+
+VOID
+NTAPI
+CmpRemoveFromSubKeyIndexCache(IN PHHIVE Hive,
+                              IN PCM_KEY_NODE Parent,
+                              IN HCELL_INDEX Child,
+                              IN PCM_KEY_NODE ChildNode)
+{
+    PCM_SUBKEY_INDEX_CACHE Cache = Hive->SubKeyIndexCache;
+    PCM_SUBKEY_INDEX *Link;
+    PCM_SUBKEY_INDEX Index;
+    ULONG Mask, i;
+
+    if (!Cache) return;
+
+    CmpLockSubKeyIndexCache(Hive, TRUE);
+
+    Link = CmpFindSubKeyIndexLink(Cache, Parent);
+    Index = *Link;
+    if (Index)
+    {
+        /* Leave a tombstone where the child was */
+        Mask = Index->Size - 1;
+        i = CmpComputeKeyNodeHash(ChildNode) & Mask;
+        while ((Index->Entries[i].Cell != CM_SUBKEY_INDEX_FREE) &&
+               (Index->Entries[i].Cell != Child))
+        {
+            i = (i + 1) & Mask;
+        }
+
+        if (Index->Entries[i].Cell == Child)
+        {
+            Index->Entries[i].Cell = CM_SUBKEY_INDEX_DELETED;
+            Index->Count--;
+        }
+        else
+        {
+            /* We never knew about this child, so the index can't be trusted */
+            *Link = Index->Next;
+            CmpFreeSubKeyIndex(Hive, Index);
+        }
+    }
+
+    /* The child's own cell is about to go away, and its index with it */
+    Link = CmpFindSubKeyIndexLink(Cache, ChildNode);
+    Index = *Link;
+    if (Index)
+    {
+        *Link = Index->Next;
+        CmpFreeSubKeyIndex(Hive, Index);
+    }
+
+    CmpUnlockSubKeyIndexCache(Hive);
+}
+
+/* EOF */
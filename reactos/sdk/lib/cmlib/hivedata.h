@@ -320,6 +320,9 @@ typedef struct _HHIVE
     ULONG StorageTypeCount;
     ULONG Version;
     DUAL Storage[HTYPE_COUNT];
+
+    /* ReactOS-specific, see cmsubidx.c */
+    struct _CM_SUBKEY_INDEX_CACHE *SubKeyIndexCache;
 } HHIVE, *PHHIVE;
 
 #define IsFreeCell(Cell)    ((Cell)->Size >= 0)
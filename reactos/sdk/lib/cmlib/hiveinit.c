@@ -620,6 +620,9 @@ VOID CMAPI
 HvFree(
     PHHIVE RegistryHive)
 {
+    /* Drop the subkey name indexes */
+    CmpFreeSubKeyIndexCache(RegistryHive);
+
     if (!RegistryHive->ReadOnly)
     {
         /* Release hive bitmap */
@@ -17,6 +17,22 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* Longest-prefix-match tries for IPv4 and IPv6 routes */
+static PFIB_NODE FIBTrie[2];
+
+/* Recently routed IPv4 destinations, flushed whenever the FIB changes */
+#define FIB_CACHE_SIZE 64
+
+typedef struct _FIB_CACHE_ENTRY {
+    IPv4_RAW_ADDRESS Destination;
+    PFIB_ENTRY Route;
+} FIB_CACHE_ENTRY, *PFIB_CACHE_ENTRY;
+
+static FIB_CACHE_ENTRY FIBCache[FIB_CACHE_SIZE];
+
+static VOID RouterPruneNode(PFIB_NODE Node);
+static VOID RouterFlushCache(VOID);
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -69,6 +85,11 @@ VOID DestroyFIBE(
     /* Unlink the FIB entry from the list */
     RemoveEntryList(&FIBE->ListEntry);
 
+    /* Take it out of the trie, and out of any cached lookup */
+    RemoveEntryList(&FIBE->NodeEntry);
+    RouterPruneNode(FIBE->Node);
+    RouterFlushCache();
+
     /* And free the FIB entry */
     FreeFIB(FIBE);
 }
@@ -186,6 +207,290 @@ UINT CommonPrefixLength(
 }
 
 
+static UINT RouterAddressBits(
+    PIP_ADDRESS Address)
+/*
+ * FUNCTION: Returns the number of bits in an address
+ */
+{
+    if (Address->Type == IP_ADDRESS_V4)
+        return 8 * sizeof(IPv4_RAW_ADDRESS);
+    else
+        return 8 * sizeof(IPv6_RAW_ADDRESS);
+}
+
+
+static UINT RouterAddressBit(
+    PIP_ADDRESS Address,
+    UINT Bit)
+/*
+ * FUNCTION: Returns one bit of an address, counting from the most significant one
+ */
+{
+    PUCHAR Bytes = (PUCHAR)&Address->Address.IPv4Address;
+
+    return (Bytes[Bit / 8] >> (7 - (Bit % 8))) & 1;
+}
+
+
+static PFIB_NODE *RouterTrieRoot(
+    PIP_ADDRESS Address)
+{
+    return &FIBTrie[(Address->Type == IP_ADDRESS_V4) ? 0 : 1];
+}
+
+
+static PFIB_NODE RouterCreateNode(
+    PIP_ADDRESS Prefix,
+    UINT PrefixLength)
+/*
+ * FUNCTION: Creates a trie node for a prefix
+ * ARGUMENTS:
+ *     Prefix       = Address the prefix is taken from
+ *     PrefixLength = Number of significant bits
+ * RETURNS:
+ *     Pointer to the new node, NULL if out of memory
+ */
+{
+    PFIB_NODE Node;
+    PUCHAR Bytes;
+    UINT i;
+
+    Node = ExAllocatePoolWithTag(NonPagedPool, sizeof(FIB_NODE), FIB_NODE_TAG);
+    if (!Node)
+        return NULL;
+
+    Node->Parent = NULL;
+    Node->Child[0] = NULL;
+    Node->Child[1] = NULL;
+    Node->Prefix = *Prefix;
+    Node->PrefixLength = PrefixLength;
+    InitializeListHead(&Node->Routes);
+
+    /* Clear the host part so that prefixes compare bit for bit */
+    Bytes = (PUCHAR)&Node->Prefix.Address.IPv4Address;
+    for (i = PrefixLength; i < RouterAddressBits(Prefix); i++)
+        Bytes[i / 8] &= ~(0x80 >> (i % 8));
+
+    return Node;
+}
+
+
+static UINT RouterMatchLength(
+    PIP_ADDRESS Address,
+    PFIB_NODE Node,
+    UINT Limit)
+/*
+ * FUNCTION: Computes how many leading bits an address shares with a node
+ * RETURNS:
+ *     The common prefix length, capped to the node's length and Limit
+ */
+{
+    UINT Length = CommonPrefixLength(Address, &Node->Prefix);
+
+    return min(Length, min(Node->PrefixLength, Limit));
+}
+
+
+static PFIB_NODE RouterInsertNode(
+    PFIB_ENTRY FIBE)
+/*
+ * FUNCTION: Finds or creates the trie node for the prefix of a FIB entry
+ * ARGUMENTS:
+ *     FIBE = Pointer to FIB entry
+ * RETURNS:
+ *     Pointer to the node, NULL if out of memory
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE *Link, Node, Parent = NULL, NewNode, Branch;
+    PIP_ADDRESS Key = &FIBE->NetworkAddress;
+    UINT Length, Common;
+
+    Length = AddrCountPrefixBits(&FIBE->Netmask);
+    Link = RouterTrieRoot(Key);
+
+    for (;;) {
+        Node = *Link;
+        if (!Node) {
+            /* Fell off the trie, hang a new leaf here */
+            NewNode = RouterCreateNode(Key, Length);
+            if (!NewNode)
+                return NULL;
+
+            NewNode->Parent = Parent;
+            *Link = NewNode;
+            return NewNode;
+        }
+
+        Common = RouterMatchLength(Key, Node, Length);
+        if (Common == Node->PrefixLength) {
+            /* This node is our prefix or one of its ancestors */
+            if (Node->PrefixLength == Length)
+                return Node;
+
+            Parent = Node;
+            Link = &Node->Child[RouterAddressBit(Key, Node->PrefixLength)];
+            continue;
+        }
+
+        /* The paths diverge inside this node's prefix, split it */
+        NewNode = RouterCreateNode(Key, Length);
+        if (!NewNode)
+            return NULL;
+
+        if (Common == Length) {
+            /* Our prefix sits between the node and its parent */
+            NewNode->Child[RouterAddressBit(&Node->Prefix, Length)] = Node;
+            NewNode->Parent = Parent;
+            Node->Parent = NewNode;
+            *Link = NewNode;
+            return NewNode;
+        }
+
+        /* Add a branch node where the two prefixes part ways */
+        Branch = RouterCreateNode(Key, Common);
+        if (!Branch) {
+            ExFreePoolWithTag(NewNode, FIB_NODE_TAG);
+            return NULL;
+        }
+
+        Branch->Child[RouterAddressBit(Key, Common)] = NewNode;
+        Branch->Child[RouterAddressBit(&Node->Prefix, Common)] = Node;
+        Branch->Parent = Parent;
+        NewNode->Parent = Branch;
+        Node->Parent = Branch;
+        *Link = Branch;
+        return NewNode;
+    }
+}
+
+
+static VOID RouterPruneNode(
+    PFIB_NODE Node)
+/*
+ * FUNCTION: Removes trie nodes which no longer carry routes or branch
+ * ARGUMENTS:
+ *     Node = Pointer to the node that just lost a route
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PFIB_NODE Parent, Child, *Link;
+
+    while (Node && IsListEmpty(&Node->Routes) &&
+           !(Node->Child[0] && Node->Child[1])) {
+        Parent = Node->Parent;
+        Child = Node->Child[0] ? Node->Child[0] : Node->Child[1];
+
+        if (Parent)
+            Link = &Parent->Child[Parent->Child[0] == Node ? 0 : 1];
+        else
+            Link = RouterTrieRoot(&Node->Prefix);
+
+        /* Splice the only child, if any, into our place */
+        *Link = Child;
+        if (Child)
+            Child->Parent = Parent;
+
+        ExFreePoolWithTag(Node, FIB_NODE_TAG);
+
+        /* With a child in our place the parent still branches the same way */
+        if (Child)
+            break;
+
+        Node = Parent;
+    }
+}
+
+
+static BOOLEAN RouterIsUsable(
+    PFIB_ENTRY FIBE)
+{
+    UCHAR State = FIBE->Router->State;
+
+    return !(State & NUD_STALE) && !(State & NUD_INCOMPLETE);
+}
+
+
+static PFIB_ENTRY RouterLookup(
+    PIP_ADDRESS Destination,
+    PBOOLEAN Cacheable)
+/*
+ * FUNCTION: Finds the most specific route to a destination
+ * ARGUMENTS:
+ *     Destination = Pointer to destination address
+ *     Cacheable   = Set to TRUE if the result can't change until the FIB does,
+ *                   i.e. no route was passed over because its router wasn't reachable
+ * RETURNS:
+ *     Pointer to FIB entry, NULL if no route matches
+ * NOTES:
+ *     The forward information base lock must be held when called.
+ *     Routes whose router is reachable are preferred over more specific
+ *     ones whose router isn't, and lower metrics win within a prefix
+ */
+{
+    PFIB_NODE Matches[8 * sizeof(IPv6_RAW_ADDRESS) + 1];
+    PFIB_NODE Node;
+    PLIST_ENTRY CurrentEntry;
+    PFIB_ENTRY Current, Best, Fallback = NULL;
+    UINT Count = 0, Bits = RouterAddressBits(Destination);
+
+    *Cacheable = TRUE;
+
+    /* Collect every node on the path whose prefix covers the destination */
+    Node = *RouterTrieRoot(Destination);
+    while (Node && RouterMatchLength(Destination, Node, Bits) == Node->PrefixLength) {
+        if (!IsListEmpty(&Node->Routes))
+            Matches[Count++] = Node;
+
+        if (Node->PrefixLength >= Bits)
+            break;
+
+        Node = Node->Child[RouterAddressBit(Destination, Node->PrefixLength)];
+    }
+
+    /* Try the most specific prefixes first */
+    while (Count--) {
+        Best = NULL;
+        CurrentEntry = Matches[Count]->Routes.Flink;
+        while (CurrentEntry != &Matches[Count]->Routes) {
+            Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, NodeEntry);
+
+            if (!Fallback)
+                Fallback = Current;
+
+            if (!RouterIsUsable(Current))
+                *Cacheable = FALSE;
+            else if (!Best || Current->Metric < Best->Metric)
+                Best = Current;
+
+            CurrentEntry = CurrentEntry->Flink;
+        }
+
+        if (Best)
+            return Best;
+    }
+
+    /* Nothing reachable, go with the most specific route anyway */
+    *Cacheable = FALSE;
+    return Fallback;
+}
+
+
+static VOID RouterFlushCache(
+    VOID)
+/*
+ * FUNCTION: Invalidates the per-destination route cache
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    RtlZeroMemory(FIBCache, sizeof(FIBCache));
+}
+
+
 PFIB_ENTRY RouterAddRoute(
     PIP_ADDRESS NetworkAddress,
     PIP_ADDRESS Netmask,
@@ -206,6 +511,7 @@ PFIB_ENTRY RouterAddRoute(
  *     these references
  */
 {
+    KIRQL OldIrql;
     PFIB_ENTRY FIBE;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
@@ -229,8 +535,23 @@ PFIB_ENTRY RouterAddRoute(
     FIBE->Router         = Router;
     FIBE->Metric         = Metric;
 
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+
+    /* Find the trie node for this prefix */
+    FIBE->Node = RouterInsertNode(FIBE);
+    if (!FIBE->Node) {
+        TcpipReleaseSpinLock(&FIBLock, OldIrql);
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        FreeFIB(FIBE);
+        return NULL;
+    }
+
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    InsertTailList(&FIBE->Node->Routes, &FIBE->NodeEntry);
+    RouterFlushCache();
+
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
@@ -248,12 +569,10 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
  */
 {
     KIRQL OldIrql;
-    PLIST_ENTRY CurrentEntry;
-    PLIST_ENTRY NextEntry;
-    PFIB_ENTRY Current;
-    UCHAR State;
-    UINT Length, BestLength = 0, MaskLength;
-    PNEIGHBOR_CACHE_ENTRY NCE, BestNCE = NULL;
+    PFIB_ENTRY Route;
+    BOOLEAN Cacheable;
+    PFIB_CACHE_ENTRY CacheEntry = NULL;
+    PNEIGHBOR_CACHE_ENTRY BestNCE = NULL;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
 
@@ -261,29 +580,30 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
 
-    CurrentEntry = FIBListHead.Flink;
-    while (CurrentEntry != &FIBListHead) {
-        NextEntry = CurrentEntry->Flink;
-	    Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
-
-        NCE   = Current->Router;
-        State = NCE->State;
-
-	Length = CommonPrefixLength(Destination, &Current->NetworkAddress);
-	MaskLength = AddrCountPrefixBits(&Current->Netmask);
-
-	TI_DbgPrint(DEBUG_ROUTER,("This-Route: %s (Sharing %d bits)\n",
-				  A2S(&NCE->Address), Length));
+    /* Most packets go where the previous ones went */
+    if (Destination->Type == IP_ADDRESS_V4) {
+        CacheEntry = &FIBCache[(Destination->Address.IPv4Address ^
+                                (Destination->Address.IPv4Address >> 16)) % FIB_CACHE_SIZE];
+        Route = CacheEntry->Route;
+        if (Route && CacheEntry->Destination == Destination->Address.IPv4Address &&
+            RouterIsUsable(Route)) {
+            BestNCE = Route->Router;
+            TcpipReleaseSpinLock(&FIBLock, OldIrql);
+            return BestNCE;
+        }
+    }
 
-	if(Length >= MaskLength && (Length > BestLength || !BestNCE) &&
-           ((!(State & NUD_STALE) && !(State & NUD_INCOMPLETE)) || !BestNCE)) {
-	    /* This seems to be a better router */
-	    BestNCE    = NCE;
-	    BestLength = Length;
-	    TI_DbgPrint(DEBUG_ROUTER,("Route selected\n"));
-	}
+    Route = RouterLookup(Destination, &Cacheable);
+    if (Route) {
+        BestNCE = Route->Router;
+        TI_DbgPrint(DEBUG_ROUTER,("Route selected: %s/%d\n",
+                                  A2S(&Route->Node->Prefix), Route->Node->PrefixLength));
 
-        CurrentEntry = NextEntry;
+        /* Only remember routes that no neighbor state change could displace */
+        if (CacheEntry && Cacheable) {
+            CacheEntry->Destination = Destination->Address.IPv4Address;
+            CacheEntry->Route = Route;
+        }
     }
 
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
@@ -492,6 +812,9 @@ NTSTATUS RouterStartup(
     /* Initialize the Forward Information Base */
     InitializeListHead(&FIBListHead);
     TcpipInitializeSpinLock(&FIBLock);
+    FIBTrie[0] = NULL;
+    FIBTrie[1] = NULL;
+    RouterFlushCache();
 
     return STATUS_SUCCESS;
 }
@@ -11,6 +11,10 @@
 
 #include <rtl.h>
 
+#ifdef _M_AMD64
+#include <emmintrin.h>
+#endif
+
 #define NDEBUG
 #include <debug.h>
 
@@ -65,34 +69,98 @@ typedef ULONG BITMAP_INDEX, *PBITMAP_INDEX;
 typedef ULONG BITMAP_BUFFER, *PBITMAP_BUFFER;
 #endif
 
-/* DATA *********************************************************************/
+/* PRIVATE FUNCTIONS ********************************************************/
 
-/* Number of set bits per byte value */
-static const
-UCHAR
-BitCountTable[256] =
+/* Number of set bits in a word, counted in parallel within the word */
+static __inline
+BITMAP_INDEX
+RtlpCountBits(
+    _In_ BITMAP_BUFFER Value)
 {
-    /* x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF */
-       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, /* 0x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 1x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 2x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 3x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 4x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 5x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 6c */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* 7x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 8x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 9x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Ax */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Bx */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Cx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Dx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Ex */
-       4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8  /* Fx */
-};
+    Value = Value - ((Value >> 1) & ((BITMAP_BUFFER)~0 / 3));
+    Value = (Value & ((BITMAP_BUFFER)~0 / 15 * 3)) + ((Value >> 2) & ((BITMAP_BUFFER)~0 / 15 * 3));
+    Value = (Value + (Value >> 4)) & ((BITMAP_BUFFER)~0 / 255 * 15);
+    return (BITMAP_INDEX)((Value * ((BITMAP_BUFFER)~0 / 255)) >> (_BITCOUNT - 8));
+}
 
+/*
+ * Returns the first word in [Buffer, MaxBuffer) that differs from Pattern,
+ * or MaxBuffer. This is where long runs spend their time, so on amd64,
+ * where SSE2 is always there and usable in kernel mode, compare 64 bytes
+ * at a time. Nothing past MaxBuffer is ever read. Pattern is either all
+ * clear or all set, so it can be replicated as 32 bit lanes.
+ */
+static __inline
+PBITMAP_BUFFER
+RtlpSkipWords(
+    _In_ PBITMAP_BUFFER Buffer,
+    _In_ PBITMAP_BUFFER MaxBuffer,
+    _In_ BITMAP_BUFFER Pattern)
+{
+#ifdef _M_AMD64
+    __m128i Wide, Block;
 
-/* PRIVATE FUNCTIONS ********************************************************/
+    /* Align to the SSE2 block size */
+    while (Buffer < MaxBuffer && ((ULONG_PTR)Buffer & 15) != 0)
+    {
+        if (*Buffer != Pattern) return Buffer;
+        Buffer++;
+    }
+
+    Wide = _mm_set1_epi32((int)Pattern);
+    while ((ULONG_PTR)MaxBuffer - (ULONG_PTR)Buffer >= 64)
+    {
+        Block = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi32(_mm_load_si128((__m128i*)Buffer), Wide),
+                                            _mm_cmpeq_epi32(_mm_load_si128((__m128i*)Buffer + 1), Wide)),
+                              _mm_and_si128(_mm_cmpeq_epi32(_mm_load_si128((__m128i*)Buffer + 2), Wide),
+                                            _mm_cmpeq_epi32(_mm_load_si128((__m128i*)Buffer + 3), Wide)));
+        if (_mm_movemask_epi8(Block) != 0xFFFF) break;
+        Buffer += 64 / sizeof(BITMAP_BUFFER);
+    }
+#else
+    /* Compare a few words at once to keep the loop short */
+    while (MaxBuffer - Buffer >= 4)
+    {
+        if (((Buffer[0] ^ Pattern) | (Buffer[1] ^ Pattern) |
+             (Buffer[2] ^ Pattern) | (Buffer[3] ^ Pattern)) != 0) break;
+        Buffer += 4;
+    }
+#endif
+
+    while (Buffer < MaxBuffer && *Buffer == Pattern)
+    {
+        Buffer++;
+    }
+
+    return Buffer;
+}
+
+#ifdef _M_AMD64
+/* Set bits in Count aligned 16 byte blocks, counted per byte and summed with PSADBW */
+static
+ULONG64
+RtlpCountBitsSse2(
+    _In_ const __m128i *Block,
+    _In_ SIZE_T Count)
+{
+    const __m128i Mask1 = _mm_set1_epi8(0x55);
+    const __m128i Mask2 = _mm_set1_epi8(0x33);
+    const __m128i Mask4 = _mm_set1_epi8(0x0F);
+    __m128i Value, Sum = _mm_setzero_si128();
+
+    for (; Count > 0; Count--, Block++)
+    {
+        Value = _mm_load_si128(Block);
+        Value = _mm_sub_epi8(Value, _mm_and_si128(_mm_srli_epi64(Value, 1), Mask1));
+        Value = _mm_add_epi8(_mm_and_si128(Value, Mask2),
+                             _mm_and_si128(_mm_srli_epi64(Value, 2), Mask2));
+        Value = _mm_and_si128(_mm_add_epi8(Value, _mm_srli_epi64(Value, 4)), Mask4);
+        Sum = _mm_add_epi64(Sum, _mm_sad_epu8(Value, _mm_setzero_si128()));
+    }
+
+    return _mm_cvtsi128_si64(Sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(Sum, Sum));
+}
+#endif
 
 static __inline
 BITMAP_INDEX
@@ -121,9 +189,10 @@ RtlpGetLengthOfRunClear(
     Value = *Buffer++ >> BitPos << BitPos;
 
     /* Skip all clear ULONGs */
-    while (Value == 0 && Buffer < MaxBuffer)
+    if (Value == 0)
     {
-        Value = *Buffer++;
+        Buffer = RtlpSkipWords(Buffer, MaxBuffer, 0);
+        if (Buffer < MaxBuffer) Value = *Buffer++;
     }
 
     /* Did we reach the end? */
@@ -175,9 +244,10 @@ RtlpGetLengthOfRunSet(
     InvValue = ~(*Buffer++) >> BitPos << BitPos;
 
     /* Skip all set ULONGs */
-    while (InvValue == 0 && Buffer < MaxBuffer)
+    if (InvValue == 0)
     {
-        InvValue = ~(*Buffer++);
+        Buffer = RtlpSkipWords(Buffer, MaxBuffer, (BITMAP_BUFFER)MAXINDEX);
+        if (Buffer < MaxBuffer) InvValue = ~(*Buffer++);
     }
 
     /* Did we reach the end? */
@@ -474,22 +544,38 @@ NTAPI
 RtlNumberOfSetBits(
     _In_ PRTL_BITMAP BitMapHeader)
 {
-    PUCHAR Byte, MaxByte;
+    PBITMAP_BUFFER Buffer, MaxBuffer;
     BITMAP_INDEX BitCount = 0;
     ULONG Shift;
 
-    Byte = (PUCHAR)BitMapHeader->Buffer;
-    MaxByte = Byte + BitMapHeader->SizeOfBitMap / 8;
+    Buffer = BitMapHeader->Buffer;
+    MaxBuffer = Buffer + BitMapHeader->SizeOfBitMap / _BITCOUNT;
 
-    while (Byte < MaxByte)
+#ifdef _M_AMD64
+    /* Count the aligned middle part 16 bytes at a time */
+    while (Buffer < MaxBuffer && ((ULONG_PTR)Buffer & 15) != 0)
     {
-        BitCount += BitCountTable[*Byte++];
+        BitCount += RtlpCountBits(*Buffer++);
     }
 
-    if (BitMapHeader->SizeOfBitMap & 7)
+    if (MaxBuffer - Buffer >= 16 / sizeof(BITMAP_BUFFER))
     {
-        Shift = 8 - (BitMapHeader->SizeOfBitMap & 7);
-        BitCount += BitCountTable[((*Byte) << Shift) & 0xFF];
+        BitCount += (BITMAP_INDEX)RtlpCountBitsSse2((const __m128i*)Buffer,
+                                                    (MaxBuffer - Buffer) / (16 / sizeof(BITMAP_BUFFER)));
+        Buffer += (MaxBuffer - Buffer) & ~(16 / sizeof(BITMAP_BUFFER) - 1);
+    }
+#endif
+
+    while (Buffer < MaxBuffer)
+    {
+        BitCount += RtlpCountBits(*Buffer++);
+    }
+
+    /* Only count the bits of the last word that belong to the bitmap */
+    if (BitMapHeader->SizeOfBitMap & (_BITCOUNT - 1))
+    {
+        Shift = _BITCOUNT - (BitMapHeader->SizeOfBitMap & (_BITCOUNT - 1));
+        BitCount += RtlpCountBits(*Buffer << Shift);
     }
 
     return BitCount;
@@ -537,7 +623,7 @@ retry:
     CurrentBit = HintIndex;
 
     /* Loop until something is found or the end is reached */
-    while (CurrentBit + NumberToFind < Margin)
+    while (CurrentBit + NumberToFind <= Margin)
     {
         /* Search for the next clear run, by skipping a set run */
         CurrentBit += RtlpGetLengthOfRunSet(BitMapHeader,
@@ -873,7 +959,7 @@ RtlFindClearRuns(
             for (Run = 0; Run < SizeOfRunArray; Run++)
             {
                 /*Is this the new smallest run? */
-                if (NumberOfBits < RunArray[SmallestRun].NumberOfBits)
+                if (RunArray[Run].NumberOfBits < RunArray[SmallestRun].NumberOfBits)
                 {
                     /* Set it as new smallest run */
                     SmallestRun = Run;
@@ -881,8 +967,8 @@ RtlFindClearRuns(
             }
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits, past the end of this run */
+        FromIndex = StartingIndex + NumberOfBits;
     }
 
     return Run;
@@ -914,8 +1000,8 @@ RtlFindLongestRunClear(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits, past the end of this run */
+        FromIndex = Index + NumberOfBits;
     }
 
     return MaxNumberOfBits;
@@ -947,8 +1033,8 @@ RtlFindLongestRunSet(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Advance bits, past the end of this run */
+        FromIndex = Index + NumberOfBits;
     }
 
     return MaxNumberOfBits;
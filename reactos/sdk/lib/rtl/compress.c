@@ -270,6 +270,1045 @@ RtlpWorkSpaceSizeLZNT1(USHORT Engine,
 }
 
 
+/* XPRESS (plain LZ77) and XPRESS Huffman (LZ77+Huffman) as described in [MS-XCA] */
+
+#define XPRESS_MIN_MATCH                3
+#define XPRESS_MAX_OFFSET               8192
+#define XPRESS_WINDOW_SIZE              8192
+#define XPRESS_HUFF_MAX_OFFSET          65535
+#define XPRESS_HUFF_WINDOW_SIZE         65536
+#define XPRESS_HUFF_MAX_LENGTH          65535
+#define XPRESS_HUFF_BLOCK_SIZE          65536
+#define XPRESS_HUFF_SYMBOLS             512
+#define XPRESS_HUFF_TABLE_SIZE          (XPRESS_HUFF_SYMBOLS / 2)
+#define XPRESS_HUFF_MAX_CODE_LENGTH     15
+#define XPRESS_HUFF_LOOKUP_BITS         10
+#define XPRESS_HUFF_END_OF_STREAM       256
+#define XPRESS_HASH_BITS                13
+#define XPRESS_HASH_SIZE                (1 << XPRESS_HASH_BITS)
+#define XPRESS_NO_POSITION              0xFFFFFFFF
+
+#define TAG_COMPRESS                    'RTCX'
+
+typedef struct _XPRESS_MATCH_FINDER
+{
+    PUCHAR Buffer;
+    ULONG Size;
+    ULONG MaxOffset;
+    ULONG WindowMask;
+    ULONG MaxChain;
+    ULONG NiceLength;
+    BOOLEAN Lazy;
+    /* Symbol 256 also ends a Huffman stream, so never return a match it would code */
+    BOOLEAN AvoidEndOfStream;
+    ULONG PendingPosition;
+    ULONG PendingLength;
+    ULONG PendingOffset;
+    PULONG Head;
+    PUSHORT Prev;
+} XPRESS_MATCH_FINDER, *PXPRESS_MATCH_FINDER;
+
+typedef struct _XPRESS_WORKSPACE
+{
+    ULONG Head[XPRESS_HASH_SIZE];
+    USHORT Prev[XPRESS_WINDOW_SIZE];
+} XPRESS_WORKSPACE, *PXPRESS_WORKSPACE;
+
+typedef struct _XPRESS_HUFF_WORKSPACE
+{
+    ULONG Head[XPRESS_HASH_SIZE];
+    USHORT Prev[XPRESS_HUFF_WINDOW_SIZE];
+    /* Literals, or matches as (Length << 16) | Offset */
+    ULONG Items[XPRESS_HUFF_BLOCK_SIZE];
+    ULONG Frequencies[XPRESS_HUFF_SYMBOLS];
+    ULONG SortKeys[XPRESS_HUFF_SYMBOLS];
+    USHORT SortSymbols[XPRESS_HUFF_SYMBOLS];
+    USHORT Codes[XPRESS_HUFF_SYMBOLS];
+    UCHAR Lengths[XPRESS_HUFF_SYMBOLS];
+} XPRESS_HUFF_WORKSPACE, *PXPRESS_HUFF_WORKSPACE;
+
+typedef struct _XPRESS_HUFF_DECODER
+{
+    /* (Length << 9) | Symbol for the codes up to XPRESS_HUFF_LOOKUP_BITS long, 0 otherwise */
+    USHORT Lookup[1 << XPRESS_HUFF_LOOKUP_BITS];
+    /* Symbols in canonical order, for the longer codes */
+    USHORT Symbols[XPRESS_HUFF_SYMBOLS];
+    USHORT Count[XPRESS_HUFF_MAX_CODE_LENGTH + 1];
+    USHORT FirstCode[XPRESS_HUFF_MAX_CODE_LENGTH + 1];
+    USHORT FirstIndex[XPRESS_HUFF_MAX_CODE_LENGTH + 1];
+} XPRESS_HUFF_DECODER, *PXPRESS_HUFF_DECODER;
+
+typedef struct _XPRESS_OUTPUT
+{
+    PUCHAR Current;
+    PUCHAR End;
+    PUCHAR FlagsPosition;
+    PUCHAR NibblePosition;
+    ULONG Flags;
+    ULONG FlagCount;
+} XPRESS_OUTPUT, *PXPRESS_OUTPUT;
+
+typedef struct _XPRESS_BIT_WRITER
+{
+    PUCHAR Current;
+    PUCHAR End;
+    /* The decoder reads two words ahead, so the bits go to two reserved words */
+    PUCHAR Word1;
+    PUCHAR Word2;
+    ULONG Bits;
+    ULONG FreeBits;
+} XPRESS_BIT_WRITER, *PXPRESS_BIT_WRITER;
+
+typedef struct _XPRESS_BIT_READER
+{
+    PUCHAR Current;
+    PUCHAR End;
+    ULONG Bits;
+    LONG ExtraBits;
+} XPRESS_BIT_READER, *PXPRESS_BIT_READER;
+
+static __inline ULONG
+RtlpXpressHash(PUCHAR Data)
+{
+    ULONG Value = Data[0] | (Data[1] << 8) | (Data[2] << 16);
+
+    return (Value * 0x9E3779B1) >> (32 - XPRESS_HASH_BITS);
+}
+
+static VOID
+RtlpXpressInitMatchFinder(PXPRESS_MATCH_FINDER Finder,
+                          PUCHAR Buffer,
+                          ULONG Size,
+                          ULONG MaxOffset,
+                          ULONG WindowSize,
+                          USHORT Engine,
+                          PULONG Head,
+                          PUSHORT Prev)
+{
+    Finder->Buffer = Buffer;
+    Finder->Size = Size;
+    Finder->MaxOffset = MaxOffset;
+    Finder->WindowMask = WindowSize - 1;
+    Finder->AvoidEndOfStream = FALSE;
+    Finder->PendingPosition = XPRESS_NO_POSITION;
+    Finder->Head = Head;
+    Finder->Prev = Prev;
+
+    /* The maximum engine walks long chains and defers matches by one byte */
+    if (Engine == COMPRESSION_ENGINE_MAXIMUM)
+    {
+        Finder->MaxChain = 256;
+        Finder->NiceLength = 258;
+        Finder->Lazy = TRUE;
+    }
+    else
+    {
+        Finder->MaxChain = 8;
+        Finder->NiceLength = 32;
+        Finder->Lazy = FALSE;
+    }
+
+    RtlFillMemory(Head, XPRESS_HASH_SIZE * sizeof(ULONG), 0xFF);
+}
+
+static __inline VOID
+RtlpXpressInsert(PXPRESS_MATCH_FINDER Finder, ULONG Position)
+{
+    ULONG Hash = RtlpXpressHash(Finder->Buffer + Position);
+    ULONG Last = Finder->Head[Hash];
+
+    /* Chains are kept as distances, a zero one ends the chain */
+    if (Last != XPRESS_NO_POSITION && Position - Last <= Finder->MaxOffset)
+        Finder->Prev[Position & Finder->WindowMask] = (USHORT)(Position - Last);
+    else
+        Finder->Prev[Position & Finder->WindowMask] = 0;
+    Finder->Head[Hash] = Position;
+}
+
+/* find the longest match for Position and add Position to the hash chains */
+static ULONG
+RtlpXpressFindMatch(PXPRESS_MATCH_FINDER Finder,
+                    ULONG Position,
+                    ULONG MaxLength,
+                    PULONG Offset)
+{
+    PUCHAR Current = Finder->Buffer + Position, Candidate;
+    ULONG Match, Length, BestLength = 0, Chain, Delta;
+
+    if (Position + XPRESS_MIN_MATCH > Finder->Size)
+        return 0;
+
+    Match = Finder->Head[RtlpXpressHash(Current)];
+    for (Chain = (MaxLength >= XPRESS_MIN_MATCH) ? Finder->MaxChain : 0;
+         Chain > 0 && Match != XPRESS_NO_POSITION && Position - Match <= Finder->MaxOffset;
+         Chain--)
+    {
+        Candidate = Finder->Buffer + Match;
+
+        /* Only candidates which could beat the best match are compared */
+        if (Candidate[BestLength] == Current[BestLength] &&
+            Candidate[0] == Current[0] && Candidate[1] == Current[1])
+        {
+            for (Length = 2; Length < MaxLength && Candidate[Length] == Current[Length]; Length++);
+
+            if (Length > BestLength &&
+                !(Finder->AvoidEndOfStream && Length == XPRESS_MIN_MATCH && Position - Match == 1))
+            {
+                BestLength = Length;
+                *Offset = Position - Match;
+                if (Length >= Finder->NiceLength || Length == MaxLength)
+                    break;
+            }
+        }
+
+        Delta = Finder->Prev[Match & Finder->WindowMask];
+        if (Delta == 0)
+            break;
+        Match -= Delta;
+    }
+
+    RtlpXpressInsert(Finder, Position);
+
+    return (BestLength >= XPRESS_MIN_MATCH) ? BestLength : 0;
+}
+
+/* choose what to code at Position: a match, or 0 for a literal */
+static ULONG
+RtlpXpressParse(PXPRESS_MATCH_FINDER Finder,
+                ULONG Position,
+                ULONG MaxLength,
+                PULONG Offset)
+{
+    ULONG Length, NextLength, NextOffset, Skip = 1;
+
+    if (Finder->PendingPosition == Position)
+    {
+        Length = Finder->PendingLength;
+        *Offset = Finder->PendingOffset;
+        Finder->PendingPosition = XPRESS_NO_POSITION;
+    }
+    else
+    {
+        Length = RtlpXpressFindMatch(Finder, Position, MaxLength, Offset);
+    }
+
+    if (Length == 0)
+        return 0;
+
+    /* Lazy evaluation: a literal is better if the next byte starts a longer match */
+    if (Finder->Lazy && Length < Finder->NiceLength && Length < MaxLength)
+    {
+        NextLength = RtlpXpressFindMatch(Finder, Position + 1, MaxLength - 1, &NextOffset);
+        if (NextLength > Length)
+        {
+            Finder->PendingPosition = Position + 1;
+            Finder->PendingLength = NextLength;
+            Finder->PendingOffset = NextOffset;
+            return 0;
+        }
+        Skip = 2;
+    }
+
+    /* Hash the positions inside the match too */
+    for (; Skip < Length && Position + Skip + XPRESS_MIN_MATCH <= Finder->Size; Skip++)
+        RtlpXpressInsert(Finder, Position + Skip);
+
+    return Length;
+}
+
+static __inline BOOLEAN
+RtlpXpressPutFlag(PXPRESS_OUTPUT Output, ULONG Flag)
+{
+    Output->Flags = (Output->Flags << 1) | Flag;
+    if (++Output->FlagCount == 32)
+    {
+        *(ULONG UNALIGNED *)Output->FlagsPosition = Output->Flags;
+        if (Output->End - Output->Current < sizeof(ULONG))
+            return FALSE;
+        Output->FlagsPosition = Output->Current;
+        Output->Current += sizeof(ULONG);
+        Output->Flags = 0;
+        Output->FlagCount = 0;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+RtlpXpressPutMatch(PXPRESS_OUTPUT Output, ULONG Length, ULONG Offset)
+{
+    PUCHAR Current = Output->Current;
+    USHORT Token = (USHORT)((Offset - 1) << 3);
+
+    /* token, length nibble, length byte and the 16 and 32 bit lengths */
+    if (Output->End - Current < 10)
+        return FALSE;
+
+    Length -= XPRESS_MIN_MATCH;
+    if (Length < 7)
+    {
+        *(USHORT UNALIGNED *)Current = Token | (USHORT)Length;
+        Current += sizeof(USHORT);
+    }
+    else
+    {
+        *(USHORT UNALIGNED *)Current = Token | 7;
+        Current += sizeof(USHORT);
+        Length -= 7;
+
+        /* Two length nibbles share one byte */
+        if (Output->NibblePosition == NULL)
+        {
+            Output->NibblePosition = Current;
+            *Current++ = (UCHAR)min(Length, 15);
+        }
+        else
+        {
+            *Output->NibblePosition |= (UCHAR)(min(Length, 15) << 4);
+            Output->NibblePosition = NULL;
+        }
+
+        if (Length >= 15)
+        {
+            Length -= 15;
+            if (Length < 255)
+            {
+                *Current++ = (UCHAR)Length;
+            }
+            else
+            {
+                *Current++ = 255;
+                Length += 15 + 7;
+                if (Length <= 0xFFFF)
+                {
+                    *(USHORT UNALIGNED *)Current = (USHORT)Length;
+                    Current += sizeof(USHORT);
+                }
+                else
+                {
+                    *(USHORT UNALIGNED *)Current = 0;
+                    Current += sizeof(USHORT);
+                    *(ULONG UNALIGNED *)Current = Length;
+                    Current += sizeof(ULONG);
+                }
+            }
+        }
+    }
+
+    Output->Current = Current;
+    return RtlpXpressPutFlag(Output, 1);
+}
+
+static NTSTATUS
+RtlpCompressBufferXpress(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
+                         ULONG *final_size, USHORT engine, PXPRESS_WORKSPACE workspace)
+{
+    XPRESS_MATCH_FINDER finder;
+    XPRESS_OUTPUT output;
+    ULONG pos = 0, length, offset;
+
+    if (dst_size < sizeof(ULONG))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    RtlpXpressInitMatchFinder(&finder, src, src_size, XPRESS_MAX_OFFSET, XPRESS_WINDOW_SIZE,
+                              engine, workspace->Head, workspace->Prev);
+
+    output.FlagsPosition = dst;
+    output.Current = dst + sizeof(ULONG);
+    output.End = dst + dst_size;
+    output.NibblePosition = NULL;
+    output.Flags = 0;
+    output.FlagCount = 0;
+
+    while (pos < src_size)
+    {
+        length = RtlpXpressParse(&finder, pos, src_size - pos, &offset);
+        if (length)
+        {
+            if (!RtlpXpressPutMatch(&output, length, offset))
+                return STATUS_BUFFER_TOO_SMALL;
+            pos += length;
+        }
+        else
+        {
+            if (output.Current >= output.End)
+                return STATUS_BUFFER_TOO_SMALL;
+            *output.Current++ = src[pos++];
+            if (!RtlpXpressPutFlag(&output, 0))
+                return STATUS_BUFFER_TOO_SMALL;
+        }
+    }
+
+    /* The remaining flags are set, a match flag at the end of the input ends the stream */
+    if (output.FlagCount)
+        output.Flags = (output.Flags << (32 - output.FlagCount)) | ((1UL << (32 - output.FlagCount)) - 1);
+    else
+        output.Flags = 0xFFFFFFFF;
+    *(ULONG UNALIGNED *)output.FlagsPosition = output.Flags;
+
+    if (final_size)
+        *final_size = output.Current - dst;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+RtlpDecompressBufferXpress(UCHAR *dst, ULONG dst_size, UCHAR *src, ULONG src_size,
+                           ULONG *final_size)
+{
+    UCHAR *src_cur = src, *src_end = src + src_size;
+    UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
+    UCHAR *nibble = NULL;
+    ULONG flags = 0, flag_count = 0, length, offset;
+
+    /* Partial decompression is no error, as for LZNT1 */
+    while (dst_cur < dst_end)
+    {
+        if (flag_count == 0)
+        {
+            if (src_end - src_cur < sizeof(ULONG))
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            flags = *(ULONG UNALIGNED *)src_cur;
+            src_cur += sizeof(ULONG);
+            flag_count = 32;
+        }
+        flag_count--;
+
+        if (!(flags & (1UL << flag_count)))
+        {
+            if (src_cur >= src_end)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            *dst_cur++ = *src_cur++;
+            continue;
+        }
+
+        /* a match flag without a match ends the stream */
+        if (src_cur == src_end)
+            break;
+
+        if (src_end - src_cur < sizeof(USHORT))
+            return STATUS_BAD_COMPRESSION_BUFFER;
+        length = *(USHORT UNALIGNED *)src_cur;
+        src_cur += sizeof(USHORT);
+        offset = (length >> 3) + 1;
+        length &= 7;
+
+        if (length == 7)
+        {
+            if (nibble == NULL)
+            {
+                if (src_cur >= src_end)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                nibble = src_cur++;
+                length = *nibble & 0xF;
+            }
+            else
+            {
+                length = *nibble >> 4;
+                nibble = NULL;
+            }
+
+            if (length == 15)
+            {
+                if (src_cur >= src_end)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                length = *src_cur++;
+
+                if (length == 255)
+                {
+                    if (src_end - src_cur < sizeof(USHORT))
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    length = *(USHORT UNALIGNED *)src_cur;
+                    src_cur += sizeof(USHORT);
+
+                    if (length == 0)
+                    {
+                        if (src_end - src_cur < sizeof(ULONG))
+                            return STATUS_BAD_COMPRESSION_BUFFER;
+                        length = *(ULONG UNALIGNED *)src_cur;
+                        src_cur += sizeof(ULONG);
+                    }
+
+                    if (length < 15 + 7)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    length -= 15 + 7;
+                }
+                length += 15;
+            }
+            length += 7;
+        }
+        length += XPRESS_MIN_MATCH;
+
+        if (offset > dst_cur - dst)
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        length = min(length, dst_end - dst_cur);
+        if (offset >= length)
+        {
+            memcpy(dst_cur, dst_cur - offset, length);
+            dst_cur += length;
+        }
+        else
+        {
+            /* overlapping copy, repeats the last offset bytes */
+            for (; length > 0; length--, dst_cur++)
+                *dst_cur = *(dst_cur - offset);
+        }
+    }
+
+    if (final_size)
+        *final_size = dst_cur - dst;
+
+    return STATUS_SUCCESS;
+}
+
+static __inline VOID
+RtlpXpressPutBits(PXPRESS_BIT_WRITER Writer, ULONG Count, ULONG Value)
+{
+    if (Writer->FreeBits >= Count)
+    {
+        Writer->FreeBits -= Count;
+        Writer->Bits = (Writer->Bits << Count) | Value;
+    }
+    else
+    {
+        /* complete the first reserved word and reserve a new one */
+        Writer->Bits = (Writer->Bits << Writer->FreeBits) | (Value >> (Count - Writer->FreeBits));
+        *(USHORT UNALIGNED *)Writer->Word1 = (USHORT)Writer->Bits;
+        Writer->Word1 = Writer->Word2;
+        Writer->Word2 = Writer->Current;
+        Writer->Current += sizeof(USHORT);
+        Writer->FreeBits += 16 - Count;
+        Writer->Bits = Value;
+    }
+}
+
+/* sort the symbols by ascending frequency (shell sort, there are 512 at most) */
+static VOID
+RtlpXpressHuffSort(PULONG Keys, PUSHORT Symbols, ULONG Count)
+{
+    static const ULONG Gaps[] = { 132, 57, 23, 10, 4, 1 };
+    ULONG g, i, j, Gap, Key;
+    USHORT Symbol;
+
+    for (g = 0; g < sizeof(Gaps) / sizeof(Gaps[0]); g++)
+    {
+        Gap = Gaps[g];
+        for (i = Gap; i < Count; i++)
+        {
+            Key = Keys[i];
+            Symbol = Symbols[i];
+            for (j = i; j >= Gap && Keys[j - Gap] > Key; j -= Gap)
+            {
+                Keys[j] = Keys[j - Gap];
+                Symbols[j] = Symbols[j - Gap];
+            }
+            Keys[j] = Key;
+            Symbols[j] = Symbol;
+        }
+    }
+}
+
+/*
+ * In-place minimum redundancy code lengths of Moffat and Katajainen.
+ * Keys holds ascending frequencies on entry and the code lengths on exit.
+ */
+static VOID
+RtlpXpressHuffCodeLengths(PULONG Keys, LONG Count)
+{
+    LONG Root, Leaf, Next, Available, Used, Depth;
+
+    if (Count == 1)
+    {
+        Keys[0] = 1;
+        return;
+    }
+
+    /* Build the tree, parents point to their own parent */
+    Keys[0] += Keys[1];
+    Root = 0;
+    Leaf = 2;
+    for (Next = 1; Next < Count - 1; Next++)
+    {
+        if (Leaf >= Count || Keys[Root] < Keys[Leaf])
+        {
+            Keys[Next] = Keys[Root];
+            Keys[Root++] = Next;
+        }
+        else
+        {
+            Keys[Next] = Keys[Leaf++];
+        }
+
+        if (Leaf >= Count || (Root < Next && Keys[Root] < Keys[Leaf]))
+        {
+            Keys[Next] += Keys[Root];
+            Keys[Root++] = Next;
+        }
+        else
+        {
+            Keys[Next] += Keys[Leaf++];
+        }
+    }
+
+    /* Depths of the internal nodes */
+    Keys[Count - 2] = 0;
+    for (Next = Count - 3; Next >= 0; Next--)
+        Keys[Next] = Keys[Keys[Next]] + 1;
+
+    /* Depths of the leaves */
+    Available = 1;
+    Used = Depth = 0;
+    Root = Count - 2;
+    Next = Count - 1;
+    while (Available > 0)
+    {
+        while (Root >= 0 && (LONG)Keys[Root] == Depth)
+        {
+            Used++;
+            Root--;
+        }
+        while (Available > Used)
+        {
+            Keys[Next--] = Depth;
+            Available--;
+        }
+        Available = 2 * Used;
+        Depth++;
+        Used = 0;
+    }
+}
+
+/* build the length limited canonical Huffman code for the block frequencies */
+static VOID
+RtlpXpressHuffBuildCode(PXPRESS_HUFF_WORKSPACE Workspace)
+{
+    ULONG LengthCount[32 + 1], NextCode[XPRESS_HUFF_MAX_CODE_LENGTH + 1];
+    ULONG Symbol, Used, Length, Total, Code, i, j;
+
+    /* The code must be complete, so use two symbols at least */
+    for (Symbol = 0, Used = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+    {
+        if (Workspace->Frequencies[Symbol])
+            Used++;
+    }
+    if (Used < 2)
+    {
+        if (Workspace->Frequencies[0] == 0)
+            Workspace->Frequencies[0] = 1;
+        else
+            Workspace->Frequencies[1] = 1;
+    }
+
+    Used = 0;
+    for (Symbol = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+    {
+        if (Workspace->Frequencies[Symbol])
+        {
+            Workspace->SortKeys[Used] = Workspace->Frequencies[Symbol];
+            Workspace->SortSymbols[Used++] = (USHORT)Symbol;
+        }
+    }
+
+    RtlpXpressHuffSort(Workspace->SortKeys, Workspace->SortSymbols, Used);
+    RtlpXpressHuffCodeLengths(Workspace->SortKeys, Used);
+
+    RtlZeroMemory(LengthCount, sizeof(LengthCount));
+    for (i = 0; i < Used; i++)
+        LengthCount[min(Workspace->SortKeys[i], 32)]++;
+
+    /* Limit the lengths, keeping the code complete */
+    for (Length = XPRESS_HUFF_MAX_CODE_LENGTH + 1; Length <= 32; Length++)
+    {
+        LengthCount[XPRESS_HUFF_MAX_CODE_LENGTH] += LengthCount[Length];
+        LengthCount[Length] = 0;
+    }
+    Total = 0;
+    for (Length = XPRESS_HUFF_MAX_CODE_LENGTH; Length > 0; Length--)
+        Total += LengthCount[Length] << (XPRESS_HUFF_MAX_CODE_LENGTH - Length);
+    while (Total != (1 << XPRESS_HUFF_MAX_CODE_LENGTH))
+    {
+        LengthCount[XPRESS_HUFF_MAX_CODE_LENGTH]--;
+        for (Length = XPRESS_HUFF_MAX_CODE_LENGTH - 1; Length > 0; Length--)
+        {
+            if (LengthCount[Length])
+            {
+                LengthCount[Length]--;
+                LengthCount[Length + 1] += 2;
+                break;
+            }
+        }
+        Total--;
+    }
+
+    /* The most frequent symbols get the shortest codes */
+    RtlZeroMemory(Workspace->Lengths, sizeof(Workspace->Lengths));
+    for (Length = 1, j = Used; Length <= XPRESS_HUFF_MAX_CODE_LENGTH; Length++)
+    {
+        for (i = LengthCount[Length]; i > 0; i--)
+            Workspace->Lengths[Workspace->SortSymbols[--j]] = (UCHAR)Length;
+    }
+
+    /* Canonical codes, ordered by length and then by symbol */
+    Code = 0;
+    LengthCount[0] = 0;
+    for (Length = 1; Length <= XPRESS_HUFF_MAX_CODE_LENGTH; Length++)
+    {
+        Code = (Code + LengthCount[Length - 1]) << 1;
+        NextCode[Length] = Code;
+    }
+    for (Symbol = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+    {
+        Length = Workspace->Lengths[Symbol];
+        if (Length)
+            Workspace->Codes[Symbol] = (USHORT)NextCode[Length]++;
+    }
+}
+
+static NTSTATUS
+RtlpCompressBufferXpressHuff(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
+                             ULONG *final_size, USHORT engine, PXPRESS_HUFF_WORKSPACE workspace)
+{
+    XPRESS_MATCH_FINDER finder;
+    XPRESS_BIT_WRITER writer;
+    UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
+    ULONG pos = 0, block_end, item_count, item, length, offset, symbol, i;
+    ULONG offset_bits;
+    BOOLEAN last;
+
+    RtlpXpressInitMatchFinder(&finder, src, src_size, XPRESS_HUFF_MAX_OFFSET,
+                              XPRESS_HUFF_WINDOW_SIZE, engine, workspace->Head, workspace->Prev);
+    finder.AvoidEndOfStream = TRUE;
+
+    do
+    {
+        /* A full last block is followed by one holding only the end of stream */
+        block_end = min(src_size - pos, XPRESS_HUFF_BLOCK_SIZE) + pos;
+        last = (block_end - pos < XPRESS_HUFF_BLOCK_SIZE);
+
+        /* Parse the block and count the symbols */
+        RtlZeroMemory(workspace->Frequencies, sizeof(workspace->Frequencies));
+        item_count = 0;
+        while (pos < block_end)
+        {
+            length = RtlpXpressParse(&finder, pos, min(block_end - pos, XPRESS_HUFF_MAX_LENGTH), &offset);
+            if (length)
+            {
+                BitScanReverse(&offset_bits, offset);
+                symbol = XPRESS_HUFF_END_OF_STREAM + min(length - XPRESS_MIN_MATCH, 15) + (offset_bits << 4);
+                workspace->Items[item_count++] = (length << 16) | offset;
+                pos += length;
+            }
+            else
+            {
+                symbol = src[pos];
+                workspace->Items[item_count++] = src[pos++];
+            }
+            workspace->Frequencies[symbol]++;
+        }
+        if (last)
+            workspace->Frequencies[XPRESS_HUFF_END_OF_STREAM]++;
+
+        RtlpXpressHuffBuildCode(workspace);
+
+        if (dst_end - dst_cur < XPRESS_HUFF_TABLE_SIZE + 2 * sizeof(USHORT))
+            return STATUS_BUFFER_TOO_SMALL;
+        for (i = 0; i < XPRESS_HUFF_TABLE_SIZE; i++)
+            dst_cur[i] = workspace->Lengths[2 * i] | (workspace->Lengths[2 * i + 1] << 4);
+
+        writer.Word1 = dst_cur + XPRESS_HUFF_TABLE_SIZE;
+        writer.Word2 = writer.Word1 + sizeof(USHORT);
+        writer.Current = writer.Word2 + sizeof(USHORT);
+        writer.End = dst_end;
+        writer.Bits = 0;
+        writer.FreeBits = 16;
+
+        for (i = 0; i < item_count; i++)
+        {
+            /* two new words and three length bytes at most */
+            if (writer.End - writer.Current < 2 * sizeof(USHORT) + 3)
+                return STATUS_BUFFER_TOO_SMALL;
+
+            item = workspace->Items[i];
+            if (item < 0x100)
+            {
+                RtlpXpressPutBits(&writer, workspace->Lengths[item], workspace->Codes[item]);
+                continue;
+            }
+
+            length = (item >> 16) - XPRESS_MIN_MATCH;
+            offset = item & 0xFFFF;
+            BitScanReverse(&offset_bits, offset);
+            symbol = XPRESS_HUFF_END_OF_STREAM + min(length, 15) + (offset_bits << 4);
+            RtlpXpressPutBits(&writer, workspace->Lengths[symbol], workspace->Codes[symbol]);
+
+            if (length >= 15)
+            {
+                if (length - 15 < 255)
+                {
+                    *writer.Current++ = (UCHAR)(length - 15);
+                }
+                else
+                {
+                    *writer.Current++ = 255;
+                    *(USHORT UNALIGNED *)writer.Current = (USHORT)length;
+                    writer.Current += sizeof(USHORT);
+                }
+            }
+
+            RtlpXpressPutBits(&writer, offset_bits, offset - (1 << offset_bits));
+        }
+
+        if (last)
+        {
+            if (writer.End - writer.Current < 2 * sizeof(USHORT))
+                return STATUS_BUFFER_TOO_SMALL;
+            RtlpXpressPutBits(&writer,
+                              workspace->Lengths[XPRESS_HUFF_END_OF_STREAM],
+                              workspace->Codes[XPRESS_HUFF_END_OF_STREAM]);
+        }
+
+        /* flush the bits, the next block starts after the reserved words */
+        *(USHORT UNALIGNED *)writer.Word1 = (USHORT)(writer.Bits << writer.FreeBits);
+        *(USHORT UNALIGNED *)writer.Word2 = 0;
+        dst_cur = writer.Current;
+    } while (!last);
+
+    if (final_size)
+        *final_size = dst_cur - dst;
+
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+RtlpXpressHuffBuildDecoder(PXPRESS_HUFF_DECODER Decoder, PUCHAR Table)
+{
+    USHORT NextIndex[XPRESS_HUFF_MAX_CODE_LENGTH + 1];
+    ULONG Symbol, Length, Code, Index, Entry, Fill;
+    LONG Left;
+
+    RtlZeroMemory(Decoder->Count, sizeof(Decoder->Count));
+    for (Symbol = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+        Decoder->Count[(Table[Symbol / 2] >> ((Symbol & 1) * 4)) & 0xF]++;
+
+    /* Only complete codes are valid */
+    Left = 1;
+    Code = 0;
+    Index = 0;
+    for (Length = 1; Length <= XPRESS_HUFF_MAX_CODE_LENGTH; Length++)
+    {
+        Left = (Left << 1) - Decoder->Count[Length];
+        if (Left < 0)
+            return FALSE;
+
+        Decoder->FirstCode[Length] = (USHORT)Code;
+        Decoder->FirstIndex[Length] = NextIndex[Length] = (USHORT)Index;
+        Code = (Code + Decoder->Count[Length]) << 1;
+        Index += Decoder->Count[Length];
+    }
+    if (Left != 0)
+        return FALSE;
+
+    for (Symbol = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+    {
+        Length = (Table[Symbol / 2] >> ((Symbol & 1) * 4)) & 0xF;
+        if (Length)
+            Decoder->Symbols[NextIndex[Length]++] = (USHORT)Symbol;
+    }
+
+    /* The short codes come first in canonical order and fill the start of the table */
+    Entry = 0;
+    for (Length = 1; Length <= XPRESS_HUFF_LOOKUP_BITS; Length++)
+    {
+        for (Index = Decoder->FirstIndex[Length];
+             Index < (ULONG)Decoder->FirstIndex[Length] + Decoder->Count[Length];
+             Index++)
+        {
+            for (Fill = 1 << (XPRESS_HUFF_LOOKUP_BITS - Length); Fill > 0; Fill--)
+                Decoder->Lookup[Entry++] = (USHORT)((Length << 9) | Decoder->Symbols[Index]);
+        }
+    }
+    RtlZeroMemory(&Decoder->Lookup[Entry], ((1 << XPRESS_HUFF_LOOKUP_BITS) - Entry) * sizeof(USHORT));
+
+    return TRUE;
+}
+
+static __inline BOOLEAN
+RtlpXpressSkipBits(PXPRESS_BIT_READER Reader, ULONG Count)
+{
+    Reader->Bits <<= Count;
+    Reader->ExtraBits -= Count;
+    if (Reader->ExtraBits < 0)
+    {
+        if (Reader->End - Reader->Current < sizeof(USHORT))
+            return FALSE;
+        Reader->Bits |= (ULONG)*(USHORT UNALIGNED *)Reader->Current << -Reader->ExtraBits;
+        Reader->Current += sizeof(USHORT);
+        Reader->ExtraBits += 16;
+    }
+
+    return TRUE;
+}
+
+static NTSTATUS
+RtlpDecompressBufferXpressHuff(UCHAR *dst, ULONG dst_size, UCHAR *src, ULONG src_size,
+                               ULONG *final_size, PXPRESS_HUFF_DECODER decoder)
+{
+    XPRESS_BIT_READER reader;
+    UCHAR *src_cur = src, *src_end = src + src_size;
+    UCHAR *dst_cur = dst, *dst_end = dst + dst_size, *block_end;
+    ULONG entry, symbol, length, offset, offset_bits;
+
+    while (dst_cur < dst_end)
+    {
+        if (src_end - src_cur < XPRESS_HUFF_TABLE_SIZE + 2 * sizeof(USHORT))
+        {
+            /* the stream may end at a block boundary */
+            if (src_cur == src)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            break;
+        }
+
+        if (!RtlpXpressHuffBuildDecoder(decoder, src_cur))
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        reader.Current = src_cur + XPRESS_HUFF_TABLE_SIZE;
+        reader.End = src_end;
+        reader.Bits = ((ULONG)*(USHORT UNALIGNED *)reader.Current << 16) |
+                      *(USHORT UNALIGNED *)(reader.Current + sizeof(USHORT));
+        reader.Current += 2 * sizeof(USHORT);
+        reader.ExtraBits = 16;
+
+        block_end = (dst_end - dst_cur > XPRESS_HUFF_BLOCK_SIZE) ? dst_cur + XPRESS_HUFF_BLOCK_SIZE : dst_end;
+        while (dst_cur < block_end)
+        {
+            entry = decoder->Lookup[reader.Bits >> (32 - XPRESS_HUFF_LOOKUP_BITS)];
+            if (entry)
+            {
+                symbol = entry & (XPRESS_HUFF_SYMBOLS - 1);
+                length = entry >> 9;
+            }
+            else
+            {
+                /* longer code, use the canonical ordering */
+                for (length = XPRESS_HUFF_LOOKUP_BITS + 1; ; length++)
+                {
+                    if (length > XPRESS_HUFF_MAX_CODE_LENGTH)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    offset = (reader.Bits >> (32 - length)) - decoder->FirstCode[length];
+                    if (offset < decoder->Count[length])
+                        break;
+                }
+                symbol = decoder->Symbols[decoder->FirstIndex[length] + offset];
+            }
+
+            if (!RtlpXpressSkipBits(&reader, length))
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            if (symbol < 0x100)
+            {
+                *dst_cur++ = (UCHAR)symbol;
+                continue;
+            }
+
+            if (symbol == XPRESS_HUFF_END_OF_STREAM && reader.Current >= src_end)
+                goto out;
+
+            symbol -= XPRESS_HUFF_END_OF_STREAM;
+            length = symbol & 0xF;
+            offset_bits = symbol >> 4;
+
+            if (length == 15)
+            {
+                if (reader.Current >= src_end)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                length = *reader.Current++;
+
+                if (length == 255)
+                {
+                    if (src_end - reader.Current < sizeof(USHORT))
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    length = *(USHORT UNALIGNED *)reader.Current;
+                    reader.Current += sizeof(USHORT);
+
+                    if (length == 0)
+                    {
+                        if (src_end - reader.Current < sizeof(ULONG))
+                            return STATUS_BAD_COMPRESSION_BUFFER;
+                        length = *(ULONG UNALIGNED *)reader.Current;
+                        reader.Current += sizeof(ULONG);
+                    }
+
+                    if (length < 15)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    length -= 15;
+                }
+                length += 15;
+            }
+            length += XPRESS_MIN_MATCH;
+
+            offset = 1 << offset_bits;
+            if (offset_bits)
+            {
+                offset += reader.Bits >> (32 - offset_bits);
+                if (!RtlpXpressSkipBits(&reader, offset_bits))
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+            }
+
+            if (offset > dst_cur - dst)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            /* matches may run past the end of the block */
+            length = min(length, dst_end - dst_cur);
+            if (offset >= length)
+            {
+                memcpy(dst_cur, dst_cur - offset, length);
+                dst_cur += length;
+            }
+            else
+            {
+                for (; length > 0; length--, dst_cur++)
+                    *dst_cur = *(dst_cur - offset);
+            }
+        }
+
+        src_cur = reader.Current;
+    }
+
+out:
+    if (final_size)
+        *final_size = dst_cur - dst;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+RtlpWorkSpaceSizeXpress(USHORT Format,
+                        USHORT Engine,
+                        PULONG BufferAndWorkSpaceSize,
+                        PULONG FragmentWorkSpaceSize)
+{
+   if (Engine != COMPRESSION_ENGINE_STANDARD &&
+       Engine != COMPRESSION_ENGINE_MAXIMUM)
+   {
+      return(STATUS_NOT_SUPPORTED);
+   }
+
+   if (Format == COMPRESSION_FORMAT_XPRESS)
+   {
+      *BufferAndWorkSpaceSize = sizeof(XPRESS_WORKSPACE);
+      *FragmentWorkSpaceSize = 0;
+   }
+   else
+   {
+      *BufferAndWorkSpaceSize = sizeof(XPRESS_HUFF_WORKSPACE);
+      *FragmentWorkSpaceSize = sizeof(XPRESS_HUFF_DECODER);
+   }
+
+   return(STATUS_SUCCESS);
+}
+
+
 /*
  * @implemented
  */
@@ -284,7 +1323,7 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                   IN PVOID WorkSpace)
 {
    USHORT Format = CompressionFormatAndEngine & COMPRESSION_FORMAT_MASK;
-   /* USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK; */
+   USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK;
 
    if ((Format == COMPRESSION_FORMAT_NONE) ||
          (Format == COMPRESSION_FORMAT_DEFAULT))
@@ -299,6 +1338,35 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                                      FinalCompressedSize,
                                      WorkSpace));
 
+   if (Format == COMPRESSION_FORMAT_XPRESS ||
+       Format == COMPRESSION_FORMAT_XPRESS_HUFF)
+   {
+      if (Engine != COMPRESSION_ENGINE_STANDARD &&
+          Engine != COMPRESSION_ENGINE_MAXIMUM)
+         return(STATUS_NOT_SUPPORTED);
+
+      if (WorkSpace == NULL)
+         return(STATUS_INVALID_PARAMETER);
+
+      /* The chunk size is meaningless here, the LZ77 window spans the whole buffer */
+      if (Format == COMPRESSION_FORMAT_XPRESS)
+         return(RtlpCompressBufferXpress(UncompressedBuffer,
+                                         UncompressedBufferSize,
+                                         CompressedBuffer,
+                                         CompressedBufferSize,
+                                         FinalCompressedSize,
+                                         Engine,
+                                         WorkSpace));
+
+      return(RtlpCompressBufferXpressHuff(UncompressedBuffer,
+                                          UncompressedBufferSize,
+                                          CompressedBuffer,
+                                          CompressedBufferSize,
+                                          FinalCompressedSize,
+                                          Engine,
+                                          WorkSpace));
+   }
+
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
 
@@ -348,6 +1416,9 @@ RtlDecompressFragment(IN USHORT format,
                       OUT PULONG final_size,
                       IN PVOID workspace)
 {
+    NTSTATUS Status;
+    PVOID decoder;
+
     DPRINT("0x%04x, %p, %u, %p, %u, %u, %p, %p :stub\n", format, uncompressed,
            uncompressed_size, compressed, compressed_size, offset, final_size, workspace);
 
@@ -357,6 +1428,32 @@ RtlDecompressFragment(IN USHORT format,
             return lznt1_decompress(uncompressed, uncompressed_size, compressed,
                                     compressed_size, offset, final_size, workspace);
 
+        case COMPRESSION_FORMAT_XPRESS:
+        case COMPRESSION_FORMAT_XPRESS_HUFF:
+            /* These streams can only be decoded from their start */
+            if (offset != 0)
+                return STATUS_NOT_SUPPORTED;
+
+            if ((format & COMPRESSION_FORMAT_MASK) == COMPRESSION_FORMAT_XPRESS)
+                return RtlpDecompressBufferXpress(uncompressed, uncompressed_size, compressed,
+                                                  compressed_size, final_size);
+
+            /* The decoding tables live in the workspace, or in a temporary allocation */
+            decoder = workspace;
+            if (decoder == NULL)
+            {
+                decoder = RtlpAllocateMemory(sizeof(XPRESS_HUFF_DECODER), TAG_COMPRESS);
+                if (decoder == NULL)
+                    return STATUS_NO_MEMORY;
+            }
+
+            Status = RtlpDecompressBufferXpressHuff(uncompressed, uncompressed_size, compressed,
+                                                    compressed_size, final_size, decoder);
+
+            if (decoder != workspace)
+                RtlpFreeMemory(decoder, TAG_COMPRESS);
+            return Status;
+
         case COMPRESSION_FORMAT_NONE:
         case COMPRESSION_FORMAT_DEFAULT:
             return STATUS_INVALID_PARAMETER;
@@ -417,6 +1514,13 @@ RtlGetCompressionWorkSpaceSize(IN USHORT CompressionFormatAndEngine,
                                     CompressBufferAndWorkSpaceSize,
                                     CompressFragmentWorkSpaceSize));
 
+   if (Format == COMPRESSION_FORMAT_XPRESS ||
+       Format == COMPRESSION_FORMAT_XPRESS_HUFF)
+      return(RtlpWorkSpaceSizeXpress(Format,
+                                     Engine,
+                                     CompressBufferAndWorkSpaceSize,
+                                     CompressFragmentWorkSpaceSize));
+
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
 
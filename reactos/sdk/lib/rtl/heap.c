@@ -1928,6 +1928,7 @@ RtlAllocateHeap(IN PVOID HeapPtr,
     BOOLEAN HeapLocked = FALSE;
     PHEAP_VIRTUAL_ALLOC_ENTRY VirtualBlock = NULL;
     PHEAP_ENTRY_EXTRA Extra;
+    PVOID FrontEndBlock;
     NTSTATUS Status;
 
     /* Force flags */
@@ -1977,6 +1978,17 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 
     Index = AllocationSize >> HEAP_ENTRY_SHIFT;
 
+    /* Small blocks are served by the low fragmentation front end, if it's enabled */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH &&
+        Index <= HEAP_LFH_MAX_INDEX &&
+        !(EntryFlags & HEAP_ENTRY_EXTRA_PRESENT))
+    {
+        FrontEndBlock = RtlpLowFragHeapAllocate(Heap, Flags, Size, Index, EntryFlags);
+        if (FrontEndBlock) return FrontEndBlock;
+
+        /* The front end couldn't grow, fall back to the backend */
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2180,6 +2192,10 @@ BOOLEAN NTAPI RtlFreeHeap(
     if (RtlpHeapIsSpecial(Flags))
         return RtlDebugFreeHeap(Heap, Flags, Ptr);
 
+    /* Blocks of the low fragmentation front end don't need the heap lock */
+    if (RtlpIsLowFragHeapEntry(Heap, (PHEAP_ENTRY)Ptr - 1))
+        return RtlpLowFragHeapFree(Heap, Flags, Ptr);
+
     /* Lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2590,6 +2606,10 @@ RtlReAllocateHeap(HANDLE HeapPtr,
         return NULL;
     }
 
+    /* Blocks of the low fragmentation front end are handled separately */
+    if (RtlpIsLowFragHeapEntry(Heap, (PHEAP_ENTRY)Ptr - 1))
+        return RtlpLowFragHeapReAllocate(Heap, Flags, Ptr, Size);
+
     /* Calculate allocation size and index */
     if (Size)
         AllocationSize = Size;
@@ -3146,6 +3166,10 @@ RtlpValidateHeapEntry(
     if ((ULONG_PTR)HeapEntry & (HEAP_ENTRY_SIZE - 1)) goto invalid_entry;
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) goto invalid_entry;
 
+    /* Blocks of the low fragmentation front end live inside a busy block */
+    if (RtlpIsLowFragHeapEntry(Heap, HeapEntry))
+        return RtlpValidateLowFragHeapEntry(Heap, HeapEntry);
+
     BigAllocation = HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC;
     Segment = Heap->Segments[HeapEntry->SegmentOffset];
 
@@ -3910,13 +3934,12 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
         }
 
         /* Check for a special magic value for enabling LFH */
-        if (*(PULONG)HeapInformation != 2)
+        if (*(PULONG)HeapInformation != HEAP_FRONT_END_LFH)
         {
             return STATUS_UNSUCCESSFUL;
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
-        return STATUS_SUCCESS;
+        return RtlpActivateLowFragHeap((PHEAP)HeapHandle);
     }
 
     return STATUS_SUCCESS;
@@ -55,6 +55,20 @@
 /* Segment flags */
 #define HEAP_USER_ALLOCATED    0x1
 
+/* Front end heap types, as reported by HeapCompatibilityInformation */
+#define HEAP_FRONT_END_NONE      0
+#define HEAP_FRONT_END_LOOKASIDE 1
+#define HEAP_FRONT_END_LFH       2
+
+/* Low fragmentation heap definitions */
+#define HEAP_LFH_SEGMENT_OFFSET        0xFF
+#define HEAP_LFH_MAX_BLOCK_SIZE        1024
+#define HEAP_LFH_MAX_INDEX             ((HEAP_LFH_MAX_BLOCK_SIZE >> HEAP_ENTRY_SHIFT) + 2)
+#define HEAP_LFH_BUCKETS               (HEAP_LFH_MAX_INDEX + 1)
+#define HEAP_LFH_AFFINITY_SLOTS        8
+#define HEAP_LFH_SUBSEGMENT_SIZE       0x4000
+#define HEAP_LFH_MIN_SUBSEGMENT_BLOCKS 8
+
 /* A handy inline to distinguis normal heap, special "debug heap" and special "page heap" */
 FORCEINLINE BOOLEAN
 RtlpHeapIsSpecial(ULONG Flags)
@@ -327,6 +341,30 @@ typedef struct _HEAP_VIRTUAL_ALLOC_ENTRY
     HEAP_ENTRY BusyBlock;
 } HEAP_VIRTUAL_ALLOC_ENTRY, *PHEAP_VIRTUAL_ALLOC_ENTRY;
 
+/* Per-processor set of free block lists, one list per block size */
+typedef struct _HEAP_LFH_AFFINITY_SLOT
+{
+    SLIST_HEADER FreeLists[HEAP_LFH_BUCKETS];
+} HEAP_LFH_AFFINITY_SLOT, *PHEAP_LFH_AFFINITY_SLOT;
+
+typedef struct _HEAP_LFH
+{
+    PHEAP Heap;
+    ULONG AffinitySlotCount;
+    LONG SubSegmentCount;
+    HEAP_LFH_AFFINITY_SLOT AffinitySlots[HEAP_LFH_AFFINITY_SLOTS];
+} HEAP_LFH, *PHEAP_LFH;
+
+C_ASSERT(HEAP_LFH_SEGMENT_OFFSET >= HEAP_SEGMENTS);
+
+/* Tells whether a busy block belongs to the low fragmentation front end */
+FORCEINLINE BOOLEAN
+RtlpIsLowFragHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry)
+{
+    return (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH) &&
+           (HeapEntry->SegmentOffset == HEAP_LFH_SEGMENT_OFFSET);
+}
+
 /* Global variables */
 extern RTL_CRITICAL_SECTION RtlpProcessHeapsListLock;
 extern BOOLEAN RtlpPageHeapEnabled;
@@ -352,6 +390,32 @@ RtlpValidateHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry);
 BOOLEAN NTAPI
 RtlpValidateHeapHeaders(PHEAP Heap, BOOLEAN Recalculate);
 
+/* heaplfh.c */
+NTSTATUS NTAPI
+RtlpActivateLowFragHeap(PHEAP Heap);
+
+PVOID NTAPI
+RtlpLowFragHeapAllocate(PHEAP Heap,
+                        ULONG Flags,
+                        SIZE_T Size,
+                        SIZE_T Index,
+                        UCHAR EntryFlags);
+
+BOOLEAN NTAPI
+RtlpLowFragHeapFree(PHEAP Heap,
+                    ULONG Flags,
+                    PVOID Ptr);
+
+PVOID NTAPI
+RtlpLowFragHeapReAllocate(PHEAP Heap,
+                          ULONG Flags,
+                          PVOID Ptr,
+                          SIZE_T Size);
+
+BOOLEAN NTAPI
+RtlpValidateLowFragHeapEntry(PHEAP Heap,
+                             PHEAP_ENTRY HeapEntry);
+
 /* heapdbg.c */
 HANDLE NTAPI
 RtlDebugCreateHeap(ULONG Flags,
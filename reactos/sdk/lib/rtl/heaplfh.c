@@ -0,0 +1,339 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS system libraries
+ * FILE:            lib/rtl/heaplfh.c
+ * PURPOSE:         RTL Heap low fragmentation front end
+ */
+
+/* Overview:
+   The low fragmentation heap (LFH) serves small requests (up to
+   HEAP_LFH_MAX_BLOCK_SIZE bytes) without taking the heap lock.
+   Blocks of a given size are carved out of "subsegments", which are plain
+   busy blocks obtained from the backend allocator. Free blocks are kept in
+   lock-free S-Lists, one per block size, replicated in several affinity
+   slots so that threads running on different processors don't fight over
+   the same list head. The memory of a subsegment is kept by the front end
+   for reuse until the heap is destroyed.
+
+   LFH blocks carry a regular HEAP_ENTRY header, so RtlSizeHeap and the
+   user flags routines keep working on them. They are told apart from
+   backend blocks by HEAP_LFH_SEGMENT_OFFSET in their SegmentOffset field. */
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+#include <heap.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ******************************************************************/
+
+/* Round-robin counter handing out affinity slots to new threads */
+static LONG RtlpLowFragHeapNextAffinity;
+
+/* FUNCTIONS *****************************************************************/
+
+FORCEINLINE
+ULONG
+RtlpGetLowFragHeapAffinitySlot(PHEAP_LFH Lfh)
+{
+    PTEB Teb = NtCurrentTeb();
+    ULONG Affinity;
+
+    /* Threads are spread over the slots the first time they use a LFH */
+    Affinity = Teb->HeapVirtualAffinity;
+    if (!Affinity)
+    {
+        Affinity = (ULONG)InterlockedIncrement(&RtlpLowFragHeapNextAffinity);
+        if (!Affinity) Affinity = 1;
+        Teb->HeapVirtualAffinity = Affinity;
+    }
+
+    return (Affinity - 1) % Lfh->AffinitySlotCount;
+}
+
+NTSTATUS NTAPI
+RtlpActivateLowFragHeap(PHEAP Heap)
+{
+    PHEAP_LFH Lfh;
+    ULONG Slot, Index;
+    BOOLEAN Activated = FALSE;
+
+    if (!Heap) return STATUS_INVALID_PARAMETER;
+
+    /* LFH is a user mode feature and is not supported for page heaps */
+    if (RtlpGetMode() != UserMode ||
+        (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS))
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    /* Nothing to do if it's already on */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_END_LFH)
+        return STATUS_SUCCESS;
+
+    /* Debug heaps, checked heaps and unserialized heaps must stay on the backend */
+    if (RtlpHeapIsSpecial(Heap->Flags) ||
+        (Heap->Flags & (HEAP_NO_SERIALIZE |
+                        HEAP_TAIL_CHECKING_ENABLED |
+                        HEAP_FREE_CHECKING_ENABLED)))
+    {
+        DPRINT1("HEAP: LFH can't be enabled for heap %p with flags %x\n", Heap, Heap->Flags);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    /* Allocate the front end descriptor from the heap itself */
+    Lfh = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, sizeof(HEAP_LFH));
+    if (!Lfh) return STATUS_NO_MEMORY;
+
+    /* Use as many affinity slots as there are processors */
+    Lfh->Heap = Heap;
+    Lfh->AffinitySlotCount = NtCurrentPeb()->NumberOfProcessors;
+    if (Lfh->AffinitySlotCount == 0) Lfh->AffinitySlotCount = 1;
+    if (Lfh->AffinitySlotCount > HEAP_LFH_AFFINITY_SLOTS) Lfh->AffinitySlotCount = HEAP_LFH_AFFINITY_SLOTS;
+
+    for (Slot = 0; Slot < HEAP_LFH_AFFINITY_SLOTS; Slot++)
+    {
+        for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+            RtlInitializeSListHead(&Lfh->AffinitySlots[Slot].FreeLists[Index]);
+    }
+
+    /* Publish it, unless somebody was faster */
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+    if (Heap->FrontEndHeapType != HEAP_FRONT_END_LFH)
+    {
+        /* Make sure the descriptor is visible before the type is */
+        InterlockedExchangePointer(&Heap->FrontEndHeap, Lfh);
+        Heap->FrontEndHeapType = HEAP_FRONT_END_LFH;
+        Activated = TRUE;
+    }
+    RtlLeaveHeapLock(Heap->LockVariable);
+
+    if (Activated)
+        DPRINT("LFH enabled for heap %p, %lu affinity slots\n", Heap, Lfh->AffinitySlotCount);
+    else
+        RtlFreeHeap(Heap, 0, Lfh);
+
+    return STATUS_SUCCESS;
+}
+
+static
+PSLIST_ENTRY
+RtlpLowFragHeapCreateSubSegment(PHEAP Heap,
+                                PHEAP_LFH Lfh,
+                                PSLIST_HEADER FreeList,
+                                SIZE_T Index)
+{
+    SIZE_T BlockSize, BlockCount, SubSegmentSize, i;
+    PVOID SubSegment;
+    PHEAP_ENTRY FirstBlock, Block;
+
+    /* Get enough blocks to fill a subsegment */
+    BlockSize = Index << HEAP_ENTRY_SHIFT;
+    BlockCount = HEAP_LFH_SUBSEGMENT_SIZE / BlockSize;
+    if (BlockCount < HEAP_LFH_MIN_SUBSEGMENT_BLOCKS) BlockCount = HEAP_LFH_MIN_SUBSEGMENT_BLOCKS;
+
+    /* Reserve room for realigning the user data */
+    SubSegmentSize = BlockCount * BlockSize;
+    if (Heap->Flags & HEAP_CREATE_ALIGN_16) SubSegmentSize += HEAP_ENTRY_SIZE;
+
+    /* The subsegment is a usual busy block of the backend */
+    SubSegment = RtlAllocateHeap(Heap, 0, SubSegmentSize);
+    if (!SubSegment) return NULL;
+
+    InterlockedIncrement(&Lfh->SubSegmentCount);
+
+    /* Make sure user data of the blocks is aligned as the heap promises */
+    FirstBlock = (PHEAP_ENTRY)SubSegment;
+    if (Heap->Flags & HEAP_CREATE_ALIGN_16)
+        FirstBlock = (PHEAP_ENTRY)(((ULONG_PTR)(FirstBlock + 1) + 15) & ~(ULONG_PTR)15) - 1;
+
+    /* Carve it into free blocks */
+    Block = FirstBlock;
+    for (i = 0; i < BlockCount; i++)
+    {
+        Block->Size = (USHORT)Index;
+        Block->Flags = 0;
+        Block->SmallTagIndex = 0;
+        Block->PreviousSize = 0;
+        Block->SegmentOffset = HEAP_LFH_SEGMENT_OFFSET;
+        Block->UnusedBytes = 0;
+
+        /* Keep the first block for the caller and share the rest */
+        if (i != 0) RtlInterlockedPushEntrySList(FreeList, (PSLIST_ENTRY)(Block + 1));
+
+        Block += Index;
+    }
+
+    return (PSLIST_ENTRY)(FirstBlock + 1);
+}
+
+PVOID NTAPI
+RtlpLowFragHeapAllocate(PHEAP Heap,
+                        ULONG Flags,
+                        SIZE_T Size,
+                        SIZE_T Index,
+                        UCHAR EntryFlags)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PSLIST_ENTRY Entry;
+    PHEAP_ENTRY InUseEntry;
+    ULONG Slot, i;
+
+    ASSERT(Index <= HEAP_LFH_MAX_INDEX);
+
+    /* Fast path: take a block from our own slot */
+    Slot = RtlpGetLowFragHeapAffinitySlot(Lfh);
+    Entry = RtlInterlockedPopEntrySList(&Lfh->AffinitySlots[Slot].FreeLists[Index]);
+
+    /* Reuse blocks which were freed on other slots before growing */
+    for (i = 1; !Entry && i < Lfh->AffinitySlotCount; i++)
+    {
+        Entry = RtlInterlockedPopEntrySList(
+            &Lfh->AffinitySlots[(Slot + i) % Lfh->AffinitySlotCount].FreeLists[Index]);
+    }
+
+    /* Slow path: get a new subsegment from the backend */
+    if (!Entry)
+    {
+        Entry = RtlpLowFragHeapCreateSubSegment(Heap,
+                                                Lfh,
+                                                &Lfh->AffinitySlots[Slot].FreeLists[Index],
+                                                Index);
+
+        /* Let the backend deal with it */
+        if (!Entry) return NULL;
+    }
+
+    /* Initialize the block */
+    InUseEntry = (PHEAP_ENTRY)Entry - 1;
+    ASSERT(InUseEntry->SegmentOffset == HEAP_LFH_SEGMENT_OFFSET);
+    ASSERT(InUseEntry->Size == Index);
+    InUseEntry->Flags = EntryFlags;
+    InUseEntry->UnusedBytes = (UCHAR)((Index << HEAP_ENTRY_SHIFT) - Size);
+
+    /* Zero memory if that was requested */
+    if (Flags & HEAP_ZERO_MEMORY)
+        RtlZeroMemory(InUseEntry + 1, Size);
+
+    return InUseEntry + 1;
+}
+
+BOOLEAN NTAPI
+RtlpLowFragHeapFree(PHEAP Heap,
+                    ULONG Flags,
+                    PVOID Ptr)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PHEAP_ENTRY HeapEntry = (PHEAP_ENTRY)Ptr - 1;
+    ULONG Slot;
+
+    /* Check this entry, fail if it's invalid */
+    if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
+        (((ULONG_PTR)Ptr & 0x7) != 0) ||
+        (HeapEntry->Size > HEAP_LFH_MAX_INDEX))
+    {
+        DPRINT1("HEAP: Trying to free an invalid LFH address %p!\n", Ptr);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    /* Mark it free and put it into our own slot */
+    HeapEntry->Flags = 0;
+    Slot = RtlpGetLowFragHeapAffinitySlot(Lfh);
+    RtlInterlockedPushEntrySList(&Lfh->AffinitySlots[Slot].FreeLists[HeapEntry->Size],
+                                 (PSLIST_ENTRY)Ptr);
+
+    return TRUE;
+}
+
+PVOID NTAPI
+RtlpLowFragHeapReAllocate(PHEAP Heap,
+                          ULONG Flags,
+                          PVOID Ptr,
+                          SIZE_T Size)
+{
+    PHEAP_ENTRY InUseEntry = (PHEAP_ENTRY)Ptr - 1;
+    SIZE_T AllocationSize, OldSize, Index;
+    PVOID NewPtr;
+
+    /* If that entry is not really in-use, we have a problem */
+    if (!(InUseEntry->Flags & HEAP_ENTRY_BUSY))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    /* Calculate allocation size and index the same way the backend does */
+    AllocationSize = Size ? Size : 1;
+    AllocationSize = (AllocationSize + Heap->AlignRound) & Heap->AlignMask;
+    Index = AllocationSize >> HEAP_ENTRY_SHIFT;
+
+    OldSize = (InUseEntry->Size << HEAP_ENTRY_SHIFT) - InUseEntry->UnusedBytes;
+
+    /* Resize in place if the block is big enough and not too big */
+    if (Index <= InUseEntry->Size &&
+        (InUseEntry->Size << HEAP_ENTRY_SHIFT) - Size <= MAXUCHAR)
+    {
+        InUseEntry->UnusedBytes = (UCHAR)((InUseEntry->Size << HEAP_ENTRY_SHIFT) - Size);
+
+        /* Zero the grown part if that was requested */
+        if ((Flags & HEAP_ZERO_MEMORY) && Size > OldSize)
+            RtlZeroMemory((PCHAR)Ptr + OldSize, Size - OldSize);
+
+        return Ptr;
+    }
+
+    /* The block has to move, fail if that is not allowed */
+    if (Flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
+        return NULL;
+    }
+
+    /* Get a new block (possibly from the backend), copy and release the old one */
+    NewPtr = RtlAllocateHeap(Heap, Flags & ~HEAP_ZERO_MEMORY, Size);
+    if (!NewPtr) return NULL;
+
+    RtlCopyMemory(NewPtr, Ptr, min(Size, OldSize));
+    if ((Flags & HEAP_ZERO_MEMORY) && Size > OldSize)
+        RtlZeroMemory((PCHAR)NewPtr + OldSize, Size - OldSize);
+
+    RtlpLowFragHeapFree(Heap, Flags, Ptr);
+
+    return NewPtr;
+}
+
+BOOLEAN NTAPI
+RtlpValidateLowFragHeapEntry(PHEAP Heap,
+                             PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_SEGMENT Segment;
+    ULONG SegmentOffset;
+
+    if (HeapEntry->Size > HEAP_LFH_MAX_INDEX ||
+        (HeapEntry->Flags & (HEAP_ENTRY_VIRTUAL_ALLOC | HEAP_ENTRY_EXTRA_PRESENT)))
+    {
+        DPRINT1("HEAP: Invalid LFH entry %p in heap %p\n", HeapEntry, Heap);
+        return FALSE;
+    }
+
+    /* The subsegment holding it must be inside one of the segments */
+    for (SegmentOffset = 0; SegmentOffset < HEAP_SEGMENTS; SegmentOffset++)
+    {
+        Segment = Heap->Segments[SegmentOffset];
+        if (!Segment) continue;
+
+        if ((HeapEntry >= Segment->FirstEntry) &&
+            (HeapEntry < Segment->LastValidEntry))
+        {
+            return TRUE;
+        }
+    }
+
+    DPRINT1("HEAP: LFH entry %p is outside of heap %p\n", HeapEntry, Heap);
+    return FALSE;
+}
+
+/* EOF */
@@ -0,0 +1,250 @@
+/*
+ * PROJECT:         ReactOS host tools
+ * LICENSE:         LGPLv3+ - the same as the btrfs driver it builds on
+ * FILE:            tools/btrfscomp/btrfscomp.c
+ * PURPOSE:         Compares the btrfs driver's zlib, LZO and zstd compression on sample files
+ */
+
+/*
+ * This builds the driver's compress.c as it is, on top of zlibhost and zstdhost,
+ * and runs it on 128 KB extents the way write_compressed does. An extent only
+ * counts as compressed if it saves at least a sector, as in write_compressed_bit,
+ * and every compressed extent is decompressed again and checked. Decompression
+ * speed only counts the extents that were stored compressed.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <typedefs.h>
+
+typedef unsigned char UINT8;
+
+#ifndef STATUS_SUCCESS
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000)
+#endif
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BB)
+#define STATUS_INTERNAL_ERROR           ((NTSTATUS)0xC00000E5)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009A)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define PagedPool 1
+#define ALLOC_TAG 0x7442484D
+#define ALLOC_TAG_ZLIB 0x7A42484D
+#define ALLOC_TAG_ZSTD 0x5A42484D
+#define ExAllocatePoolWithTag(type, size, tag) malloc(size)
+#define ExFreePool(ptr) free(ptr)
+#define ERR print_error
+
+/* The driver's messages use %llx for UINT64, which isn't always long long here */
+static void print_error(const char* format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+static __inline UINT64 sector_align(UINT64 n, UINT64 a) {
+    if (n & (a - 1))
+        n = (n + a) & ~(a - 1);
+
+    return n;
+}
+
+/* Keep compress.c from pulling in the kernel headers */
+#define BTRFS_DRV_H_DEFINED
+#include "btrfs.h"
+#include "compress.c"
+
+#define EXTENT_SIZE 0x20000
+#define SECTOR_SIZE 0x1000
+
+typedef struct {
+    const char* name;
+    UINT8 type;
+    unsigned int level;
+    UINT64 stored;
+    UINT64 compressed_extents;
+    UINT64 decomp_bytes;
+    clock_t comp_time;
+    clock_t decomp_time;
+} codec;
+
+static double mb_per_sec(UINT64 bytes, clock_t ticks) {
+    if (ticks == 0)
+        return 0.0;
+
+    return ((double)bytes / (1024.0 * 1024.0)) / ((double)ticks / CLOCKS_PER_SEC);
+}
+
+static int run_extent(codec* c, UINT8* data, UINT32 len, UINT8* comp, UINT32 comp_len, UINT8* decomp) {
+    NTSTATUS Status;
+    UINT32 out_len;
+    UINT64 padded;
+    clock_t start;
+
+    start = clock();
+    Status = compress_extent(c->type, c->level, data, len, comp, comp_len, &out_len);
+    c->comp_time += clock() - start;
+
+    if (!NT_SUCCESS(Status)) {
+        fprintf(stderr, "%s: compress_extent returned %08x\n", c->name, Status);
+        return 0;
+    }
+
+    if (out_len + SECTOR_SIZE > len) {
+        c->stored += len;
+        return 1;
+    }
+
+    /* On disk the extent is padded to the end of the sector */
+    padded = sector_align(out_len, SECTOR_SIZE);
+    memset(comp + out_len, 0, (size_t)(padded - out_len));
+
+    start = clock();
+    Status = decompress(c->type, comp, padded, decomp, len);
+    c->decomp_time += clock() - start;
+
+    if (!NT_SUCCESS(Status) || memcmp(data, decomp, len)) {
+        fprintf(stderr, "%s: extent didn't survive the round trip (%08x)\n", c->name, Status);
+        return 0;
+    }
+
+    if (c->type == BTRFS_COMPRESSION_ZSTD) {
+        ZSTD_frameHeader zfh;
+
+        if (ZSTD_getFrameHeader(&zfh, comp, out_len) != 0 || zfh.windowSize > (1 << ZSTD_BTRFS_MAX_WINDOWLOG)) {
+            fprintf(stderr, "%s: frame window is bigger than Linux allows\n", c->name);
+            return 0;
+        }
+    }
+
+    c->stored += padded;
+    c->compressed_extents++;
+    c->decomp_bytes += len;
+
+    return 1;
+}
+
+static UINT8* read_file(const char* path, UINT64* size) {
+    FILE* f;
+    UINT8* data;
+    long len;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "couldn't open %s\n", path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = malloc(len > 0 ? len : 1);
+    if (data && len > 0 && fread(data, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "couldn't read %s\n", path);
+        free(data);
+        data = NULL;
+    }
+
+    fclose(f);
+
+    *size = len;
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    codec codecs[] = {
+        { "zlib", BTRFS_COMPRESSION_ZLIB, 3 },
+        { "lzo", BTRFS_COMPRESSION_LZO, 0 },
+        { "zstd", BTRFS_COMPRESSION_ZSTD, 3 },
+    };
+    UINT8 *comp, *decomp;
+    UINT32 comp_len;
+    UINT64 total = 0, extents = 0;
+    int i, first = 1;
+    unsigned int j;
+
+    while (first + 1 < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-z"))
+            codecs[0].level = atoi(argv[first + 1]);
+        else if (!strcmp(argv[first], "-s"))
+            codecs[2].level = atoi(argv[first + 1]);
+        else
+            break;
+
+        first += 2;
+    }
+
+    if (first >= argc) {
+        printf("Compresses files in 128 KB extents like the btrfs driver, and prints the\n"
+               "space used and the speed for zlib, LZO and zstd.\n"
+               "Syntax: btrfscomp [-z zlib level] [-s zstd level] <file> [<file> ...]\n");
+        return 1;
+    }
+
+    comp_len = 0;
+    for (j = 0; j < sizeof(codecs) / sizeof(codecs[0]); j++) {
+        comp_len = max(comp_len, compression_buffer_size(codecs[j].type, EXTENT_SIZE));
+    }
+
+    comp = malloc(comp_len + SECTOR_SIZE);
+    decomp = malloc(EXTENT_SIZE);
+    if (!comp || !decomp) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (i = first; i < argc; i++) {
+        UINT8* data;
+        UINT64 size, off;
+
+        data = read_file(argv[i], &size);
+        if (!data)
+            return 1;
+
+        for (off = 0; off < size; off += EXTENT_SIZE) {
+            UINT32 len = (UINT32)min(size - off, EXTENT_SIZE);
+
+            for (j = 0; j < sizeof(codecs) / sizeof(codecs[0]); j++) {
+                if (!run_extent(&codecs[j], data + off, len, comp,
+                                compression_buffer_size(codecs[j].type, len), decomp))
+                    return 1;
+            }
+
+            total += len;
+            extents++;
+        }
+
+        free(data);
+    }
+
+    printf("%llu bytes in %llu extents\n", (unsigned long long)total, (unsigned long long)extents);
+    printf("codec  level  stored      ratio  compressed  comp MB/s  decomp MB/s\n");
+
+    for (j = 0; j < sizeof(codecs) / sizeof(codecs[0]); j++) {
+        codec* c = &codecs[j];
+
+        printf("%-6s %5u  %10llu  %5.3f  %10llu  %9.1f  %11.1f\n", c->name, c->level,
+               (unsigned long long)c->stored, total ? (double)c->stored / (double)total : 1.0,
+               (unsigned long long)c->compressed_extents, mb_per_sec(total, c->comp_time),
+               mb_per_sec(c->decomp_bytes, c->decomp_time));
+    }
+
+    free(comp);
+    free(decomp);
+
+    return 0;
+}
@@ -141,6 +141,13 @@ CmiInitializeHive(
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
+    /* Index large keys by name, we are single-threaded so no locking needed */
+    if (!CmpInitializeSubKeyIndexCache(&Hive->Hive, NULL, NULL))
+    {
+        HvFree(&Hive->Hive);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     /* Add the new hive to the hive list */
     InsertTailList(&CmiHiveListHead,
                    &Hive->HiveList);
@@ -57,9 +57,15 @@ DIB_FUNCTIONS DibFunctionsForBitmapFormat[] =
   },
   /* BMF_32BPP */
   {
+#ifdef _M_AMD64
+    DIB_32BPP_PutPixel, DIB_32BPP_GetPixel, DIB_32BPP_HLine, DIB_32BPP_VLine,
+    DIB_32BPP_BitBlt_SSE2, DIB_32BPP_BitBltSrcCopy, DIB_XXBPP_StretchBlt,
+    DIB_32BPP_TransparentBlt, DIB_32BPP_ColorFill_SSE2, DIB_32BPP_AlphaBlend_SSE2
+#else
     DIB_32BPP_PutPixel, DIB_32BPP_GetPixel, DIB_32BPP_HLine, DIB_32BPP_VLine,
     DIB_32BPP_BitBlt, DIB_32BPP_BitBltSrcCopy, DIB_XXBPP_StretchBlt,
     DIB_32BPP_TransparentBlt, DIB_32BPP_ColorFill, DIB_32BPP_AlphaBlend
+#endif
   },
   /* BMF_4RLE */
   {
@@ -0,0 +1,240 @@
+/*
+ * PROJECT:         Win32 subsystem
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            win32ss/gdi/dib/dib32bpp_sse2.c
+ * PURPOSE:         SSE2 versions of the hot 32bpp DIB functions
+ */
+
+#include <win32k.h>
+#include <emmintrin.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * Exact x / 255 for 0 <= x <= 255 * 255, in every 16 bit lane.
+ * This must give the same results as the integer division in
+ * DIB_32BPP_AlphaBlend, pixels are compared bit by bit by the tests.
+ */
+static __inline __m128i
+Div255Epu16(__m128i x)
+{
+  x = _mm_add_epi16(x, _mm_add_epi16(_mm_srli_epi16(x, 8), _mm_set1_epi16(1)));
+  return _mm_srli_epi16(x, 8);
+}
+
+static __inline ULONG
+BlendPixel(ULONG Dst, ULONG Src, ULONG ConstAlpha, BOOLEAN SrcAlpha)
+{
+  ULONG Result = 0, Alpha, Shift;
+  ULONG Channel[4];
+
+  for (Shift = 0; Shift < 4; Shift++)
+  {
+    Channel[Shift] = (((Src >> (Shift * 8)) & 0xff) * ConstAlpha) / 255;
+  }
+  Alpha = SrcAlpha ? Channel[3] : ConstAlpha;
+
+  for (Shift = 0; Shift < 4; Shift++)
+  {
+    Channel[Shift] += (((Dst >> (Shift * 8)) & 0xff) * (255 - Alpha)) / 255;
+    Result |= min(Channel[Shift], 255) << (Shift * 8);
+  }
+  return Result;
+}
+
+/* Blend two pixels held as 16 bit channels, see DIB_32BPP_AlphaBlend */
+static __inline __m128i
+BlendPixels2(__m128i Dst, __m128i Src, __m128i ConstAlpha, BOOLEAN SrcAlpha)
+{
+  __m128i Alpha;
+
+  Src = Div255Epu16(_mm_mullo_epi16(Src, ConstAlpha));
+  if (SrcAlpha)
+  {
+    /* Broadcast the alpha channel of each pixel to its four channels */
+    Alpha = _mm_shufflelo_epi16(Src, 0xff);
+    Alpha = _mm_shufflehi_epi16(Alpha, 0xff);
+  }
+  else
+  {
+    Alpha = ConstAlpha;
+  }
+
+  Dst = _mm_mullo_epi16(Dst, _mm_sub_epi16(_mm_set1_epi16(255), Alpha));
+  return _mm_add_epi16(Div255Epu16(Dst), Src);
+}
+
+static VOID
+AlphaBlendLine(PULONG Dst, PULONG Src, LONG Count, ULONG ConstAlpha, BOOLEAN SrcAlpha)
+{
+  __m128i Zero = _mm_setzero_si128();
+  __m128i Const = _mm_set1_epi16((SHORT)ConstAlpha);
+  __m128i S, D, Lo, Hi;
+
+  for (; Count >= 4; Count -= 4, Dst += 4, Src += 4)
+  {
+    S = _mm_loadu_si128((__m128i *)Src);
+    D = _mm_loadu_si128((__m128i *)Dst);
+    Lo = BlendPixels2(_mm_unpacklo_epi8(D, Zero), _mm_unpacklo_epi8(S, Zero), Const, SrcAlpha);
+    Hi = BlendPixels2(_mm_unpackhi_epi8(D, Zero), _mm_unpackhi_epi8(S, Zero), Const, SrcAlpha);
+    /* Saturation does the clamping to 255 */
+    _mm_storeu_si128((__m128i *)Dst, _mm_packus_epi16(Lo, Hi));
+  }
+
+  for (; Count > 0; Count--, Dst++, Src++)
+  {
+    *Dst = BlendPixel(*Dst, *Src, ConstAlpha, SrcAlpha);
+  }
+}
+
+static VOID
+FillLine(PULONG Dst, LONG Count, ULONG Color)
+{
+  __m128i Pattern = _mm_set1_epi32((INT)Color);
+
+  for (; Count > 0 && ((ULONG_PTR)Dst & 15) != 0; Count--)
+  {
+    *Dst++ = Color;
+  }
+  for (; Count >= 4; Count -= 4, Dst += 4)
+  {
+    _mm_store_si128((__m128i *)Dst, Pattern);
+  }
+  for (; Count > 0; Count--)
+  {
+    *Dst++ = Color;
+  }
+}
+
+static VOID
+RopLine(PULONG Dst, PULONG Src, LONG Count, ROP4 Rop4)
+{
+  __m128i S, D;
+
+  for (; Count >= 4; Count -= 4, Dst += 4, Src += 4)
+  {
+    S = _mm_loadu_si128((__m128i *)Src);
+    D = _mm_loadu_si128((__m128i *)Dst);
+    switch (Rop4)
+    {
+      case ROP4_SRCAND:   D = _mm_and_si128(D, S); break;
+      case ROP4_SRCPAINT: D = _mm_or_si128(D, S); break;
+      default:            D = _mm_xor_si128(D, S); break;
+    }
+    _mm_storeu_si128((__m128i *)Dst, D);
+  }
+
+  for (; Count > 0; Count--, Dst++, Src++)
+  {
+    switch (Rop4)
+    {
+      case ROP4_SRCAND:   *Dst &= *Src; break;
+      case ROP4_SRCPAINT: *Dst |= *Src; break;
+      default:            *Dst ^= *Src; break;
+    }
+  }
+}
+
+BOOLEAN
+DIB_32BPP_ColorFill_SSE2(SURFOBJ* DestSurface, RECTL* DestRect, ULONG color)
+{
+  PBYTE DestBits;
+  LONG DestY;
+
+  DestBits = (PBYTE)DestSurface->pvScan0 + DestRect->top * DestSurface->lDelta +
+             4 * DestRect->left;
+  for (DestY = DestRect->top; DestY < DestRect->bottom; DestY++)
+  {
+    FillLine((PULONG)DestBits, DestRect->right - DestRect->left, color);
+    DestBits += DestSurface->lDelta;
+  }
+
+  return TRUE;
+}
+
+BOOLEAN
+DIB_32BPP_BitBlt_SSE2(PBLTINFO BltInfo)
+{
+  SURFOBJ *Source = BltInfo->SourceSurface;
+  SURFOBJ *Dest = BltInfo->DestSurface;
+  PBYTE SourceBits, DestBits;
+  LONG Width, Height, j;
+
+  /* Only the plain source ROPs between two 32bpp surfaces without translation */
+  if ((BltInfo->Rop4 != ROP4_SRCAND &&
+       BltInfo->Rop4 != ROP4_SRCPAINT &&
+       BltInfo->Rop4 != ROP4_SRCINVERT) ||
+      Source == NULL || Source->iBitmapFormat != BMF_32BPP ||
+      (BltInfo->XlateSourceToDest != NULL &&
+       (BltInfo->XlateSourceToDest->flXlate & XO_TRIVIAL) == 0))
+  {
+    return DIB_32BPP_BitBlt(BltInfo);
+  }
+
+  Width = BltInfo->DestRect.right - BltInfo->DestRect.left;
+  Height = BltInfo->DestRect.bottom - BltInfo->DestRect.top;
+
+  /* Overlapping blits on the same surface need the careful order of the generic code */
+  if (Source->pvScan0 == Dest->pvScan0 &&
+      BltInfo->SourcePoint.x < BltInfo->DestRect.right &&
+      BltInfo->DestRect.left < BltInfo->SourcePoint.x + Width &&
+      BltInfo->SourcePoint.y < BltInfo->DestRect.bottom &&
+      BltInfo->DestRect.top < BltInfo->SourcePoint.y + Height)
+  {
+    return DIB_32BPP_BitBlt(BltInfo);
+  }
+
+  SourceBits = (PBYTE)Source->pvScan0 + BltInfo->SourcePoint.y * Source->lDelta +
+               4 * BltInfo->SourcePoint.x;
+  DestBits = (PBYTE)Dest->pvScan0 + BltInfo->DestRect.top * Dest->lDelta +
+             4 * BltInfo->DestRect.left;
+  for (j = 0; j < Height; j++)
+  {
+    RopLine((PULONG)DestBits, (PULONG)SourceBits, Width, BltInfo->Rop4);
+    SourceBits += Source->lDelta;
+    DestBits += Dest->lDelta;
+  }
+
+  return TRUE;
+}
+
+BOOLEAN
+DIB_32BPP_AlphaBlend_SSE2(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
+                          RECTL* SourceRect, CLIPOBJ* ClipRegion,
+                          XLATEOBJ* ColorTranslation, BLENDOBJ* BlendObj)
+{
+  BLENDFUNCTION BlendFunc = BlendObj->BlendFunction;
+  PBYTE SourceBits, DestBits;
+  LONG Width, j;
+
+  /* Stretching, translation and invalid parameters are left to the generic code */
+  if (BlendFunc.BlendOp != AC_SRC_OVER || BlendFunc.BlendFlags != 0 ||
+      (BlendFunc.AlphaFormat & ~AC_SRC_ALPHA) != 0 ||
+      Source->iBitmapFormat != BMF_32BPP ||
+      (ColorTranslation != NULL && (ColorTranslation->flXlate & XO_TRIVIAL) == 0) ||
+      DestRect->right - DestRect->left != SourceRect->right - SourceRect->left ||
+      DestRect->bottom - DestRect->top != SourceRect->bottom - SourceRect->top)
+  {
+    return DIB_32BPP_AlphaBlend(Dest, Source, DestRect, SourceRect, ClipRegion,
+                                ColorTranslation, BlendObj);
+  }
+
+  Width = DestRect->right - DestRect->left;
+  SourceBits = (PBYTE)Source->pvScan0 + SourceRect->top * Source->lDelta +
+               4 * SourceRect->left;
+  DestBits = (PBYTE)Dest->pvScan0 + DestRect->top * Dest->lDelta +
+             4 * DestRect->left;
+  for (j = DestRect->top; j < DestRect->bottom; j++)
+  {
+    AlphaBlendLine((PULONG)DestBits, (PULONG)SourceBits, Width,
+                   BlendFunc.SourceConstantAlpha,
+                   (BlendFunc.AlphaFormat & AC_SRC_ALPHA) != 0);
+    SourceBits += Source->lDelta;
+    DestBits += Dest->lDelta;
+  }
+
+  return TRUE;
+}
+
+/* EOF */
@@ -89,7 +89,7 @@ CalculateCoordinates(
         /* Check for right-to-left case */
         if (pbltdata->siDst.iFormat == 0)
         {
-            pbltdata->siPat.pjBase += (psizlPat->cx - 1) * pbltdata->siMsk.jBpp / 8;
+            pbltdata->siPat.pjBase += (psizlPat->cx - 1) * pbltdata->siPat.jBpp / 8;
             pbltdata->siPat.ptOrig.x = psizlPat->cx - 1 - pbltdata->siPat.ptOrig.x;
         }
     }
@@ -187,6 +187,14 @@ EngBitBlt(
         {
             bltdata.siDst.iFormat = psoTrg->iBitmapFormat;
             bltdata.siSrc.iFormat = psoSrc->iBitmapFormat;
+
+            /* Without color translation the equal surface versions do the job
+               and save an xlate call per pixel */
+            if ((psoSrc->iBitmapFormat == psoTrg->iBitmapFormat) &&
+                (pxlo->flXlate & XO_TRIVIAL))
+            {
+                bltdata.siSrc.iFormat = 0;
+            }
         }
 
         /* Set the source format info */
@@ -250,26 +258,26 @@ EngBitBlt(
         psizlPat = NULL;
     }
 
-    /* Check if the ROP uses a mask */
-    if (ROP4_USES_MASK(rop4))
+    /* Check if the ROP uses a mask, but we don't have a mask surface */
+    if (ROP4_USES_MASK(rop4) && (psoMask == NULL))
     {
-        //__debugbreak();
+        /* Must have a brush */
+        NT_ASSERT(pbo); // FIXME: test this!
 
-        /* Check if we don't have a mask surface */
+        /* Check if the BRUSHOBJ can provide the mask */
+        psoMask = BRUSHOBJ_psoMask(pbo);
         if (psoMask == NULL)
         {
-            /* Must have a brush */
-            NT_ASSERT(pbo); // FIXME: test this!
-
-            /* Check if the BRUSHOBJ can provide the mask */
-            psoMask = BRUSHOBJ_psoMask(pbo);
-            if (psoMask == NULL)
-            {
-                /* We have no mask, assume the mask is all foreground */
-                rop4 = (rop4 & 0xFF) || ((rop4 & 0xFF) << 8);
-            }
+            /* We have no mask, assume the mask is all foreground */
+            rop4 = ROP4_FGND(rop4) | (ROP4_FGND(rop4) << 8);
+            bltdata.rop4 = rop4;
+            bltdata.apfnDoRop[0] = bltdata.apfnDoRop[1];
         }
+    }
 
+    /* Check if the ROP uses a mask */
+    if (ROP4_USES_MASK(rop4))
+    {
         /* Set the mask format info */
         bltdata.siMsk.iFormat = psoMask->iBitmapFormat;
         bltdata.siMsk.pvScan0 = psoMask->pvScan0;
@@ -25,6 +25,8 @@ typedef struct _FONT_ENTRY_COLL_MEM
 typedef struct _FONT_CACHE_ENTRY
 {
     LIST_ENTRY ListEntry;
+    LIST_ENTRY HashEntry;
+    SIZE_T Size;
     int GlyphIndex;
     FT_Face Face;
     FT_BitmapGlyph BitmapGlyph;
@@ -89,10 +89,19 @@ static BOOL RenderingEnabled = TRUE;
 #define ASSERT_FREETYPE_LOCK_NOT_HELD() \
   ASSERT(FreeTypeLock->Owner != KeGetCurrentThread())
 
-#define MAX_FONT_CACHE 256
+/* The glyph cache is bounded by the memory it takes, the least recently
+   used glyphs go first. Lookups go through a hash of face, glyph and height. */
+#define MAX_FONT_CACHE_SIZE (1024 * 1024)
+#define FONT_CACHE_HASH_SIZE 1024
 
 static LIST_ENTRY FontCacheListHead;
-static UINT FontCacheNumEntries;
+static LIST_ENTRY FontCacheHashTable[FONT_CACHE_HASH_SIZE];
+
+/* Statistics, shown by the !gdi.glyphcache KDBG command */
+UINT FontCacheNumEntries;
+SIZE_T FontCacheSize;
+ULONG FontCacheHits;
+ULONG FontCacheMisses;
 
 static PWCHAR ElfScripts[32] =   /* These are in the order of the fsCsb[0] bits */
 {
@@ -232,9 +241,11 @@ RemoveCachedEntry(PFONT_CACHE_ENTRY Entry)
 
     FT_Done_Glyph((FT_Glyph)Entry->BitmapGlyph);
     RemoveEntryList(&Entry->ListEntry);
-    ExFreePoolWithTag(Entry, TAG_FONT);
+    RemoveEntryList(&Entry->HashEntry);
+    ASSERT(FontCacheSize >= Entry->Size);
+    FontCacheSize -= Entry->Size;
     FontCacheNumEntries--;
-    ASSERT(FontCacheNumEntries <= MAX_FONT_CACHE);
+    ExFreePoolWithTag(Entry, TAG_FONT);
 }
 
 static void
@@ -454,10 +465,16 @@ BOOL FASTCALL
 InitFontSupport(VOID)
 {
     ULONG ulError;
+    UINT i;
 
     InitializeListHead(&FontListHead);
     InitializeListHead(&FontCacheListHead);
+    for (i = 0; i < FONT_CACHE_HASH_SIZE; i++)
+    {
+        InitializeListHead(&FontCacheHashTable[i]);
+    }
     FontCacheNumEntries = 0;
+    FontCacheSize = 0;
     /* Fast Mutexes must be allocated from non paged pool */
     FontListLock = ExAllocatePoolWithTag(NonPagedPool, sizeof(FAST_MUTEX), TAG_INTERNAL_SYNC);
     if (FontListLock == NULL)
@@ -2640,6 +2657,23 @@ SameScaleMatrix(
             FLOATOBJ_Equal(&pmx1->efM22, &pmx2->efM22));
 }
 
+static
+PLIST_ENTRY
+FontCacheBucket(
+    FT_Face Face,
+    INT GlyphIndex,
+    INT Height)
+{
+    ULONG Hash;
+
+    Hash = (ULONG)((ULONG_PTR)Face >> 4);
+    Hash = Hash * 31 + (ULONG)GlyphIndex;
+    Hash = Hash * 31 + (ULONG)Height;
+    Hash ^= Hash >> 16;
+
+    return &FontCacheHashTable[Hash & (FONT_CACHE_HASH_SIZE - 1)];
+}
+
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphCacheGet(
     FT_Face Face,
@@ -2647,31 +2681,32 @@ ftGdiGlyphCacheGet(
     INT Height,
     PMATRIX pmx)
 {
-    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY BucketHead, CurrentEntry;
     PFONT_CACHE_ENTRY FontEntry;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    CurrentEntry = FontCacheListHead.Flink;
-    while (CurrentEntry != &FontCacheListHead)
+    BucketHead = FontCacheBucket(Face, GlyphIndex, Height);
+    for (CurrentEntry = BucketHead->Flink;
+         CurrentEntry != BucketHead;
+         CurrentEntry = CurrentEntry->Flink)
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, HashEntry);
         if ((FontEntry->Face == Face) &&
             (FontEntry->GlyphIndex == GlyphIndex) &&
             (FontEntry->Height == Height) &&
             (SameScaleMatrix(&FontEntry->mxWorldToDevice, pmx)))
-            break;
-        CurrentEntry = CurrentEntry->Flink;
-    }
-
-    if (CurrentEntry == &FontCacheListHead)
-    {
-        return NULL;
+        {
+            /* Most recently used first */
+            RemoveEntryList(&FontEntry->ListEntry);
+            InsertHeadList(&FontCacheListHead, &FontEntry->ListEntry);
+            FontCacheHits++;
+            return FontEntry->BitmapGlyph;
+        }
     }
 
-    RemoveEntryList(CurrentEntry);
-    InsertHeadList(&FontCacheListHead, CurrentEntry);
-    return FontEntry->BitmapGlyph;
+    FontCacheMisses++;
+    return NULL;
 }
 
 /* no cache */
@@ -2775,12 +2810,19 @@ ftGdiGlyphCacheSet(
     NewEntry->BitmapGlyph = BitmapGlyph;
     NewEntry->Height = Height;
     NewEntry->mxWorldToDevice = *pmx;
+    NewEntry->Size = sizeof(FONT_CACHE_ENTRY) + sizeof(FT_BitmapGlyphRec) +
+                     abs(BitmapGlyph->bitmap.pitch) * BitmapGlyph->bitmap.rows;
 
     InsertHeadList(&FontCacheListHead, &NewEntry->ListEntry);
-    if (++FontCacheNumEntries > MAX_FONT_CACHE)
+    InsertHeadList(FontCacheBucket(Face, GlyphIndex, Height), &NewEntry->HashEntry);
+    FontCacheNumEntries++;
+    FontCacheSize += NewEntry->Size;
+
+    /* Make room by dropping the least recently used glyphs, but not this one */
+    while (FontCacheSize > MAX_FONT_CACHE_SIZE &&
+           FontCacheListHead.Blink != &NewEntry->ListEntry)
     {
-        NewEntry = CONTAINING_RECORD(FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry);
-        RemoveCachedEntry(NewEntry);
+        RemoveCachedEntry(CONTAINING_RECORD(FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry));
     }
 
     return BitmapGlyph;
@@ -15,6 +15,10 @@
 extern PENTRY gpentHmgr;
 extern PULONG gpaulRefCount;
 extern ULONG gulFirstUnused;
+extern UINT FontCacheNumEntries;
+extern SIZE_T FontCacheSize;
+extern ULONG FontCacheHits;
+extern ULONG FontCacheMisses;
 
 
 static const char * gpszObjectTypes[] =
@@ -69,6 +73,7 @@ KdbCommand_Gdi_help(VOID)
              "- handle <handle> - Displays information about a handle\n"
              "- entry <entry> - Displays an ENTRY, <entry> can be a pointer or index\n"
              "- baseobject <object> - Displays a BASEOBJECT\n"
+             "- glyphcache - Displays the glyph cache statistics\n"
 #if DBG_ENABLE_EVENT_LOGGING
              "- eventlist <object> - Displays the eventlist for an object\n"
 #endif
@@ -278,6 +283,18 @@ KdbCommand_Gdi_baseobject(char *argv)
 {
 }
 
+static
+VOID
+KdbCommand_Gdi_glyphcache(VOID)
+{
+    ULONG Total = FontCacheHits + FontCacheMisses;
+
+    DbgPrint("Glyph cache: %u entries, %Iu bytes\n", FontCacheNumEntries, FontCacheSize);
+    DbgPrint(" hits = %lu, misses = %lu (%lu%% hits)\n",
+             FontCacheHits, FontCacheMisses,
+             Total ? (ULONG)((ULONGLONG)FontCacheHits * 100 / Total) : 0);
+}
+
 #if DBG_ENABLE_EVENT_LOGGING
 static
 VOID
@@ -347,6 +364,10 @@ DbgGdiKdbgCliCallback(
     {
         KdbCommand_Gdi_baseobject(argv[1]);
     }
+    else if (stricmp(argv[0], "!gdi.glyphcache") == 0)
+    {
+        KdbCommand_Gdi_glyphcache();
+    }
 #if DBG_ENABLE_EVENT_LOGGING
     else if (stricmp(argv[0], "!gdi.eventlist") == 0)
     {
@@ -958,6 +958,7 @@ co_IntPeekMessage( PMSG Msg,
           posted to this threads message queue. If any we loop again.
         */
         if ((ProcessMask & QS_TIMER) &&
+            pti->cTimersReady &&
             PostTimerMessages(Window))
         {
             continue;
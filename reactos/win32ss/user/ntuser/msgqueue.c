@@ -524,13 +524,14 @@ MsqPostMouseMove(PTHREADINFO pti, MSG* Msg, LONG_PTR ExtraInfo)
     ListHead = &MessageQueue->HardwareMessagesListHead;
 
     // Do nothing if empty.
-    if (!IsListEmpty(ListHead->Flink))
+    if (!IsListEmpty(ListHead))
     {
        // Look at the end of the list,
        Message = CONTAINING_RECORD(ListHead->Blink, USER_MESSAGE, ListEntry);
 
-       // If the mouse move message is existing on the list,
-       if (Message->Msg.message == WM_MOUSEMOVE)
+       // If the mouse move message is existing on the list, and not being processed right now,
+       if (Message->Msg.message == WM_MOUSEMOVE &&
+           MessageQueue->idSysPeek != (ULONG_PTR)Message)
        {
           // Overwrite the message with updated data!
           Message->Msg = *Msg;
@@ -731,6 +732,21 @@ co_MsqInsertMouseMessage(MSG* Msg, DWORD flags, ULONG_PTR dwExtraInfo, BOOL Hook
    }
 }
 
+/* Keep the counts co_MsqPeekHardwareMessage checks filters against */
+static VOID FASTCALL
+MsqCountInputMessage(PUSER_MESSAGE_QUEUE MessageQueue, UINT Message, LONG Delta)
+{
+   MessageQueue->cInputMessages += Delta;
+   if (Message >= WM_KEYFIRST && Message <= WM_KEYLAST)
+   {
+      MessageQueue->cInputKeyMessages += Delta;
+   }
+   else if (Message >= WM_MOUSEFIRST && Message <= WM_MOUSELAST)
+   {
+      MessageQueue->cInputMouseMessages += Delta;
+   }
+}
+
 PUSER_MESSAGE FASTCALL
 MsqCreateMessage(LPMSG Msg)
 {
@@ -758,6 +774,15 @@ MsqDestroyMessage(PUSER_MESSAGE Message)
       return;
    }
    RemoveEntryList(&Message->ListEntry);
+   if (Message->pqInput)
+   {
+      MsqCountInputMessage(Message->pqInput, Message->Msg.message, -1);
+   }
+   else
+   {
+      Message->pti->cPostedMessages--;
+      if (Message->QS_Flags & QS_EVENT) Message->pti->cPostedEvents--;
+   }
    Message->pti = NULL;
    ExFreeToPagedLookasideList(pgMessageLookasideList, Message);
    PostMsgCount--;
@@ -1362,20 +1387,31 @@ MsqPostMessage(PTHREADINFO pti,
 
    MessageQueue = pti->MessageQueue;
 
+   if (Msg->message == WM_HOTKEY) MessageBits |= QS_HOTKEY; // Justin Case, just set it.
+   Message->dwQEvent = dwQEvent;
+   Message->ExtraInfo = ExtraInfo;
+   Message->QS_Flags = MessageBits;
+   Message->pti = pti;
+
    if (!HardwareMessage)
    {
        InsertTailList(&pti->PostedMessagesListHead, &Message->ListEntry);
+       pti->cPostedMessages++;
+       if (MessageBits & QS_EVENT) pti->cPostedEvents++;
+       // Any filter may match now.
+       pti->bPostMissValid = FALSE;
    }
    else
    {
        InsertTailList(&MessageQueue->HardwareMessagesListHead, &Message->ListEntry);
+       Message->pqInput = MessageQueue;
+       MsqCountInputMessage(MessageQueue, Msg->message, 1);
    }
 
-   if (Msg->message == WM_HOTKEY) MessageBits |= QS_HOTKEY; // Justin Case, just set it.
-   Message->dwQEvent = dwQEvent;
-   Message->ExtraInfo = ExtraInfo;
-   Message->QS_Flags = MessageBits;
-   Message->pti = pti;
+   if (pti->cPostedMessages + MessageQueue->cInputMessages > pti->cMaxQueueDepth)
+   {
+       pti->cMaxQueueDepth = pti->cPostedMessages + MessageQueue->cInputMessages;
+   }
    MsqWakeQueue(pti, MessageBits, TRUE);
    TRACE("Post Message %d\n",PostMsgCount);
 }
@@ -1986,6 +2022,20 @@ filter_contains_hw_range( UINT first, UINT last )
     return 1;
 }
 
+/* check whether any of the queued hardware messages can pass the filter, without walking the queue */
+static BOOL FASTCALL
+MsqInputFilterMayMatch(PUSER_MESSAGE_QUEUE MessageQueue, UINT first, UINT last)
+{
+    if (MessageQueue->cInputMessages == 0) return FALSE;
+    if (first == 0 && last == 0) return TRUE;
+
+    /* Only the key and mouse ranges are counted, anything else is checked the slow way */
+    if (MessageQueue->cInputMessages != MessageQueue->cInputKeyMessages + MessageQueue->cInputMouseMessages) return TRUE;
+    if (MessageQueue->cInputKeyMessages && first <= WM_KEYLAST && last >= WM_KEYFIRST) return TRUE;
+    if (MessageQueue->cInputMouseMessages && first <= WM_MOUSELAST && last >= WM_MOUSEFIRST) return TRUE;
+    return FALSE;
+}
+
 /* check whether message is in the range of mouse messages */
 static inline BOOL is_mouse_message( UINT message )
 {
@@ -2012,6 +2062,8 @@ co_MsqPeekHardwareMessage(IN PTHREADINFO pti,
    ULONG_PTR idSave;
    DWORD QS_Flags;
    LONG_PTR ExtraInfo;
+   LARGE_INTEGER LargeTickCount;
+   ULONG Latency;
    BOOL Ret = FALSE;
    PUSER_MESSAGE_QUEUE MessageQueue = pti->MessageQueue;
 
@@ -2021,6 +2073,8 @@ co_MsqPeekHardwareMessage(IN PTHREADINFO pti,
 
    if (IsListEmpty(ListHead)) return FALSE;
 
+   if (!MsqInputFilterMayMatch(MessageQueue, MsgFilterLow, MsgFilterHigh)) return FALSE;
+
    if (!MessageQueue->ptiSysLock)
    {
       MessageQueue->ptiSysLock = pti;
@@ -2096,6 +2150,15 @@ co_MsqPeekHardwareMessage(IN PTHREADINFO pti,
             pti->ptLast   = msg.pt;
             pti->timeLast = msg.time;
             MessageQueue->ExtraInfo = ExtraInfo;
+
+            if (Remove)
+            {
+               KeQueryTickCount(&LargeTickCount);
+               Latency = MsqCalculateMessageTime(&LargeTickCount) - msg.time;
+               pti->cInputRetrieved++;
+               pti->dwInputLatency += Latency;
+               pti->dwMaxInputLatency = max(pti->dwMaxInputLatency, Latency);
+            }
             Ret = TRUE;
             break;
          }
@@ -2121,12 +2184,28 @@ MsqPeekMessage(IN PTHREADINFO pti,
    PUSER_MESSAGE CurrentMessage;
    PLIST_ENTRY ListHead;
    DWORD QS_Flags;
+   ULONG_PTR idWnd;
    BOOL Ret = FALSE;
 
    ListHead = pti->PostedMessagesListHead.Flink;
 
    if (IsListEmpty(ListHead)) return FALSE;
 
+   /* Internal events only match by their QS bit, co_IntPeekMessage asks for them on every pass */
+   if (MsgFilterLow == 0 && MsgFilterHigh == 0 && !(QSflags & ~QS_EVENT) && pti->cPostedEvents == 0)
+      return FALSE;
+
+   /* Nothing was posted since this filter last came up empty */
+   idWnd = (!Window || Window == PWND_BOTTOM) ? (ULONG_PTR)Window : (ULONG_PTR)Window->head.h;
+   if ( pti->bPostMissValid &&
+        pti->idPostMissWnd == idWnd &&
+        pti->msgPostMissMin == MsgFilterLow &&
+        pti->msgPostMissMax == MsgFilterHigh &&
+        pti->fsPostMissQS == QSflags )
+   {
+      return FALSE;
+   }
+
    while(ListHead != &pti->PostedMessagesListHead)
    {
       CurrentMessage = CONTAINING_RECORD(ListHead, USER_MESSAGE, ListEntry);
@@ -2161,6 +2240,15 @@ MsqPeekMessage(IN PTHREADINFO pti,
       }
    }
 
+   if (!Ret)
+   {
+      pti->bPostMissValid = TRUE;
+      pti->idPostMissWnd  = idWnd;
+      pti->msgPostMissMin = MsgFilterLow;
+      pti->msgPostMissMax = MsgFilterHigh;
+      pti->fsPostMissQS   = QSflags;
+   }
+
    return Ret;
 }
 
@@ -5,6 +5,8 @@
 #define MSQ_ISHOOK      1
 #define MSQ_INJECTMODULE 2
 
+struct _USER_MESSAGE_QUEUE;
+
 typedef struct _USER_MESSAGE
 {
   LIST_ENTRY ListEntry;
@@ -13,10 +15,10 @@ typedef struct _USER_MESSAGE
   LONG_PTR ExtraInfo;
   DWORD dwQEvent;
   PTHREADINFO pti;
+  /* Queue whose hardware list holds the message, NULL for posted messages */
+  struct _USER_MESSAGE_QUEUE *pqInput;
 } USER_MESSAGE, *PUSER_MESSAGE;
 
-struct _USER_MESSAGE_QUEUE;
-
 typedef struct _USER_SENT_MESSAGE
 {
   LIST_ENTRY ListEntry;
@@ -57,6 +59,10 @@ typedef struct _USER_MESSAGE_QUEUE
 
   /* Queue for hardware messages for the queue. */
   LIST_ENTRY HardwareMessagesListHead;
+  /* Hardware messages queued, and how many fall in the key and mouse filter ranges */
+  ULONG cInputMessages;
+  ULONG cInputKeyMessages;
+  ULONG cInputMouseMessages;
   /* Last click message for translating double clicks */
   MSG msgDblClk;
   /* Current capture window for this queue. */
@@ -146,6 +146,22 @@ typedef struct _THREADINFO
     // Accounting of queue bit sets, the rest are flags. QS_TIMER QS_PAINT counts are handled in thread information.
     DWORD nCntsQBits[QSIDCOUNTS]; // QS_KEY QS_MOUSEMOVE QS_MOUSEBUTTON QS_POSTMESSAGE QS_SENDMESSAGE QS_HOTKEY
 
+    /* Posted list depth and the QS_EVENT messages in it. */
+    ULONG cPostedMessages;
+    ULONG cPostedEvents;
+    /* Last filter MsqPeekMessage found nothing for, valid until the next post. */
+    BOOL bPostMissValid;
+    ULONG_PTR idPostMissWnd;
+    UINT msgPostMissMin;
+    UINT msgPostMissMax;
+    UINT fsPostMissQS;
+
+    /* Queue statistics: peak posted plus input depth, and the time input waited to be retrieved. */
+    ULONG cMaxQueueDepth;
+    ULONG cInputRetrieved;
+    ULONG dwInputLatency;     // Sum over cInputRetrieved messages, in ms
+    ULONG dwMaxInputLatency;
+
     LIST_ENTRY WindowListHead;
     LIST_ENTRY W32CallbackListHead;
     SINGLE_LIST_ENTRY  ReferencesList;
@@ -0,0 +1,181 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for BitBlt ROPs between DIB sections
+ */
+
+#include <apitest.h>
+
+#include <wingdi.h>
+#include <winuser.h>
+
+static const DWORD gadwRops[] =
+{
+    SRCCOPY, SRCAND, SRCPAINT, SRCINVERT, MERGECOPY, 0xE20746 /* DSPDxax */, 0xB8074A /* PSDPxax */
+};
+
+static
+HBITMAP
+CreateDIB(HDC hdc, WORD wBpp, LONG cx, LONG cy, PVOID *ppvBits)
+{
+    struct
+    {
+        BITMAPINFOHEADER bmiHeader;
+        RGBQUAD bmiColors[256];
+    } bmi;
+    ULONG i;
+
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = cx;
+    bmi.bmiHeader.biHeight = -cy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = wBpp;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    /* Use the same gray palette for all indexed formats */
+    for (i = 0; i < 256; i++)
+    {
+        bmi.bmiColors[i].rgbRed = bmi.bmiColors[i].rgbGreen = bmi.bmiColors[i].rgbBlue = (BYTE)i;
+    }
+
+    return CreateDIBSection(hdc, (PBITMAPINFO)&bmi, DIB_RGB_COLORS, ppvBits, NULL, 0);
+}
+
+static
+ULONG
+DoRop(DWORD dwRop, ULONG D, ULONG S, ULONG P)
+{
+    switch (dwRop)
+    {
+        case SRCCOPY:   return S;
+        case SRCAND:    return D & S;
+        case SRCPAINT:  return D | S;
+        case SRCINVERT: return D ^ S;
+        case MERGECOPY: return P & S;
+        case 0xE20746:  return D ^ (S & (P ^ D));
+        case 0xB8074A:  return P ^ (S & (D ^ P));
+    }
+    return 0;
+}
+
+static
+void
+Test_BitBlt_Rops(void)
+{
+    HDC hdcSrc, hdcDst;
+    HBITMAP hbmSrc, hbmDst;
+    HBRUSH hbr;
+    PULONG pulSrc, pulDst;
+    ULONG aulOrig[16 * 16], i, r, ulExpected;
+    BOOL ret;
+
+    hdcSrc = CreateCompatibleDC(NULL);
+    hdcDst = CreateCompatibleDC(NULL);
+    hbmSrc = CreateDIB(hdcSrc, 32, 16, 16, (PVOID*)&pulSrc);
+    hbmDst = CreateDIB(hdcDst, 32, 16, 16, (PVOID*)&pulDst);
+    ok(hbmSrc != NULL && hbmDst != NULL, "Failed to create the DIB sections\n");
+    if (!hbmSrc || !hbmDst) return;
+
+    SelectObject(hdcSrc, hbmSrc);
+    SelectObject(hdcDst, hbmDst);
+    hbr = CreateSolidBrush(RGB(0x12, 0x34, 0x56));
+    SelectObject(hdcDst, hbr);
+
+    for (i = 0; i < 16 * 16; i++)
+    {
+        pulSrc[i] = (i * 0x9E3779B1) & 0xFFFFFF;
+        aulOrig[i] = (i * 0x85EBCA77) & 0xFFFFFF;
+    }
+
+    for (r = 0; r < sizeof(gadwRops) / sizeof(gadwRops[0]); r++)
+    {
+        CopyMemory(pulDst, aulOrig, sizeof(aulOrig));
+        ret = BitBlt(hdcDst, 1, 1, 13, 14, hdcSrc, 2, 0, gadwRops[r]);
+        ok(ret == TRUE, "BitBlt with rop 0x%lx failed\n", gadwRops[r]);
+        GdiFlush();
+
+        for (i = 0; i < 16 * 16; i++)
+        {
+            ulExpected = aulOrig[i];
+            if ((i % 16) >= 1 && (i % 16) < 14 && (i / 16) >= 1 && (i / 16) < 15)
+            {
+                ulExpected = DoRop(gadwRops[r], aulOrig[i], pulSrc[i - 16 + 1], 0x123456) & 0xFFFFFF;
+            }
+            if ((pulDst[i] & 0xFFFFFF) != ulExpected) break;
+        }
+        ok(i == 16 * 16, "Rop 0x%lx: pixel %lu is 0x%lx, expected 0x%lx\n",
+           gadwRops[r], i, i < 16 * 16 ? pulDst[i] : 0, i < 16 * 16 ? ulExpected : 0);
+    }
+
+    DeleteDC(hdcSrc);
+    DeleteDC(hdcDst);
+    DeleteObject(hbmSrc);
+    DeleteObject(hbmDst);
+    DeleteObject(hbr);
+}
+
+static
+void
+Test_BitBlt_SrcRopSpans(void)
+{
+    static const DWORD adwRops[] = { SRCAND, SRCPAINT, SRCINVERT };
+    HDC hdcSrc, hdcDst;
+    HBITMAP hbmSrc, hbmDst;
+    PULONG pulSrc, pulDst;
+    ULONG aulOrig[20 * 3], i, r, xDst, xSrc, cx, x, y, ulExpected;
+    BOOL ret;
+
+    hdcSrc = CreateCompatibleDC(NULL);
+    hdcDst = CreateCompatibleDC(NULL);
+    hbmSrc = CreateDIB(hdcSrc, 32, 20, 3, (PVOID*)&pulSrc);
+    hbmDst = CreateDIB(hdcDst, 32, 20, 3, (PVOID*)&pulDst);
+    ok(hbmSrc != NULL && hbmDst != NULL, "Failed to create the DIB sections\n");
+    if (!hbmSrc || !hbmDst) return;
+
+    SelectObject(hdcSrc, hbmSrc);
+    SelectObject(hdcDst, hbmDst);
+
+    for (i = 0; i < 20 * 3; i++)
+    {
+        pulSrc[i] = (i * 0x9E3779B1) & 0xFFFFFF;
+        aulOrig[i] = (i * 0x85EBCA77) & 0xFFFFFF;
+    }
+
+    /* Odd widths and every start alignment, on both sides of a 4 pixel step */
+    for (r = 0; r < sizeof(adwRops) / sizeof(adwRops[0]); r++)
+    for (xDst = 0; xDst < 4; xDst++)
+    for (xSrc = 0; xSrc < 4; xSrc++)
+    for (cx = 1; cx <= 13; cx += 2)
+    {
+        CopyMemory(pulDst, aulOrig, sizeof(aulOrig));
+        ret = BitBlt(hdcDst, xDst, 1, cx, 1, hdcSrc, xSrc, 2, adwRops[r]);
+        ok(ret == TRUE, "BitBlt with rop 0x%lx failed\n", adwRops[r]);
+        GdiFlush();
+
+        for (i = 0; i < 20 * 3; i++)
+        {
+            x = i % 20;
+            y = i / 20;
+            ulExpected = aulOrig[i];
+            if (y == 1 && x >= xDst && x < xDst + cx)
+            {
+                ulExpected = DoRop(adwRops[r], aulOrig[i], pulSrc[2 * 20 + xSrc + x - xDst], 0);
+            }
+            if ((pulDst[i] & 0xFFFFFF) != ulExpected) break;
+        }
+        ok(i == 20 * 3, "Rop 0x%lx, dst %lu, src %lu, width %lu: pixel %lu is 0x%lx, expected 0x%lx\n",
+           adwRops[r], xDst, xSrc, cx, i, i < 20 * 3 ? pulDst[i] : 0, i < 20 * 3 ? ulExpected : 0);
+    }
+
+    DeleteDC(hdcSrc);
+    DeleteDC(hdcDst);
+    DeleteObject(hbmSrc);
+    DeleteObject(hbmDst);
+}
+
+START_TEST(BitBlt)
+{
+    Test_BitBlt_Rops();
+    Test_BitBlt_SrcRopSpans();
+}
@@ -0,0 +1,141 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * PURPOSE:         Test for GdiAlphaBlend between 32bpp DIB sections
+ */
+
+#include <apitest.h>
+
+#include <wingdi.h>
+#include <winuser.h>
+
+#define CX 20
+#define CY 3
+
+static const BYTE gajConstAlpha[] = { 0, 1, 127, 128, 200, 254, 255 };
+
+static
+HBITMAP
+CreateDIB32(HDC hdc, PULONG *ppulBits)
+{
+    BITMAPINFO bmi;
+
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = CX;
+    bmi.bmiHeader.biHeight = -CY;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    return CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, (PVOID*)ppulBits, NULL, 0);
+}
+
+/* Same integer arithmetic as DIB_32BPP_AlphaBlend in win32k */
+static
+ULONG
+BlendPixel(ULONG ulDst, ULONG ulSrc, ULONG ConstAlpha, BOOL bSrcAlpha)
+{
+    ULONG aul[4], ulResult = 0, Alpha, i;
+
+    for (i = 0; i < 4; i++)
+    {
+        aul[i] = (((ulSrc >> (i * 8)) & 0xFF) * ConstAlpha) / 255;
+    }
+    Alpha = bSrcAlpha ? aul[3] : ConstAlpha;
+
+    for (i = 0; i < 4; i++)
+    {
+        aul[i] += (((ulDst >> (i * 8)) & 0xFF) * (255 - Alpha)) / 255;
+        ulResult |= min(aul[i], 255) << (i * 8);
+    }
+
+    return ulResult;
+}
+
+static
+void
+Test_GdiAlphaBlend_Spans(BOOL bSrcAlpha)
+{
+    HDC hdcSrc, hdcDst;
+    HBITMAP hbmSrc, hbmDst;
+    PULONG pulSrc, pulDst;
+    ULONG aulOrig[CX * CY], ulExpected, i, a, xDst, xSrc, cx, x, y;
+    BLENDFUNCTION bf;
+    BYTE jAlpha;
+    BOOL ret;
+
+    hdcSrc = CreateCompatibleDC(NULL);
+    hdcDst = CreateCompatibleDC(NULL);
+    hbmSrc = CreateDIB32(hdcSrc, &pulSrc);
+    hbmDst = CreateDIB32(hdcDst, &pulDst);
+    ok(hbmSrc != NULL && hbmDst != NULL, "Failed to create the DIB sections\n");
+    if (!hbmSrc || !hbmDst) return;
+
+    SelectObject(hdcSrc, hbmSrc);
+    SelectObject(hdcDst, hbmDst);
+
+    for (i = 0; i < CX * CY; i++)
+    {
+        /* Premultiplied sources for per-pixel alpha, including 0 and 255 */
+        pulSrc[i] = (i * 0x9E3779B1) ^ (i << 7);
+        if (bSrcAlpha)
+        {
+            jAlpha = (i % 5 == 0) ? 0xFF : (i % 7 == 0) ? 0 : (BYTE)(pulSrc[i] >> 24);
+            pulSrc[i] = ((ULONG)jAlpha << 24) |
+                        ((((pulSrc[i] >> 16) & 0xFF) * jAlpha / 255) << 16) |
+                        ((((pulSrc[i] >> 8) & 0xFF) * jAlpha / 255) << 8) |
+                        ((pulSrc[i] & 0xFF) * jAlpha / 255);
+        }
+        aulOrig[i] = i * 0x85EBCA77;
+    }
+
+    bf.BlendOp = AC_SRC_OVER;
+    bf.BlendFlags = 0;
+    bf.AlphaFormat = bSrcAlpha ? AC_SRC_ALPHA : 0;
+
+    /* Odd widths and every start alignment, on both sides of a 4 pixel step */
+    for (a = 0; a < sizeof(gajConstAlpha) / sizeof(gajConstAlpha[0]); a++)
+    {
+        bf.SourceConstantAlpha = gajConstAlpha[a];
+        for (xDst = 0; xDst < 4; xDst++)
+        for (xSrc = 0; xSrc < 4; xSrc++)
+        for (cx = 1; cx <= 13; cx += 2)
+        {
+            CopyMemory(pulDst, aulOrig, sizeof(aulOrig));
+            ret = GdiAlphaBlend(hdcDst, xDst, 1, cx, 1, hdcSrc, xSrc, 2, cx, 1, bf);
+            ok(ret == TRUE, "GdiAlphaBlend failed\n");
+            GdiFlush();
+
+            for (i = 0; i < CX * CY; i++)
+            {
+                x = i % CX;
+                y = i / CX;
+                ulExpected = aulOrig[i];
+                if (y == 1 && x >= xDst && x < xDst + cx)
+                {
+                    ulExpected = BlendPixel(aulOrig[i],
+                                            pulSrc[2 * CX + xSrc + x - xDst],
+                                            bf.SourceConstantAlpha,
+                                            bSrcAlpha);
+                }
+                if (pulDst[i] != ulExpected) break;
+            }
+            ok(i == CX * CY,
+               "Alpha %u/%d, dst %lu, src %lu, width %lu: pixel %lu is 0x%08lx, expected 0x%08lx\n",
+               bf.SourceConstantAlpha, bSrcAlpha, xDst, xSrc, cx, i,
+               i < CX * CY ? pulDst[i] : 0, i < CX * CY ? ulExpected : 0);
+        }
+    }
+
+    DeleteDC(hdcSrc);
+    DeleteDC(hdcDst);
+    DeleteObject(hbmSrc);
+    DeleteObject(hbmDst);
+}
+
+START_TEST(GdiAlphaBlend)
+{
+    Test_GdiAlphaBlend_Spans(FALSE);
+    Test_GdiAlphaBlend_Spans(TRUE);
+}
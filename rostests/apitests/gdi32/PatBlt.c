@@ -126,6 +126,46 @@ void Test_BrushOrigin()
 
 }
 
+void Test_SolidSpans()
+{
+    HBRUSH hbr;
+    ULONG i, x, y, xDst, cx, ulExpected;
+    BOOL ret;
+
+    hbr = CreateSolidBrush(RGB(0x12, 0x34, 0x56));
+    if (!SelectObject(hdcTarget, hbr))
+    {
+        printf("failed to select solid brush\n");
+        return;
+    }
+
+    /* Odd widths and every start alignment, on both sides of a 4 pixel step */
+    for (xDst = 0; xDst < 4; xDst++)
+    {
+        for (cx = 1; cx <= 11; cx += 2)
+        {
+            for (i = 0; i < 16 * 16; i++) gpulTargetBits[i] = 0xA5A5A5;
+
+            ret = PatBlt(hdcTarget, xDst, 1, cx, 2, PATCOPY);
+            ok_long(ret, 1);
+            GdiFlush();
+
+            for (i = 0; i < 16 * 16; i++)
+            {
+                x = i % 16;
+                y = i / 16;
+                ulExpected = (y >= 1 && y < 3 && x >= xDst && x < xDst + cx) ? 0x123456 : 0xA5A5A5;
+                if ((gpulTargetBits[i] & 0xFFFFFF) != ulExpected) break;
+            }
+            ok(i == 16 * 16, "dst %lu, width %lu: pixel %lu is 0x%lx\n",
+               xDst, cx, i, i < 16 * 16 ? gpulTargetBits[i] : 0);
+        }
+    }
+
+    SelectObject(hdcTarget, GetStockObject(WHITE_BRUSH));
+    DeleteObject(hbr);
+}
+
 START_TEST(PatBlt)
 {
     BITMAPINFO bmi;
@@ -171,6 +211,8 @@ START_TEST(PatBlt)
 
     Test_BrushOrigin();
 
+    Test_SolidSpans();
+
 
 }
 
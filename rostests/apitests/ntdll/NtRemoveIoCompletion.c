@@ -0,0 +1,242 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for NtRemoveIoCompletion/NtRemoveIoCompletionEx and the completion modes
+ */
+
+#include <apitest.h>
+
+#define WIN32_NO_STATUS
+#include <ndk/iofuncs.h>
+#include <ndk/obfuncs.h>
+#include <ndk/rtlfuncs.h>
+
+/* More than the kernel takes from the queue at once */
+#define TEST_PACKETS    40
+
+#ifndef FILE_SKIP_COMPLETION_PORT_ON_SUCCESS
+#define FILE_SKIP_COMPLETION_PORT_ON_SUCCESS 0x1
+#endif
+
+typedef NTSTATUS (NTAPI *PNT_REMOVE_IO_COMPLETION_EX)(HANDLE, PFILE_IO_COMPLETION_INFORMATION, ULONG, PULONG, PLARGE_INTEGER, BOOLEAN);
+static PNT_REMOVE_IO_COMPLETION_EX pNtRemoveIoCompletionEx;
+
+static
+VOID
+PostPackets(HANDLE Port, ULONG First, ULONG Count)
+{
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = First; i < First + Count; i++)
+    {
+        Status = NtSetIoCompletion(Port, (PVOID)(ULONG_PTR)(i + 1), (PVOID)(ULONG_PTR)(0x1000 + i), STATUS_SUCCESS, i);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+}
+
+static
+VOID
+CheckPackets(PFILE_IO_COMPLETION_INFORMATION Information, ULONG First, ULONG Count)
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        ok(Information[i].KeyContext == (PVOID)(ULONG_PTR)(First + i + 1),
+           "Packet %lu: key %p\n", First + i, Information[i].KeyContext);
+        ok(Information[i].ApcContext == (PVOID)(ULONG_PTR)(0x1000 + First + i),
+           "Packet %lu: context %p\n", First + i, Information[i].ApcContext);
+        ok_ntstatus(Information[i].IoStatusBlock.Status, STATUS_SUCCESS);
+        ok_size_t(Information[i].IoStatusBlock.Information, First + i);
+    }
+}
+
+static
+VOID
+NTAPI
+ApcRoutine(ULONG_PTR Parameter)
+{
+    *(PBOOLEAN)Parameter = TRUE;
+}
+
+static
+VOID
+Test_RemoveIoCompletion(HANDLE Port)
+{
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER Timeout;
+    PVOID Key, Context;
+    NTSTATUS Status;
+
+    Timeout.QuadPart = 0;
+    Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, &Timeout);
+    ok_ntstatus(Status, STATUS_TIMEOUT);
+
+    PostPackets(Port, 0, 2);
+    Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, &Timeout);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_ptr(Key, (PVOID)1);
+    ok_ptr(Context, (PVOID)0x1000);
+    ok_size_t(IoStatusBlock.Information, 0);
+    Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, &Timeout);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_ptr(Key, (PVOID)2);
+    ok_ptr(Context, (PVOID)0x1001);
+    ok_size_t(IoStatusBlock.Information, 1);
+    Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, &Timeout);
+    ok_ntstatus(Status, STATUS_TIMEOUT);
+}
+
+static
+VOID
+Test_RemoveIoCompletionEx(HANDLE Port)
+{
+    FILE_IO_COMPLETION_INFORMATION Information[TEST_PACKETS + 1];
+    LARGE_INTEGER Timeout;
+    BOOLEAN ApcCalled;
+    NTSTATUS Status;
+    ULONG Removed;
+
+    Timeout.QuadPart = 0;
+
+    Removed = 0x55555555;
+    Status = pNtRemoveIoCompletionEx(Port, Information, 0, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_INVALID_PARAMETER);
+
+    Status = pNtRemoveIoCompletionEx(Port, Information, 1, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_TIMEOUT);
+    ok_dec(Removed, 0);
+
+    /* A partial batch leaves the rest queued, in order */
+    PostPackets(Port, 0, 5);
+    Status = pNtRemoveIoCompletionEx(Port, Information, 3, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_dec(Removed, 3);
+    CheckPackets(Information, 0, 3);
+    Status = pNtRemoveIoCompletionEx(Port, Information, 10, &Removed, &Timeout, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_dec(Removed, 2);
+    CheckPackets(Information, 3, 2);
+
+    /* Everything queued comes out in a single call */
+    PostPackets(Port, 0, TEST_PACKETS);
+    RtlFillMemory(Information, sizeof(Information), 0x55);
+    Status = pNtRemoveIoCompletionEx(Port, Information, TEST_PACKETS + 1, &Removed, NULL, FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_dec(Removed, TEST_PACKETS);
+    CheckPackets(Information, 0, TEST_PACKETS);
+    ok(Information[TEST_PACKETS].KeyContext == (PVOID)(ULONG_PTR)0x5555555555555555ULL,
+       "Entry past the packets was written\n");
+
+    /* An alertable wait delivers user APCs */
+    ApcCalled = FALSE;
+    ok(QueueUserAPC(ApcRoutine, GetCurrentThread(), (ULONG_PTR)&ApcCalled), "QueueUserAPC failed\n");
+    Status = pNtRemoveIoCompletionEx(Port, Information, 1, &Removed, NULL, TRUE);
+    ok_ntstatus(Status, STATUS_USER_APC);
+    ok_dec(Removed, 0);
+    ok(ApcCalled == TRUE, "APC was not called\n");
+}
+
+static
+VOID
+Test_SkipOnSuccess(VOID)
+{
+    FILE_IO_COMPLETION_NOTIFICATION_INFORMATION NotificationInformation;
+    WCHAR TempPath[MAX_PATH], FileName[MAX_PATH];
+    IO_STATUS_BLOCK IoStatusBlock;
+    OVERLAPPED Overlapped;
+    LARGE_INTEGER Timeout;
+    HANDLE FileHandle, Port;
+    PVOID Key, Context;
+    UCHAR Buffer[512];
+    NTSTATUS Status;
+    DWORD Written;
+    BOOL Ret;
+
+    GetTempPathW(MAX_PATH, TempPath);
+    GetTempFileNameW(TempPath, L"ioc", 0, FileName);
+    FileHandle = CreateFileW(FileName,
+                             GENERIC_READ | GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             FILE_FLAG_OVERLAPPED | FILE_FLAG_DELETE_ON_CLOSE,
+                             NULL);
+    ok(FileHandle != INVALID_HANDLE_VALUE, "Failed to create %ls: %lu\n", FileName, GetLastError());
+    if (FileHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    Port = CreateIoCompletionPort(FileHandle, NULL, 0x55, 0);
+    ok(Port != NULL, "CreateIoCompletionPort failed: %lu\n", GetLastError());
+
+    NotificationInformation.Flags = 0x80;
+    Status = NtSetInformationFile(FileHandle,
+                                  &IoStatusBlock,
+                                  &NotificationInformation,
+                                  sizeof(NotificationInformation),
+                                  FileIoCompletionNotificationInformation);
+    if (Status == STATUS_INVALID_INFO_CLASS)
+    {
+        skip("FileIoCompletionNotificationInformation unavailable\n");
+        NtClose(Port);
+        CloseHandle(FileHandle);
+        return;
+    }
+    ok_ntstatus(Status, STATUS_INVALID_PARAMETER);
+
+    NotificationInformation.Flags = FILE_SKIP_COMPLETION_PORT_ON_SUCCESS;
+    Status = NtSetInformationFile(FileHandle,
+                                  &IoStatusBlock,
+                                  &NotificationInformation,
+                                  sizeof(NotificationInformation),
+                                  FileIoCompletionNotificationInformation);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    /* Only requests that really went asynchronous are queued */
+    RtlFillMemory(Buffer, sizeof(Buffer), 0x55);
+    ZeroMemory(&Overlapped, sizeof(Overlapped));
+    Ret = WriteFile(FileHandle, Buffer, sizeof(Buffer), &Written, &Overlapped);
+    if (Ret)
+    {
+        ok_dec(Written, sizeof(Buffer));
+        Timeout.QuadPart = 0;
+        Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, &Timeout);
+        ok_ntstatus(Status, STATUS_TIMEOUT);
+    }
+    else
+    {
+        ok_err(ERROR_IO_PENDING);
+        Status = NtRemoveIoCompletion(Port, &Key, &Context, &IoStatusBlock, NULL);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+        ok_ptr(Key, (PVOID)0x55);
+        ok_ptr(Context, &Overlapped);
+        ok_size_t(IoStatusBlock.Information, sizeof(Buffer));
+    }
+
+    NtClose(Port);
+    CloseHandle(FileHandle);
+}
+
+START_TEST(NtRemoveIoCompletion)
+{
+    HANDLE Port;
+    NTSTATUS Status;
+
+    Status = NtCreateIoCompletion(&Port, IO_COMPLETION_ALL_ACCESS, NULL, 0);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    Test_RemoveIoCompletion(Port);
+
+    pNtRemoveIoCompletionEx = (PVOID)GetProcAddress(GetModuleHandleW(L"ntdll"), "NtRemoveIoCompletionEx");
+    if (!pNtRemoveIoCompletionEx)
+        skip("NtRemoveIoCompletionEx unavailable\n");
+    else
+        Test_RemoveIoCompletionEx(Port);
+
+    NtClose(Port);
+
+    Test_SkipOnSuccess();
+}
@@ -5,6 +5,9 @@
 #include <ndk/mmfuncs.h>
 #include <ndk/rtlfuncs.h>
 
+#define LARGE_BITMAP_BITS   (1024 * 1024)
+#define BENCH_BITMAP_BITS   (1024 * 1024 * 1024)
+
 static
 PVOID
 AllocateGuarded(
@@ -612,11 +615,148 @@ Test_RtlFindLastBackwardRunClear(void)
 void
 Test_RtlFindClearRuns(void)
 {
+    RTL_BITMAP BitMapHeader;
+    RTL_BITMAP_RUN Runs[8];
+    ULONG *Buffer;
+
+    Buffer = AllocateGuarded(2 * sizeof(*Buffer));
+    Buffer[0] = 0xF9F078B2;
+    Buffer[1] = 0x3F303F30;
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 8, FALSE), 8);
+    ok_int(Runs[0].StartingIndex, 0);
+    ok_int(Runs[0].NumberOfBits, 1);
+    ok_int(Runs[1].StartingIndex, 2);
+    ok_int(Runs[1].NumberOfBits, 2);
+    ok_int(Runs[4].StartingIndex, 15);
+    ok_int(Runs[4].NumberOfBits, 5);
+    ok_int(Runs[7].StartingIndex, 38);
+    ok_int(Runs[7].NumberOfBits, 2);
+
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 2, FALSE), 2);
+    ok_int(Runs[1].StartingIndex, 2);
+    ok_int(Runs[1].NumberOfBits, 2);
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 40);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 8, FALSE), 8);
+    ok_int(Runs[7].StartingIndex, 38);
+    ok_int(Runs[7].NumberOfBits, 2);
+
+    /* The three longest runs, in no particular order */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 3, TRUE), 3);
+    ok_int(Runs[0].NumberOfBits + Runs[1].NumberOfBits + Runs[2].NumberOfBits, 15);
+    FreeGuarded(Buffer);
 }
 
 void
 Test_RtlFindLongestRunClear(void)
 {
+    RTL_BITMAP BitMapHeader;
+    ULONG *Buffer;
+    ULONG Index;
+
+    Buffer = AllocateGuarded(2 * sizeof(*Buffer));
+    Buffer[0] = 0xF9F078B2;
+    Buffer[1] = 0x3F303F30;
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 8);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 2);
+    ok_int(Index, 2);
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 28);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 5);
+    ok_int(Index, 15);
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 6);
+    ok_int(Index, 46);
+    FreeGuarded(Buffer);
+}
+
+/* Bitmaps spanning many words, so the word skipping loops run to the end of the buffer */
+void
+Test_LargeBitmap(void)
+{
+    RTL_BITMAP BitMapHeader;
+    ULONG *Buffer;
+    ULONG Index;
+
+    Buffer = AllocateGuarded(LARGE_BITMAP_BITS / 8);
+    RtlInitializeBitMap(&BitMapHeader, Buffer, LARGE_BITMAP_BITS);
+    RtlSetAllBits(&BitMapHeader);
+    ok_int(RtlNumberOfSetBits(&BitMapHeader), LARGE_BITMAP_BITS);
+    ok_int(RtlFindClearBits(&BitMapHeader, 1, 0), -1);
+
+    /* A free run at the very end, right before the guard page */
+    RtlClearBits(&BitMapHeader, LARGE_BITMAP_BITS - 100, 100);
+    ok_int(RtlNumberOfSetBits(&BitMapHeader), LARGE_BITMAP_BITS - 100);
+    ok_int(RtlFindClearBits(&BitMapHeader, 100, 0), LARGE_BITMAP_BITS - 100);
+    ok_int(RtlFindClearBits(&BitMapHeader, 100, 1000), LARGE_BITMAP_BITS - 100);
+    ok_int(RtlFindClearBits(&BitMapHeader, 101, 0), -1);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 100);
+    ok_int(Index, LARGE_BITMAP_BITS - 100);
+
+    RtlClearBits(&BitMapHeader, 12345, 1);
+    ok_int(RtlFindClearBits(&BitMapHeader, 1, 0), 12345);
+    ok_int(RtlFindClearBits(&BitMapHeader, 1, 12346), LARGE_BITMAP_BITS - 100);
+
+    /* Partial last word */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, LARGE_BITMAP_BITS - 33);
+    ok_int(RtlNumberOfSetBits(&BitMapHeader), LARGE_BITMAP_BITS - 100 - 1);
+    ok_int(RtlNumberOfClearBits(&BitMapHeader), 100 - 33 + 1);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 100 - 33);
+    ok_int(Index, LARGE_BITMAP_BITS - 100);
+    FreeGuarded(Buffer);
+}
+
+static
+VOID
+Benchmark(void)
+{
+    LARGE_INTEGER Frequency, Start, End;
+    RTL_BITMAP BitMapHeader;
+    ULONG *Buffer;
+    ULONG i, Index, Count;
+
+    Buffer = AllocateGuarded(BENCH_BITMAP_BITS / 8);
+    if (!Buffer)
+    {
+        skip("Not enough memory for the benchmark bitmap\n");
+        return;
+    }
+
+    /* Mostly allocated, with single free bits scattered around */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, BENCH_BITMAP_BITS);
+    RtlSetAllBits(&BitMapHeader);
+    for (i = 0; i < BENCH_BITMAP_BITS / 32; i += 61)
+    {
+        Buffer[i] &= ~(1UL << (i % 32));
+    }
+    RtlClearBits(&BitMapHeader, BENCH_BITMAP_BITS - 1000, 1000);
+
+    QueryPerformanceFrequency(&Frequency);
+
+    QueryPerformanceCounter(&Start);
+    Count = RtlNumberOfSetBits(&BitMapHeader);
+    QueryPerformanceCounter(&End);
+    trace("RtlNumberOfSetBits: %lu in %lu us\n", Count,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    QueryPerformanceCounter(&Start);
+    Index = RtlFindClearBits(&BitMapHeader, 1000, 0);
+    QueryPerformanceCounter(&End);
+    trace("RtlFindClearBits: %lu in %lu us\n", Index,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    QueryPerformanceCounter(&Start);
+    Count = RtlFindLongestRunClear(&BitMapHeader, &Index);
+    QueryPerformanceCounter(&End);
+    trace("RtlFindLongestRunClear: %lu at %lu in %lu us\n", Count, Index,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    FreeGuarded(Buffer);
 }
 
 
@@ -642,5 +782,8 @@ START_TEST(RtlBitmap)
     Test_RtlFindLastBackwardRunClear();
     Test_RtlFindClearRuns();
     Test_RtlFindLongestRunClear();
+    Test_LargeBitmap();
+
+    if (winetest_interactive) Benchmark();
 }
 
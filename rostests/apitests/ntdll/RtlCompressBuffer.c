@@ -0,0 +1,257 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for the XPRESS formats of RtlCompressBuffer and RtlDecompressBuffer
+ */
+
+#include <apitest.h>
+
+#define WIN32_NO_STATUS
+#include <ndk/rtlfuncs.h>
+
+#define TEST_SIZE           (300 * 1024)
+#define BENCH_ITERATIONS    20
+
+/* Reference vectors of [MS-XCA] for the plain LZ77 format */
+static const UCHAR Alphabet[] = "abcdefghijklmnopqrstuvwxyz";
+static const UCHAR AlphabetXpress[] =
+{
+    0x3f, 0x00, 0x00, 0x00, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a
+};
+static const UCHAR AbcXpress[] =
+{
+    0xff, 0xff, 0xff, 0x1f, 0x61, 0x62, 0x63, 0x17, 0x00, 0x0f, 0xff, 0x26, 0x01
+};
+
+/* And for LZ77+Huffman: the 4-bit code lengths of the 512 symbols, then the
+   codes of the letters and of the end of stream symbol */
+static const UCHAR AlphabetXpressHuff[] =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x50, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x45, 0x44, 0x04, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xd8, 0x52, 0x3e, 0xd7, 0x94, 0x11, 0x5b, 0xe9, 0x19, 0x5f, 0xf9, 0xd6, 0x7c, 0xdf, 0x8d, 0x04,
+    0x00, 0x00, 0x00, 0x00
+};
+
+static const USHORT Formats[] =
+{
+    COMPRESSION_FORMAT_XPRESS,
+    COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_MAXIMUM,
+    COMPRESSION_FORMAT_XPRESS_HUFF,
+    COMPRESSION_FORMAT_XPRESS_HUFF | COMPRESSION_ENGINE_MAXIMUM
+};
+
+static
+VOID
+FillBuffer(PUCHAR Buffer, ULONG Size, ULONG Kind)
+{
+    ULONG i, Seed = 0x12345678;
+
+    for (i = 0; i < Size; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        switch (Kind)
+        {
+            /* Incompressible */
+            case 0: Buffer[i] = (UCHAR)(Seed >> 16); break;
+            /* Runs */
+            case 1: Buffer[i] = (UCHAR)(i / 1000); break;
+            /* Text like, with repeats and a few random bytes */
+            default:
+                Buffer[i] = ((Seed >> 16) % 50 == 0 || i < 20) ? "etaoin shrdlu"[(Seed >> 8) % 13] : Buffer[i - 17];
+                break;
+        }
+    }
+}
+
+static
+VOID
+TestReferenceVectors(VOID)
+{
+    UCHAR Buffer[512];
+    ULONG FinalSize, i;
+    NTSTATUS Status;
+
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, Buffer, sizeof(Buffer),
+                                 (PUCHAR)AlphabetXpress, sizeof(AlphabetXpress), &FinalSize);
+    ok(Status == STATUS_SUCCESS, "RtlDecompressBuffer failed: 0x%lx\n", Status);
+    ok(FinalSize == 26, "FinalSize is %lu\n", FinalSize);
+    ok(!memcmp(Buffer, Alphabet, 26), "Wrong data\n");
+
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, Buffer, sizeof(Buffer),
+                                 (PUCHAR)AbcXpress, sizeof(AbcXpress), &FinalSize);
+    ok(Status == STATUS_SUCCESS, "RtlDecompressBuffer failed: 0x%lx\n", Status);
+    ok(FinalSize == 300, "FinalSize is %lu\n", FinalSize);
+    for (i = 0; i < 300; i++)
+    {
+        if (Buffer[i] != "abc"[i % 3]) break;
+    }
+    ok(i == 300, "Wrong data at %lu\n", i);
+
+    /* A shorter output buffer is no error */
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, Buffer, 100,
+                                 (PUCHAR)AbcXpress, sizeof(AbcXpress), &FinalSize);
+    ok(Status == STATUS_SUCCESS, "RtlDecompressBuffer failed: 0x%lx\n", Status);
+    ok(FinalSize == 100, "FinalSize is %lu\n", FinalSize);
+
+    /* Truncated input is */
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, Buffer, sizeof(Buffer),
+                                 (PUCHAR)AbcXpress, 9, &FinalSize);
+    ok(Status == STATUS_BAD_COMPRESSION_BUFFER, "Unexpected status 0x%lx\n", Status);
+
+    /* The Huffman stream says where it ends, so the bigger buffer isn't filled */
+    RtlFillMemory(Buffer, sizeof(Buffer), 0x55);
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS_HUFF, Buffer, sizeof(Buffer),
+                                 (PUCHAR)AlphabetXpressHuff, sizeof(AlphabetXpressHuff), &FinalSize);
+    ok(Status == STATUS_SUCCESS, "RtlDecompressBuffer failed: 0x%lx\n", Status);
+    ok(FinalSize == 26, "FinalSize is %lu\n", FinalSize);
+    ok(!memcmp(Buffer, Alphabet, 26), "Wrong data\n");
+}
+
+static
+VOID
+TestRoundTrip(PUCHAR Data, PUCHAR Compressed, PUCHAR Decompressed, PVOID WorkSpace)
+{
+    static const ULONG Sizes[] = { 0, 1, 3, 4096, 65536, 65537, TEST_SIZE };
+    ULONG f, k, s, CompressedSize, FinalSize;
+    NTSTATUS Status;
+
+    for (k = 0; k < 3; k++)
+    {
+        FillBuffer(Data, TEST_SIZE, k);
+
+        for (f = 0; f < sizeof(Formats) / sizeof(Formats[0]); f++)
+        {
+            for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++)
+            {
+                Status = RtlCompressBuffer(Formats[f], Data, Sizes[s], Compressed, 2 * TEST_SIZE,
+                                           4096, &CompressedSize, WorkSpace);
+                ok(Status == STATUS_SUCCESS, "Format 0x%x, kind %lu, size %lu: compression failed: 0x%lx\n",
+                   Formats[f], k, Sizes[s], Status);
+                if (Status != STATUS_SUCCESS) continue;
+
+                if (k != 0 && Sizes[s] >= 4096)
+                {
+                    ok(CompressedSize < Sizes[s] / 2, "Format 0x%x, kind %lu: %lu bytes compressed to %lu\n",
+                       Formats[f], k, Sizes[s], CompressedSize);
+                }
+
+                RtlFillMemory(Decompressed, TEST_SIZE, 0xCC);
+                Status = RtlDecompressBuffer(Formats[f] & ~COMPRESSION_ENGINE_MAXIMUM, Decompressed, Sizes[s],
+                                             Compressed, CompressedSize, &FinalSize);
+                ok(Status == STATUS_SUCCESS, "Format 0x%x, kind %lu, size %lu: decompression failed: 0x%lx\n",
+                   Formats[f], k, Sizes[s], Status);
+                ok(FinalSize == Sizes[s], "FinalSize is %lu, expected %lu\n", FinalSize, Sizes[s]);
+                ok(!memcmp(Decompressed, Data, Sizes[s]), "Format 0x%x, kind %lu, size %lu: wrong data\n",
+                   Formats[f], k, Sizes[s]);
+            }
+
+            /* The output buffer must be large enough */
+            Status = RtlCompressBuffer(Formats[f], Data, 4096, Compressed, 16,
+                                       4096, &CompressedSize, WorkSpace);
+            ok(Status == STATUS_BUFFER_TOO_SMALL, "Unexpected status 0x%lx\n", Status);
+        }
+    }
+}
+
+static
+VOID
+Benchmark(PUCHAR Data, PUCHAR Compressed, PUCHAR Decompressed, PVOID WorkSpace)
+{
+    static const USHORT BenchFormats[] =
+    {
+        COMPRESSION_FORMAT_LZNT1,
+        COMPRESSION_FORMAT_XPRESS,
+        COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_MAXIMUM,
+        COMPRESSION_FORMAT_XPRESS_HUFF,
+        COMPRESSION_FORMAT_XPRESS_HUFF | COMPRESSION_ENGINE_MAXIMUM
+    };
+    LARGE_INTEGER Frequency, Start, Middle, End;
+    ULONG f, i, CompressedSize = 0, FinalSize;
+
+    QueryPerformanceFrequency(&Frequency);
+    FillBuffer(Data, TEST_SIZE, 2);
+
+    for (f = 0; f < sizeof(BenchFormats) / sizeof(BenchFormats[0]); f++)
+    {
+        QueryPerformanceCounter(&Start);
+        for (i = 0; i < BENCH_ITERATIONS; i++)
+        {
+            RtlCompressBuffer(BenchFormats[f], Data, TEST_SIZE, Compressed, 2 * TEST_SIZE,
+                              4096, &CompressedSize, WorkSpace);
+        }
+        QueryPerformanceCounter(&Middle);
+        for (i = 0; i < BENCH_ITERATIONS; i++)
+        {
+            RtlDecompressBuffer(BenchFormats[f] & ~COMPRESSION_ENGINE_MAXIMUM, Decompressed, TEST_SIZE,
+                                Compressed, CompressedSize, &FinalSize);
+        }
+        QueryPerformanceCounter(&End);
+
+        if (Middle.QuadPart > Start.QuadPart && End.QuadPart > Middle.QuadPart)
+        {
+            trace("Format 0x%03x: %lu -> %lu bytes, compress %lu KB/s, decompress %lu KB/s\n",
+                  BenchFormats[f], (ULONG)TEST_SIZE, CompressedSize,
+                  (ULONG)((double)TEST_SIZE * BENCH_ITERATIONS / 1024 * Frequency.QuadPart / (Middle.QuadPart - Start.QuadPart)),
+                  (ULONG)((double)TEST_SIZE * BENCH_ITERATIONS / 1024 * Frequency.QuadPart / (End.QuadPart - Middle.QuadPart)));
+        }
+    }
+}
+
+START_TEST(RtlCompressBuffer)
+{
+    ULONG WorkSpaceSize, FragmentWorkSpaceSize, MaxWorkSpaceSize = 0, f;
+    PUCHAR Data, Compressed, Decompressed;
+    PVOID WorkSpace;
+    NTSTATUS Status;
+
+    for (f = 0; f < sizeof(Formats) / sizeof(Formats[0]); f++)
+    {
+        Status = RtlGetCompressionWorkSpaceSize(Formats[f], &WorkSpaceSize, &FragmentWorkSpaceSize);
+        ok(Status == STATUS_SUCCESS, "Format 0x%x: RtlGetCompressionWorkSpaceSize failed: 0x%lx\n",
+           Formats[f], Status);
+        if (Status != STATUS_SUCCESS)
+        {
+            skip("XPRESS compression is not supported\n");
+            return;
+        }
+        MaxWorkSpaceSize = max(MaxWorkSpaceSize, WorkSpaceSize);
+    }
+
+    TestReferenceVectors();
+
+    Data = RtlAllocateHeap(RtlGetProcessHeap(), 0, TEST_SIZE);
+    Compressed = RtlAllocateHeap(RtlGetProcessHeap(), 0, 2 * TEST_SIZE);
+    Decompressed = RtlAllocateHeap(RtlGetProcessHeap(), 0, TEST_SIZE);
+    WorkSpace = RtlAllocateHeap(RtlGetProcessHeap(), 0, MaxWorkSpaceSize);
+    if (!Data || !Compressed || !Decompressed || !WorkSpace)
+    {
+        skip("Out of memory\n");
+    }
+    else
+    {
+        TestRoundTrip(Data, Compressed, Decompressed, WorkSpace);
+        if (winetest_interactive) Benchmark(Data, Compressed, Decompressed, WorkSpace);
+    }
+
+    if (Data) RtlFreeHeap(RtlGetProcessHeap(), 0, Data);
+    if (Compressed) RtlFreeHeap(RtlGetProcessHeap(), 0, Compressed);
+    if (Decompressed) RtlFreeHeap(RtlGetProcessHeap(), 0, Decompressed);
+    if (WorkSpace) RtlFreeHeap(RtlGetProcessHeap(), 0, WorkSpace);
+}
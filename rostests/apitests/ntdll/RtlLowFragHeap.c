@@ -0,0 +1,196 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for the low fragmentation heap front end
+ */
+
+#include <apitest.h>
+
+#define WIN32_NO_STATUS
+#include <ndk/rtlfuncs.h>
+
+#define LFH_TYPE            2
+#define BENCH_ITERATIONS    100000
+#define BENCH_MAX_THREADS   8
+
+static HANDLE BenchHeap;
+
+static
+ULONG
+QueryFrontEnd(HANDLE hHeap)
+{
+    ULONG FrontEnd = 0xdeadbeef;
+    SIZE_T ReturnLength = 0;
+    NTSTATUS Status;
+
+    Status = RtlQueryHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd), &ReturnLength);
+    ok(Status == STATUS_SUCCESS, "RtlQueryHeapInformation failed: 0x%lx\n", Status);
+    ok(ReturnLength == sizeof(ULONG), "Wrong return length: %lu\n", (ULONG)ReturnLength);
+
+    return FrontEnd;
+}
+
+static
+VOID
+TestBlocks(HANDLE hHeap)
+{
+    PUCHAR Blocks[64];
+    PUCHAR Block;
+    SIZE_T Size;
+    ULONG i, j;
+
+    /* Allocate all the small sizes and check their contents survive */
+    for (i = 0; i < 64; i++)
+    {
+        Size = (i * 16) + 1;
+        Blocks[i] = RtlAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Size);
+        ok(Blocks[i] != NULL, "Allocation of %lu bytes failed\n", (ULONG)Size);
+        if (!Blocks[i]) return;
+
+        ok(((ULONG_PTR)Blocks[i] & (sizeof(PVOID) * 2 - 1)) == 0, "Unaligned block %p\n", Blocks[i]);
+        ok(RtlSizeHeap(hHeap, 0, Blocks[i]) == Size, "Size is %lu, expected %lu\n",
+           (ULONG)RtlSizeHeap(hHeap, 0, Blocks[i]), (ULONG)Size);
+
+        for (j = 0; j < Size; j++)
+        {
+            if (Blocks[i][j] != 0) break;
+        }
+        ok(j == Size, "Block %lu is not zeroed at %lu\n", i, j);
+
+        RtlFillMemory(Blocks[i], Size, (UCHAR)i);
+    }
+
+    for (i = 0; i < 64; i++)
+    {
+        Size = (i * 16) + 1;
+        for (j = 0; j < Size; j++)
+        {
+            if (Blocks[i][j] != (UCHAR)i) break;
+        }
+        ok(j == Size, "Block %lu was overwritten at %lu\n", i, j);
+        ok(RtlFreeHeap(hHeap, 0, Blocks[i]) == TRUE, "Failed to free block %lu\n", i);
+    }
+
+    /* Grow a block across the front end limit, then shrink it back */
+    Block = RtlAllocateHeap(hHeap, 0, 24);
+    ok(Block != NULL, "Allocation failed\n");
+    if (!Block) return;
+    RtlFillMemory(Block, 24, 0x55);
+
+    Block = RtlReAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Block, 4000);
+    ok(Block != NULL, "Reallocation failed\n");
+    if (!Block) return;
+    ok(RtlSizeHeap(hHeap, 0, Block) == 4000, "Wrong size %lu\n", (ULONG)RtlSizeHeap(hHeap, 0, Block));
+    ok(Block[0] == 0x55 && Block[23] == 0x55, "Contents were lost\n");
+    ok(Block[24] == 0 && Block[3999] == 0, "Grown part is not zeroed\n");
+
+    Block = RtlReAllocateHeap(hHeap, 0, Block, 20);
+    ok(Block != NULL, "Reallocation failed\n");
+    if (!Block) return;
+    ok(RtlSizeHeap(hHeap, 0, Block) == 20, "Wrong size %lu\n", (ULONG)RtlSizeHeap(hHeap, 0, Block));
+    ok(Block[0] == 0x55 && Block[19] == 0x55, "Contents were lost\n");
+
+    ok(RtlValidateHeap(hHeap, 0, Block) == TRUE, "Block is not valid\n");
+    ok(RtlFreeHeap(hHeap, 0, Block) == TRUE, "Failed to free block\n");
+    ok(RtlValidateHeap(hHeap, 0, NULL) == TRUE, "Heap is not valid\n");
+}
+
+static
+DWORD
+WINAPI
+BenchThread(LPVOID Parameter)
+{
+    PVOID Blocks[16];
+    ULONG i, j;
+
+    for (i = 0; i < BENCH_ITERATIONS / 16; i++)
+    {
+        for (j = 0; j < 16; j++)
+            Blocks[j] = RtlAllocateHeap(BenchHeap, 0, 16 + (j * 24));
+
+        for (j = 0; j < 16; j++)
+            RtlFreeHeap(BenchHeap, 0, Blocks[j]);
+    }
+
+    return 0;
+}
+
+static
+VOID
+Benchmark(HANDLE hHeap, PCSTR Name)
+{
+    HANDLE Threads[BENCH_MAX_THREADS];
+    LARGE_INTEGER Frequency, Start, End;
+    ULONG Count, i;
+    double Seconds;
+
+    BenchHeap = hHeap;
+    QueryPerformanceFrequency(&Frequency);
+
+    for (Count = 1; Count <= BENCH_MAX_THREADS; Count *= 2)
+    {
+        QueryPerformanceCounter(&Start);
+        for (i = 0; i < Count; i++)
+            Threads[i] = CreateThread(NULL, 0, BenchThread, NULL, 0, NULL);
+
+        WaitForMultipleObjects(Count, Threads, TRUE, INFINITE);
+        QueryPerformanceCounter(&End);
+
+        for (i = 0; i < Count; i++)
+            CloseHandle(Threads[i]);
+
+        Seconds = (double)(End.QuadPart - Start.QuadPart) / Frequency.QuadPart;
+        if (Seconds > 0)
+        {
+            trace("%s heap, %lu thread(s): %lu allocations/s\n", Name, Count,
+                  (ULONG)((double)Count * (BENCH_ITERATIONS / 16 * 16) / Seconds));
+        }
+    }
+}
+
+START_TEST(RtlLowFragHeap)
+{
+    HANDLE hHeap;
+    ULONG FrontEnd;
+    NTSTATUS Status;
+
+    /* An unserialized heap can't get LFH */
+    hHeap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "Failed to create heap\n");
+    if (hHeap)
+    {
+        FrontEnd = LFH_TYPE;
+        Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+        ok(!NT_SUCCESS(Status), "LFH enabled for an unserialized heap: 0x%lx\n", Status);
+        ok(QueryFrontEnd(hHeap) != LFH_TYPE, "Unexpected front end\n");
+        RtlDestroyHeap(hHeap);
+    }
+
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "Failed to create heap\n");
+    if (!hHeap) return;
+
+    /* Baseline numbers from the backend */
+    TestBlocks(hHeap);
+    if (winetest_interactive) Benchmark(hHeap, "Backend");
+
+    /* Only the LFH magic value is accepted */
+    FrontEnd = 1;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_UNSUCCESSFUL, "Unexpected status 0x%lx\n", Status);
+
+    FrontEnd = LFH_TYPE;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_SUCCESS, "Failed to enable LFH: 0x%lx\n", Status);
+    ok(QueryFrontEnd(hHeap) == LFH_TYPE, "LFH is not enabled\n");
+
+    /* Enabling it twice is fine */
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &FrontEnd, sizeof(FrontEnd));
+    ok(Status == STATUS_SUCCESS, "Failed to enable LFH again: 0x%lx\n", Status);
+
+    TestBlocks(hHeap);
+    if (winetest_interactive) Benchmark(hHeap, "LFH");
+
+    ok(RtlValidateHeap(hHeap, 0, NULL) == TRUE, "Heap is not valid\n");
+    RtlDestroyHeap(hHeap);
+}